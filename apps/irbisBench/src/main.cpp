@@ -0,0 +1,513 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Нагрузочный тест клиента: N потоков, каждый со своим подключением,
+// выполняют взвешенную смесь операций (чтение записей, поиск с чтением
+// найденного, листание словаря, форматирование, пакетная запись)
+// в течение заданного времени после разогрева. Отчёт -- пропускная
+// способность и перцентили задержки по операциям (точные) и по кодам
+// команд протокола (по гистограммам RequestMetrics).
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static const char *benchVersion = "0.1";
+
+/// \brief Операции, из которых составляется смесь.
+enum class Operation
+{
+    Read,   ///< Чтение случайной записи.
+    Search, ///< Поиск и чтение первых найденных записей.
+    Terms,  ///< Листание словаря.
+    Format, ///< Форматирование случайной записи.
+    Write   ///< Пакетная запись новых записей.
+};
+
+static const char *operationNames[] = { "read", "search", "terms", "format", "write" };
+static const std::size_t OperationCount = 5;
+
+/// \brief Настройки прогона.
+struct Settings
+{
+    std::string connectionString { "host=127.0.0.1;port=6666;user=librarian;password=secret;db=IBIS;" };
+    int threads { 4 };
+    int warmup { 2 };    // секунды
+    int duration { 10 }; // секунды
+    std::vector<std::pair<Operation, int>> mix { { Operation::Read, 4 }, { Operation::Search, 2 }, { Operation::Terms, 1 } };
+    std::vector<std::string> expressions;
+    std::string termPrefix { "K=" };
+    std::string format { "@brief" };
+    std::string writeDatabase;
+    int batch { 10 };
+    int readFound { 10 };
+    std::string label;
+    std::string csvPath;
+    std::string jsonPath;
+};
+
+/// \brief Замеры одной операции.
+struct OperationSamples
+{
+    std::vector<uint64_t> micros;
+    uint64_t errors { 0 };
+};
+
+/// \brief Итоговая строка отчёта.
+struct ReportRow
+{
+    std::string kind;    // operation либо command
+    std::string name;
+    uint64_t requests { 0 };
+    uint64_t errors { 0 };
+    double throughput { 0 };
+    double mean { 0 };
+    uint64_t p50 { 0 }, p95 { 0 }, p99 { 0 }, maximum { 0 };
+};
+
+static Settings settings;
+static std::atomic<bool> measuring { false };
+static std::atomic<bool> finished { false };
+static std::mutex samplesMutex;
+static std::vector<OperationSamples> allSamples (OperationCount);
+
+//=========================================================
+
+static void printUsage()
+{
+    std::cout << "Usage: irbisBench [options]\n"
+              << "  --connection STRING  connection string (default " << settings.connectionString << ")\n"
+              << "  --threads N          client threads, one connection each (default 4)\n"
+              << "  --warmup SECONDS     warm-up time excluded from the report (default 2)\n"
+              << "  --duration SECONDS   measured time (default 10)\n"
+              << "  --mix LIST           weighted operations, e.g. read:4,search:2,terms:1,format:1,write:1\n"
+              << "  --search EXPR        search expression (repeatable, default \"K=A$\")\n"
+              << "  --terms PREFIX       start term for dictionary browsing (default K=)\n"
+              << "  --format FORMAT      format for the format operation (default @brief)\n"
+              << "  --write-database DB  database for the write operation (required for write)\n"
+              << "  --batch N            records per write operation (default 10)\n"
+              << "  --read-found N       records read after each search (default 10)\n"
+              << "  --label TEXT         label stored in CSV/JSON rows (e.g. release)\n"
+              << "  --csv FILE           write the report as CSV\n"
+              << "  --json FILE          write the report as JSON" << std::endl;
+}
+
+static bool parseMix (const std::string &text)
+{
+    settings.mix.clear();
+    std::istringstream stream (text);
+    std::string item;
+    while (std::getline (stream, item, ',')) {
+        const auto colon = item.find (':');
+        const auto name = item.substr (0, colon);
+        const auto weight = colon == std::string::npos ? 1 : std::atoi (item.c_str() + colon + 1);
+        const auto found = std::find_if (std::begin (operationNames), std::end (operationNames),
+            [&name] (const char *one) { return name == one; });
+        if (found == std::end (operationNames) || weight <= 0) {
+            std::cerr << "Bad mix item: " << item << std::endl;
+            return false;
+        }
+        settings.mix.emplace_back (static_cast<Operation> (found - std::begin (operationNames)), weight);
+    }
+    return !settings.mix.empty();
+}
+
+/// \brief Разбор аргументов командной строки.
+/// \return true если все хорошо.
+static bool parseCommandLine (int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            printUsage();
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--connection") {
+            settings.connectionString = value;
+        }
+        else if (arg == "--threads") {
+            settings.threads = std::max (std::atoi (value.c_str()), 1);
+        }
+        else if (arg == "--warmup") {
+            settings.warmup = std::max (std::atoi (value.c_str()), 0);
+        }
+        else if (arg == "--duration") {
+            settings.duration = std::max (std::atoi (value.c_str()), 1);
+        }
+        else if (arg == "--mix") {
+            if (!parseMix (value)) {
+                return false;
+            }
+        }
+        else if (arg == "--search") {
+            settings.expressions.push_back (value);
+        }
+        else if (arg == "--terms") {
+            settings.termPrefix = value;
+        }
+        else if (arg == "--format") {
+            settings.format = value;
+        }
+        else if (arg == "--write-database") {
+            settings.writeDatabase = value;
+        }
+        else if (arg == "--batch") {
+            settings.batch = std::max (std::atoi (value.c_str()), 1);
+        }
+        else if (arg == "--read-found") {
+            settings.readFound = std::max (std::atoi (value.c_str()), 0);
+        }
+        else if (arg == "--label") {
+            settings.label = value;
+        }
+        else if (arg == "--csv") {
+            settings.csvPath = value;
+        }
+        else if (arg == "--json") {
+            settings.jsonPath = value;
+        }
+        else {
+            printUsage();
+            return false;
+        }
+    }
+
+    if (settings.expressions.empty()) {
+        settings.expressions.emplace_back ("K=A$");
+    }
+
+    for (const auto &item : settings.mix) {
+        if (item.first == Operation::Write && settings.writeDatabase.empty()) {
+            // Запись меняет базу, поэтому только в явно указанную.
+            std::cerr << "The write operation requires --write-database" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//=========================================================
+
+/// \brief Выполнение одной операции.
+/// \return true, если сервер не сообщил об ошибке.
+static bool runOperation (irbis::Connection &connection, Operation operation, std::mt19937 &random,
+                          irbis::Mfn maxMfn, irbis::String &nextTerm)
+{
+    std::uniform_int_distribution<irbis::Mfn> anyMfn (1, std::max (maxMfn, static_cast<irbis::Mfn> (1)));
+    switch (operation) {
+        case Operation::Read:
+            connection.readRecord (anyMfn (random));
+            break;
+
+        case Operation::Search: {
+            std::uniform_int_distribution<std::size_t> anyExpression (0, settings.expressions.size() - 1);
+            auto found = connection.search (irbis::fromUtf (settings.expressions[anyExpression (random)]));
+            if (connection.lastError < 0) {
+                return false;
+            }
+            if (found.size() > static_cast<std::size_t> (settings.readFound)) {
+                found.resize (static_cast<std::size_t> (settings.readFound));
+            }
+            if (!found.empty()) {
+                connection.readRecords (found);
+            }
+            break;
+        }
+
+        case Operation::Terms: {
+            // Листаем словарь порциями, начиная заново по достижении конца префикса.
+            const auto prefix = irbis::fromUtf (settings.termPrefix);
+            const auto terms = connection.readTerms (nextTerm, 20);
+            if (terms.size() < 20 || terms.back().text.compare (0, prefix.size(), prefix) != 0) {
+                nextTerm = prefix;
+            }
+            else {
+                nextTerm = terms.back().text;
+            }
+            if (connection.lastError == -202 || connection.lastError == -203) {
+                connection.lastError = 0;
+            }
+            break;
+        }
+
+        case Operation::Format:
+            connection.formatRecord (irbis::fromUtf (settings.format), anyMfn (random));
+            break;
+
+        case Operation::Write: {
+            std::vector<irbis::MarcRecord> records (static_cast<std::size_t> (settings.batch));
+            std::vector<irbis::MarcRecord*> pointers;
+            for (auto &record : records) {
+                record.database = irbis::fromUtf (settings.writeDatabase);
+                record.add (200, L"").add (L'a', L"irbisBench").add (L'e', std::to_wstring (random()));
+                pointers.push_back (&record);
+            }
+            connection.writeRecords (pointers, false, true, true);
+            break;
+        }
+    }
+
+    return connection.lastError >= 0;
+}
+
+static void clientLoop (int index, std::shared_ptr<irbis::RequestMetrics> metrics, std::atomic<int> *failedConnects)
+{
+    irbis::Connection connection;
+    connection.parseConnectionString (irbis::fromUtf (settings.connectionString));
+    connection.metrics = metrics;
+    if (!connection.connect()) {
+        std::cerr << "Thread " << index << ": not connected, error " << connection.lastError << std::endl;
+        ++*failedConnects;
+        return;
+    }
+
+    std::mt19937 random (static_cast<std::mt19937::result_type> (index + 1));
+    int totalWeight = 0;
+    for (const auto &item : settings.mix) {
+        totalWeight += item.second;
+    }
+    std::uniform_int_distribution<int> anyWeight (0, totalWeight - 1);
+    const auto maxMfn = connection.getMaxMfn (connection.database);
+    auto nextTerm = irbis::fromUtf (settings.termPrefix);
+    std::vector<OperationSamples> samples (OperationCount);
+
+    while (!finished) {
+        auto pick = anyWeight (random);
+        auto operation = settings.mix.front().first;
+        for (const auto &item : settings.mix) {
+            if (pick < item.second) {
+                operation = item.first;
+                break;
+            }
+            pick -= item.second;
+        }
+
+        const auto counted = measuring.load();
+        const auto started = Clock::now();
+        bool success;
+        try {
+            success = runOperation (connection, operation, random, maxMfn, nextTerm);
+        }
+        catch (const std::exception &) {
+            success = false;
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds> (Clock::now() - started).count();
+
+        // Операции, начатые при разогреве, в отчёт не попадают.
+        if (counted && measuring) {
+            auto &target = samples[static_cast<std::size_t> (operation)];
+            target.micros.push_back (static_cast<uint64_t> (elapsed));
+            if (!success) {
+                ++target.errors;
+            }
+        }
+    }
+
+    connection.metrics.reset();
+    connection.disconnect();
+
+    std::lock_guard<std::mutex> guard (samplesMutex);
+    for (std::size_t i = 0; i < OperationCount; ++i) {
+        auto &target = allSamples[i];
+        target.micros.insert (target.micros.end(), samples[i].micros.begin(), samples[i].micros.end());
+        target.errors += samples[i].errors;
+    }
+}
+
+//=========================================================
+
+static uint64_t exactPercentile (const std::vector<uint64_t> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<std::size_t> (std::ceil (fraction * static_cast<double> (sorted.size())));
+    return sorted[std::min (std::max (rank, static_cast<std::size_t> (1)), sorted.size()) - 1];
+}
+
+static std::vector<ReportRow> buildReport (const irbis::RequestMetrics &metrics, double seconds)
+{
+    std::vector<ReportRow> result;
+    for (std::size_t i = 0; i < OperationCount; ++i) {
+        auto &samples = allSamples[i];
+        if (samples.micros.empty()) {
+            continue;
+        }
+        std::sort (samples.micros.begin(), samples.micros.end());
+        ReportRow row;
+        row.kind = "operation";
+        row.name = operationNames[i];
+        row.requests = samples.micros.size();
+        row.errors = samples.errors;
+        row.throughput = static_cast<double> (row.requests) / seconds;
+        uint64_t sum = 0;
+        for (const auto value : samples.micros) {
+            sum += value;
+        }
+        row.mean = static_cast<double> (sum) / static_cast<double> (row.requests);
+        row.p50 = exactPercentile (samples.micros, 0.50);
+        row.p95 = exactPercentile (samples.micros, 0.95);
+        row.p99 = exactPercentile (samples.micros, 0.99);
+        row.maximum = samples.micros.back();
+        result.push_back (row);
+    }
+
+    for (const auto &command : metrics.snapshot()) {
+        ReportRow row;
+        row.kind = "command";
+        row.name = command.command;
+        row.requests = command.requests;
+        row.errors = command.errors;
+        row.throughput = static_cast<double> (row.requests) / seconds;
+        row.mean = command.total.mean();
+        row.p50 = command.total.percentile (0.50);
+        row.p95 = command.total.percentile (0.95);
+        row.p99 = command.total.percentile (0.99);
+        row.maximum = command.total.maximum;
+        result.push_back (row);
+    }
+
+    return result;
+}
+
+static void writeText (std::ostream &stream, const std::vector<ReportRow> &rows)
+{
+    stream << std::left << std::setw (10) << "kind" << std::setw (10) << "name" << std::right
+           << std::setw (10) << "requests" << std::setw (8) << "errors"
+           << std::setw (12) << "req/s" << std::setw (12) << "mean, us"
+           << std::setw (10) << "p50" << std::setw (10) << "p95"
+           << std::setw (10) << "p99" << std::setw (10) << "max" << '\n';
+    for (const auto &row : rows) {
+        stream << std::left << std::setw (10) << row.kind << std::setw (10) << row.name << std::right
+               << std::setw (10) << row.requests << std::setw (8) << row.errors
+               << std::setw (12) << std::fixed << std::setprecision (1) << row.throughput
+               << std::setw (12) << row.mean
+               << std::setw (10) << row.p50 << std::setw (10) << row.p95
+               << std::setw (10) << row.p99 << std::setw (10) << row.maximum << '\n';
+    }
+    stream << "(command percentiles are histogram bucket bounds)" << std::endl;
+}
+
+static void writeCsv (std::ostream &stream, const std::vector<ReportRow> &rows)
+{
+    stream << "label,version,threads,kind,name,requests,errors,throughput,mean_us,p50_us,p95_us,p99_us,max_us\n";
+    for (const auto &row : rows) {
+        stream << settings.label << ',' << irbis::libraryVersionString() << ',' << settings.threads << ','
+               << row.kind << ',' << row.name << ',' << row.requests << ',' << row.errors << ','
+               << std::fixed << std::setprecision (2) << row.throughput << ',' << row.mean << ','
+               << row.p50 << ',' << row.p95 << ',' << row.p99 << ',' << row.maximum << '\n';
+    }
+}
+
+static std::string jsonString (const std::string &text)
+{
+    std::string result = "\"";
+    for (const auto c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        if (static_cast<unsigned char> (c) < 0x20) {
+            continue;
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+static void writeJson (std::ostream &stream, const std::vector<ReportRow> &rows, double seconds)
+{
+    stream << "{\n  \"label\": " << jsonString (settings.label)
+           << ",\n  \"version\": " << jsonString (irbis::libraryVersionString())
+           << ",\n  \"threads\": " << settings.threads
+           << ",\n  \"seconds\": " << std::fixed << std::setprecision (3) << seconds
+           << ",\n  \"rows\": [";
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        const auto &row = rows[i];
+        stream << (i == 0 ? "\n" : ",\n")
+               << "    { \"kind\": " << jsonString (row.kind) << ", \"name\": " << jsonString (row.name)
+               << ", \"requests\": " << row.requests << ", \"errors\": " << row.errors
+               << std::setprecision (2) << ", \"throughput\": " << row.throughput << ", \"meanUs\": " << row.mean
+               << ", \"p50Us\": " << row.p50 << ", \"p95Us\": " << row.p95
+               << ", \"p99Us\": " << row.p99 << ", \"maxUs\": " << row.maximum << " }";
+    }
+    stream << "\n  ]\n}\n";
+}
+
+static bool writeFile (const std::string &path, const std::function<void (std::ostream&)> &writer)
+{
+    std::ofstream stream (path);
+    if (!stream) {
+        std::cerr << "Can't create " << path << std::endl;
+        return false;
+    }
+    writer (stream);
+    return true;
+}
+
+int main (int argc, char *argv[])
+{
+    std::cout << "IRBIS-BENCH application version " << benchVersion
+              << ", client version " << irbis::libraryVersionString() << std::endl;
+
+    if (!parseCommandLine (argc, argv)) {
+        return 1;
+    }
+
+    auto metrics = std::make_shared<irbis::RequestMetrics>();
+    std::atomic<int> failedConnects { 0 };
+    std::vector<std::thread> clients;
+    for (int i = 0; i < settings.threads; ++i) {
+        clients.emplace_back (clientLoop, i, metrics, &failedConnects);
+    }
+
+    std::this_thread::sleep_for (std::chrono::seconds (settings.warmup));
+    metrics->reset();
+    measuring = true;
+    const auto started = Clock::now();
+    std::this_thread::sleep_for (std::chrono::seconds (settings.duration));
+    measuring = false;
+    const auto seconds = std::chrono::duration<double> (Clock::now() - started).count();
+    finished = true;
+    for (auto &client : clients) {
+        client.join();
+    }
+
+    if (failedConnects == settings.threads) {
+        std::cerr << "No client could connect" << std::endl;
+        return 2;
+    }
+
+    const auto rows = buildReport (*metrics, seconds);
+    writeText (std::cout, rows);
+
+    auto result = 0;
+    if (!settings.csvPath.empty()
+        && !writeFile (settings.csvPath, [&rows] (std::ostream &stream) { writeCsv (stream, rows); })) {
+        result = 3;
+    }
+    if (!settings.jsonPath.empty()
+        && !writeFile (settings.jsonPath, [&rows, seconds] (std::ostream &stream) { writeJson (stream, rows, seconds); })) {
+        result = 3;
+    }
+
+    return result;
+}
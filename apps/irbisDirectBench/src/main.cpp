@@ -0,0 +1,244 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Нагрузочный тест прямого доступа: один объект DirectAccess64
+// читают N потоков одновременно (случайные MFN), затем N растёт.
+// С ключом --scan вместо случайного чтения база просматривается
+// целиком (DirectAccess64::scan) с тем же числом потоков.
+// Отчёт -- записи и мегабайты в секунду и ускорение относительно
+// одного потока, то есть насколько чтение масштабируется по ядрам.
+
+#include "irbis.h"
+#include "irbis_direct.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static const char *benchVersion = "0.1";
+
+/// \brief Настройки прогона.
+struct Settings
+{
+    std::string database { "testData/Irbis64/Datai/IBIS/ibis" };
+    std::vector<int> threads { 1, 2, 4, 8 };
+    int duration { 3 }; // секунды на каждое число потоков
+    bool mapped { false };
+    bool xrfOnly { false };
+    bool scan { false };
+};
+
+/// \brief Итог одного шага.
+struct StepResult
+{
+    int threads { 0 };
+    uint64_t records { 0 };
+    uint64_t missing { 0 };
+    uint64_t bytes { 0 };
+    double seconds { 0 };
+};
+
+static Settings settings;
+
+//=========================================================
+
+static void printUsage()
+{
+    std::cout << "Usage: irbisDirectBench [options]\n"
+              << "  --database PATH    database files without extension (default " << settings.database << ")\n"
+              << "  --threads LIST     comma-separated thread counts (default 1,2,4,8)\n"
+              << "  --duration SECONDS measured time per thread count (default 3)\n"
+              << "  --mapped           map the MST file into memory\n"
+              << "  --xrf-only         read cross-references only, not the records\n"
+              << "  --scan             scan the whole database once per thread count" << std::endl;
+}
+
+static bool parseThreads (const std::string &text)
+{
+    settings.threads.clear();
+    std::istringstream stream (text);
+    std::string item;
+    while (std::getline (stream, item, ',')) {
+        const auto count = std::atoi (item.c_str());
+        if (count <= 0) {
+            std::cerr << "Bad thread count: " << item << std::endl;
+            return false;
+        }
+        settings.threads.push_back (count);
+    }
+    return !settings.threads.empty();
+}
+
+/// \brief Разбор аргументов командной строки.
+/// \return true если все хорошо.
+static bool parseCommandLine (int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--mapped") {
+            settings.mapped = true;
+            continue;
+        }
+        if (arg == "--xrf-only") {
+            settings.xrfOnly = true;
+            continue;
+        }
+        if (arg == "--scan") {
+            settings.scan = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printUsage();
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--database") {
+            settings.database = value;
+        }
+        else if (arg == "--threads") {
+            if (!parseThreads (value)) {
+                return false;
+            }
+        }
+        else if (arg == "--duration") {
+            settings.duration = std::max (std::atoi (value.c_str()), 1);
+        }
+        else {
+            printUsage();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// \brief Один шаг: count потоков читают случайные записи в течение duration.
+static StepResult runStep (irbis::DirectAccess64 &access, int count)
+{
+    const auto maxMfn = access.getMaxMfn();
+    std::atomic<bool> finished { false };
+    std::vector<StepResult> partial (static_cast<std::size_t> (count));
+    std::vector<std::thread> readers;
+    const auto started = Clock::now();
+    for (int index = 0; index < count; ++index) {
+        readers.emplace_back ([&access, &finished, &partial, maxMfn, index] {
+            std::mt19937 random (static_cast<unsigned> (index + 1));
+            std::uniform_int_distribution<irbis::Mfn> distribution (1, maxMfn);
+            auto &mine = partial[static_cast<std::size_t> (index)];
+            while (!finished) {
+                const auto mfn = distribution (random);
+                try {
+                    if (settings.xrfOnly) {
+                        const auto xrf = access.xrf->readRecord (mfn);
+                        mine.bytes += irbis::XrfRecord64::RecordSize;
+                        if (xrf.offset == 0) {
+                            ++mine.missing;
+                            continue;
+                        }
+                    }
+                    else {
+                        const auto record = access.readMstRecord (mfn);
+                        mine.bytes += record.leader.length;
+                    }
+                    ++mine.records;
+                }
+                catch (const irbis::IrbisException &) {
+                    ++mine.missing;
+                }
+            }
+        });
+    }
+
+    std::this_thread::sleep_for (std::chrono::seconds (settings.duration));
+    finished = true;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+
+    StepResult result;
+    result.threads = count;
+    result.seconds = std::chrono::duration<double> (Clock::now() - started).count();
+    for (const auto &one : partial) {
+        result.records += one.records;
+        result.missing += one.missing;
+        result.bytes += one.bytes;
+    }
+    return result;
+}
+
+/// \brief Один шаг в режиме --scan: полный просмотр базы count потоками.
+static StepResult runScan (irbis::DirectAccess64 &access, int count)
+{
+    irbis::ScanOptions options;
+    options.threads = static_cast<std::size_t> (count);
+    const auto started = Clock::now();
+    const auto progress = access.scan ([] (const irbis::MstRecord64 &) { return true; }, options);
+
+    StepResult result;
+    result.threads = count;
+    result.seconds = std::chrono::duration<double> (Clock::now() - started).count();
+    result.records = progress.delivered;
+    result.missing = progress.skipped + progress.errors;
+    result.bytes = progress.bytes;
+    return result;
+}
+
+int main (int argc, char *argv[])
+{
+    std::cout << "IRBIS-DIRECT-BENCH application version " << benchVersion
+              << ", client version " << irbis::libraryVersionString() << std::endl;
+
+    if (!parseCommandLine (argc, argv)) {
+        return 1;
+    }
+
+    auto mstPath = irbis::fromUtf (settings.database + ".mst");
+    auto xrfPath = irbis::fromUtf (settings.database + ".xrf");
+    irbis::IO::convertSlashes (mstPath);
+    irbis::IO::convertSlashes (xrfPath);
+
+    std::unique_ptr<irbis::DirectAccess64> access;
+    try {
+        access.reset (new irbis::DirectAccess64 (mstPath, xrfPath, irbis::DirectAccessMode::ReadOnly,
+                                                 settings.mapped));
+    }
+    catch (const std::exception &) {
+        std::cerr << "Can't open " << settings.database << ".mst/.xrf" << std::endl;
+        return 2;
+    }
+    if (access->getMaxMfn() == 0) {
+        std::cerr << "Database is empty" << std::endl;
+        return 2;
+    }
+
+    std::cout << "Database " << settings.database << ", max MFN " << access->getMaxMfn()
+              << (settings.mapped ? ", mapped" : "") << (settings.xrfOnly ? ", XRF only" : "")
+              << (settings.scan ? ", full scan" : "") << "\n\n"
+              << std::setw (8) << "threads" << std::setw (14) << "records/s" << std::setw (10) << "MB/s"
+              << std::setw (10) << "speedup" << std::setw (10) << "missing" << std::endl;
+
+    double single = 0;
+    for (const auto count : settings.threads) {
+        const auto step = settings.scan ? runScan (*access, count) : runStep (*access, count);
+        const auto rate = static_cast<double> (step.records) / step.seconds;
+        if (single == 0) {
+            single = rate / step.threads;
+        }
+        std::cout << std::setw (8) << step.threads
+                  << std::fixed << std::setprecision (0) << std::setw (14) << rate
+                  << std::setprecision (1) << std::setw (10) << static_cast<double> (step.bytes) / step.seconds / 1048576.0
+                  << std::setprecision (2) << std::setw (10) << (single > 0 ? rate / single : 0.0)
+                  << std::setw (10) << step.missing << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,834 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Заменитель сервера ИРБИС64 для нагрузочного тестирования клиента
+// без лицензионного сервера. Обслуживает команды A, B, C, G, H, I,
+// K, N, O и P, отдавая данные прямо из файлов MST/XRF/L01/N01/IFP.
+// MST-файлы проецируются в память, записи читаются без блокировок.
+// Форматирование (PFT) не поддерживается: команда G понимает только
+// формат `&uf('+0')`, которым клиент читает записи пачками.
+// Поисковые выражения -- простые термины (`I=01`, `"K=ЖИЗНЬ$"`),
+// соединённые операторами `+`, `*` и `^` слева направо,
+// без скобок и квалификаторов.
+
+#include "irbis.h"
+#include "irbis_direct.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef IRBIS_WINDOWS
+
+#include <winsock2.h>
+#include <windows.h>
+#pragma comment (lib, "ws2_32.lib")
+
+#else
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <unistd.h>
+#define closesocket(__x) close(__x)
+
+#endif
+
+static const char *mockVersion = "0.1";
+static short localPort = 6666;
+static std::string dataPath = ".";
+static int threadCount = 4;
+static int latency = 0; // миллисекунды
+static bool verbose = false;
+static int listenerSocket = -1;
+static int idleTimeout = 30; // секунды
+static std::atomic<bool> stop { false };
+
+static const std::size_t MaxPacket = 32000;    // как MAXPACKET сервера
+static const std::size_t MaxRequest = 1 << 24; // защита от мусора
+
+static std::mutex queueMutex;
+static std::condition_variable queueCondition;
+static std::deque<int> clientQueue;
+static std::atomic<uint64_t> servedCount { 0 };
+static std::atomic<uint64_t> failedCount { 0 };
+
+//=========================================================
+
+/// \brief Открытая база данных.
+struct Database
+{
+    std::unique_ptr<irbis::DirectAccess64> records; ///< Записи (если есть MST).
+    std::unique_ptr<irbis::InvertedFile64> index;   ///< Словарь (если есть IFP).
+};
+
+static std::mutex databaseMutex;
+static std::map<std::string, std::shared_ptr<Database>> databases;
+
+static std::string toLower (std::string text)
+{
+    std::transform (text.begin(), text.end(), text.begin(),
+        [] (char c) { return static_cast<char> (std::tolower (static_cast<unsigned char> (c))); });
+    return text;
+}
+
+static std::string toUpper (std::string text)
+{
+    std::transform (text.begin(), text.end(), text.begin(),
+        [] (char c) { return static_cast<char> (std::toupper (static_cast<unsigned char> (c))); });
+    return text;
+}
+
+/// \brief Поиск файла базы данных с учётом регистра символов.
+/// \details Базы ИРБИС64 приходят с Windows, где регистр не важен:
+/// каталог может называться `IBIS`, а файлы -- `ibis.mst`.
+static std::string findFile (const std::string &name, const char *extension)
+{
+    for (const auto &directory : { toUpper (name), toLower (name), name }) {
+        for (const auto &file : { toLower (name), toUpper (name) }) {
+            for (const auto &ext : { toLower (extension), toUpper (extension) }) {
+                auto path = irbis::IO::combinePath (irbis::IO::combinePath (dataPath, directory), file + ext);
+                irbis::IO::convertSlashes (path);
+                if (irbis::IO::fileExist (path)) {
+                    return path;
+                }
+            }
+        }
+    }
+
+    return std::string();
+}
+
+/// \brief Получение базы данных по имени (база открывается при первом обращении).
+/// \return Указатель на базу либо nullptr.
+static std::shared_ptr<Database> getDatabase (const std::string &name)
+{
+    const auto key = toLower (name);
+    if (key.empty() || key.find_first_of ("/\\.") != std::string::npos) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard (databaseMutex);
+    const auto found = databases.find (key);
+    if (found != databases.end()) {
+        return found->second;
+    }
+
+    auto result = std::make_shared<Database>();
+    try {
+        const auto mst = findFile (key, ".mst");
+        const auto xrf = findFile (key, ".xrf");
+        if (!mst.empty() && !xrf.empty()) {
+            result->records.reset (new irbis::DirectAccess64
+                (irbis::cp1251_to_unicode (mst), irbis::cp1251_to_unicode (xrf), irbis::DirectAccessMode::ReadOnly,
+                 true));
+        }
+        const auto ifp = findFile (key, ".ifp");
+        if (!ifp.empty()) {
+            result->index.reset (new irbis::InvertedFile64 (irbis::cp1251_to_unicode (ifp)));
+        }
+    }
+    catch (const std::exception &exception) {
+        std::cerr << "Can't open database " << key << ": " << exception.what() << std::endl;
+        return nullptr;
+    }
+
+    if (!result->records && !result->index) {
+        return nullptr;
+    }
+
+    if (verbose) {
+        std::cout << "Database " << key << " opened"
+                  << (result->records ? ", records" : "")
+                  << (result->index ? ", index" : "") << std::endl;
+    }
+    databases[key] = result;
+    return result;
+}
+
+//=========================================================
+
+/// \brief Строка запроса по индексу (пустая, если строки нет).
+static const std::string& lineAt (const std::vector<std::string> &lines, std::size_t index)
+{
+    static const std::string empty;
+    return index < lines.size() ? lines[index] : empty;
+}
+
+static int intAt (const std::vector<std::string> &lines, std::size_t index)
+{
+    return std::atoi (lineAt (lines, index).c_str());
+}
+
+static void appendLine (std::string &answer, const std::string &line)
+{
+    answer += line;
+    answer += "\r\n";
+}
+
+static void appendLine (std::string &answer, int64_t value)
+{
+    appendLine (answer, std::to_string (value));
+}
+
+static std::string failure (int code)
+{
+    return std::to_string (code) + "\r\n";
+}
+
+//=========================================================
+
+/// \brief Команда O: максимальный MFN.
+static std::string getMaxMfn (const std::vector<std::string> &lines)
+{
+    const auto database = getDatabase (lineAt (lines, 10));
+    if (!database || !database->records) {
+        return failure (-400);
+    }
+
+    return failure (static_cast<int> (database->records->getMaxMfn()));
+}
+
+/// \brief Чтение записи.
+/// \param mfn MFN записи.
+/// \param lines Сюда помещаются строки записи в клиентском представлении.
+/// \return Код возврата.
+static int dumpRecord (Database &database, int mfn, std::vector<std::string> &lines)
+{
+    if (mfn <= 0 || static_cast<irbis::Mfn> (mfn) > database.records->getMaxMfn()) {
+        return -140;
+    }
+
+    irbis::MstRecord64 record;
+    try {
+        record = database.records->readMstRecord (static_cast<irbis::Mfn> (mfn));
+    }
+    catch (const irbis::IrbisException &) {
+        return -141;
+    }
+
+    const auto status = static_cast<unsigned> (record.leader.status);
+    lines.push_back (std::to_string (record.leader.mfn) + "#" + std::to_string (status));
+    lines.push_back ("0#" + std::to_string (record.leader.version));
+    for (std::size_t i = 0; i < record.fieldCount(); ++i) {
+        const auto data = record.fieldData (i);
+        lines.push_back (std::to_string (record.entry (i).tag) + "#"
+            + std::string (reinterpret_cast<const char*> (data.cdata()), data.size()));
+    }
+
+    return record.deleted() ? -603 : 0;
+}
+
+/// \brief Команда C: чтение записи.
+static std::string readRecord (const std::vector<std::string> &lines)
+{
+    const auto database = getDatabase (lineAt (lines, 10));
+    if (!database || !database->records) {
+        return failure (-400);
+    }
+
+    std::vector<std::string> record;
+    const auto code = dumpRecord (*database, intAt (lines, 11), record);
+    if (record.empty()) {
+        return failure (code);
+    }
+
+    std::string result;
+    appendLine (result, code);
+    for (const auto &line : record) {
+        appendLine (result, line);
+    }
+
+    return result;
+}
+
+/// \brief Команда G: форматирование записей.
+/// \details Поддерживается только формат `&uf('+0')`, которым
+/// клиент пакетно читает записи; для прочих форматов
+/// выдаётся пустой текст.
+static std::string formatRecords (const std::vector<std::string> &lines)
+{
+    const auto database = getDatabase (lineAt (lines, 10));
+    if (!database || !database->records) {
+        return failure (-400);
+    }
+
+    auto format = lineAt (lines, 11);
+    if (!format.empty() && format[0] == '!') {
+        format.erase (0, 1);
+    }
+    const auto dump = format == "&uf('+0')";
+    const auto count = intAt (lines, 12);
+
+    std::string result;
+    appendLine (result, 0);
+    for (int i = 0; i < count; ++i) {
+        const auto mfn = intAt (lines, 13 + static_cast<std::size_t> (i));
+        std::vector<std::string> record;
+        if (dumpRecord (*database, mfn, record) != 0 && record.empty()) {
+            continue;
+        }
+        result += std::to_string (mfn) + "#";
+        if (dump) {
+            result += '0';
+            for (const auto &line : record) {
+                result += '\x1F';
+                result += line;
+            }
+        }
+        result += "\r\n";
+    }
+
+    return result;
+}
+
+/// \brief Все MFN, связанные с термином (либо с группой терминов при усечении `$`).
+static std::vector<irbis::Mfn> lookupTerm (irbis::InvertedFile64 &index, irbis::String term)
+{
+    std::vector<irbis::Mfn> result;
+    const auto truncated = !term.empty() && term.back() == L'$';
+    if (truncated) {
+        term.pop_back();
+    }
+
+    auto addPostings = [&index, &result] (const irbis::String &one) {
+        for (const auto &posting : index.readPostings (one)) {
+            result.push_back (posting.mfn);
+        }
+    };
+
+    if (!truncated) {
+        addPostings (term);
+    }
+    else {
+        for (const auto &one : index.listTerms (term)) {
+            addPostings (one.text);
+        }
+    }
+
+    std::sort (result.begin(), result.end());
+    result.erase (std::unique (result.begin(), result.end()), result.end());
+    return result;
+}
+
+/// \brief Вычисление простого поискового выражения слева направо.
+/// \throw irbis::IrbisException Неподдерживаемый синтаксис.
+static std::vector<irbis::Mfn> evaluate (irbis::InvertedFile64 &index, const irbis::String &expression)
+{
+    std::vector<irbis::Mfn> result;
+    auto first = true;
+    wchar_t operation = L'+';
+    std::size_t position = 0;
+    while (position < expression.size()) {
+        const auto c = expression[position];
+        if (c == L' ' || c == L'\t') {
+            ++position;
+            continue;
+        }
+        if (c == L'+' || c == L'*' || c == L'^') {
+            operation = c;
+            ++position;
+            continue;
+        }
+        if (c == L'(' || c == L')') {
+            throw irbis::IrbisException();
+        }
+
+        irbis::String term;
+        if (c == L'"') {
+            const auto closing = expression.find (L'"', position + 1);
+            if (closing == irbis::String::npos) {
+                throw irbis::IrbisException();
+            }
+            term = expression.substr (position + 1, closing - position - 1);
+            position = closing + 1;
+        }
+        else {
+            const auto end = expression.find_first_of (L" \t+*^()", position);
+            term = expression.substr (position, end == irbis::String::npos ? irbis::String::npos : end - position);
+            position = end == irbis::String::npos ? expression.size() : end;
+        }
+
+        irbis::toUpper (term);
+        const auto found = lookupTerm (index, term);
+        if (first) {
+            result = found;
+            first = false;
+            continue;
+        }
+
+        std::vector<irbis::Mfn> combined;
+        switch (operation) {
+            case L'*':
+                std::set_intersection (result.begin(), result.end(), found.begin(), found.end(),
+                    std::back_inserter (combined));
+                break;
+            case L'^':
+                std::set_difference (result.begin(), result.end(), found.begin(), found.end(),
+                    std::back_inserter (combined));
+                break;
+            default:
+                std::set_union (result.begin(), result.end(), found.begin(), found.end(),
+                    std::back_inserter (combined));
+                break;
+        }
+        result.swap (combined);
+    }
+
+    return result;
+}
+
+/// \brief Команда K: поиск.
+static std::string search (const std::vector<std::string> &lines)
+{
+    const auto database = getDatabase (lineAt (lines, 10));
+    if (!database || !database->index) {
+        return failure (-401);
+    }
+
+    std::vector<irbis::Mfn> found;
+    try {
+        found = evaluate (*database->index, irbis::fromUtf (lineAt (lines, 11)));
+    }
+    catch (const irbis::IrbisException &) {
+        return failure (-2222);
+    }
+
+    const auto count = static_cast<std::size_t> (std::max (intAt (lines, 12), 0));
+    const auto first = static_cast<std::size_t> (std::max (intAt (lines, 13), 1));
+    const auto limit = count == 0 ? MaxPacket : std::min (count, MaxPacket);
+
+    std::string result;
+    appendLine (result, 0);
+    appendLine (result, static_cast<int64_t> (found.size()));
+    for (auto i = first - 1; i < found.size() && i - (first - 1) < limit; ++i) {
+        appendLine (result, found[i]);
+    }
+
+    return result;
+}
+
+/// \brief Команды H и P: чтение терминов.
+static std::string readTerms (const std::vector<std::string> &lines, bool reverse)
+{
+    const auto database = getDatabase (lineAt (lines, 10));
+    if (!database || !database->index) {
+        return failure (-401);
+    }
+
+    const auto startTerm = irbis::fromUtf (lineAt (lines, 11));
+    auto count = intAt (lines, 12);
+    count = count <= 0 ? 100 : std::min (count, static_cast<int> (MaxPacket));
+    const auto terms = database->index->readTerms (startTerm, count, reverse);
+
+    std::string result;
+    if (terms.empty()) {
+        appendLine (result, reverse ? -204 : -203);
+    }
+    else {
+        appendLine (result, terms.front().text == startTerm ? 0 : -202);
+    }
+    for (const auto &term : terms) {
+        appendLine (result, std::to_string (term.count) + "#" + irbis::toUtf (term.text));
+    }
+
+    return result;
+}
+
+/// \brief Команда I: чтение ссылок для терминов.
+static std::string readPostings (const std::vector<std::string> &lines)
+{
+    const auto database = getDatabase (lineAt (lines, 10));
+    if (!database || !database->index) {
+        return failure (-401);
+    }
+
+    const auto count = std::max (intAt (lines, 11), 0);
+    const auto first = std::max (intAt (lines, 12), 1);
+    std::string body;
+    for (std::size_t i = 14; i < lines.size(); ++i) {
+        if (lines[i].empty()) {
+            continue;
+        }
+        for (const auto &posting : database->index->readPostings (irbis::fromUtf (lines[i]), first, count)) {
+            body += std::to_string (posting.mfn) + "#" + std::to_string (posting.tag) + "#"
+                    + std::to_string (posting.occurrence) + "#" + std::to_string (posting.count) + "\r\n";
+        }
+    }
+
+    return body.empty() ? failure (-202) : "0\r\n" + body;
+}
+
+/// \brief Выполнение команды.
+/// \param lines Строки запроса (код команды первой строкой).
+/// \return Ответ без заголовка.
+static std::string execute (const std::vector<std::string> &lines)
+{
+    const auto &command = lineAt (lines, 0);
+    if (command == "A") {
+        return "0\r\n30\r\n";
+    }
+    if (command == "B" || command == "N") {
+        return "0\r\n";
+    }
+    if (command == "O") {
+        return getMaxMfn (lines);
+    }
+    if (command == "C") {
+        return readRecord (lines);
+    }
+    if (command == "G") {
+        return formatRecords (lines);
+    }
+    if (command == "K") {
+        return search (lines);
+    }
+    if (command == "H" || command == "P") {
+        return readTerms (lines, command == "P");
+    }
+    if (command == "I") {
+        return readPostings (lines);
+    }
+
+    return failure (-2222);
+}
+
+//=========================================================
+
+/// \brief Чтение пакета запроса: длина первой строкой, затем сам запрос.
+static bool receiveRequest (int socket, std::vector<std::string> &lines)
+{
+    std::string packet;
+    std::size_t newline = std::string::npos, expected = 0;
+    char buffer[4096];
+    while (true) {
+        const auto received = ::recv (socket, buffer, sizeof (buffer), 0);
+        if (received <= 0) {
+            return false;
+        }
+        packet.append (buffer, static_cast<std::size_t> (received));
+        if (newline == std::string::npos) {
+            newline = packet.find ('\n');
+            if (newline == std::string::npos) {
+                if (packet.size() > 16) {
+                    return false;
+                }
+                continue;
+            }
+            expected = static_cast<std::size_t> (std::strtoul (packet.c_str(), nullptr, 10));
+            if (expected == 0 || expected > MaxRequest) {
+                return false;
+            }
+        }
+        if (packet.size() - newline - 1 >= expected) {
+            break;
+        }
+    }
+
+    std::size_t start = newline + 1;
+    const auto end = newline + 1 + expected;
+    while (start < end) {
+        auto stop_ = packet.find ('\n', start);
+        if (stop_ == std::string::npos || stop_ > end) {
+            stop_ = end;
+        }
+        auto length = stop_ - start;
+        if (length != 0 && packet[start + length - 1] == '\r') {
+            --length;
+        }
+        lines.emplace_back (packet, start, length);
+        start = stop_ + 1;
+    }
+
+    return !lines.empty();
+}
+
+static bool sendAll (int socket, const std::string &data)
+{
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        const auto chunk = ::send (socket, data.data() + sent, static_cast<int> (data.size() - sent), 0);
+        if (chunk <= 0) {
+            return false;
+        }
+        sent += static_cast<std::size_t> (chunk);
+    }
+    return true;
+}
+
+/// \brief Ограничение времени приёма и передачи для подключения,
+/// чтобы молчащий клиент не занимал рабочий поток бесконечно.
+static void setTimeouts (int socket)
+{
+#ifdef IRBIS_WINDOWS
+
+    const DWORD timeout = static_cast<DWORD> (idleTimeout) * 1000;
+
+#else
+
+    struct timeval timeout {};
+    timeout.tv_sec = idleTimeout;
+
+#endif
+
+    ::setsockopt (socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*> (&timeout), sizeof (timeout));
+    ::setsockopt (socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*> (&timeout), sizeof (timeout));
+}
+
+/// \brief Обслуживание одного подключения (одна команда на подключение).
+static void handleClient (int socket)
+{
+    setTimeouts (socket);
+
+    std::vector<std::string> lines;
+    if (!receiveRequest (socket, lines)) {
+        ++failedCount;
+        ::closesocket (socket);
+        return;
+    }
+
+    std::string body;
+    try {
+        body = execute (lines);
+    }
+    catch (const std::exception &exception) {
+        std::cerr << "Command " << lineAt (lines, 0) << " failed: " << exception.what() << std::endl;
+        body = failure (-8888);
+    }
+
+    if (latency > 0) {
+        std::this_thread::sleep_for (std::chrono::milliseconds (latency));
+    }
+
+    // Заголовок: команда, идентификатор клиента, номер команды,
+    // размер остатка ответа, версия сервера и пять пустых строк.
+    const std::string rest = "64.2014\r\n\r\n\r\n\r\n\r\n\r\n" + body;
+    std::string answer;
+    appendLine (answer, lineAt (lines, 0));
+    appendLine (answer, lineAt (lines, 3));
+    appendLine (answer, lineAt (lines, 4));
+    appendLine (answer, static_cast<int64_t> (rest.size()));
+    answer += rest;
+
+    if (sendAll (socket, answer)) {
+        ++servedCount;
+    }
+    else {
+        ++failedCount;
+    }
+
+    if (verbose) {
+        std::cout << lineAt (lines, 0) << " " << lineAt (lines, 10) << ": " << answer.size() << " bytes" << std::endl;
+    }
+
+    ::closesocket (socket);
+}
+
+static void workerLoop()
+{
+    while (true) {
+        int socket;
+        {
+            std::unique_lock<std::mutex> lock (queueMutex);
+            queueCondition.wait (lock, [] { return stop || !clientQueue.empty(); });
+            if (clientQueue.empty()) {
+                return;
+            }
+            socket = clientQueue.front();
+            clientQueue.pop_front();
+        }
+        handleClient (socket);
+    }
+}
+
+//=========================================================
+
+static void printUsage()
+{
+    std::cout << "Usage: irbisMockServer [--port N] [--data PATH] [--threads N] [--latency MS] [--timeout SEC] [--verbose]\n"
+              << "  --port     TCP port to listen (default 6666)\n"
+              << "  --data     directory containing database subdirectories, e.g. Irbis64/Datai (default .)\n"
+              << "  --threads  number of worker threads (default 4)\n"
+              << "  --latency  artificial delay before each answer, milliseconds (default 0)\n"
+              << "  --timeout  drop a client silent for this long, seconds (default 30)\n"
+              << "  --verbose  print every request" << std::endl;
+}
+
+/// \brief Разбор аргументов командной строки.
+/// \return true если все хорошо.
+static bool parseCommandLine (int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--port" && hasValue) {
+            localPort = static_cast<short> (std::atoi (argv[++i]));
+        }
+        else if (arg == "--data" && hasValue) {
+            dataPath = argv[++i];
+        }
+        else if (arg == "--threads" && hasValue) {
+            threadCount = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--latency" && hasValue) {
+            latency = std::max (std::atoi (argv[++i]), 0);
+        }
+        else if (arg == "--timeout" && hasValue) {
+            idleTimeout = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--verbose") {
+            verbose = true;
+        }
+        else {
+            printUsage();
+            return false;
+        }
+    }
+
+    if (!irbis::IO::directoryExist (dataPath)) {
+        std::cerr << "Data directory " << dataPath << " not found" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+#ifndef IRBIS_WINDOWS
+
+static void handleSignal (int sig)
+{
+    if (sig == SIGINT || sig == SIGTERM) {
+        stop = true;
+    }
+}
+
+#endif
+
+/// \brief Инициализация сети и обработчиков сигналов.
+/// \return true, если все хорошо.
+static bool initialize()
+{
+#ifdef IRBIS_WINDOWS
+
+    WSADATA wsaData;
+    if (WSAStartup (0x0202, &wsaData)) {
+        return false;
+    }
+
+#else
+
+    // Без SA_RESTART, чтобы accept прерывался сигналом.
+    struct sigaction action {};
+    action.sa_handler = handleSignal;
+    ::sigaction (SIGINT, &action, nullptr);
+    ::sigaction (SIGTERM, &action, nullptr);
+    ::signal (SIGPIPE, SIG_IGN);
+
+#endif
+
+    return true;
+}
+
+static bool createListener()
+{
+    listenerSocket = ::socket (AF_INET, SOCK_STREAM, 0);
+    if (listenerSocket == -1) {
+        std::cerr << "socket() failed" << std::endl;
+        return false;
+    }
+
+    const int reuse = 1;
+    ::setsockopt (listenerSocket, SOL_SOCKET, SO_REUSEADDR,
+        reinterpret_cast<const char*> (&reuse), sizeof (reuse));
+
+    struct sockaddr_in localAddress {};
+    localAddress.sin_family = AF_INET;
+    localAddress.sin_addr.s_addr = htonl (INADDR_ANY);
+    localAddress.sin_port = htons (localPort);
+    if (::bind (listenerSocket, reinterpret_cast<struct sockaddr*> (&localAddress), sizeof (localAddress)) == -1) {
+        std::cerr << "bind() failed" << std::endl;
+        ::closesocket (listenerSocket);
+        return false;
+    }
+
+    if (::listen (listenerSocket, SOMAXCONN) == -1) {
+        std::cerr << "listen() failed" << std::endl;
+        ::closesocket (listenerSocket);
+        return false;
+    }
+
+    return true;
+}
+
+/// \brief Главный серверный цикл: подключения раздаются рабочим потокам.
+static void serverLoop()
+{
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadCount; ++i) {
+        workers.emplace_back (workerLoop);
+    }
+
+    while (!stop) {
+        const auto clientSocket = ::accept (listenerSocket, nullptr, nullptr);
+        if (clientSocket == -1) {
+            if (!stop) {
+                std::cerr << "accept() failed" << std::endl;
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard (queueMutex);
+            clientQueue.push_back (static_cast<int> (clientSocket));
+        }
+        queueCondition.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard (queueMutex);
+        stop = true;
+    }
+    queueCondition.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    ::closesocket (listenerSocket);
+}
+
+int main (int argc, char *argv[])
+{
+    std::cout << "IRBIS-MOCK-SERVER application version " << mockVersion << std::endl;
+
+    if (!parseCommandLine (argc, argv)) {
+        return 1;
+    }
+
+    if (!initialize()) {
+        std::cerr << "initialize() failed" << std::endl;
+        return 2;
+    }
+
+    if (!createListener()) {
+        return 3;
+    }
+
+    std::cout << "Listening on port " << localPort << ", data " << dataPath
+              << ", threads " << threadCount << ", latency " << latency << " ms" << std::endl;
+    serverLoop();
+    std::cout << "Served " << servedCount << " requests, failed " << failedCount << std::endl;
+
+    return 0;
+}
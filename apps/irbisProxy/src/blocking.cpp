@@ -0,0 +1,275 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Упрощённый прокси для сервера ИРБИС64 для Windows: по потоку
+// на клиента, блокирующие сокеты, один сервер. Основная версия
+// (main.cpp, proxy.cpp) опирается на epoll/poll и splice и собирается
+// только под POSIX; реплики, кэш, журнал трафика и статистика
+// есть только в ней.
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#ifdef IRBIS_WINDOWS
+
+#include <winsock2.h>
+#include <windows.h>
+#pragma comment (lib, "ws2_32.lib")
+#define SHUT_WR SD_SEND
+
+#else
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define closesocket(__x) close(__x)
+
+#endif
+
+static const char *proxyVersion = "0.2";
+static short localPort = 6666;
+static std::string remoteHost = "127.0.0.1";
+static short remotePort = 5555;
+static int timeout = 60; // секунды
+static bool verbose = false;
+static int listenerSocket = -1;
+static std::atomic<uint64_t> handledCount { 0 };
+static std::atomic<uint64_t> failedCount { 0 };
+
+//=========================================================
+
+static void printUsage()
+{
+    std::cout << "Usage: irbisProxy [--listen PORT] [--upstream HOST:PORT] [--timeout SEC] [--verbose]\n"
+              << "  --listen    TCP port for clients (default 6666)\n"
+              << "  --upstream  IRBIS64 server (default 127.0.0.1:5555)\n"
+              << "  --timeout   socket time limit, seconds (default 60)\n"
+              << "  --verbose   print every request\n"
+              << "Other options of the POSIX build are not supported here." << std::endl;
+}
+
+/// \brief Разбор аргументов командной строки.
+/// \return true если все хорошо.
+static bool parseCommandLine (int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--listen" && hasValue) {
+            localPort = static_cast<short> (std::atoi (argv[++i]));
+        }
+        else if (arg == "--upstream" && hasValue) {
+            const std::string value = argv[++i];
+            const auto colon = value.rfind (':');
+            remoteHost = value.substr (0, colon);
+            if (colon != std::string::npos) {
+                remotePort = static_cast<short> (std::atoi (value.c_str() + colon + 1));
+            }
+        }
+        else if (arg == "--timeout" && hasValue) {
+            timeout = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--verbose") {
+            verbose = true;
+        }
+        else {
+            printUsage();
+            return false;
+        }
+    }
+    return true;
+}
+
+static void setTimeouts (int socket)
+{
+#ifdef IRBIS_WINDOWS
+
+    const DWORD limit = static_cast<DWORD> (timeout) * 1000;
+
+#else
+
+    struct timeval limit {};
+    limit.tv_sec = timeout;
+
+#endif
+
+    ::setsockopt (socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*> (&limit), sizeof (limit));
+    ::setsockopt (socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*> (&limit), sizeof (limit));
+}
+
+static bool sendAll (int socket, const char *data, std::size_t size)
+{
+    while (size != 0) {
+        const auto sent = ::send (socket, data, static_cast<int> (size), 0);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<std::size_t> (sent);
+    }
+    return true;
+}
+
+/// \brief Получение пакета запроса целиком (длина первой строкой).
+static bool receiveRequest (int socket, std::string &packet)
+{
+    char buffer[4096];
+    while (true) {
+        const auto newline = packet.find ('\n');
+        if (newline != std::string::npos
+            && packet.size() - newline - 1 >= std::strtoul (packet.c_str(), nullptr, 10)) {
+            return true;
+        }
+        if (newline == std::string::npos && packet.size() > 32) {
+            return false; // длина не может быть такой длинной
+        }
+        const auto got = ::recv (socket, buffer, sizeof (buffer), 0);
+        if (got <= 0) {
+            return false;
+        }
+        packet.append (buffer, static_cast<std::size_t> (got));
+    }
+}
+
+/// \brief Подключение к серверу.
+/// \return Сокет либо -1.
+static int connectUpstream()
+{
+    try {
+        const auto addresses = irbis::AddressResolver::instance().resolve
+            (irbis::String (remoteHost.begin(), remoteHost.end()), remotePort); // имя хоста -- ASCII
+        for (const auto &address : addresses) {
+            const auto result = static_cast<int> (::socket (address.family, SOCK_STREAM, 0));
+            if (result < 0) {
+                continue;
+            }
+            setTimeouts (result);
+            if (::connect (result, reinterpret_cast<const sockaddr*> (address.address.data()),
+                           static_cast<int> (address.address.size())) == 0) {
+                return result;
+            }
+            ::closesocket (result);
+        }
+    }
+    catch (const std::exception &) {
+        // имя не разрешилось
+    }
+    return -1;
+}
+
+/// \brief Обслуживание одного клиента: запрос серверу, ответ клиенту.
+static bool relay (int client)
+{
+    std::string packet;
+    if (!receiveRequest (client, packet)) {
+        return false;
+    }
+    if (verbose) {
+        const auto newline = packet.find ('\n');
+        const auto end = packet.find ('\n', newline + 1);
+        std::cout << "request " << packet.substr (newline + 1, end - newline - 1)
+                  << ", " << packet.size() << " bytes" << std::endl;
+    }
+
+    const auto upstream = connectUpstream();
+    if (upstream < 0) {
+        return false;
+    }
+
+    auto result = sendAll (upstream, packet.data(), packet.size());
+    if (result) {
+        ::shutdown (upstream, SHUT_WR);
+        char buffer[32 * 1024];
+        while (true) {
+            const auto got = ::recv (upstream, buffer, sizeof (buffer), 0);
+            if (got == 0) {
+                break;
+            }
+            if (got < 0 || !sendAll (client, buffer, static_cast<std::size_t> (got))) {
+                result = false;
+                break;
+            }
+        }
+    }
+    ::closesocket (upstream);
+    return result;
+}
+
+static void handleClient (int client)
+{
+    setTimeouts (client);
+    if (relay (client)) {
+        ++handledCount;
+    }
+    else {
+        ++failedCount;
+    }
+    ::shutdown (client, SHUT_WR);
+    ::closesocket (client);
+}
+
+static bool createListener()
+{
+    listenerSocket = static_cast<int> (::socket (AF_INET, SOCK_STREAM, 0));
+    if (listenerSocket < 0) {
+        std::cerr << "socket() failed" << std::endl;
+        return false;
+    }
+
+    struct sockaddr_in localAddress {};
+    localAddress.sin_family = AF_INET;
+    localAddress.sin_addr.s_addr = htonl (INADDR_ANY);
+    localAddress.sin_port = htons (localPort);
+    if (::bind (listenerSocket, reinterpret_cast<struct sockaddr*> (&localAddress), sizeof (localAddress)) != 0) {
+        std::cerr << "bind() to port " << localPort << " failed" << std::endl;
+        ::closesocket (listenerSocket);
+        return false;
+    }
+
+    if (::listen (listenerSocket, SOMAXCONN) != 0) {
+        std::cerr << "listen() failed" << std::endl;
+        ::closesocket (listenerSocket);
+        return false;
+    }
+
+    return true;
+}
+
+int main (int argc, char *argv[])
+{
+    std::cout << "IRBIS-PROXY application version " << proxyVersion << " (blocking)" << std::endl;
+
+    if (!parseCommandLine (argc, argv)) {
+        return 1;
+    }
+
+    // Заодно инициализирует WinSock.
+    irbis::AddressResolver::instance();
+
+    if (!createListener()) {
+        return 3;
+    }
+
+    std::cout << "Listening on port " << localPort << ", upstream " << remoteHost << ':' << remotePort << std::endl;
+    while (true) {
+        const auto client = static_cast<int> (::accept (listenerSocket, nullptr, nullptr));
+        if (client < 0) {
+            std::cerr << "accept() failed" << std::endl;
+            break;
+        }
+        std::thread (handleClient, client).detach();
+    }
+
+    std::cout << "Handled " << handledCount << ", failed " << failedCount << std::endl;
+    ::closesocket (listenerSocket);
+    return 4;
+}
@@ -0,0 +1,349 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "proxy.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+/// \file cache.cpp
+/// \brief Разбор запросов и кэш ответов прокси.
+///
+/// Пакет запроса: длина, затем строки, разделённые '\n':
+/// код команды, код АРМ, код команды, идентификатор клиента,
+/// номер запроса, пароль, имя пользователя, три пустые строки
+/// и параметры команды. Ответ сервера повторяет код команды,
+/// идентификатор клиента и номер запроса в первых трёх строках
+/// (разделитель "\r\n"); в четвёртой -- длина остатка ответа.
+
+namespace proxy {
+
+namespace {
+
+const std::size_t MaxRequest = 1 << 24; // защита от мусора
+const std::size_t HeaderLines = 10; // строки запроса до параметров
+const std::size_t AnswerHeaderLines = 10; // строки заголовка ответа
+
+// Команды, заведомо не изменяющие данных.
+const std::set<std::string> readOnlyCommands
+{
+    "A", "B", "C", "G", "H", "I", "K", "L", "N", "O", "P", "0", "1", "+1", "+3", "+9"
+};
+
+// Команды записи, первый параметр которых -- имя базы данных.
+const std::set<std::string> databaseWrites { "D", "F", "Q" };
+
+// Строка, начинающаяся с position; position переводится на следующую.
+std::string nextLine (const irbis::Bytes &packet, std::size_t &position, std::size_t size)
+{
+    const auto begin = packet.begin() + static_cast<std::ptrdiff_t> (position);
+    const auto end = packet.begin() + static_cast<std::ptrdiff_t> (size);
+    const auto found = std::find (begin, end, '\n');
+    auto last = found;
+    if (last != begin && *(last - 1) == '\r') {
+        --last;
+    }
+    position = found == end ? size : static_cast<std::size_t> (found - packet.begin()) + 1;
+    return std::string (begin, last);
+}
+
+std::string toUpper (std::string text)
+{
+    for (auto &c : text) {
+        c = static_cast<char> (std::toupper (static_cast<unsigned char> (c)));
+    }
+    return text;
+}
+
+}
+
+//=========================================================
+
+std::size_t completePacket (const irbis::Byte *data, std::size_t size)
+{
+    std::size_t length = 0, position = 0;
+    for (; position < size; ++position) {
+        const auto c = data[position];
+        if (c == '\n') {
+            break;
+        }
+        if (c < '0' || c > '9' || position >= 9) {
+            throw std::runtime_error ("bad packet length");
+        }
+        length = length * 10 + (c - '0');
+    }
+
+    if (position == size) {
+        return 0;
+    }
+    if (length == 0 || length > MaxRequest) {
+        throw std::runtime_error ("bad packet length");
+    }
+
+    const auto total = position + 1 + length;
+    return size >= total ? total : 0;
+}
+
+RequestInfo parseRequest (const irbis::Bytes &packet, std::size_t size)
+{
+    RequestInfo result;
+    std::size_t position = 0;
+    nextLine (packet, position, size); // длина пакета
+    std::vector<std::string> header;
+    while (position < size && header.size() < HeaderLines) {
+        header.push_back (nextLine (packet, position, size));
+    }
+    result.paramsOffset = position;
+    if (header.size() < HeaderLines) {
+        // Неполный заголовок: команда неизвестна, считается записью.
+        result.command = header.empty() ? std::string() : header.front();
+        result.write = true;
+        return result;
+    }
+
+    result.command = header[0];
+    result.clientId = header[3];
+    result.queryId = header[4];
+    const auto first = nextLine (packet, position, size);
+    if (result.command == "L") {
+        // Спецификация файла: путь.база.имя; '&' -- запись файла.
+        const auto dot = first.find ('.');
+        if (dot != std::string::npos) {
+            const auto next = first.find ('.', dot + 1);
+            if (next != std::string::npos) {
+                result.database = first.substr (dot + 1, next - dot - 1);
+            }
+        }
+        result.write = first.find ('&') != std::string::npos;
+    }
+    else if (readOnlyCommands.count (result.command) != 0) {
+        result.database = first;
+    }
+    else {
+        result.write = true;
+        if (databaseWrites.count (result.command) != 0) {
+            result.database = first;
+        }
+        else if (result.command == "6") {
+            // Блокировка, актуализация, затем записи в виде "база\x1Fзапись".
+            nextLine (packet, position, size);
+            const auto record = nextLine (packet, position, size);
+            const auto delimiter = record.find ('\x1F');
+            if (delimiter != std::string::npos) {
+                result.database = record.substr (0, delimiter);
+            }
+        }
+        // Прочие команды (глобальная корректировка, администрирование)
+        // сбрасывают кэш целиком.
+    }
+    result.database = toUpper (result.database);
+
+    return result;
+}
+
+bool answerIsCacheable (const irbis::Bytes &answer)
+{
+    std::size_t position = 0;
+    for (std::size_t line = 0; line < AnswerHeaderLines; ++line) {
+        if (position >= answer.size()) {
+            return false;
+        }
+        const auto text = nextLine (answer, position, answer.size());
+        if (line == 3) {
+            const auto expected = std::strtoull (text.c_str(), nullptr, 10);
+            if (expected != 0 && answer.size() - position < expected) {
+                return false; // ответ оборван
+            }
+        }
+    }
+
+    // Коды от -1000 и ниже -- ошибки сеанса и сервера (клиент
+    // не зарегистрирован, неверный пароль, перегрузка), их не кэшируем.
+    // Прочие отрицательные коды (например, -202 -- конец словаря)
+    // описывают сами данные.
+    const auto rc = nextLine (answer, position, answer.size());
+    const auto isNumber = rc.size() > 1 && rc[0] == '-'
+        && std::all_of (rc.begin() + 1, rc.end(), [] (char c) { return c >= '0' && c <= '9'; });
+    return !isNumber || std::strtol (rc.c_str(), nullptr, 10) > -1000;
+}
+
+irbis::Bytes rewriteAnswer (const irbis::Bytes &answer, const std::string &clientId, const std::string &queryId)
+{
+    std::size_t position = 0;
+    nextLine (answer, position, answer.size()); // код команды
+    const auto commandEnd = position;
+    nextLine (answer, position, answer.size());
+    nextLine (answer, position, answer.size());
+    if (position >= answer.size()) {
+        return answer;
+    }
+
+    irbis::Bytes result;
+    result.reserve (answer.size() + clientId.size() + queryId.size());
+    result.insert (result.end(), answer.begin(), answer.begin() + static_cast<std::ptrdiff_t> (commandEnd));
+    result.insert (result.end(), clientId.begin(), clientId.end());
+    result.push_back ('\r');
+    result.push_back ('\n');
+    result.insert (result.end(), queryId.begin(), queryId.end());
+    result.push_back ('\r');
+    result.push_back ('\n');
+    result.insert (result.end(), answer.begin() + static_cast<std::ptrdiff_t> (position), answer.end());
+    return result;
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param maxBytes Предельный объём ответов в кэше (0 -- кэш выключен).
+/// \param ttl Время жизни ответа.
+/// \param commands Кэшируемые команды через запятую.
+ResponseCache::ResponseCache (std::size_t maxBytes, std::chrono::seconds ttl, const std::string &commands)
+    : _maxBytes { maxBytes }, _ttl { ttl }
+{
+    std::istringstream stream (commands);
+    std::string command;
+    while (std::getline (stream, command, ',')) {
+        command.erase (std::remove (command.begin(), command.end(), ' '), command.end());
+        if (!command.empty()) {
+            this->_commands.insert (command);
+        }
+    }
+}
+
+/// \brief Можно ли брать ответ на данный запрос из кэша.
+bool ResponseCache::cacheable (const RequestInfo &request) const noexcept
+{
+    return this->_maxBytes != 0 && !request.write && this->_commands.count (request.command) != 0;
+}
+
+/// \brief Поколение данных базы: меняется при каждом сбросе.
+uint64_t ResponseCache::generation (const std::string &database) const
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    const auto found = this->_generations.find (database);
+    return this->_globalGeneration + (found == this->_generations.end() ? 0 : found->second);
+}
+
+/// \brief Сброс ответов по базе данных.
+/// \param database Имя базы (пустое -- сброс всего кэша).
+void ResponseCache::invalidate (const std::string &database)
+{
+    if (this->_maxBytes == 0) {
+        return;
+    }
+
+    ++this->invalidations;
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    if (database.empty()) {
+        ++this->_globalGeneration;
+        this->_entries.clear();
+        this->_index.clear();
+        this->_bytes = 0;
+        return;
+    }
+
+    ++this->_generations[database];
+    for (auto it = this->_entries.begin(); it != this->_entries.end();) {
+        const auto current = it++;
+        if (current->database == database) {
+            this->_erase (current);
+        }
+    }
+}
+
+/// \brief Поиск ответа.
+/// \param key Ключ (команда и параметры).
+/// \param answer Сюда помещается копия ответа.
+/// \return true, если ответ найден и не устарел.
+bool ResponseCache::lookup (const std::string &key, irbis::Bytes &answer)
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    const auto found = this->_index.find (key);
+    if (found == this->_index.end()) {
+        ++this->misses;
+        return false;
+    }
+
+    const auto entry = found->second;
+    if (entry->expires < Clock::now()) {
+        this->_erase (entry);
+        ++this->misses;
+        return false;
+    }
+
+    this->_entries.splice (this->_entries.begin(), this->_entries, entry);
+    answer = entry->answer;
+    ++this->hits;
+    return true;
+}
+
+/// \brief Помещение ответа в кэш.
+/// \param key Ключ (команда и параметры).
+/// \param database База данных запроса.
+/// \param generation Поколение базы на момент запроса.
+/// \param answer Ответ сервера.
+void ResponseCache::store (const std::string &key, const std::string &database, uint64_t generation,
+                           irbis::Bytes &&answer)
+{
+    if (answer.size() > this->_maxBytes / 4) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    const auto found = this->_generations.find (database);
+    const auto current = this->_globalGeneration + (found == this->_generations.end() ? 0 : found->second);
+    if (current != generation) {
+        return; // за время запроса база изменилась
+    }
+
+    const auto existing = this->_index.find (key);
+    if (existing != this->_index.end()) {
+        this->_erase (existing->second);
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.database = database;
+    entry.answer = std::move (answer);
+    entry.expires = Clock::now() + this->_ttl;
+    this->_bytes += entry.key.size() + entry.answer.size();
+    this->_entries.push_front (std::move (entry));
+    this->_index[key] = this->_entries.begin();
+    ++this->stores;
+
+    while (this->_bytes > this->_maxBytes && !this->_entries.empty()) {
+        this->_erase (std::prev (this->_entries.end()));
+    }
+}
+
+/// \brief Текстовое представление состояния кэша.
+std::string ResponseCache::toText() const
+{
+    if (this->_maxBytes == 0) {
+        return "cache disabled\n";
+    }
+
+    std::size_t entries, bytes;
+    {
+        std::lock_guard<std::mutex> guard (this->_mutex);
+        entries = this->_entries.size();
+        bytes = this->_bytes;
+    }
+    std::ostringstream result;
+    result << "cache: entries " << entries << ", bytes " << bytes << " of " << this->_maxBytes
+           << ", hits " << this->hits << ", misses " << this->misses << ", stores " << this->stores
+           << ", invalidations " << this->invalidations << '\n';
+    return result.str();
+}
+
+void ResponseCache::_erase (std::list<Entry>::iterator entry)
+{
+    this->_bytes -= entry->key.size() + entry->answer.size();
+    this->_index.erase (entry->key);
+    this->_entries.erase (entry);
+}
+
+}
@@ -0,0 +1,315 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "capture.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+/// \file capture.cpp
+/// \brief Журнал трафика прокси.
+
+namespace proxy {
+
+namespace {
+
+const char Magic[8] = { 'I', 'R', 'B', 'I', 'S', 'C', 'A', 'P' };
+const uint32_t FormatVersion = 1;
+const std::size_t FileHeaderSize = 16;
+const std::size_t RecordHeaderSize = 4 + 8 + 4 + 2 + 1 + 1 + 4 + 4;
+const std::size_t MaxQueuedBytes = 64 * 1024 * 1024;
+
+// Номера строк пакета (без строки длины), содержащих пароль.
+const std::size_t PasswordLine = 5;
+const std::size_t LoginPasswordLine = 11; // второй параметр команды A
+
+void put16 (irbis::Bytes &buffer, uint16_t value)
+{
+    buffer.push_back (static_cast<irbis::Byte> (value));
+    buffer.push_back (static_cast<irbis::Byte> (value >> 8));
+}
+
+void put32 (irbis::Bytes &buffer, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8) {
+        buffer.push_back (static_cast<irbis::Byte> (value >> shift));
+    }
+}
+
+void put64 (irbis::Bytes &buffer, uint64_t value)
+{
+    for (int shift = 0; shift < 64; shift += 8) {
+        buffer.push_back (static_cast<irbis::Byte> (value >> shift));
+    }
+}
+
+uint64_t get (const irbis::Byte *data, int bytes)
+{
+    uint64_t result = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        result = (result << 8) | data[i];
+    }
+    return result;
+}
+
+// Замена содержимого строк с паролем; true, если такие строки есть.
+bool replacePassword (const irbis::Bytes &packet, std::size_t size, const std::string &value,
+                      irbis::Bytes &result)
+{
+    const auto begin = packet.begin(), end = packet.begin() + static_cast<std::ptrdiff_t> (size);
+    auto bodyStart = std::find (begin, end, '\n');
+    if (bodyStart == end) {
+        return false;
+    }
+    ++bodyStart;
+
+    // Границы строк тела пакета.
+    std::vector<std::pair<std::ptrdiff_t, std::ptrdiff_t>> lines;
+    for (auto position = bodyStart; position < end && lines.size() <= LoginPasswordLine;) {
+        const auto next = std::find (position, end, '\n');
+        lines.emplace_back (position - begin, next - begin);
+        position = next == end ? end : next + 1;
+    }
+    if (lines.size() <= PasswordLine) {
+        return false;
+    }
+
+    std::vector<std::size_t> targets { PasswordLine };
+    const std::string command (begin + lines[0].first, begin + lines[0].second);
+    if (command == "A" && lines.size() > LoginPasswordLine) {
+        targets.push_back (LoginPasswordLine);
+    }
+
+    irbis::Bytes body;
+    body.reserve (size);
+    auto copied = bodyStart - begin;
+    for (const auto index : targets) {
+        body.insert (body.end(), begin + copied, begin + lines[index].first);
+        body.insert (body.end(), value.begin(), value.end());
+        copied = lines[index].second;
+    }
+    body.insert (body.end(), begin + copied, end);
+
+    const auto length = std::to_string (body.size()) + '\n';
+    result.assign (length.begin(), length.end());
+    result.insert (result.end(), body.begin(), body.end());
+    return true;
+}
+
+}
+
+//=========================================================
+
+irbis::Bytes scrubPassword (const irbis::Bytes &packet, std::size_t size, bool &scrubbed)
+{
+    irbis::Bytes result;
+    scrubbed = replacePassword (packet, size, std::string(), result);
+    if (!scrubbed) {
+        result.assign (packet.begin(), packet.begin() + static_cast<std::ptrdiff_t> (size));
+    }
+    return result;
+}
+
+irbis::Bytes restorePassword (const irbis::Bytes &packet, const std::string &password)
+{
+    irbis::Bytes result;
+    return replacePassword (packet, packet.size(), password, result) ? result : packet;
+}
+
+//=========================================================
+
+/// \brief Конструктор: запускает поток записи.
+/// \param prefix Начало имён файлов (к нему добавляется номер и ".cap").
+/// \param rotateBytes Размер, по достижении которого начинается новый файл.
+CaptureWriter::CaptureWriter (const std::string &prefix, std::size_t rotateBytes)
+    : _prefix { prefix }, _rotateBytes { rotateBytes }
+{
+    this->_open();
+    this->_thread = std::thread ([this] { this->_run(); });
+}
+
+/// \brief Деструктор.
+CaptureWriter::~CaptureWriter()
+{
+    this->close();
+}
+
+/// \brief Запись оставшейся очереди и закрытие файла.
+void CaptureWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> guard (this->_mutex);
+        this->_stopping = true;
+    }
+    this->_condition.notify_one();
+    if (this->_thread.joinable()) {
+        this->_thread.join();
+    }
+    if (this->_file != nullptr) {
+        std::fclose (this->_file);
+        this->_file = nullptr;
+    }
+}
+
+/// \brief Текстовое представление состояния журнала.
+std::string CaptureWriter::toText() const
+{
+    std::ostringstream result;
+    result << "capture: written " << this->written << ", dropped " << this->dropped
+           << ", files " << this->files << '\n';
+    return result.str();
+}
+
+/// \brief Постановка записи в очередь (не блокирует вызывающего).
+void CaptureWriter::write (CaptureRecord &&record)
+{
+    const auto bytes = record.request.size() + record.response.size() + RecordHeaderSize;
+    {
+        std::lock_guard<std::mutex> guard (this->_mutex);
+        if (this->_stopping || this->_queuedBytes + bytes > MaxQueuedBytes) {
+            ++this->dropped;
+            return;
+        }
+        this->_queuedBytes += bytes;
+        this->_queue.push_back (std::move (record));
+    }
+    this->_condition.notify_one();
+}
+
+// Следующий файл: первый ещё не существующий номер.
+void CaptureWriter::_open()
+{
+    if (this->_file != nullptr) {
+        std::fclose (this->_file);
+        this->_file = nullptr;
+    }
+
+    while (true) {
+        char suffix[16];
+        std::snprintf (suffix, sizeof (suffix), ".%06u.cap", ++this->_sequence);
+        const auto fileName = this->_prefix + suffix;
+        auto existing = std::fopen (fileName.c_str(), "rb");
+        if (existing != nullptr) {
+            std::fclose (existing);
+            continue;
+        }
+        this->_file = std::fopen (fileName.c_str(), "wb");
+        if (this->_file == nullptr) {
+            throw std::runtime_error ("can't create " + fileName);
+        }
+        break;
+    }
+
+    irbis::Bytes header (Magic, Magic + sizeof (Magic));
+    put32 (header, FormatVersion);
+    put32 (header, 0);
+    std::fwrite (header.data(), 1, header.size(), this->_file);
+    this->_fileSize = header.size();
+    ++this->files;
+}
+
+void CaptureWriter::_run()
+{
+    irbis::Bytes buffer;
+    while (true) {
+        std::deque<CaptureRecord> batch;
+        {
+            std::unique_lock<std::mutex> lock (this->_mutex);
+            this->_condition.wait (lock, [this] { return this->_stopping || !this->_queue.empty(); });
+            if (this->_queue.empty()) {
+                break;
+            }
+            batch.swap (this->_queue);
+            this->_queuedBytes = 0;
+        }
+
+        for (const auto &record : batch) {
+            buffer.clear();
+            put32 (buffer, static_cast<uint32_t> (RecordHeaderSize - 4 + record.request.size()
+                                                  + record.response.size()));
+            put64 (buffer, record.timestamp);
+            put32 (buffer, record.latency);
+            put16 (buffer, record.upstream);
+            buffer.push_back (record.flags);
+            buffer.push_back (0);
+            put32 (buffer, static_cast<uint32_t> (record.request.size()));
+            put32 (buffer, static_cast<uint32_t> (record.response.size()));
+            buffer.insert (buffer.end(), record.request.begin(), record.request.end());
+            buffer.insert (buffer.end(), record.response.begin(), record.response.end());
+
+            if (this->_fileSize + buffer.size() > this->_rotateBytes && this->_fileSize > FileHeaderSize) {
+                try {
+                    this->_open();
+                }
+                catch (const std::exception &) {
+                    ++this->dropped;
+                    continue;
+                }
+            }
+            if (std::fwrite (buffer.data(), 1, buffer.size(), this->_file) != buffer.size()) {
+                ++this->dropped;
+                continue;
+            }
+            this->_fileSize += buffer.size();
+            ++this->written;
+        }
+        std::fflush (this->_file);
+    }
+}
+
+//=========================================================
+
+/// \brief Конструктор: открывает файл и проверяет заголовок.
+/// \throw std::runtime_error Файл не найден либо не является журналом.
+CaptureReader::CaptureReader (const std::string &fileName)
+{
+    this->_file = std::fopen (fileName.c_str(), "rb");
+    if (this->_file == nullptr) {
+        throw std::runtime_error ("can't open " + fileName);
+    }
+
+    irbis::Byte header[FileHeaderSize];
+    if (std::fread (header, 1, sizeof (header), this->_file) != sizeof (header)
+        || !std::equal (Magic, Magic + sizeof (Magic), reinterpret_cast<const char*> (header))
+        || get (header + 8, 4) != FormatVersion) {
+        std::fclose (this->_file);
+        throw std::runtime_error (fileName + " is not a capture file");
+    }
+}
+
+/// \brief Деструктор.
+CaptureReader::~CaptureReader()
+{
+    std::fclose (this->_file);
+}
+
+/// \brief Чтение очередной записи.
+/// \return false, если записи кончились (оборванная запись в конце
+/// файла, например при аварийной остановке прокси, пропускается).
+bool CaptureReader::read (CaptureRecord &record)
+{
+    irbis::Byte header[RecordHeaderSize];
+    if (std::fread (header, 1, sizeof (header), this->_file) != sizeof (header)) {
+        return false;
+    }
+
+    const auto recordSize = static_cast<std::size_t> (get (header, 4));
+    record.timestamp = get (header + 4, 8);
+    record.latency = static_cast<uint32_t> (get (header + 12, 4));
+    record.upstream = static_cast<uint16_t> (get (header + 16, 2));
+    record.flags = header[18];
+    const auto requestSize = static_cast<std::size_t> (get (header + 20, 4));
+    const auto responseSize = static_cast<std::size_t> (get (header + 24, 4));
+    if (recordSize != RecordHeaderSize - 4 + requestSize + responseSize) {
+        return false;
+    }
+
+    record.request.resize (requestSize);
+    record.response.resize (responseSize);
+    return std::fread (record.request.data(), 1, requestSize, this->_file) == requestSize
+           && std::fread (record.response.data(), 1, responseSize, this->_file) == responseSize;
+}
+
+}
@@ -0,0 +1,112 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#ifndef IRBIS_PROXY_CAPTURE_H
+#define IRBIS_PROXY_CAPTURE_H
+
+#include "irbis.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// \file capture.h
+/// \brief Журнал трафика прокси.
+///
+/// Файл журнала: заголовок (8 байт "IRBISCAP", версия формата
+/// и 4 резервных байта), затем записи. Запись: длина остатка записи,
+/// время получения запроса (микросекунды от начала эпохи), время
+/// обработки прокси (микросекунды), номер сервера (0xFFFF -- ответ
+/// из кэша), флаги, резервный байт, длины запроса и ответа, сами
+/// запрос и ответ. Числа -- little-endian. Файлы только дописываются;
+/// по достижении заданного размера начинается следующий файл.
+
+namespace proxy {
+
+/// \brief Запись журнала: запрос клиента и ответ на него.
+struct CaptureRecord
+{
+    static const uint8_t Failed    = 1; ///< Запрос не доведён до конца.
+    static const uint8_t Cached    = 2; ///< Ответ взят из кэша.
+    static const uint8_t Truncated = 4; ///< Ответ сохранён не полностью.
+    static const uint8_t Scrubbed  = 8; ///< Пароль удалён из запроса.
+
+    static const uint16_t NoUpstream = 0xFFFF; ///< Сервер не участвовал.
+
+    uint64_t     timestamp { 0 };          ///< Время получения запроса, микросекунды от начала эпохи.
+    uint32_t     latency   { 0 };          ///< Время обработки прокси, микросекунды.
+    uint16_t     upstream  { NoUpstream }; ///< Номер сервера.
+    uint8_t      flags     { 0 };          ///< Флаги.
+    irbis::Bytes request;                  ///< Пакет запроса (с длиной первой строкой).
+    irbis::Bytes response;                 ///< Ответ сервера.
+};
+
+/// \brief Запись журнала в фоновом потоке.
+///
+/// Рабочие потоки прокси не ждут диска: записи копятся в очереди,
+/// а при её переполнении отбрасываются (с подсчётом).
+class CaptureWriter final
+{
+public:
+    std::atomic<uint64_t> written { 0 }; ///< Записано записей.
+    std::atomic<uint64_t> dropped { 0 }; ///< Отброшено записей.
+    std::atomic<uint64_t> files   { 0 }; ///< Начато файлов.
+
+    CaptureWriter (const std::string &prefix, std::size_t rotateBytes);
+    CaptureWriter (const CaptureWriter &) = delete;
+    CaptureWriter& operator = (const CaptureWriter &) = delete;
+    ~CaptureWriter();
+
+    void        close();
+    std::string toText() const;
+    void        write (CaptureRecord &&record);
+
+private:
+    std::string _prefix;
+    std::size_t _rotateBytes;
+    std::FILE  *_file { nullptr };
+    std::size_t _fileSize { 0 };
+    unsigned    _sequence { 0 };
+
+    std::mutex                _mutex;
+    std::condition_variable   _condition;
+    std::deque<CaptureRecord> _queue;
+    std::size_t               _queuedBytes { 0 };
+    bool                      _stopping { false };
+    std::thread               _thread;
+
+    void _open();
+    void _run();
+};
+
+/// \brief Последовательное чтение файла журнала.
+class CaptureReader final
+{
+public:
+    explicit CaptureReader (const std::string &fileName);
+    CaptureReader (const CaptureReader &) = delete;
+    CaptureReader& operator = (const CaptureReader &) = delete;
+    ~CaptureReader();
+
+    bool read (CaptureRecord &record);
+
+private:
+    std::FILE *_file { nullptr };
+};
+
+/// \brief Копия пакета запроса без пароля (длина пакета пересчитывается).
+/// \param packet Пакет запроса.
+/// \param size Длина пакета.
+/// \param scrubbed Устанавливается, если пароль был удалён.
+irbis::Bytes scrubPassword (const irbis::Bytes &packet, std::size_t size, bool &scrubbed);
+
+/// \brief Подстановка пароля в пакет, из которого он был удалён.
+irbis::Bytes restorePassword (const irbis::Bytes &packet, const std::string &password);
+
+}
+
+#endif
@@ -1,311 +1,349 @@
-#include "irbis.h"
-#include "irbis_internal.h"
-
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Прокси для сервера ИРБИС64. Подключения клиентов раздаются
+// рабочим потокам, каждый из которых обслуживает свои сеансы
+// в цикле событий (см. proxy.cpp). Число одновременных подключений
+// к серверу ограничено, лишние запросы ждут в очереди.
+// Запись идёт на основной сервер, чтение распределяется
+// между ним и репликами (см. router.cpp).
+// Ответы на команды, не изменяющие данных (по умолчанию L, H, P, O),
+// могут кэшироваться; команды записи сбрасывают кэш своей базы.
+// Трафик может записываться в журнал для воспроизведения
+// утилитой irbisReplay (пароли из запросов удаляются).
+// Статистика по командам выдаётся на отдельном порту
+// (подходит и для curl, и для nc).
+
+#include "proxy.h"
+
+#include <cstdlib>
 #include <iostream>
-#include <algorithm>
-#include <cmath>
-
-#ifdef IRBIS_WINDOWS
-
-#include <winsock2.h>
-#include <windows.h>
-#pragma comment (lib, "ws2_32.lib")
-
-#else
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netdb.h>
+#include <poll.h>
 #include <csignal>
 #include <unistd.h>
-#define HOSTENT struct hostent
 #define closesocket(__x) close(__x)
 
-#endif
-
-static const char *proxyVersion = "0.1";
-static bool stopFlag = false;
-static int currentLoad = 0;
-static int64_t transactionIndex = 0;
-static short localPort = 6666;
-static short remotePort = 5555;
-static int listenerSocket;
+static const char *proxyVersion = "0.2";
+static proxy::Settings settings;
+static int listenerSocket = -1;
+static int statsSocket = -1;
 static volatile bool stop = false;
 
-static void drawLine()
+// Без проверки серверов их имена всё равно разрешаются заново с этим периодом.
+static const std::chrono::seconds resolveInterval { 60 };
+
+// Столько ждём запроса от клиента статистики (nc может ничего не прислать).
+static const int statsRequestMs = 500;
+
+//=========================================================
+
+static void printUsage()
+{
+    std::cout << "Usage: irbisProxy [--listen PORT] [--upstream HOST:PORT[@W]] [--replica HOST:PORT[@W]]...\n"
+              << "                  [--health-interval SEC] [--workers N] [--max-upstream N]\n"
+              << "                  [--stats-port PORT] [--timeout SEC] [--no-splice] [--verbose]\n"
+              << "                  [--cache-size MB] [--cache-ttl SEC] [--cache-commands LIST]\n"
+              << "                  [--capture PREFIX] [--capture-rotate MB]\n"
+              << "  --listen        TCP port for clients (default 6666)\n"
+              << "  --upstream      primary IRBIS64 server, receives all writes (default 127.0.0.1:5555)\n"
+              << "  --replica       read-only replica (repeatable); @W sets the read weight, 0 = no reads\n"
+              << "  --health-interval  upstream check period, seconds (default 5, 0 = disabled)\n"
+              << "  --workers       number of event loop threads (default: number of cores)\n"
+              << "  --max-upstream  simultaneous server connections in total, 0 = unlimited (default 64)\n"
+              << "  --stats-port    TCP port serving statistics as text (default: disabled)\n"
+              << "  --timeout       request time limit, seconds (default 60)\n"
+              << "  --no-splice     copy responses through userspace buffers\n"
+              << "  --verbose       print every request\n"
+              << "  --cache-size    response cache size, megabytes (default 0 = disabled)\n"
+              << "  --cache-ttl     cached response lifetime, seconds (default 30)\n"
+              << "  --cache-commands  comma-separated cacheable commands (default L,H,P,O)\n"
+              << "  --capture       write request/response pairs to PREFIX.NNNNNN.cap (passwords scrubbed)\n"
+              << "  --capture-rotate  capture file size limit, megabytes (default 256)" << std::endl;
+}
+
+/// \brief Разбор адреса сервера вида HOST:PORT[@WEIGHT].
+static proxy::UpstreamConfig parseUpstream (std::string value)
 {
-    std::cout << "--------------------------------------------------\n";
+    proxy::UpstreamConfig result;
+    const auto at = value.rfind ('@');
+    if (at != std::string::npos) {
+        result.weight = static_cast<unsigned> (std::max (std::atoi (value.c_str() + at + 1), 0));
+        value.resize (at);
+    }
+    const auto colon = value.rfind (':');
+    result.host = value.substr (0, colon);
+    if (colon != std::string::npos) {
+        result.port = static_cast<short> (std::atoi (value.c_str() + colon + 1));
+    }
+    return result;
 }
 
 /// \brief Разбор аргументов командной строки.
-/// \param argc
-/// \param argv
 /// \return true если все хорошо.
 static bool parseCommandLine (int argc, char *argv[])
 {
-    // TODO implement
+    proxy::UpstreamConfig primary;
+    std::vector<proxy::UpstreamConfig> replicas;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--listen" && hasValue) {
+            settings.listenPort = static_cast<short> (std::atoi (argv[++i]));
+        }
+        else if (arg == "--upstream" && hasValue) {
+            primary = parseUpstream (argv[++i]);
+        }
+        else if (arg == "--replica" && hasValue) {
+            replicas.push_back (parseUpstream (argv[++i]));
+        }
+        else if (arg == "--health-interval" && hasValue) {
+            settings.healthInterval = std::max (std::atoi (argv[++i]), 0);
+        }
+        else if (arg == "--workers" && hasValue) {
+            settings.workers = std::max (std::atoi (argv[++i]), 0);
+        }
+        else if (arg == "--max-upstream" && hasValue) {
+            settings.maxUpstream = std::max (std::atoi (argv[++i]), 0);
+        }
+        else if (arg == "--stats-port" && hasValue) {
+            settings.statsPort = static_cast<short> (std::atoi (argv[++i]));
+        }
+        else if (arg == "--timeout" && hasValue) {
+            settings.timeout = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--no-splice") {
+            settings.splice = false;
+        }
+        else if (arg == "--cache-size" && hasValue) {
+            settings.cacheSize = static_cast<std::size_t> (std::max (std::atoi (argv[++i]), 0)) * 1024 * 1024;
+        }
+        else if (arg == "--cache-ttl" && hasValue) {
+            settings.cacheTtl = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--cache-commands" && hasValue) {
+            settings.cacheCommands = argv[++i];
+        }
+        else if (arg == "--capture" && hasValue) {
+            settings.capturePath = argv[++i];
+        }
+        else if (arg == "--capture-rotate" && hasValue) {
+            settings.captureRotate = static_cast<std::size_t> (std::max (std::atoi (argv[++i]), 1)) << 20;
+        }
+        else if (arg == "--verbose") {
+            settings.verbose = true;
+        }
+        else {
+            printUsage();
+            return false;
+        }
+    }
+
+    primary.primary = true;
+    settings.upstreams.push_back (primary);
+    settings.upstreams.insert (settings.upstreams.end(), replicas.begin(), replicas.end());
+
+    if (settings.workers == 0) {
+        settings.workers = std::max (static_cast<int> (std::thread::hardware_concurrency()), 1);
+    }
+
     return true;
 }
 
-#ifndef IRBIS_WINDOWS
-
 static void handleSignal (int sig)
 {
-    if (sig == SIGINT) {
+    if (sig == SIGINT || sig == SIGTERM) {
         stop = true;
-        std::cout << "SIGINT received" << std::endl;
     }
 }
 
-#endif
-
-/// \brief Считывание конфигурации и инициализация.
+/// \brief Инициализация обработчиков сигналов.
 /// \return true, если все хорошо.
 static bool initialize()
 {
-    std::cout << "Initializing..." << std::endl;
+    struct sigaction action {};
+    action.sa_handler = handleSignal;
+    ::sigaction (SIGINT, &action, nullptr);
+    ::sigaction (SIGTERM, &action, nullptr);
+    ::signal (SIGPIPE, SIG_IGN);
 
-#ifdef IRBIS_WINDOWS
+    return true;
+}
 
-    WSADATA wsaData;
-    if (WSAStartup (0x0202, &wsaData)) {
-        return false;
+static int createListener (short port)
+{
+    const auto result = ::socket (AF_INET, SOCK_STREAM, 0);
+    if (result == -1) {
+        std::cerr << "socket() failed" << std::endl;
+        return -1;
     }
 
-#else
+    const int reuse = 1;
+    ::setsockopt (result, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
 
-    ::signal (SIGCHLD, SIG_IGN);
-    ::signal (SIGINT, handleSignal);
+    struct sockaddr_in localAddress {};
+    localAddress.sin_family = AF_INET;
+    localAddress.sin_addr.s_addr = htonl (INADDR_ANY);
+    localAddress.sin_port = htons (port);
+    if (::bind (result, reinterpret_cast<struct sockaddr*> (&localAddress), sizeof (localAddress)) == -1) {
+        std::cerr << "bind() to port " << port << " failed" << std::endl;
+        ::closesocket (result);
+        return -1;
+    }
 
-#endif
+    if (::listen (result, SOMAXCONN) == -1) {
+        std::cerr << "listen() failed" << std::endl;
+        ::closesocket (result);
+        return -1;
+    }
 
-    std::cout << "Initialization done" << std::endl;
-    return true;
+    return result;
 }
 
-static int getMin(int x, int y)
+/// \brief Ожидание подключения с периодической проверкой флага остановки.
+static int acceptClient (int listener)
 {
-    return x > y ? y : x;
+    while (!stop) {
+        struct pollfd one {};
+        one.fd = listener;
+        one.events = POLLIN;
+        if (::poll (&one, 1, 500) <= 0) {
+            continue;
+        }
+        const auto result = ::accept (listener, nullptr, nullptr);
+        if (result >= 0) {
+            return result;
+        }
+    }
+    return -1;
 }
 
-static bool receiveExact (int socket, irbis::ChunkedBuffer &buffer, int howMany)
+/// \brief Вычитывание запроса клиента статистики (заголовков HTTP либо ничего).
+///
+/// Если закрыть сокет, не прочитав присланного, клиент получит RST
+/// и может потерять ответ.
+static void readStatsRequest (int client)
 {
-    char temp [1024];
-    try {
-        int toRead = getMin ((int) sizeof (temp), howMany);
-        while (toRead > 0) {
-            int received = ::recv (socket, temp, toRead, 0);
-            if (received <= 0) {
-                // error occurred
-                return false;
-            }
-            buffer.write ((irbis::Byte*) temp, 0, received);
-            howMany -= received;
-            toRead = getMin ((int) sizeof (temp), howMany);
+    std::string request;
+    char buffer[1024];
+    const auto deadline = proxy::Clock::now() + std::chrono::milliseconds (statsRequestMs);
+    while (request.find ("\r\n\r\n") == std::string::npos && request.size() < 16384) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+                (deadline - proxy::Clock::now()).count();
+        struct pollfd one {};
+        one.fd = client;
+        one.events = POLLIN;
+        if (left <= 0 || ::poll (&one, 1, static_cast<int> (left)) <= 0) {
+            break;
         }
+        const auto got = ::recv (client, buffer, sizeof (buffer), 0);
+        if (got <= 0) {
+            break;
+        }
+        request.append (buffer, static_cast<std::size_t> (got));
     }
-    catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return false;
-    }
-    return true;
 }
 
-static bool receiveAll (int socket, irbis::ChunkedBuffer &buffer)
+/// \brief Выдача статистики: текст отсылается каждому подключившемуся.
+static void statsLoop (const proxy::Statistics &statistics, const proxy::UpstreamLimiter &limiter,
+                       const proxy::ResponseCache &cache, const proxy::Router &router,
+                       const proxy::CaptureWriter *capture)
 {
-    char temp [1024];
-    try {
-        while (true) {
-            int received = ::recv (socket, temp, sizeof (temp), 0);
-            if (received < 0) {
-                // error occurred
-                return false;
-            }
-            if (received == 0) {
-                // end of data
-                break;
-            }
-            buffer.write ((irbis::Byte*) temp, 0, received);
+    while (!stop) {
+        const auto client = acceptClient (statsSocket);
+        if (client < 0) {
+            break;
         }
+        readStatsRequest (client);
+        const auto text = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n"
+                + statistics.toText (limiter.inUse(), limiter.queued()) + cache.toText() + router.toText()
+                + (capture != nullptr ? capture->toText() : std::string());
+        ::send (client, text.data(), text.size(), MSG_NOSIGNAL);
+        ::shutdown (client, SHUT_WR);
+        ::closesocket (client);
     }
-    catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return false;
-    }
-    return true;
 }
 
-static bool sendAll(int socket, irbis::ChunkedBuffer &buffer)
+/// \brief Периодическая проверка серверов и разрешение их имён.
+static void healthLoop (proxy::Router &router)
 {
-    char temp [1024];
-    try {
-        while (true) {
-            int chunk = buffer.read ((irbis::Byte*) temp, 0, sizeof(temp));
-            if (chunk == 0) {
-                break;
+    const std::chrono::seconds interval (settings.healthInterval);
+    auto next = proxy::Clock::now() + (interval.count() != 0 ? std::chrono::seconds (0) : resolveInterval);
+    while (!stop) {
+        if (proxy::Clock::now() >= next) {
+            if (interval.count() != 0) {
+                router.checkHealth (interval);
+                next = proxy::Clock::now() + interval;
             }
-            int sended = ::send (socket, temp, chunk, 0);
-            if (sended < 0) {
-                // error occurred
-                return false;
+            else {
+                router.resolve();
+                next = proxy::Clock::now() + resolveInterval;
             }
         }
+        std::this_thread::sleep_for (std::chrono::milliseconds (200));
     }
-    catch (const std::exception &e) {
-        std::cerr << e.what() << std::endl;
-        return false;
-    }
-    return true;
 }
 
-static bool createListener()
+/// \brief Главный серверный цикл: подключения раздаются рабочим потокам по кругу.
+static void serverLoop()
 {
-    std::cout << "Creating listener socket" << std::endl;
-
-    listenerSocket = ::socket (AF_INET, SOCK_STREAM, 0);
-    if (listenerSocket == -1) {
-        std::cerr << "socket() failed" << std::endl;
-        return false;
+    proxy::Statistics statistics;
+    proxy::UpstreamLimiter limiter (static_cast<std::size_t> (settings.maxUpstream));
+    proxy::ResponseCache cache (settings.cacheSize, std::chrono::seconds (settings.cacheTtl),
+                                settings.cacheCommands);
+    proxy::Router router (settings.upstreams);
+    std::unique_ptr<proxy::CaptureWriter> capture;
+    if (!settings.capturePath.empty()) {
+        capture.reset (new proxy::CaptureWriter (settings.capturePath, settings.captureRotate));
     }
-
-    struct sockaddr_in localAddress { 0 };
-    localAddress.sin_family = AF_INET;
-    localAddress.sin_addr.s_addr = htonl (INADDR_ANY);
-    localAddress.sin_port = htons (localPort);
-
-    auto returnCode = ::bind (listenerSocket,
-        (struct sockaddr*) &localAddress,
-        sizeof (localAddress));
-    if (returnCode == -1) {
-        std::cerr << "bind() failed" << std::endl;
-        ::closesocket (listenerSocket);
-        return false;
+    std::vector<std::unique_ptr<proxy::Worker>> workers;
+    for (int i = 0; i < settings.workers; ++i) {
+        workers.emplace_back (new proxy::Worker (settings, statistics, limiter, cache, router, capture.get()));
+        workers.back()->start();
     }
 
-    returnCode = ::listen (listenerSocket, 0);
-    if (returnCode == -1) {
-        std::cerr << "listen() failed" << std::endl;
-        ::closesocket (listenerSocket);
-        return false;
+    std::thread stats;
+    if (statsSocket >= 0) {
+        stats = std::thread (statsLoop, std::cref (statistics), std::cref (limiter), std::cref (cache),
+                             std::cref (router), capture.get());
     }
+    std::thread health (healthLoop, std::ref (router));
 
-    std::cout << "Listener socket created" << std::endl;
-    return true;
-}
-
-template <class It>
-int32_t parseInt32 (const It begin, const It end)
-{
-    int32_t result = 0;
-    for (It it = begin; it != end; ++it) {
-        auto c = (uint8_t) *it;
-        result = (result * 10) + (c - '0');
-    }
-    return result;
-}
-
-/// \brief Обработка клиента.
-static void handleClient (int downSocket)
-{
-    std::cout << "Client arrived" << std::endl;
-
-    auto upSocket = ::socket (AF_INET, SOCK_STREAM, 0);
-    if (upSocket == -1) {
-        std::cerr << "socket() failed" << std::endl;
-        ::closesocket (downSocket);
-        return;
+    std::size_t next = 0;
+    while (!stop) {
+        const auto clientSocket = acceptClient (listenerSocket);
+        if (clientSocket < 0) {
+            continue;
+        }
+        workers[next++ % workers.size()]->adopt (clientSocket);
     }
 
-    struct sockaddr_in serverAddress { 0 };
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons (remotePort);
-    serverAddress.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
-
-    auto returnCode = ::connect (upSocket,
-                                 (struct sockaddr *)& serverAddress,
-                                 sizeof(serverAddress));
-    if (returnCode == -1) {
-        std::cerr << "connect() failed" << std::endl;
-        ::closesocket (downSocket);
-        ::closesocket (upSocket);
-        return;
+    for (auto &worker : workers) {
+        worker->stop();
     }
-
-    {
-        // Фаза 0
-        irbis::ChunkedBuffer requestBuffer;
-        if (!receiveExact (downSocket, requestBuffer, 10)) {
-            std::cerr << "receiveExact() failed" << std::endl;
-            return;
-        }
-        int32_t received = requestBuffer.size();
-        auto begin = std::begin (requestBuffer);
-        auto end = std::end (requestBuffer);
-        auto found = std::find (begin, end, 0x0A);
-        if (found == end) {
-            std::cerr << "receiveExact() failed" << std::endl;
-            return;
-        }
-        int32_t requestSize = parseInt32 (begin, found);
-        int32_t remaining = requestSize - received + (int)(found - begin) + 1;
-
-        // Фаза 1
-        if (!receiveExact (downSocket, requestBuffer, remaining)) {
-            std::cout << "receiveExact() failed" << std::endl;
-            return;
-        }
-
-        std::cout << "Client request: " << requestBuffer.size() << std::endl;
-        if (!sendAll (upSocket, requestBuffer)) {
-            std::cerr << "sendAll() failed" << std::endl;
-            return;
-        }
-        ::shutdown (upSocket, 1);
+    if (stats.joinable()) {
+        stats.join();
     }
-    {
-        // Фаза 2
-        irbis::ChunkedBuffer responseBuffer;
-        if (!receiveAll (upSocket, responseBuffer)) {
-            std::cerr << "receiveAll() failed" << std::endl;
-            return;
-        }
-        std::cout << "Server response: " << responseBuffer.size() << std::endl;
-        if (!sendAll (downSocket, responseBuffer)) {
-            std::cerr << "sendAll() failed" << std::endl;
-            return;
-        }
+    if (health.joinable()) {
+        health.join();
     }
-
-    ::closesocket (downSocket);
-    std::cout << "Client handled" << std::endl;
-}
-
-/// \brief Главный серверный цикл.
-/// \return
-static bool serverLoop()
-{
-    while (!stop) {
-        auto clientSocket = ::accept (listenerSocket, nullptr, nullptr);
-        if (clientSocket == -1) {
-            std::cerr << "accept() failed" << std::endl;
-            ::closesocket (listenerSocket);
-            return false;
-        }
-
-        std::thread handler (handleClient, clientSocket);
-        handler.detach();
+    std::cout << statistics.toText (limiter.inUse(), limiter.queued()) << cache.toText() << router.toText();
+    if (capture) {
+        capture->close();
+        std::cout << capture->toText();
     }
-
-    return true;
+    std::cout << std::flush;
+    ::closesocket (listenerSocket);
 }
 
 int main (int argc, char *argv[])
 {
     std::cout << "IRBIS-PROXY application version " << proxyVersion << std::endl;
 
-    if (!parseCommandLine(argc, argv)) {
-        std::cerr << "parseCommandLine() failed" << std::endl;
+    if (!parseCommandLine (argc, argv)) {
         return 1;
     }
 
@@ -314,17 +352,24 @@ int main (int argc, char *argv[])
         return 2;
     }
 
-    if (!createListener()) {
-        std::cerr << "createListener() failed" << std::endl;
+    listenerSocket = createListener (settings.listenPort);
+    if (listenerSocket < 0) {
         return 3;
     }
-
-    if (!serverLoop()) {
-        std::cerr << "serverLoop() failed" << std::endl;
-        return 4;
+    if (settings.statsPort != 0) {
+        statsSocket = createListener (settings.statsPort);
+        if (statsSocket < 0) {
+            return 3;
+        }
     }
 
-    std::cout << "Exiting" << std::endl;
+    std::cout << "Listening on port " << settings.listenPort << ", upstreams " << settings.upstreams.size()
+              << ", workers " << settings.workers
+              << ", max upstream " << settings.maxUpstream << std::endl;
+    serverLoop();
+    if (statsSocket >= 0) {
+        ::closesocket (statsSocket);
+    }
 
     return 0;
 }
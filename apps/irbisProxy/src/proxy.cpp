@@ -0,0 +1,1004 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "proxy.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#define PROXY_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+/// \file proxy.cpp
+/// \brief Цикл событий прокси.
+///
+/// Каждый рабочий поток обслуживает свои сеансы в собственном
+/// цикле событий (epoll в Linux, poll в прочих системах).
+/// Сеанс -- одно клиентское подключение, то есть ровно одна команда:
+/// чтение пакета запроса, ожидание разрешения ограничителя,
+/// подключение к серверу, передача запроса, пересылка ответа.
+/// В Linux ответ пересылается через канал вызовами splice,
+/// не попадая в память процесса; исключение -- ответы, собираемые
+/// для кэша (см. cache.cpp) и журнала трафика (см. capture.cpp).
+/// Ответ из кэша отдаётся без обращения к серверу.
+
+namespace proxy {
+
+namespace {
+
+const std::size_t RelayBuffer  = 64 * 1024;
+const std::size_t MaxCaptured  = 1 << 20; // ответ в журнале трафика
+const uint64_t    WakeKey      = 0;
+
+enum class State
+{
+    ReadRequest, ///< Получение пакета запроса от клиента.
+    Queued,      ///< Ожидание разрешения на подключение к серверу.
+    Connecting,  ///< Подключение к серверу.
+    SendRequest, ///< Передача запроса серверу.
+    Discard,     ///< Чтение ответа на предварительный запрос.
+    Relay        ///< Пересылка ответа клиенту.
+};
+
+/// \brief Не удалось подключиться к серверу.
+class ConnectError
+    : public std::runtime_error
+{
+public:
+    ConnectError() : std::runtime_error ("connect failed") {}
+};
+
+void setNonBlocking (int socket)
+{
+    const auto flags = ::fcntl (socket, F_GETFL, 0);
+    if (flags < 0 || ::fcntl (socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error ("fcntl failed");
+    }
+}
+
+bool wouldBlock() noexcept
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void closeSocket (int &socket) noexcept
+{
+    if (socket >= 0) {
+        ::close (socket);
+        socket = -1;
+    }
+}
+
+uint64_t microsBetween (Clock::time_point from, Clock::time_point to) noexcept
+{
+    const auto result = std::chrono::duration_cast<std::chrono::microseconds> (to - from).count();
+    return result > 0 ? static_cast<uint64_t> (result) : 0;
+}
+
+}
+
+//=========================================================
+
+/// \brief Сеанс: одно клиентское подключение.
+struct Session
+{
+    uint64_t    id       { 0 };
+    int         client   { -1 };
+    int         upstream { -1 };
+    State       state    { State::ReadRequest };
+    bool        haveSlot { false };
+    std::string command;
+    RequestInfo info;
+
+    bool         capture { false };         ///< Ответ собирается для кэша.
+    bool         record  { false };         ///< Ответ собирается для журнала трафика.
+    bool         truncated { false };       ///< Ответ не уместился в журнал.
+    bool         cached  { false };         ///< Ответ взят из кэша.
+    std::string  cacheKey;
+    uint64_t     cacheGeneration { 0 };
+    irbis::Bytes response;
+
+    Route        route;
+    bool         routed   { false };
+    std::size_t  preamble { 0 };   ///< Номер выполняемого предварительного запроса.
+    int          attempts { 0 };
+
+    irbis::Bytes request;
+    std::size_t  requestSize { 0 };
+    std::size_t  sent        { 0 };
+
+    irbis::Bytes buffer;
+    std::size_t  pendingOffset { 0 };
+    std::size_t  pendingSize   { 0 };
+    int          pipe[2]       { -1, -1 };
+    std::size_t  piped         { 0 };
+    uint64_t     bytesOut      { 0 };
+
+    Clock::time_point accepted, received, granted, upstreamStarted, deadline;
+    std::chrono::system_clock::time_point receivedWall;
+    unsigned clientInterest   { ~0u };
+    unsigned upstreamInterest { ~0u };
+};
+
+//=========================================================
+
+/// \brief Учёт обработанного запроса.
+void Statistics::record (const std::string &command, bool failed, bool cached, uint64_t bytesIn,
+                         uint64_t bytesOut, uint64_t latencyMicros, uint64_t queuedMicros)
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    auto &stats = this->_commands[command];
+    ++stats.requests;
+    if (failed) {
+        ++stats.errors;
+    }
+    if (cached) {
+        ++stats.cached;
+    }
+    stats.bytesIn += bytesIn;
+    stats.bytesOut += bytesOut;
+    stats.latency.add (latencyMicros);
+    stats.queued.add (queuedMicros);
+}
+
+/// \brief Снимок статистики по командам.
+std::map<std::string, CommandStats> Statistics::snapshot() const
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    return this->_commands;
+}
+
+/// \brief Текстовое представление статистики.
+/// \param upstreamInUse Занято подключений к серверу.
+/// \param upstreamQueued Сеансов в очереди за подключением.
+std::string Statistics::toText (std::size_t upstreamInUse, std::size_t upstreamQueued) const
+{
+    std::ostringstream result;
+    result << "accepted " << this->accepted << ", active " << this->active
+           << ", timeouts " << this->timeouts << ", spliced " << this->spliced
+           << ", upstream in use " << upstreamInUse << ", queued " << upstreamQueued << '\n';
+    result << std::left << std::setw (8) << "command" << std::right
+           << std::setw (10) << "requests" << std::setw (8) << "errors" << std::setw (10) << "cached"
+           << std::setw (12) << "mean, us" << std::setw (10) << "p50"
+           << std::setw (10) << "p95" << std::setw (10) << "p99"
+           << std::setw (10) << "max" << std::setw (12) << "queue p95"
+           << std::setw (14) << "bytes in" << std::setw (14) << "bytes out" << '\n';
+    for (const auto &pair : this->snapshot()) {
+        const auto &stats = pair.second;
+        result << std::left << std::setw (8) << pair.first << std::right
+               << std::setw (10) << stats.requests << std::setw (8) << stats.errors
+               << std::setw (10) << stats.cached
+               << std::setw (12) << std::fixed << std::setprecision (1) << stats.latency.mean()
+               << std::setw (10) << stats.latency.percentile (0.5)
+               << std::setw (10) << stats.latency.percentile (0.95)
+               << std::setw (10) << stats.latency.percentile (0.99)
+               << std::setw (10) << stats.latency.maximum
+               << std::setw (12) << stats.queued.percentile (0.95)
+               << std::setw (14) << stats.bytesIn << std::setw (14) << stats.bytesOut << '\n';
+    }
+    return result.str();
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param limit Предельное число подключений (0 -- без ограничения).
+UpstreamLimiter::UpstreamLimiter (std::size_t limit)
+    : _limit { limit }
+{
+}
+
+/// \brief Запрос разрешения на подключение к серверу.
+/// \param worker Рабочий поток сеанса.
+/// \param session Идентификатор сеанса.
+/// \return true, если разрешение выдано сразу; иначе сеанс
+/// поставлен в очередь и получит его через Worker::grant.
+bool UpstreamLimiter::acquire (Worker *worker, uint64_t session)
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    if (this->_limit == 0 || this->_inUse < this->_limit) {
+        ++this->_inUse;
+        return true;
+    }
+    this->_waiting.emplace_back (worker, session);
+    return false;
+}
+
+/// \brief Освобождение подключения: оно передаётся первому ожидающему.
+void UpstreamLimiter::release()
+{
+    std::pair<Worker*, uint64_t> next { nullptr, 0 };
+    {
+        std::lock_guard<std::mutex> guard (this->_mutex);
+        if (this->_waiting.empty()) {
+            --this->_inUse;
+            return;
+        }
+        next = this->_waiting.front();
+        this->_waiting.pop_front();
+    }
+    next.first->grant (next.second);
+}
+
+/// \brief Число занятых подключений.
+std::size_t UpstreamLimiter::inUse() const
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    return this->_inUse;
+}
+
+/// \brief Число сеансов в очереди.
+std::size_t UpstreamLimiter::queued() const
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    return this->_waiting.size();
+}
+
+//=========================================================
+
+#ifdef PROXY_EPOLL
+
+struct Poller::Impl
+{
+    int epoll { -1 };
+    std::unordered_map<int, unsigned> registered;
+    std::vector<epoll_event> buffer = std::vector<epoll_event> (256);
+};
+
+Poller::Poller()
+    : _impl { new Impl }
+{
+    this->_impl->epoll = ::epoll_create1 (EPOLL_CLOEXEC);
+    if (this->_impl->epoll < 0) {
+        throw std::runtime_error ("epoll_create1 failed");
+    }
+}
+
+Poller::~Poller()
+{
+    ::close (this->_impl->epoll);
+}
+
+/// \brief Регистрация сокета либо изменение ожидаемых событий.
+void Poller::set (int socket, uint64_t key, unsigned flags)
+{
+    auto &impl = *this->_impl;
+    epoll_event event {};
+    event.data.u64 = key;
+    event.events = ((flags & Readable) ? EPOLLIN : 0u) | ((flags & Writable) ? EPOLLOUT : 0u);
+    const auto found = impl.registered.find (socket);
+    if (found == impl.registered.end()) {
+        if (::epoll_ctl (impl.epoll, EPOLL_CTL_ADD, socket, &event) < 0) {
+            throw std::runtime_error ("epoll_ctl failed");
+        }
+        impl.registered[socket] = flags;
+    }
+    else if (found->second != flags) {
+        if (::epoll_ctl (impl.epoll, EPOLL_CTL_MOD, socket, &event) < 0) {
+            throw std::runtime_error ("epoll_ctl failed");
+        }
+        found->second = flags;
+    }
+}
+
+/// \brief Снятие сокета с учёта (до его закрытия).
+void Poller::remove (int socket)
+{
+    auto &impl = *this->_impl;
+    if (impl.registered.erase (socket) != 0) {
+        ::epoll_ctl (impl.epoll, EPOLL_CTL_DEL, socket, nullptr);
+    }
+}
+
+/// \brief Ожидание событий.
+void Poller::wait (std::vector<Event> &events, int timeoutMs)
+{
+    auto &impl = *this->_impl;
+    events.clear();
+    const auto count = ::epoll_wait (impl.epoll, impl.buffer.data(), static_cast<int> (impl.buffer.size()), timeoutMs);
+    for (int i = 0; i < count; ++i) {
+        const auto &one = impl.buffer[static_cast<std::size_t> (i)];
+        unsigned flags = 0;
+        if (one.events & EPOLLIN) {
+            flags |= Readable;
+        }
+        if (one.events & EPOLLOUT) {
+            flags |= Writable;
+        }
+        events.push_back ({ one.data.u64, flags, (one.events & (EPOLLERR | EPOLLHUP)) != 0 });
+    }
+}
+
+#else
+
+struct Poller::Impl
+{
+    std::map<int, std::pair<uint64_t, unsigned>> registered;
+    std::vector<pollfd> fds;
+};
+
+Poller::Poller()
+    : _impl { new Impl }
+{
+}
+
+Poller::~Poller() = default;
+
+void Poller::set (int socket, uint64_t key, unsigned flags)
+{
+    this->_impl->registered[socket] = std::make_pair (key, flags);
+}
+
+void Poller::remove (int socket)
+{
+    this->_impl->registered.erase (socket);
+}
+
+void Poller::wait (std::vector<Event> &events, int timeoutMs)
+{
+    auto &impl = *this->_impl;
+    events.clear();
+    impl.fds.clear();
+    for (const auto &pair : impl.registered) {
+        pollfd one {};
+        one.fd = pair.first;
+        one.events = static_cast<short> (((pair.second.second & Readable) ? POLLIN : 0)
+                | ((pair.second.second & Writable) ? POLLOUT : 0));
+        impl.fds.push_back (one);
+    }
+    if (::poll (impl.fds.data(), static_cast<nfds_t> (impl.fds.size()), timeoutMs) <= 0) {
+        return;
+    }
+    for (const auto &one : impl.fds) {
+        if (one.revents == 0) {
+            continue;
+        }
+        unsigned flags = 0;
+        if (one.revents & POLLIN) {
+            flags |= Readable;
+        }
+        if (one.revents & POLLOUT) {
+            flags |= Writable;
+        }
+        const auto key = impl.registered[one.fd].first;
+        events.push_back ({ key, flags, (one.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0 });
+    }
+}
+
+#endif
+
+//=========================================================
+
+/// \brief Конструктор.
+Worker::Worker (const Settings &settings, Statistics &statistics, UpstreamLimiter &limiter,
+                ResponseCache &cache, Router &router, CaptureWriter *capture)
+    : _settings { settings }, _statistics { statistics }, _limiter { limiter }, _cache { cache },
+      _router { router }, _capture { capture }
+{
+    int fds[2];
+    if (::pipe (fds) < 0) {
+        throw std::runtime_error ("pipe failed");
+    }
+    this->_wakeRead = fds[0];
+    this->_wakeWrite = fds[1];
+    setNonBlocking (this->_wakeRead);
+    setNonBlocking (this->_wakeWrite);
+    this->_poller.set (this->_wakeRead, WakeKey, Poller::Readable);
+}
+
+/// \brief Деструктор.
+Worker::~Worker()
+{
+    this->stop();
+    this->_poller.remove (this->_wakeRead);
+    closeSocket (this->_wakeRead);
+    closeSocket (this->_wakeWrite);
+}
+
+/// \brief Передача нового клиентского подключения (из потока-приёмника).
+void Worker::adopt (int client)
+{
+    {
+        std::lock_guard<std::mutex> guard (this->_inboxMutex);
+        this->_newClients.push_back (client);
+    }
+    this->_wake();
+}
+
+/// \brief Выдача сеансу разрешения на подключение к серверу (из любого потока).
+void Worker::grant (uint64_t session)
+{
+    {
+        std::lock_guard<std::mutex> guard (this->_inboxMutex);
+        this->_granted.push_back (session);
+    }
+    this->_wake();
+}
+
+/// \brief Запуск потока.
+void Worker::start()
+{
+    this->_thread = std::thread ([this] { this->_run(); });
+}
+
+/// \brief Остановка потока; незавершённые сеансы прерываются.
+void Worker::stop()
+{
+    this->_stopping = true;
+    this->_wake();
+    if (this->_thread.joinable()) {
+        this->_thread.join();
+    }
+}
+
+void Worker::_wake()
+{
+    const char byte = 1;
+    // Если канал переполнен, поток и так будет разбужен.
+    const auto written = ::write (this->_wakeWrite, &byte, 1);
+    (void) written;
+}
+
+void Worker::_run()
+{
+    std::vector<Poller::Event> events;
+    auto lastCheck = Clock::now();
+    while (!this->_stopping) {
+        this->_poller.wait (events, 500);
+        for (const auto &event : events) {
+            if (event.key == WakeKey) {
+                char buffer[256];
+                while (::read (this->_wakeRead, buffer, sizeof (buffer)) > 0) {
+                }
+                this->_drainInbox();
+                continue;
+            }
+
+            const auto found = this->_sessions.find (event.key / 2);
+            if (found == this->_sessions.end()) {
+                continue;
+            }
+            auto &session = *found->second;
+            const auto fromClient = event.key % 2 == 0;
+            if (event.failed && fromClient && session.state != State::Relay) {
+                // Клиент ушёл, не дождавшись ответа.
+                this->_finish (session, true);
+                continue;
+            }
+            this->_progress (session);
+        }
+
+        const auto now = Clock::now();
+        if (now - lastCheck >= std::chrono::seconds (1)) {
+            this->_checkTimeouts();
+            lastCheck = now;
+        }
+    }
+
+    while (!this->_sessions.empty()) {
+        this->_finish (*this->_sessions.begin()->second, true);
+    }
+    std::lock_guard<std::mutex> guard (this->_inboxMutex);
+    for (auto client : this->_newClients) {
+        ::close (client);
+    }
+    this->_newClients.clear();
+}
+
+void Worker::_drainInbox()
+{
+    std::vector<int> clients;
+    std::vector<uint64_t> granted;
+    {
+        std::lock_guard<std::mutex> guard (this->_inboxMutex);
+        clients.swap (this->_newClients);
+        granted.swap (this->_granted);
+    }
+
+    const auto now = Clock::now();
+    for (const auto client : clients) {
+        std::unique_ptr<Session> session { new Session };
+        session->id = this->_nextId++;
+        session->client = client;
+        session->accepted = now;
+        session->deadline = now + std::chrono::seconds (this->_settings.timeout);
+        auto &ref = *session;
+        this->_sessions[ref.id] = std::move (session);
+        ++this->_statistics.accepted;
+        ++this->_statistics.active;
+        try {
+            setNonBlocking (client);
+            this->_updateInterest (ref);
+        }
+        catch (const std::exception &) {
+            this->_finish (ref, true);
+        }
+    }
+
+    for (const auto id : granted) {
+        const auto found = this->_sessions.find (id);
+        if (found == this->_sessions.end()) {
+            // Сеанс уже завершён: разрешение передаётся дальше.
+            this->_limiter.release();
+            continue;
+        }
+        auto &session = *found->second;
+        session.haveSlot = true;
+        this->_progress (session);
+    }
+}
+
+void Worker::_progress (Session &session)
+{
+    try {
+        if (session.state == State::ReadRequest) {
+            if (!this->_readRequest (session)) {
+                return;
+            }
+            session.info = parseRequest (session.request, session.requestSize);
+            session.command = session.info.command;
+            session.received = Clock::now();
+            session.receivedWall = std::chrono::system_clock::now();
+            session.record = this->_capture != nullptr;
+            if (session.info.write) {
+                this->_cache.invalidate (session.info.database);
+            }
+            if (!this->_serveFromCache (session)) {
+                session.state = State::Queued;
+                session.haveSlot = this->_limiter.acquire (this, session.id);
+            }
+        }
+
+        if (session.state == State::Queued) {
+            if (!session.haveSlot) {
+                this->_updateInterest (session);
+                return;
+            }
+            this->_connectUpstream (session);
+        }
+
+        if (session.state == State::Connecting) {
+            int error = 0;
+            socklen_t length = sizeof (error);
+            if (::getsockopt (session.upstream, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+                throw ConnectError();
+            }
+            sockaddr_storage peer {};
+            socklen_t peerLength = sizeof (peer);
+            if (::getpeername (session.upstream, reinterpret_cast<sockaddr*> (&peer), &peerLength) < 0) {
+                if (errno != ENOTCONN) {
+                    throw ConnectError();
+                }
+                this->_updateInterest (session);
+                return;
+            }
+            session.state = State::SendRequest;
+        }
+
+        if (session.state == State::SendRequest) {
+            const auto inPreamble = session.preamble < session.route.preambles.size();
+            const auto &packet = inPreamble ? session.route.preambles[session.preamble].second : session.request;
+            const auto size = inPreamble ? packet.size() : session.requestSize;
+            while (session.sent < size) {
+                const auto sent = ::send (session.upstream, packet.data() + session.sent,
+                                          size - session.sent, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (wouldBlock()) {
+                        this->_updateInterest (session);
+                        return;
+                    }
+                    throw std::runtime_error ("send failed");
+                }
+                session.sent += static_cast<std::size_t> (sent);
+            }
+            ::shutdown (session.upstream, SHUT_WR);
+            session.state = inPreamble ? State::Discard : State::Relay;
+        }
+
+        if (session.state == State::Discard) {
+            irbis::Byte buffer[4096];
+            while (true) {
+                const auto received = ::recv (session.upstream, buffer, sizeof (buffer), 0);
+                if (received < 0) {
+                    if (wouldBlock()) {
+                        this->_updateInterest (session);
+                        return;
+                    }
+                    throw std::runtime_error ("recv from server failed");
+                }
+                if (received == 0) {
+                    break;
+                }
+            }
+            this->_closeUpstream (session);
+            ++session.preamble;
+            this->_connectUpstream (session);
+            this->_updateInterest (session);
+            return;
+        }
+
+        if (session.state == State::Relay) {
+            const auto done = session.pipe[0] >= 0 ? this->_relaySplice (session) : this->_relay (session);
+            if (done) {
+                this->_finish (session, false);
+                return;
+            }
+        }
+
+        this->_updateInterest (session);
+    }
+    catch (const ConnectError &) {
+        if (!this->_retryUpstream (session)) {
+            this->_finish (session, true);
+        }
+    }
+    catch (const std::exception &exception) {
+        if (this->_settings.verbose) {
+            std::cerr << "Session " << session.id << " (" << session.command << "): "
+                      << exception.what() << std::endl;
+        }
+        this->_finish (session, true);
+    }
+}
+
+// Вычитывание запроса; true, когда пакет получен полностью.
+bool Worker::_readRequest (Session &session)
+{
+    irbis::Byte buffer[4096];
+    while (true) {
+        const auto received = ::recv (session.client, buffer, sizeof (buffer), 0);
+        if (received < 0) {
+            if (wouldBlock()) {
+                return false;
+            }
+            throw std::runtime_error ("recv failed");
+        }
+        if (received == 0) {
+            throw std::runtime_error ("client closed the connection");
+        }
+        session.request.insert (session.request.end(), buffer, buffer + received);
+        const auto total = completePacket (session.request.data(), session.request.size());
+        if (total != 0) {
+            session.requestSize = total;
+            return true;
+        }
+    }
+}
+
+// Ответ из кэша; при промахе сеанс начинает собирать ответ сервера.
+bool Worker::_serveFromCache (Session &session)
+{
+    if (!this->_cache.cacheable (session.info)) {
+        return false;
+    }
+
+    const auto params = session.request.begin() + static_cast<std::ptrdiff_t> (session.info.paramsOffset);
+    session.cacheKey = session.info.command + '\n'
+        + std::string (params, session.request.begin() + static_cast<std::ptrdiff_t> (session.requestSize));
+    irbis::Bytes answer;
+    if (!this->_cache.lookup (session.cacheKey, answer)) {
+        session.capture = true;
+        session.cacheGeneration = this->_cache.generation (session.info.database);
+        return false;
+    }
+
+    session.buffer = rewriteAnswer (answer, session.info.clientId, session.info.queryId);
+    session.pendingOffset = 0;
+    session.pendingSize = session.buffer.size();
+    session.cached = true;
+    session.state = State::Relay;
+    return true;
+}
+
+void Worker::_connectUpstream (Session &session)
+{
+    if (!session.routed) {
+        session.granted = Clock::now();
+        session.route = this->_router.route (session.info, session.request, session.requestSize);
+        session.routed = true;
+    }
+
+    const auto inPreamble = session.preamble < session.route.preambles.size();
+    if (!inPreamble) {
+        session.upstreamStarted = Clock::now();
+    }
+    session.sent = 0;
+
+    // Адрес разрешён заранее (Router::resolve()): цикл событий не ждёт DNS.
+    const auto address = this->_router.address
+        (inPreamble ? session.route.preambles[session.preamble].first : session.route.upstream);
+    if (address.address.empty()) {
+        throw ConnectError();
+    }
+    session.upstream = ::socket (address.family, SOCK_STREAM, 0);
+    if (session.upstream < 0) {
+        throw std::runtime_error ("socket failed");
+    }
+    setNonBlocking (session.upstream);
+    const int one = 1;
+    ::setsockopt (session.upstream, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    const auto result = ::connect (session.upstream, reinterpret_cast<const sockaddr*> (address.address.data()),
+                                   static_cast<socklen_t> (address.address.size()));
+    if (result < 0 && errno != EINPROGRESS) {
+        throw ConnectError();
+    }
+    session.state = result == 0 ? State::SendRequest : State::Connecting;
+
+#ifdef PROXY_EPOLL
+    if (!inPreamble && this->_settings.splice && !session.capture && !session.record && session.pipe[0] < 0) {
+        if (::pipe2 (session.pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+            session.pipe[0] = session.pipe[1] = -1;
+        }
+    }
+#endif
+}
+
+// Повторное подключение после неудачи: чтение уходит на другой сервер,
+// недоступный при выходе клиента сервер пропускается.
+bool Worker::_retryUpstream (Session &session)
+{
+    if (session.routed && session.info.command == "B" && session.preamble < session.route.preambles.size()) {
+        // Снятие с регистрации на недоступном сервере можно пропустить.
+        this->_closeUpstream (session);
+        ++session.preamble;
+    }
+    else {
+        if (!session.routed || session.route.upstream == 0 || session.attempts != 0) {
+            return false;
+        }
+
+        ++session.attempts;
+        this->_closeUpstream (session);
+        const auto failed = session.route.upstream;
+        this->_router.connectFailed (failed);
+        session.route = this->_router.route (session.info, session.request, session.requestSize, failed);
+        session.preamble = 0;
+    }
+
+    try {
+        this->_connectUpstream (session);
+        this->_updateInterest (session);
+    }
+    catch (const std::exception &) {
+        return false;
+    }
+    return true;
+}
+
+void Worker::_closeUpstream (Session &session)
+{
+    if (session.upstream >= 0) {
+        this->_poller.remove (session.upstream);
+        closeSocket (session.upstream);
+    }
+    session.upstreamInterest = ~0u;
+}
+
+// Пересылка ответа через буфер; true, когда ответ передан полностью.
+bool Worker::_relay (Session &session)
+{
+    if (session.buffer.empty()) {
+        session.buffer.resize (RelayBuffer);
+    }
+
+    while (true) {
+        if (session.pendingSize != 0) {
+            const auto sent = ::send (session.client, session.buffer.data() + session.pendingOffset,
+                                      session.pendingSize, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (wouldBlock()) {
+                    return false;
+                }
+                throw std::runtime_error ("send to client failed");
+            }
+            session.pendingOffset += static_cast<std::size_t> (sent);
+            session.pendingSize -= static_cast<std::size_t> (sent);
+            session.bytesOut += static_cast<uint64_t> (sent);
+            continue;
+        }
+
+        if (session.upstream < 0) {
+            return true; // ответ из кэша
+        }
+        const auto received = ::recv (session.upstream, session.buffer.data(), session.buffer.size(), 0);
+        if (received < 0) {
+            if (wouldBlock()) {
+                return false;
+            }
+            throw std::runtime_error ("recv from server failed");
+        }
+        if (received == 0) {
+            return true;
+        }
+        session.pendingOffset = 0;
+        session.pendingSize = static_cast<std::size_t> (received);
+        if (session.capture && session.response.size() + session.pendingSize > this->_settings.cacheSize / 4) {
+            session.capture = false; // слишком большой ответ не кэшируется
+        }
+        if (session.capture || session.record) {
+            const auto limit = session.record ? std::max (this->_settings.cacheSize / 4, MaxCaptured)
+                                              : this->_settings.cacheSize / 4;
+            const auto room = std::min (session.pendingSize,
+                                        limit > session.response.size() ? limit - session.response.size() : 0);
+            session.truncated = session.truncated || room < session.pendingSize;
+            session.response.insert (session.response.end(), session.buffer.begin(),
+                                     session.buffer.begin() + static_cast<std::ptrdiff_t> (room));
+        }
+    }
+}
+
+// Пересылка ответа через канал без копирования; true, когда ответ передан.
+bool Worker::_relaySplice (Session &session)
+{
+#ifdef PROXY_EPOLL
+    while (true) {
+        if (session.piped != 0) {
+            const auto moved = ::splice (session.pipe[0], nullptr, session.client, nullptr,
+                                         session.piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved < 0) {
+                if (wouldBlock()) {
+                    return false;
+                }
+                throw std::runtime_error ("splice to client failed");
+            }
+            session.piped -= static_cast<std::size_t> (moved);
+            session.bytesOut += static_cast<uint64_t> (moved);
+            continue;
+        }
+
+        const auto moved = ::splice (session.upstream, nullptr, session.pipe[1], nullptr,
+                                     RelayBuffer, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved < 0) {
+            if (wouldBlock()) {
+                return false;
+            }
+            throw std::runtime_error ("splice from server failed");
+        }
+        if (moved == 0) {
+            ++this->_statistics.spliced;
+            return true;
+        }
+        session.piped = static_cast<std::size_t> (moved);
+    }
+#else
+    (void) session;
+    throw std::logic_error ("splice is not supported");
+#endif
+}
+
+void Worker::_updateInterest (Session &session)
+{
+    unsigned client = 0, upstream = 0;
+    switch (session.state) {
+        case State::ReadRequest:
+            client = Poller::Readable;
+            break;
+        case State::Queued:
+            break;
+        case State::Connecting:
+        case State::SendRequest:
+            upstream = Poller::Writable;
+            break;
+        case State::Discard:
+            upstream = Poller::Readable;
+            break;
+        case State::Relay:
+            if (session.pendingSize != 0 || session.piped != 0) {
+                client = Poller::Writable;
+            }
+            else {
+                upstream = Poller::Readable;
+            }
+            break;
+    }
+
+    if (client != session.clientInterest) {
+        this->_poller.set (session.client, session.id * 2, client);
+        session.clientInterest = client;
+    }
+    if (session.upstream >= 0 && upstream != session.upstreamInterest) {
+        this->_poller.set (session.upstream, session.id * 2 + 1, upstream);
+        session.upstreamInterest = upstream;
+    }
+}
+
+void Worker::_finish (Session &session, bool failed)
+{
+    const auto now = Clock::now();
+    if (!session.command.empty()) {
+        const auto queued = session.haveSlot ? microsBetween (session.received, session.granted) : 0;
+        this->_statistics.record (session.command, failed, session.cached, session.requestSize,
+                                  session.bytesOut, microsBetween (session.received, now), queued);
+        if (session.routed) {
+            this->_router.finished (session.route.upstream, failed, microsBetween (session.upstreamStarted, now));
+        }
+        if (this->_settings.verbose) {
+            std::cout << session.command << (failed ? " failed " : session.cached ? " cached " : " ")
+                      << (session.routed ? "upstream " + std::to_string (session.route.upstream) + ", " : "")
+                      << session.bytesOut << " bytes, "
+                      << microsBetween (session.received, now) << " us" << std::endl;
+        }
+    }
+
+    if (session.record && !session.command.empty()) {
+        CaptureRecord record;
+        record.timestamp = static_cast<uint64_t> (std::chrono::duration_cast<std::chrono::microseconds>
+                (session.receivedWall.time_since_epoch()).count());
+        record.latency = static_cast<uint32_t> (std::min<uint64_t> (microsBetween (session.received, now),
+                                                                    UINT32_MAX));
+        if (session.routed) {
+            record.upstream = static_cast<uint16_t> (session.route.upstream);
+        }
+        bool scrubbed = false;
+        record.request = scrubPassword (session.request, session.requestSize, scrubbed);
+        record.flags = static_cast<uint8_t> ((failed ? CaptureRecord::Failed : 0)
+                | (session.cached ? CaptureRecord::Cached : 0)
+                | (session.truncated ? CaptureRecord::Truncated : 0)
+                | (scrubbed ? CaptureRecord::Scrubbed : 0));
+        if (session.cached) {
+            record.response = session.buffer;
+        }
+        else if (session.capture) {
+            record.response = session.response; // ещё понадобится кэшу
+        }
+        else {
+            record.response = std::move (session.response);
+        }
+        this->_capture->write (std::move (record));
+    }
+
+    if (!failed && session.capture && !session.truncated && answerIsCacheable (session.response)) {
+        this->_cache.store (session.cacheKey, session.info.database, session.cacheGeneration,
+                            std::move (session.response));
+    }
+    if (!failed && session.info.write) {
+        // Ответы, полученные во время записи, тоже устарели.
+        this->_cache.invalidate (session.info.database);
+    }
+
+    this->_poller.remove (session.client);
+    closeSocket (session.client);
+    this->_closeUpstream (session);
+    closeSocket (session.pipe[0]);
+    closeSocket (session.pipe[1]);
+    if (session.haveSlot) {
+        this->_limiter.release();
+    }
+
+    --this->_statistics.active;
+    this->_sessions.erase (session.id);
+}
+
+void Worker::_checkTimeouts()
+{
+    const auto now = Clock::now();
+    std::vector<uint64_t> expired;
+    for (const auto &pair : this->_sessions) {
+        if (pair.second->deadline < now) {
+            expired.push_back (pair.first);
+        }
+    }
+    for (const auto id : expired) {
+        ++this->_statistics.timeouts;
+        this->_finish (*this->_sessions[id], true);
+    }
+}
+
+}
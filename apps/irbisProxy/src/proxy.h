@@ -0,0 +1,349 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#ifndef IRBIS_PROXY_H
+#define IRBIS_PROXY_H
+
+#include "irbis.h"
+#include "capture.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace irbis {
+
+struct ResolvedAddress;
+
+}
+
+namespace proxy {
+
+using Clock = std::chrono::steady_clock;
+
+//=========================================================
+
+/// \brief Сервер ИРБИС64, к которому обращается прокси.
+struct UpstreamConfig
+{
+    std::string host    { "127.0.0.1" }; ///< Адрес сервера.
+    short       port    { 5555 };        ///< Порт сервера.
+    unsigned    weight  { 1 };           ///< Вес при распределении чтения (0 -- не читать).
+    bool        primary { false };       ///< Основной сервер (получает запись).
+};
+
+/// \brief Настройки прокси.
+struct Settings
+{
+    short       listenPort   { 6666 };        ///< Порт для клиентов.
+    std::vector<UpstreamConfig> upstreams;    ///< Серверы; первый -- основной.
+    int         healthInterval { 5 };         ///< Период проверки серверов, секунды (0 -- не проверять).
+    int         workers      { 0 };           ///< Число рабочих потоков (0 -- по числу ядер).
+    int         maxUpstream  { 64 };          ///< Предельное число одновременных подключений к серверу.
+    short       statsPort    { 0 };           ///< Порт выдачи статистики (0 -- не выдавать).
+    int         timeout      { 60 };          ///< Предельное время обработки запроса, секунды.
+    bool        splice       { true };        ///< Пересылать ответ без копирования (где возможно).
+    std::size_t cacheSize    { 0 };           ///< Объём кэша ответов, байт (0 -- кэш выключен).
+    int         cacheTtl     { 30 };          ///< Время жизни ответа в кэше, секунды.
+    std::string cacheCommands { "L,H,P,O" };  ///< Кэшируемые команды через запятую.
+    std::string capturePath;                  ///< Начало имён файлов журнала трафика (пусто -- не писать).
+    std::size_t captureRotate { 256u << 20 }; ///< Размер файла журнала, байт.
+    bool        verbose      { false };       ///< Печатать каждый запрос.
+};
+
+//=========================================================
+
+/// \brief Статистика одной команды.
+struct CommandStats
+{
+    uint64_t         requests      { 0 }; ///< Число запросов.
+    uint64_t         errors        { 0 }; ///< Число запросов, не доведённых до конца.
+    uint64_t         cached        { 0 }; ///< Число ответов из кэша.
+    uint64_t         bytesIn       { 0 }; ///< Байт получено от клиентов.
+    uint64_t         bytesOut      { 0 }; ///< Байт отослано клиентам.
+    irbis::Histogram latency;             ///< Время обработки, микросекунды.
+    irbis::Histogram queued;              ///< Ожидание подключения к серверу, микросекунды.
+};
+
+/// \brief Статистика прокси.
+class Statistics final
+{
+public:
+    std::atomic<uint64_t> accepted  { 0 }; ///< Принято подключений.
+    std::atomic<uint64_t> active    { 0 }; ///< Подключений в обработке.
+    std::atomic<uint64_t> timeouts  { 0 }; ///< Запросов, прерванных по таймауту.
+    std::atomic<uint64_t> spliced   { 0 }; ///< Ответов, пересланных без копирования.
+
+    void record (const std::string &command, bool failed, bool cached, uint64_t bytesIn, uint64_t bytesOut,
+                 uint64_t latencyMicros, uint64_t queuedMicros);
+    std::map<std::string, CommandStats> snapshot() const;
+    std::string toText (std::size_t upstreamInUse, std::size_t upstreamQueued) const;
+
+private:
+    mutable std::mutex _mutex;
+    std::map<std::string, CommandStats> _commands;
+};
+
+//=========================================================
+
+/// \brief Разобранный заголовок запроса.
+struct RequestInfo
+{
+    std::string command;          ///< Код команды.
+    std::string clientId;         ///< Идентификатор клиента.
+    std::string queryId;          ///< Номер запроса.
+    std::string database;         ///< База данных, к которой относится команда (пусто -- все).
+    std::size_t paramsOffset { 0 }; ///< Смещение параметров команды в пакете.
+    bool        write { false };  ///< Команда может изменить данные.
+};
+
+/// \brief Кэш ответов сервера на команды, не изменяющие данных.
+///
+/// Ключ -- код команды вместе с её параметрами, без идентификатора
+/// клиента и номера запроса (их ответ из кэша получает от запроса).
+/// Записи вытесняются по давности использования и по времени жизни.
+/// Команда, изменяющая данные, сбрасывает все ответы по своей базе;
+/// ответ, полученный от сервера до такого сброса, в кэш не попадает.
+/// Все методы потокобезопасны.
+class ResponseCache final
+{
+public:
+    std::atomic<uint64_t> hits          { 0 }; ///< Ответов из кэша.
+    std::atomic<uint64_t> misses        { 0 }; ///< Промахов.
+    std::atomic<uint64_t> stores        { 0 }; ///< Ответов, помещённых в кэш.
+    std::atomic<uint64_t> invalidations { 0 }; ///< Сбросов по командам записи.
+
+    ResponseCache (std::size_t maxBytes, std::chrono::seconds ttl, const std::string &commands);
+    ResponseCache (const ResponseCache &) = delete;
+    ResponseCache& operator = (const ResponseCache &) = delete;
+
+    bool        cacheable  (const RequestInfo &request) const noexcept;
+    uint64_t    generation (const std::string &database) const;
+    void        invalidate (const std::string &database);
+    bool        lookup     (const std::string &key, irbis::Bytes &answer);
+    void        store      (const std::string &key, const std::string &database, uint64_t generation,
+                            irbis::Bytes &&answer);
+    std::string toText     () const;
+
+private:
+    struct Entry
+    {
+        std::string       key;
+        std::string       database;
+        irbis::Bytes      answer;
+        Clock::time_point expires;
+    };
+
+    mutable std::mutex _mutex;
+    std::size_t _maxBytes;
+    std::chrono::seconds _ttl;
+    std::set<std::string> _commands;
+    std::list<Entry> _entries; // в начале -- недавно использованные
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+    std::map<std::string, uint64_t> _generations;
+    uint64_t _globalGeneration { 0 };
+    std::size_t _bytes { 0 };
+
+    void _erase (std::list<Entry>::iterator entry);
+};
+
+//=========================================================
+
+/// \brief Маршрут запроса.
+struct Route
+{
+    std::size_t upstream { 0 }; ///< Сервер, получающий сам запрос.
+
+    /// \brief Предварительные запросы к серверам (их ответы отбрасываются).
+    std::vector<std::pair<std::size_t, irbis::Bytes>> preambles;
+};
+
+/// \brief Выбор сервера для запроса.
+///
+/// Запись и все прочие команды идут на основной сервер (первый
+/// в списке), чтение (C, G, H, I, K, L) -- на исправный сервер
+/// с наименьшим числом выполняемых запросов в расчёте на единицу веса.
+/// ИРБИС64 знает только зарегистрированных у него клиентов, поэтому
+/// пакет регистрации (A) запоминается и повторяется на сервере
+/// перед первым обращением к нему этого клиента, а при выходе (B)
+/// клиент снимается с регистрации на всех серверах и забывается
+/// (как и клиент, долго не присылавший запросов). Клиенты,
+/// регистрировавшиеся не через прокси, работают только с основным
+/// сервером. Имена серверов разрешаются заранее (resolve()), поэтому
+/// рабочие потоки не ждут DNS. Все методы потокобезопасны.
+class Router final
+{
+public:
+    explicit Router (const std::vector<UpstreamConfig> &upstreams);
+    Router (const Router &) = delete;
+    Router& operator = (const Router &) = delete;
+    ~Router();
+
+    irbis::ResolvedAddress address (std::size_t index) const;
+    void           checkHealth   (std::chrono::seconds interval);
+    const UpstreamConfig& config (std::size_t index) const;
+    void           connectFailed (std::size_t index);
+    void           finished      (std::size_t index, bool failed, uint64_t latencyMicros);
+    void           resolve       ();
+    Route          route         (const RequestInfo &request, const irbis::Bytes &packet, std::size_t size,
+                                  std::size_t avoid = SIZE_MAX);
+    std::string    toText        () const;
+
+private:
+    struct Upstream;
+    struct Client;
+
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<Upstream>> _upstreams;
+    std::unordered_map<std::string, Client> _clients;
+    std::size_t _next { 0 };
+    Clock::time_point _nextPrune;
+
+    std::size_t _pick (std::size_t avoid);
+    void        _pruneClients (Clock::time_point now);
+};
+
+//=========================================================
+
+class Worker;
+
+/// \brief Ограничитель числа одновременных подключений к серверу.
+///
+/// Сеанс, не получивший разрешения сразу, ставится в очередь
+/// и получает его при освобождении (в потоке своего рабочего).
+class UpstreamLimiter final
+{
+public:
+    explicit UpstreamLimiter (std::size_t limit);
+
+    bool        acquire (Worker *worker, uint64_t session);
+    void        release();
+    std::size_t inUse()  const;
+    std::size_t queued() const;
+
+private:
+    mutable std::mutex _mutex;
+    std::size_t _limit;
+    std::size_t _inUse { 0 };
+    std::deque<std::pair<Worker*, uint64_t>> _waiting;
+};
+
+//=========================================================
+
+/// \brief Ожидание событий на сокетах (epoll либо poll).
+class Poller final
+{
+public:
+    static const unsigned Readable = 1; ///< Ждать возможности чтения.
+    static const unsigned Writable = 2; ///< Ждать возможности записи.
+
+    /// \brief Событие: ключ, переданный при регистрации, и флаги.
+    struct Event
+    {
+        uint64_t key;
+        unsigned flags;
+        bool     failed;
+    };
+
+    Poller();
+    Poller (const Poller &) = delete;
+    Poller& operator = (const Poller &) = delete;
+    ~Poller();
+
+    void set    (int socket, uint64_t key, unsigned flags);
+    void remove (int socket);
+    void wait   (std::vector<Event> &events, int timeoutMs);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+//=========================================================
+
+struct Session;
+
+/// \brief Рабочий поток: обслуживает свои сеансы в цикле событий.
+class Worker final
+{
+public:
+    Worker (const Settings &settings, Statistics &statistics, UpstreamLimiter &limiter, ResponseCache &cache,
+            Router &router, CaptureWriter *capture);
+    Worker (const Worker &) = delete;
+    Worker& operator = (const Worker &) = delete;
+    ~Worker();
+
+    void adopt   (int client);
+    void grant   (uint64_t session);
+    void start();
+    void stop();
+
+private:
+    const Settings  &_settings;
+    Statistics      &_statistics;
+    UpstreamLimiter &_limiter;
+    ResponseCache   &_cache;
+    Router          &_router;
+    CaptureWriter   *_capture;
+    Poller           _poller;
+    std::thread      _thread;
+    int              _wakeRead  { -1 };
+    int              _wakeWrite { -1 };
+    std::atomic<bool> _stopping { false };
+    uint64_t         _nextId    { 1 };
+    std::unordered_map<uint64_t, std::unique_ptr<Session>> _sessions;
+
+    std::mutex              _inboxMutex;
+    std::vector<int>        _newClients;
+    std::vector<uint64_t>   _granted;
+
+    void _run();
+    void _wake();
+    void _drainInbox();
+    void _progress  (Session &session);
+    bool _readRequest (Session &session);
+    bool _serveFromCache (Session &session);
+    void _connectUpstream (Session &session);
+    bool _retryUpstream (Session &session);
+    void _closeUpstream (Session &session);
+    bool _relay     (Session &session);
+    bool _relaySplice (Session &session);
+    void _updateInterest (Session &session);
+    void _finish    (Session &session, bool failed);
+    void _checkTimeouts();
+};
+
+//=========================================================
+
+/// \brief Длина пакета запроса, если он получен полностью.
+/// \param data Полученные байты (длина первой строкой, затем запрос).
+/// \param size Число байт.
+/// \return Полная длина пакета либо 0, если пакет ещё не получен.
+/// \throw std::runtime_error Пакет испорчен.
+std::size_t completePacket (const irbis::Byte *data, std::size_t size);
+
+/// \brief Разбор заголовка пакета запроса.
+/// \param packet Пакет (длина первой строкой).
+/// \param size Длина пакета.
+RequestInfo parseRequest (const irbis::Bytes &packet, std::size_t size);
+
+/// \brief Ответ получен полностью и не содержит кода ошибки.
+bool answerIsCacheable (const irbis::Bytes &answer);
+
+/// \brief Ответ с подставленными идентификатором клиента и номером запроса.
+irbis::Bytes rewriteAnswer (const irbis::Bytes &answer, const std::string &clientId, const std::string &queryId);
+
+}
+
+#endif
@@ -0,0 +1,371 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "proxy.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/// \file router.cpp
+/// \brief Распределение запросов между серверами.
+
+namespace proxy {
+
+namespace {
+
+// Команды, которые можно отдать любому серверу.
+const std::set<std::string> readCommands { "C", "G", "H", "I", "K", "L" };
+
+// Столько неудачных подключений подряд выводят сервер из работы.
+const unsigned MaxFailures = 3;
+
+// На столько сервер выводится из работы без активной проверки.
+const std::chrono::seconds PassiveDowntime { 30 };
+
+// Клиенты, не обращавшиеся столько времени, забываются.
+const std::chrono::hours ClientLifetime { 1 };
+
+// Так часто route() ищет забытых клиентов.
+const std::chrono::minutes ClientPruneInterval { 1 };
+
+const std::chrono::milliseconds HealthTimeout { 1000 };
+
+// Проверка доступности: подключение с таймаутом.
+bool probe (const irbis::ResolvedAddress &address)
+{
+    if (address.address.empty()) {
+        return false; // имя не разрешилось
+    }
+
+    try {
+        const auto socket = ::socket (address.family, SOCK_STREAM, 0);
+        if (socket < 0) {
+            return false;
+        }
+        ::fcntl (socket, F_SETFL, ::fcntl (socket, F_GETFL, 0) | O_NONBLOCK);
+        auto result = ::connect (socket, reinterpret_cast<const sockaddr*> (address.address.data()),
+                                 static_cast<socklen_t> (address.address.size())) == 0;
+        if (!result && errno == EINPROGRESS) {
+            pollfd one {};
+            one.fd = socket;
+            one.events = POLLOUT;
+            if (::poll (&one, 1, static_cast<int> (HealthTimeout.count())) == 1) {
+                int error = 0;
+                socklen_t length = sizeof (error);
+                result = ::getsockopt (socket, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+            }
+        }
+        ::close (socket);
+        return result;
+    }
+    catch (const std::exception &) {
+        return false;
+    }
+}
+
+}
+
+//=========================================================
+
+/// \brief Состояние сервера.
+struct Router::Upstream
+{
+    UpstreamConfig    config;
+    std::size_t       outstanding     { 0 }; ///< Выполняемых запросов.
+    unsigned          failures        { 0 }; ///< Неудачных подключений подряд.
+    Clock::time_point downUntil;             ///< Сервер не используется до этого момента.
+    irbis::ResolvedAddress address;          ///< Адрес сервера (см. Router::resolve()).
+    uint64_t          requests        { 0 };
+    uint64_t          errors          { 0 };
+    uint64_t          connectFailures { 0 };
+    uint64_t          logins          { 0 }; ///< Повторённых регистраций клиентов.
+    irbis::Histogram  latency;               ///< Время обработки, микросекунды.
+};
+
+/// \brief Клиент, зарегистрировавшийся через прокси.
+struct Router::Client
+{
+    irbis::Bytes          login;      ///< Пакет регистрации (с паролем, только в памяти).
+    std::set<std::size_t> registered; ///< Серверы, знающие клиента.
+    Clock::time_point     lastSeen;
+
+    Client() = default;
+    Client (const Client &) = delete;
+    Client& operator = (const Client &) = delete;
+
+    /// \brief Пароль не остаётся в освобождённой памяти.
+    ~Client()
+    {
+        std::fill (this->login.begin(), this->login.end(), irbis::Byte (0));
+    }
+};
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param upstreams Серверы; первый -- основной.
+Router::Router (const std::vector<UpstreamConfig> &upstreams)
+{
+    for (const auto &config : upstreams) {
+        std::unique_ptr<Upstream> upstream { new Upstream };
+        upstream->config = config;
+        this->_upstreams.push_back (std::move (upstream));
+    }
+    if (this->_upstreams.empty()) {
+        throw std::invalid_argument ("no upstream servers");
+    }
+    this->_upstreams.front()->config.primary = true;
+    this->resolve();
+}
+
+/// \brief Деструктор.
+Router::~Router() = default;
+
+/// \brief Адрес сервера, полученный при последнем разрешении имени.
+/// \return Адрес (пустой, если имя ни разу не разрешилось).
+irbis::ResolvedAddress Router::address (std::size_t index) const
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    return this->_upstreams.at (index)->address;
+}
+
+/// \brief Активная проверка серверов (вызывается периодически).
+/// \param interval Период проверки: недоступный сервер выводится из работы до следующей.
+///
+/// Заодно обновляет адреса серверов (см. resolve()).
+void Router::checkHealth (std::chrono::seconds interval)
+{
+    this->resolve();
+
+    std::vector<irbis::ResolvedAddress> addresses;
+    {
+        std::lock_guard<std::mutex> guard (this->_mutex);
+        for (const auto &upstream : this->_upstreams) {
+            addresses.push_back (upstream->address);
+        }
+    }
+
+    std::vector<bool> alive;
+    for (const auto &address : addresses) {
+        alive.push_back (probe (address));
+    }
+
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    for (std::size_t i = 0; i < alive.size(); ++i) {
+        auto &upstream = *this->_upstreams[i];
+        if (alive[i]) {
+            upstream.failures = 0;
+            upstream.downUntil = Clock::time_point();
+        }
+        else {
+            upstream.downUntil = now + interval * 2;
+        }
+    }
+
+    this->_pruneClients (now);
+}
+
+/// \brief Настройки сервера.
+const UpstreamConfig& Router::config (std::size_t index) const
+{
+    return this->_upstreams.at (index)->config;
+}
+
+/// \brief Неудачное подключение к серверу, выбранному route().
+void Router::connectFailed (std::size_t index)
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    auto &upstream = *this->_upstreams.at (index);
+    --upstream.outstanding;
+    ++upstream.connectFailures;
+    if (++upstream.failures >= MaxFailures) {
+        upstream.downUntil = Clock::now() + PassiveDowntime;
+    }
+}
+
+/// \brief Завершение запроса, направленного route().
+void Router::finished (std::size_t index, bool failed, uint64_t latencyMicros)
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    auto &upstream = *this->_upstreams.at (index);
+    --upstream.outstanding;
+    ++upstream.requests;
+    if (failed) {
+        ++upstream.errors;
+    }
+    else {
+        upstream.failures = 0;
+    }
+    upstream.latency.add (latencyMicros);
+}
+
+/// \brief Разрешение имён серверов.
+///
+/// Вызывается из конструктора и затем периодически из фонового потока,
+/// но не из рабочих: getaddrinfo может надолго заблокировать поток.
+/// Если имя не разрешилось, остаётся прежний адрес.
+void Router::resolve()
+{
+    std::vector<UpstreamConfig> configs;
+    {
+        std::lock_guard<std::mutex> guard (this->_mutex);
+        for (const auto &upstream : this->_upstreams) {
+            configs.push_back (upstream->config);
+        }
+    }
+
+    std::vector<irbis::ResolvedAddress> resolved;
+    for (const auto &config : configs) {
+        try {
+            const auto addresses = irbis::AddressResolver::instance().resolve
+                (irbis::String (config.host.begin(), config.host.end()), config.port); // имя хоста -- ASCII
+            resolved.push_back (addresses.front());
+        }
+        catch (const std::exception &) {
+            resolved.emplace_back();
+        }
+    }
+
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    for (std::size_t i = 0; i < resolved.size(); ++i) {
+        if (!resolved[i].address.empty()) {
+            this->_upstreams[i]->address = std::move (resolved[i]);
+        }
+    }
+}
+
+/// \brief Выбор сервера для запроса.
+/// \param request Разобранный заголовок запроса.
+/// \param packet Пакет запроса.
+/// \param size Длина пакета.
+/// \param avoid Сервер, который не следует выбирать (после неудачи).
+/// \return Маршрут; выбранный сервер считается занятым запросом
+/// до вызова finished() либо connectFailed().
+Route Router::route (const RequestInfo &request, const irbis::Bytes &packet, std::size_t size,
+                     std::size_t avoid)
+{
+    Route result;
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    if (now >= this->_nextPrune) {
+        this->_pruneClients (now);
+    }
+
+    if (request.command == "A") {
+        auto &client = this->_clients[request.clientId];
+        std::fill (client.login.begin(), client.login.end(), irbis::Byte (0));
+        client.login.assign (packet.begin(), packet.begin() + static_cast<std::ptrdiff_t> (size));
+        client.registered = { 0 };
+        client.lastSeen = now;
+    }
+    else if (request.command == "B") {
+        const auto found = this->_clients.find (request.clientId);
+        if (found != this->_clients.end()) {
+            for (const auto index : found->second.registered) {
+                if (index != 0) {
+                    result.preambles.emplace_back
+                        (index, irbis::Bytes (packet.begin(), packet.begin() + static_cast<std::ptrdiff_t> (size)));
+                }
+            }
+            this->_clients.erase (found);
+        }
+    }
+    else {
+        const auto found = this->_clients.find (request.clientId);
+        if (found != this->_clients.end()) {
+            auto &client = found->second;
+            client.lastSeen = now;
+
+            // Запись и прочие команды -- только основному серверу.
+            if (readCommands.count (request.command) != 0 && !request.write) {
+                if (avoid != 0) {
+                    // Регистрация на отказавшем сервере могла не состояться.
+                    client.registered.erase (avoid);
+                }
+                result.upstream = this->_pick (avoid);
+                if (client.registered.insert (result.upstream).second) {
+                    result.preambles.emplace_back (result.upstream, client.login);
+                    ++this->_upstreams[result.upstream]->logins;
+                }
+            }
+        }
+    }
+
+    ++this->_upstreams[result.upstream]->outstanding;
+    return result;
+}
+
+/// \brief Текстовое представление состояния серверов.
+std::string Router::toText() const
+{
+    const auto now = Clock::now();
+    std::ostringstream result;
+    result << std::left << std::setw (24) << "upstream" << std::setw (9) << "role" << std::right
+           << std::setw (7) << "weight" << std::setw (7) << "state" << std::setw (13) << "outstanding"
+           << std::setw (10) << "requests" << std::setw (8) << "errors" << std::setw (10) << "conn.fail"
+           << std::setw (8) << "logins" << std::setw (12) << "mean, us" << std::setw (10) << "p95"
+           << std::setw (10) << "p99" << '\n';
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    for (const auto &upstream : this->_upstreams) {
+        const auto &config = upstream->config;
+        result << std::left << std::setw (24) << (config.host + ':' + std::to_string (config.port))
+               << std::setw (9) << (config.primary ? "primary" : "replica") << std::right
+               << std::setw (7) << config.weight
+               << std::setw (7) << (upstream->downUntil > now ? "down" : "up")
+               << std::setw (13) << upstream->outstanding << std::setw (10) << upstream->requests
+               << std::setw (8) << upstream->errors << std::setw (10) << upstream->connectFailures
+               << std::setw (8) << upstream->logins
+               << std::setw (12) << std::fixed << std::setprecision (1) << upstream->latency.mean()
+               << std::setw (10) << upstream->latency.percentile (0.95)
+               << std::setw (10) << upstream->latency.percentile (0.99) << '\n';
+    }
+    return result.str();
+}
+
+// Забывание клиентов, давно не присылавших запросов. Вызывается под _mutex.
+void Router::_pruneClients (Clock::time_point now)
+{
+    this->_nextPrune = now + ClientPruneInterval;
+    for (auto it = this->_clients.begin(); it != this->_clients.end();) {
+        if (now - it->second.lastSeen > ClientLifetime) {
+            it = this->_clients.erase (it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+// Исправный сервер с наименьшей загрузкой на единицу веса;
+// при отсутствии таковых -- основной. Вызывается под _mutex.
+std::size_t Router::_pick (std::size_t avoid)
+{
+    const auto now = Clock::now();
+    const auto count = this->_upstreams.size();
+    std::size_t best = SIZE_MAX;
+    double bestScore = 0;
+    const auto start = this->_next++;
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto index = (start + i) % count;
+        const auto &upstream = *this->_upstreams[index];
+        if (index == avoid || upstream.config.weight == 0 || upstream.downUntil > now) {
+            continue;
+        }
+        const auto score = static_cast<double> (upstream.outstanding + 1) / upstream.config.weight;
+        if (best == SIZE_MAX || score < bestScore) {
+            best = index;
+            bestScore = score;
+        }
+    }
+    return best == SIZE_MAX ? 0 : best;
+}
+
+}
@@ -0,0 +1,423 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Воспроизведение журнала трафика, записанного irbisProxy
+// (ключ --capture): запросы из журнала повторно отсылаются
+// на указанный сервер в исходном темпе, с ускорением либо
+// без пауз. Запросы одного клиента выполняются одним потоком
+// в исходном порядке. Отчёт -- перцентили задержки по командам
+// в журнале и при воспроизведении, а также их разница.
+
+#include "capture.h"
+#include "proxy.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static const char *replayVersion = "0.1";
+
+/// \brief Настройки воспроизведения.
+struct Settings
+{
+    std::string host { "127.0.0.1" };
+    short port { 6666 };
+    double speed { 1 };   // 0 -- без пауз
+    int concurrency { 4 };
+    std::string password;
+    bool includeWrites { false };
+    bool includeCached { false };
+    int timeout { 60 };   // секунды
+    std::string csvPath;
+    std::vector<std::string> files;
+};
+
+/// \brief Запрос, подлежащий воспроизведению.
+struct ReplayItem
+{
+    uint64_t timestamp { 0 };    // микросекунды от начала эпохи
+    uint32_t capturedLatency { 0 };
+    int capturedCode { 0 };
+    std::string command;
+    irbis::Bytes request;
+};
+
+/// \brief Замеры одной команды.
+struct CommandSamples
+{
+    std::vector<uint64_t> captured;
+    std::vector<uint64_t> replayed;
+    uint64_t errors { 0 };     // сбои сети
+    uint64_t mismatches { 0 }; // код возврата отличается от записанного
+};
+
+/// \brief Итоговая строка отчёта.
+struct ReportRow
+{
+    std::string command;
+    uint64_t requests { 0 };
+    uint64_t errors { 0 };
+    uint64_t mismatches { 0 };
+    uint64_t captured[3] {};
+    uint64_t replayed[3] {};
+};
+
+static const double Fractions[3] = { 0.50, 0.95, 0.99 };
+
+static Settings settings;
+static std::mutex samplesMutex;
+static std::map<std::string, CommandSamples> allSamples;
+static std::atomic<uint64_t> lateRequests { 0 };
+
+//=========================================================
+
+static void printUsage()
+{
+    std::cout << "Usage: irbisReplay [options] FILE...\n"
+              << "  --target HOST:PORT   server to replay against (default 127.0.0.1:6666)\n"
+              << "  --speed X            1 = original pace, N = N times faster, 0 or max = no pauses (default 1)\n"
+              << "  --concurrency N      replay threads; requests of a client keep their order (default 4)\n"
+              << "  --password PW        password restored into scrubbed requests\n"
+              << "  --include-writes     also replay commands that modify data (skipped by default)\n"
+              << "  --include-cached     also replay requests answered from the proxy cache\n"
+              << "  --timeout SECONDS    answer time limit (default 60)\n"
+              << "  --csv FILE           write the report as CSV" << std::endl;
+}
+
+/// \brief Разбор аргументов командной строки.
+/// \return true если все хорошо.
+static bool parseCommandLine (int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--target" && hasValue) {
+            const std::string value = argv[++i];
+            const auto colon = value.rfind (':');
+            settings.host = value.substr (0, colon);
+            if (colon != std::string::npos) {
+                settings.port = static_cast<short> (std::atoi (value.c_str() + colon + 1));
+            }
+        }
+        else if (arg == "--speed" && hasValue) {
+            const std::string value = argv[++i];
+            settings.speed = value == "max" ? 0 : std::max (std::atof (value.c_str()), 0.0);
+        }
+        else if (arg == "--concurrency" && hasValue) {
+            settings.concurrency = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--password" && hasValue) {
+            settings.password = argv[++i];
+        }
+        else if (arg == "--include-writes") {
+            settings.includeWrites = true;
+        }
+        else if (arg == "--include-cached") {
+            settings.includeCached = true;
+        }
+        else if (arg == "--timeout" && hasValue) {
+            settings.timeout = std::max (std::atoi (argv[++i]), 1);
+        }
+        else if (arg == "--csv" && hasValue) {
+            settings.csvPath = argv[++i];
+        }
+        else if (!arg.empty() && arg[0] != '-') {
+            settings.files.push_back (arg);
+        }
+        else {
+            printUsage();
+            return false;
+        }
+    }
+
+    if (settings.files.empty()) {
+        printUsage();
+        return false;
+    }
+
+    return true;
+}
+
+//=========================================================
+
+/// \brief Код возврата из ответа сервера (первая строка после заголовка).
+/// \return INT32_MIN, если ответ слишком короткий.
+static int returnCode (const irbis::Bytes &answer)
+{
+    const std::size_t headerLines = 10;
+    std::size_t line = 0, start = 0;
+    for (std::size_t i = 0; i < answer.size(); ++i) {
+        if (answer[i] != '\n') {
+            continue;
+        }
+        if (line == headerLines) {
+            break;
+        }
+        ++line;
+        start = i + 1;
+    }
+    if (line != headerLines || start >= answer.size()) {
+        return INT32_MIN;
+    }
+    const std::string text (answer.begin() + static_cast<std::ptrdiff_t> (start), answer.end());
+    return std::atoi (text.c_str());
+}
+
+/// \brief Чтение журналов: запросы, подлежащие воспроизведению, по возрастанию времени.
+static bool loadCapture (std::vector<ReplayItem> &items)
+{
+    uint64_t skippedWrites = 0, skippedOther = 0;
+    for (const auto &fileName : settings.files) {
+        try {
+            proxy::CaptureReader reader (fileName);
+            proxy::CaptureRecord record;
+            while (reader.read (record)) {
+                if ((record.flags & proxy::CaptureRecord::Failed) != 0
+                    || ((record.flags & proxy::CaptureRecord::Cached) != 0 && !settings.includeCached)) {
+                    ++skippedOther;
+                    continue;
+                }
+                const auto request = proxy::parseRequest (record.request, record.request.size());
+                if (request.write && !settings.includeWrites) {
+                    ++skippedWrites;
+                    continue;
+                }
+
+                ReplayItem item;
+                item.timestamp = record.timestamp;
+                item.capturedLatency = record.latency;
+                item.capturedCode = (record.flags & proxy::CaptureRecord::Truncated) != 0
+                        ? INT32_MIN : returnCode (record.response);
+                item.command = request.command;
+                item.request = (record.flags & proxy::CaptureRecord::Scrubbed) != 0 && !settings.password.empty()
+                        ? proxy::restorePassword (record.request, settings.password)
+                        : std::move (record.request);
+                items.push_back (std::move (item));
+            }
+        }
+        catch (const std::exception &exception) {
+            std::cerr << exception.what() << std::endl;
+            return false;
+        }
+    }
+
+    std::stable_sort (items.begin(), items.end(),
+        [] (const ReplayItem &first, const ReplayItem &second) { return first.timestamp < second.timestamp; });
+    std::cout << "Loaded " << items.size() << " requests, skipped " << skippedWrites
+              << " writes and " << skippedOther << " failed/cached" << std::endl;
+    return true;
+}
+
+//=========================================================
+
+/// \brief Отсылка одного запроса и получение ответа целиком.
+static irbis::Bytes execute (const irbis::Bytes &request)
+{
+    irbis::Tcp4Socket socket (irbis::String (settings.host.begin(), settings.host.end()), settings.port);
+    socket.receiveTimeout = settings.timeout * 1000;
+    socket.open();
+    socket.send (request.data(), request.size());
+
+    irbis::Bytes result;
+    irbis::Byte buffer[32 * 1024];
+    while (true) {
+        const auto received = socket.receive (buffer, sizeof (buffer));
+        if (received == 0) {
+            break;
+        }
+        result.insert (result.end(), buffer, buffer + received);
+    }
+    socket.close();
+    return result;
+}
+
+/// \brief Поток воспроизведения: свои запросы по порядку, с паузами согласно журналу.
+static void replayLoop (const std::vector<const ReplayItem*> *items, uint64_t firstTimestamp, Clock::time_point started)
+{
+    std::map<std::string, CommandSamples> samples;
+    for (const auto item : *items) {
+        if (settings.speed > 0) {
+            const auto offset = static_cast<double> (item->timestamp - firstTimestamp) / settings.speed;
+            const auto due = started + std::chrono::microseconds (static_cast<int64_t> (offset));
+            if (Clock::now() > due + std::chrono::milliseconds (10)) {
+                ++lateRequests;
+            }
+            std::this_thread::sleep_until (due);
+        }
+
+        auto &target = samples[item->command];
+        const auto begin = Clock::now();
+        try {
+            const auto answer = execute (item->request);
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds> (Clock::now() - begin).count();
+            target.captured.push_back (item->capturedLatency);
+            target.replayed.push_back (static_cast<uint64_t> (elapsed));
+            if (item->capturedCode != INT32_MIN && returnCode (answer) != item->capturedCode) {
+                ++target.mismatches;
+            }
+        }
+        catch (const std::exception &) {
+            ++target.errors;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard (samplesMutex);
+    for (auto &pair : samples) {
+        auto &target = allSamples[pair.first];
+        target.captured.insert (target.captured.end(), pair.second.captured.begin(), pair.second.captured.end());
+        target.replayed.insert (target.replayed.end(), pair.second.replayed.begin(), pair.second.replayed.end());
+        target.errors += pair.second.errors;
+        target.mismatches += pair.second.mismatches;
+    }
+}
+
+//=========================================================
+
+static uint64_t exactPercentile (const std::vector<uint64_t> &sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<std::size_t> (std::ceil (fraction * static_cast<double> (sorted.size())));
+    return sorted[std::min (std::max (rank, static_cast<std::size_t> (1)), sorted.size()) - 1];
+}
+
+static ReportRow makeRow (const std::string &command, CommandSamples &samples)
+{
+    ReportRow row;
+    row.command = command;
+    row.requests = samples.replayed.size() + samples.errors;
+    row.errors = samples.errors;
+    row.mismatches = samples.mismatches;
+    std::sort (samples.captured.begin(), samples.captured.end());
+    std::sort (samples.replayed.begin(), samples.replayed.end());
+    for (std::size_t i = 0; i < 3; ++i) {
+        row.captured[i] = exactPercentile (samples.captured, Fractions[i]);
+        row.replayed[i] = exactPercentile (samples.replayed, Fractions[i]);
+    }
+    return row;
+}
+
+static std::vector<ReportRow> buildReport()
+{
+    std::vector<ReportRow> result;
+    CommandSamples total;
+    for (auto &pair : allSamples) {
+        auto &samples = pair.second;
+        total.captured.insert (total.captured.end(), samples.captured.begin(), samples.captured.end());
+        total.replayed.insert (total.replayed.end(), samples.replayed.begin(), samples.replayed.end());
+        total.errors += samples.errors;
+        total.mismatches += samples.mismatches;
+        result.push_back (makeRow (pair.first, samples));
+    }
+    result.push_back (makeRow ("total", total));
+    return result;
+}
+
+// Изменение задержки в процентах.
+static double delta (uint64_t captured, uint64_t replayed)
+{
+    return captured == 0 ? 0 : (static_cast<double> (replayed) - static_cast<double> (captured)) * 100 / captured;
+}
+
+static void writeText (std::ostream &stream, const std::vector<ReportRow> &rows)
+{
+    stream << std::left << std::setw (8) << "command" << std::right
+           << std::setw (10) << "requests" << std::setw (8) << "errors" << std::setw (10) << "mismatch";
+    for (const auto fraction : Fractions) {
+        const auto name = "p" + std::to_string (static_cast<int> (fraction * 100));
+        stream << std::setw (11) << (name + " cap") << std::setw (11) << (name + " rep") << std::setw (9) << "delta";
+    }
+    stream << '\n';
+    for (const auto &row : rows) {
+        stream << std::left << std::setw (8) << row.command << std::right
+               << std::setw (10) << row.requests << std::setw (8) << row.errors << std::setw (10) << row.mismatches;
+        for (std::size_t i = 0; i < 3; ++i) {
+            stream << std::setw (11) << row.captured[i] << std::setw (11) << row.replayed[i]
+                   << std::setw (8) << std::fixed << std::setprecision (1) << std::showpos
+                   << delta (row.captured[i], row.replayed[i]) << std::noshowpos << '%';
+        }
+        stream << '\n';
+    }
+    stream << "(latencies in microseconds; captured values are proxy timings)" << std::endl;
+}
+
+static void writeCsv (std::ostream &stream, const std::vector<ReportRow> &rows)
+{
+    stream << "command,requests,errors,mismatches,p50_captured_us,p50_replayed_us,"
+              "p95_captured_us,p95_replayed_us,p99_captured_us,p99_replayed_us\n";
+    for (const auto &row : rows) {
+        stream << row.command << ',' << row.requests << ',' << row.errors << ',' << row.mismatches;
+        for (std::size_t i = 0; i < 3; ++i) {
+            stream << ',' << row.captured[i] << ',' << row.replayed[i];
+        }
+        stream << '\n';
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    std::cout << "IRBIS-REPLAY application version " << replayVersion
+              << ", client version " << irbis::libraryVersionString() << std::endl;
+
+    if (!parseCommandLine (argc, argv)) {
+        return 1;
+    }
+
+    std::vector<ReplayItem> items;
+    if (!loadCapture (items)) {
+        return 2;
+    }
+    if (items.empty()) {
+        std::cerr << "Nothing to replay" << std::endl;
+        return 2;
+    }
+
+    // Клиент целиком достаётся одному потоку, чтобы сохранить порядок его запросов.
+    std::vector<std::vector<const ReplayItem*>> queues (static_cast<std::size_t> (settings.concurrency));
+    const std::hash<std::string> hasher;
+    for (const auto &item : items) {
+        const auto request = proxy::parseRequest (item.request, item.request.size());
+        queues[hasher (request.clientId) % queues.size()].push_back (&item);
+    }
+
+    const auto firstTimestamp = items.front().timestamp;
+    const auto started = Clock::now();
+    std::vector<std::thread> threads;
+    for (const auto &queue : queues) {
+        threads.emplace_back (replayLoop, &queue, firstTimestamp, started);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto seconds = std::chrono::duration<double> (Clock::now() - started).count();
+    const auto capturedSeconds = static_cast<double> (items.back().timestamp - firstTimestamp) / 1e6;
+
+    std::cout << "Replayed in " << std::fixed << std::setprecision (2) << seconds << " s (captured span "
+              << capturedSeconds << " s), late requests " << lateRequests << std::endl;
+    const auto rows = buildReport();
+    writeText (std::cout, rows);
+
+    if (!settings.csvPath.empty()) {
+        std::ofstream stream (settings.csvPath);
+        if (!stream) {
+            std::cerr << "Can't create " << settings.csvPath << std::endl;
+            return 3;
+        }
+        writeCsv (stream, rows);
+    }
+
+    return 0;
+}
@@ -9,6 +9,9 @@
 // ReSharper disable CppClangTidyCppcoreguidelinesMacroUsage
 // ReSharper disable CommentTypo
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <ctime>
 #include <cstdio>
 #include <cstdlib>
@@ -225,12 +228,18 @@ namespace irbis
 {
 
 class  AlphabetTable;
+class  BulkWriter;
+class  BulkWriterOptions;
+class  BulkWriterStatistics;
 class  ChunkedBuffer;
 class  ClientInfo;
 class  ClientQuery;
 class  ClientSocket;
 class  Connection;
 class  ConnectionFactory;
+class  ConnectionLease;
+class  ConnectionPool;
+class  DatabaseFound;
 class  DatabaseInfo;
 class  Date;
 class  Ean13;
@@ -244,6 +253,8 @@ class  FoundLine;
 class  GblResult;
 class  GblSettings;
 class  GblStatements;
+class  Hedging;
+class  HedgingStatistics;
 class  IlfEntry;
 class  IlfFile;
 class  IniFile;
@@ -259,6 +270,7 @@ class  MarcRecord;
 class  MarcRecordList;
 class  MenuEntry;
 class  MenuFile;
+class  MultiSearchResult;
 class  NetworkException;
 class  NotImplementedException;
 struct NumberText;
@@ -268,13 +280,19 @@ class  ParFile;
 class  PhantomField;
 class  PhantomRecord;
 class  PhantomSubField;
+class  PoolStatistics;
 class  PostingParameters;
 class  ProcessInfo;
 class  ProtocolText;
 class  RawRecord;
+class  RecordCache;
 class  RecordField;
 class  RecordSerializer;
+class  RequestMetrics;
+class  RequestTrace;
+class  RetryPolicy;
 class  Search;
+class  SearchCursor;
 class  SearchParameters;
 class  SearchScenario;
 class  ServerResponse;
@@ -282,6 +300,7 @@ class  ServerStat;
 class  StopWords;
 class  SubField;
 class  TableDefinition;
+class  TermCursor;
 class  TermInfo;
 class  TermParameters;
 class  TermPosting;
@@ -2002,6 +2021,84 @@ enum class RequestStage
 
 //=========================================================
 
+/// \brief Политика использования кэша записей.
+enum class CachePolicy
+{
+    Bypass,    ///< Кэш не используется: запись всегда читается с сервера.
+    Trust,     ///< Запись из кэша выдаётся без обращения к серверу.
+    Revalidate ///< Запись читается с сервера, но разбирается, только если изменилась её версия.
+};
+
+//=========================================================
+
+/// \brief Политика повторов запросов при сбоях сети.
+///
+/// Повторяется запрос, не дошедший до сервера (сбой подключения
+/// либо отсылки), а запрос, не изменяющий данных (см. idempotent()),
+/// -- при любом сбое сети. Паузы между попытками растут
+/// экспоненциально, со случайным разбросом. По умолчанию повторов нет.
+class IRBIS_API RetryPolicy final
+{
+public:
+    unsigned maxAttempts { 1 };                  ///< Попыток всего (1 -- без повторов).
+    std::chrono::milliseconds baseDelay { 50 };  ///< Пауза перед первым повтором.
+    std::chrono::milliseconds maxDelay { 2000 }; ///< Предельная пауза.
+    double multiplier { 2.0 };                   ///< Множитель паузы при каждом следующем повторе.
+    std::chrono::milliseconds deadline { 0 };    ///< Срок одного вызова с учётом повторов (0 -- без ограничения).
+
+    std::chrono::milliseconds backoff    (unsigned attempt) const;
+    static bool               idempotent (const std::string &command) noexcept;
+};
+
+/// \brief Статистика дублирования запросов.
+///
+/// Снимок, полученный методом Hedging::statistics().
+class IRBIS_API HedgingStatistics final
+{
+public:
+    uint64_t requests { 0 }; ///< Запросов, выполненных с возможностью дублирования.
+    uint64_t hedged   { 0 }; ///< Запросов, для которых был отослан дубликат.
+    uint64_t wins     { 0 }; ///< Случаев, когда дубликат ответил первым.
+
+    double hedgeRate () const noexcept;
+    double winRate   () const noexcept;
+};
+
+/// \brief Дублирование медленных запросов на чтение.
+///
+/// Если ответ на запрос, не изменяющий данных, не получен за время,
+/// укладывающееся в заданный перцентиль недавних задержек, тот же запрос
+/// отсылается через подключение, арендованное у пула (см. setPool()),
+/// и используется первый полученный ответ. Без пула дубликаты
+/// не отсылаются, а только собирается статистика задержек.
+/// Объект может разделяться несколькими подключениями
+/// (в том числе подключениями пула), все методы потокобезопасны.
+class IRBIS_API Hedging final
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+public:
+    explicit Hedging    (double percentile = 0.95,
+                         std::chrono::milliseconds minDelay = std::chrono::milliseconds (1),
+                         std::chrono::milliseconds maxDelay = std::chrono::milliseconds (1000),
+                         std::size_t window = 256);
+    Hedging             (const Hedging&) = delete; ///< Конструктор копирования.
+    Hedging             (Hedging&&)      = delete; ///< Конструктор перемещения.
+    ~Hedging            ();
+    Hedging& operator = (const Hedging&) = delete; ///< Оператор копирования.
+    Hedging& operator = (Hedging&&)      = delete; ///< Оператор перемещения.
+
+    std::chrono::microseconds delay      () const;
+    ConnectionPool*           pool       () const noexcept;
+    void                      record     (uint64_t micros, bool hedged, bool hedgeWon);
+    void                      setPool    (ConnectionPool *pool) noexcept;
+    HedgingStatistics         statistics () const;
+};
+
+//=========================================================
+
 /// \brief Базовые функции подключения
 class IRBIS_API ConnectionBase
 {
@@ -2009,12 +2106,41 @@ private:
     bool _connected;
     StringList _databaseStack;
     std::mutex _mutex;
+    std::size_t _pendingAsync;          ///< Асинхронные запросы, ответ на которые ещё не разобран.
+    std::condition_variable _asyncDone; ///< Сигнал об уменьшении _pendingAsync.
 
+    friend class SearchCursor;
+    friend class TermCursor;
     friend class ServerResponse;
 
 protected:
 
-    bool _checkConnection();
+    /// \brief Заполнение запроса для пакета элементов [offset, offset + count).
+    using BatchBuilder  = std::function<void (ClientQuery &query, std::size_t offset, std::size_t count)>;
+
+    /// \brief Разбор ответа на пакет (nullptr, если ответ не получен).
+    using BatchConsumer = std::function<void (std::size_t offset, std::size_t count, ServerResponse *response)>;
+
+    /// \brief Размер элемента с указанным индексом в закодированном запросе, байты.
+    using BatchWeigher  = std::function<std::size_t (std::size_t index)>;
+
+    /// \brief Обработчик завершения асинхронного запроса: ответ сервера либо исключение.
+    using AsyncCompletion = std::function<void (Bytes &&answer, std::exception_ptr error)>;
+
+    int                _acceptRegistration (ServerResponse &response);
+    void               _beginAsync         ();
+    void               _endAsync           ();
+    std::unique_lock<std::mutex> _lock     ();
+    void               _waitAsync          ();
+    bool               _checkConnection    ();
+    void               _forgetConnection   () noexcept;
+    static int         _generateClientId   ();
+    void               _runBatches         (const std::string &command, std::size_t total,
+                                            const BatchBuilder &build, const BatchConsumer &consume,
+                                            const BatchWeigher &weigh = nullptr);
+    static BatchWeigher _weighMfns         (const MfnList &mfnList);
+    std::future<Bytes> _submitAsync        (ClientQuery &query);
+    void               _submitAsync        (ClientQuery &query, AsyncCompletion completion);
 
 public:
 
@@ -2031,7 +2157,19 @@ public:
     IniFile      iniFile;                  ///< Содержимое серверного INI-файла для данного клиента.
     int          interval;                 ///< Интервал автоматического подтверждения, секунды.
     RequestStage stage;                    ///< Этап выполнения запроса
+    std::size_t  batchSize;                ///< Число записей в одном запросе пакетных операций.
+    std::size_t  parallelism;              ///< Число одновременных запросов пакетных операций.
+    std::size_t  maxPacketSize;            ///< Предельный размер списка элементов в одном запросе пакетных операций, байты (0 -- без ограничения).
+    int          connectTimeout;           ///< Таймаут подключения к серверу, миллисекунды (0 -- без ограничения).
+    int          receiveTimeout;           ///< Предельное время ожидания ответа, миллисекунды (0 -- без ограничения).
+    bool         noDelay;                  ///< Отключить алгоритм Нейгла (TCP_NODELAY).
+    int          receiveBufferSize;        ///< Размер приёмного буфера сокета, байты (0 -- по умолчанию).
     std::unique_ptr <ClientSocket> socket; ///< Клиентский сокет.
+    std::shared_ptr <RecordCache>  cache;  ///< Кэш записей (может быть общим для нескольких подключений).
+    std::shared_ptr <RequestMetrics> metrics; ///< Сбор метрик этапов запросов (по умолчанию выключен).
+    CachePolicy  cachePolicy;              ///< Политика использования кэша записей.
+    RetryPolicy  retryPolicy;              ///< Повторы запросов при сбоях сети.
+    std::shared_ptr <Hedging> hedging;     ///< Дублирование медленных запросов на чтение (по умолчанию выключено).
 
     ConnectionBase  ();
     ~ConnectionBase ();
@@ -2079,6 +2217,10 @@ public:
     MfnList                  search       (const Search &search);
     MfnList                  search       (const String &expression);
     MfnList                  search       (const SearchParameters &parameters);
+    MultiSearchResult        searchMany   (const String &expression, const StringList &databases,
+                                           const std::function<void (const DatabaseFound&)> &handler = nullptr);
+    MultiSearchResult        searchMany   (const SearchParameters &parameters, const StringList &databases,
+                                           const std::function<void (const DatabaseFound&)> &handler = nullptr);
 };
 
 /// \brief Администраторские функции
@@ -2112,6 +2254,7 @@ class IRBIS_API ConnectionLite : public virtual ConnectionBase
 {
 public:
     LiteRecord readLiteRecord (Mfn mfn);
+    LiteRecord readLiteRecord (Mfn mfn, CachePolicy policy);
 };
 
 /// \brief Полноценные функции работы с записями
@@ -2121,8 +2264,10 @@ public:
     IRBIS_MAYBE_UNUSED bool                     deleteRecord (Mfn mfn);
                        MarcRecord               readRecord   (Mfn mfn);
                        MarcRecord               readRecord   (const String &databaseName, Mfn mfn);
+                       MarcRecord               readRecord   (const String &databaseName, Mfn mfn, CachePolicy policy);
                        MarcRecord               readRecord   (const String &databaseName, Mfn mfn, int version);
                        std::vector <MarcRecord> readRecords  (const MfnList &mfnList);
+                       std::vector <MarcRecord> readRecords  (const MfnList &mfnList, std::vector<int> &errors);
     IRBIS_MAYBE_UNUSED int                      writeRecord  (MarcRecord &record, bool lockFlag = false, bool actualize = true, bool dontParseResponse = false);
 };
 
@@ -2137,12 +2282,16 @@ class IRBIS_API Connection final :
     public virtual ConnectionLite,
     public virtual ConnectionFull
 {
+private:
+
+    void               _registerAsync      (std::shared_ptr<std::promise<bool>> promise);
+
 public:
 
     Connection  ()                             = default; ///< Конструктор по умолчанию.
     Connection  (const Connection&)            = delete;  ///< Конструктор копирования.
     Connection  (Connection&&)                 = delete;  ///< Конструктор перемещения.
-    ~Connection ()                             = default; ///< Деструктор.
+    ~Connection ();
     Connection& operator = (const Connection&) = delete;  ///< Оператор копирования.
     Connection& operator = (Connection&&)      = delete;  ///< Оператор перемещения.
 
@@ -2151,9 +2300,12 @@ public:
     std::future<bool> connectAsync();
     std::future<void> disconnectAsync();
     std::future<bool> executeAsync(ClientQuery &query);
+    std::future<bool> executeAsync(ClientQuery &query, std::function<void (ServerResponse&)> handler);
     String formatRecord (const String &format, Mfn mfn);
     std::string formatRecordLite (const std::string &format, Mfn mfn);
     String formatRecord (const String &format, const MarcRecord &record);
+    StringList formatRecords (const String &format, const MfnList &mfnList);
+    std::vector<std::string> formatRecordsLite (const std::string &format, const MfnList &mfnList);
     DatabaseInfo getDatabaseInfo (const String &databaseName);
     GblResult globalCorrection (const GblSettings &settings);
     std::vector<UserInfo> getUserList();
@@ -2188,6 +2340,338 @@ public:
 
 //=========================================================
 
+/// \brief Статистика пула подключений.
+///
+/// Снимок, полученный методом ConnectionPool::statistics().
+class IRBIS_API PoolStatistics final
+{
+public:
+    std::size_t totalConnections  { 0 }; ///< Подключений в пуле (и свободных, и выданных).
+    std::size_t idleConnections   { 0 }; ///< Свободных подключений.
+    std::size_t leasedConnections { 0 }; ///< Выданных в аренду подключений.
+    std::size_t waiters           { 0 }; ///< Потоков, ожидающих подключение в данный момент.
+    std::size_t peakWaiters       { 0 }; ///< Максимальное число одновременно ожидающих потоков.
+    uint64_t    leases            { 0 }; ///< Всего выдано подключений.
+    uint64_t    handshakes        { 0 }; ///< Успешных регистраций на сервере (команда "A").
+    uint64_t    failedHandshakes  { 0 }; ///< Неудачных попыток регистрации.
+    uint64_t    evictions         { 0 }; ///< Подключений, отброшенных как "мёртвые".
+    uint64_t    keepAlives        { 0 }; ///< Выполнено фоновых команд noOp.
+    uint64_t    timeouts          { 0 }; ///< Ожиданий подключения, завершившихся по таймауту.
+    double      totalLeaseMs      { 0 }; ///< Суммарное время аренды, миллисекунды.
+    double      maxLeaseMs        { 0 }; ///< Максимальное время аренды, миллисекунды.
+    double      totalWaitMs       { 0 }; ///< Суммарное время ожидания подключения, миллисекунды.
+    double      maxWaitMs         { 0 }; ///< Максимальное время ожидания подключения, миллисекунды.
+
+    double averageLeaseMs () const noexcept;
+    double averageWaitMs  () const noexcept;
+};
+
+//=========================================================
+
+/// \brief Аренда подключения из пула.
+///
+/// Пока объект аренды жив, подключение используется монопольно.
+/// Деструктор возвращает подключение в пул. Объекты данного типа
+/// можно перемещать, но нельзя копировать.
+class IRBIS_API ConnectionLease final
+{
+private:
+    ConnectionPool *_pool;
+    Connection *_connection;
+    std::chrono::steady_clock::time_point _since;
+
+    friend class ConnectionPool;
+    ConnectionLease (ConnectionPool *pool, Connection *connection) noexcept;
+
+public:
+    ConnectionLease             () noexcept;                        ///< Конструктор по умолчанию (пустая аренда).
+    ConnectionLease             (const ConnectionLease&) = delete;  ///< Конструктор копирования.
+    ConnectionLease             (ConnectionLease &&other) noexcept; ///< Конструктор перемещения.
+    ~ConnectionLease            ();                                 ///< Деструктор.
+    ConnectionLease& operator = (const ConnectionLease&) = delete;  ///< Оператор копирования.
+    ConnectionLease& operator = (ConnectionLease &&other) noexcept; ///< Оператор перемещения.
+
+    /// \brief Арендованное подключение (может быть nullptr).
+    Connection* get() const noexcept { return this->_connection; }
+
+    Connection& operator * () const noexcept { return *this->_connection; }  ///< Доступ к подключению.
+    Connection* operator -> () const noexcept { return this->_connection; } ///< Доступ к подключению.
+    explicit operator bool () const noexcept { return this->_connection != nullptr; } ///< Есть ли подключение?
+
+    void release () noexcept;
+};
+
+//=========================================================
+
+/// \brief Пул подключений к серверу ИРБИС64.
+///
+/// Держит от minSize до maxSize зарегистрированных на сервере подключений,
+/// выдаёт их в аренду (ConnectionLease) и принимает обратно. Фоновый поток
+/// подтверждает простаивающие подключения командой noOp с периодичностью,
+/// заданной сервером (ConnectionBase::interval), и отбрасывает подключения,
+/// сессия которых на сервере потеряна. Новые подключения создаются фабрикой.
+class IRBIS_API ConnectionPool final
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+    friend class ConnectionLease;
+    void _giveBack (Connection *connection, double leaseMs) noexcept;
+
+public:
+    ConnectionPool (const String &connectionString, std::size_t minSize = 1, std::size_t maxSize = 8,
+                    ConnectionFactory *factory = nullptr);
+    ConnectionPool             (const ConnectionPool&) = delete; ///< Конструктор копирования.
+    ConnectionPool             (ConnectionPool&&)      = delete; ///< Конструктор перемещения.
+    ~ConnectionPool            ();
+    ConnectionPool& operator = (const ConnectionPool&) = delete; ///< Оператор копирования.
+    ConnectionPool& operator = (ConnectionPool&&)      = delete; ///< Оператор перемещения.
+
+    ConnectionLease              acquire        ();
+    ConnectionLease              acquire        (std::chrono::milliseconds timeout);
+    std::shared_ptr<RecordCache> cache          () const;
+    std::size_t                  maxSize        () const noexcept;
+    std::size_t                  minSize        () const noexcept;
+    void                         setCache       (std::shared_ptr<RecordCache> cache, CachePolicy policy = CachePolicy::Trust);
+    void                         setHedging     (std::shared_ptr<Hedging> hedging);
+    void                         setRetryPolicy (const RetryPolicy &policy);
+    void                         shutdown       ();
+    PoolStatistics               statistics     () const;
+    ConnectionLease              tryAcquire     ();
+    std::size_t                  warmUp         ();
+
+    static bool isDeadSession (int errorCode) noexcept;
+};
+
+//=========================================================
+
+/// \brief Настройки пакетной записи (BulkWriter).
+class IRBIS_API BulkWriterOptions final
+{
+public:
+    std::size_t maxBatchRecords { 100 };          ///< Предельное число записей в одном пакете.
+    std::size_t maxBatchBytes   { 512u * 1024u }; ///< Предельный размер закодированного пакета, байты.
+    std::size_t maxPending      { 1000 };         ///< Записей, принятых, но ещё не записанных (далее add() ждёт).
+    std::size_t connections     { 4 };            ///< Одновременно отсылаемых пакетов (подключений пула).
+    unsigned    retries         { 2 };            ///< Повторов пакета, не успевшего уйти на сервер.
+    std::chrono::milliseconds linger { 10 };      ///< Ожидание новых записей перед отсылкой неполного пакета.
+    bool        lockFlag        { false };        ///< Оставить записи заблокированными.
+    bool        actualize       { true };         ///< Актуализировать записи.
+    bool        parseResponse   { true };         ///< Разбирать ответ сервера (MFN, версия, статус записи).
+};
+
+/// \brief Статистика пакетной записи.
+///
+/// Снимок, полученный методом BulkWriter::statistics().
+class IRBIS_API BulkWriterStatistics final
+{
+public:
+    uint64_t accepted       { 0 }; ///< Принято записей.
+    uint64_t written        { 0 }; ///< Записано записей.
+    uint64_t failed         { 0 }; ///< Записей, которые записать не удалось.
+    uint64_t batches        { 0 }; ///< Отослано пакетов (без повторов).
+    uint64_t retries        { 0 }; ///< Повторных отсылок пакетов.
+    uint64_t bytesSent      { 0 }; ///< Отослано байт в телах пакетов.
+    uint64_t throttled      { 0 }; ///< Вызовов add(), ждавших из-за отставания сервера.
+    double   throttledMs    { 0 }; ///< Суммарное время такого ожидания, миллисекунды.
+};
+
+/// \brief Пакетная запись большого числа записей через пул подключений.
+///
+/// Записи принимаются потоком (add()), кодируются в фоновом потоке
+/// и собираются в пакеты команды "6" с ограничением по числу записей
+/// и размеру. Пакеты отсылаются одновременно через несколько подключений
+/// пула; MFN, версия и статус, возвращённые сервером, заносятся в записи.
+/// Пакет повторяется через другое подключение, только если сбой случился
+/// до начала его отсылки (нет подключения, сбой при подключении к серверу).
+/// Если связь оборвалась после начала отсылки, пакет не повторяется:
+/// сервер мог успеть его выполнить, а повтор создал бы записи
+/// с MFN = 0 заново. Такие записи получают код -100002, и их состояние
+/// на сервере следует проверить. Если сервер не успевает,
+/// add() ждёт, пока число незаписанных записей не опустится ниже
+/// BulkWriterOptions::maxPending.
+class IRBIS_API BulkWriter final
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+public:
+    /// \brief Уведомление о завершении записи (код 0 -- успех, иначе код ошибки).
+    using Callback = std::function<void (MarcRecord &record, int errorCode)>;
+
+    explicit BulkWriter     (ConnectionPool &pool, const BulkWriterOptions &options = BulkWriterOptions());
+    BulkWriter              (const BulkWriter&) = delete; ///< Конструктор копирования.
+    BulkWriter              (BulkWriter&&)      = delete; ///< Конструктор перемещения.
+    ~BulkWriter             ();
+    BulkWriter& operator =  (const BulkWriter&) = delete; ///< Оператор копирования.
+    BulkWriter& operator =  (BulkWriter&&)      = delete; ///< Оператор перемещения.
+
+    bool                 add         (MarcRecord *record);
+    bool                 add         (MarcRecord &&record);
+    void                 close       ();
+    bool                 flush       ();
+    void                 setCallback (Callback callback);
+    BulkWriterStatistics statistics  () const;
+};
+
+//=========================================================
+
+/// \brief Статистика кэша записей.
+///
+/// Снимок, полученный методом RecordCache::statistics().
+class IRBIS_API RecordCacheStatistics final
+{
+public:
+    std::size_t entries       { 0 }; ///< Записей в кэше.
+    std::size_t bytes         { 0 }; ///< Оценка занятой памяти, байты.
+    uint64_t    hits          { 0 }; ///< Записей, выданных из кэша.
+    uint64_t    misses        { 0 }; ///< Записей, не найденных в кэше.
+    uint64_t    evictions     { 0 }; ///< Записей, вытесненных из-за нехватки места.
+    uint64_t    invalidations { 0 }; ///< Записей, удалённых из-за изменения на сервере.
+    uint64_t    revalidations { 0 }; ///< Сверок версии с сервером.
+    uint64_t    stale         { 0 }; ///< Сверок, при которых версия оказалась устаревшей.
+
+    double hitRatio() const noexcept;
+};
+
+/// \brief Кэш записей на стороне клиента.
+///
+/// Хранит разобранные записи (MarcRecord и LiteRecord) с ключом
+/// "база данных + MFN" и вытесняет давно не использовавшиеся записи,
+/// когда оценка занятой памяти превышает заданный предел.
+/// Может разделяться несколькими подключениями (в том числе
+/// подключениями пула), все методы потокобезопасны.
+/// Подключение сбрасывает запись в кэше при её сохранении,
+/// удалении и актуализации.
+class IRBIS_API RecordCache final
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+public:
+    explicit RecordCache    (std::size_t capacity = 16u * 1024u * 1024u);
+    RecordCache             (const RecordCache&) = delete; ///< Конструктор копирования.
+    RecordCache             (RecordCache&&)      = delete; ///< Конструктор перемещения.
+    ~RecordCache            ();
+    RecordCache& operator = (const RecordCache&) = delete; ///< Оператор копирования.
+    RecordCache& operator = (RecordCache&&)      = delete; ///< Оператор перемещения.
+
+    std::size_t           capacity           () const noexcept;
+    void                  clear              ();
+    bool                  get                (const String &database, Mfn mfn, MarcRecord &record);
+    bool                  get                (const String &database, Mfn mfn, LiteRecord &record);
+    void                  invalidate         (const String &database, Mfn mfn);
+    void                  invalidateDatabase (const String &database);
+    void                  put                (const String &database, const MarcRecord &record);
+    void                  put                (const String &database, const LiteRecord &record);
+    bool                  revalidate         (const String &database, Mfn mfn, unsigned int version, MarcRecord &record);
+    bool                  revalidate         (const String &database, Mfn mfn, unsigned int version, LiteRecord &record);
+    RecordCacheStatistics statistics         () const;
+
+    static int versionOf (const std::vector<ByteSpan> &lines) noexcept;
+};
+
+//=========================================================
+
+/// \brief Гистограмма с логарифмическими корзинами.
+///
+/// Корзина 0 содержит нулевые значения, корзина i (i > 0) --
+/// значения от 2^(i-1) до 2^i - 1.
+class IRBIS_API Histogram final
+{
+public:
+    static const std::size_t BucketCount = 48; ///< Число корзин.
+
+    uint64_t count   { 0 }; ///< Число значений.
+    uint64_t sum     { 0 }; ///< Сумма значений.
+    uint64_t minimum { 0 }; ///< Минимальное значение.
+    uint64_t maximum { 0 }; ///< Максимальное значение.
+    std::array<uint64_t, BucketCount> buckets {}; ///< Число значений в корзинах.
+
+    void     add        (uint64_t value)        noexcept;
+    double   mean       ()                const noexcept;
+    void     merge      (const Histogram &other) noexcept;
+    uint64_t percentile (double fraction) const noexcept;
+};
+
+/// \brief Число этапов выполнения запроса (см. RequestStage).
+const std::size_t RequestStageCount = static_cast<std::size_t> (RequestStage::Error) + 1;
+
+/// \brief Отметки времени этапов выполнения одного запроса.
+///
+/// Заполняется ServerResponse, если к подключению привязан
+/// RequestMetrics. Время этапа -- от входа в него до входа
+/// в следующий этап.
+class IRBIS_API RequestTrace final
+{
+public:
+    using Clock = std::chrono::steady_clock; ///< Часы для отметок времени.
+
+    std::string   command;           ///< Код команды.
+    RequestStage  current { RequestStage::None }; ///< Текущий этап.
+    Clock::time_point mark;          ///< Момент входа в текущий этап.
+    std::array<uint64_t, RequestStageCount> micros {}; ///< Длительность этапов, микросекунды.
+    uint64_t      bytesSent     { 0 }; ///< Отослано байт.
+    uint64_t      bytesReceived { 0 }; ///< Получено байт.
+    bool          failed { false };  ///< Запрос завершился ошибкой.
+
+    RequestTrace (const std::string &command_, RequestStage stage, Clock::time_point started) noexcept;
+
+    void     enter (RequestStage stage) noexcept;
+    void     move  (RequestStage from, RequestStage to, uint64_t microseconds) noexcept;
+    uint64_t total () const noexcept;
+};
+
+/// \brief Накопленные метрики одной команды сервера.
+class IRBIS_API CommandMetrics final
+{
+public:
+    std::string command;             ///< Код команды ("C", "K", "G" и т. д.).
+    uint64_t    requests { 0 };      ///< Выполнено запросов.
+    uint64_t    errors   { 0 };      ///< Из них завершилось ошибкой.
+    std::array<Histogram, RequestStageCount> stages; ///< Длительность этапов, микросекунды.
+    Histogram   total;               ///< Полное время выполнения, микросекунды.
+    Histogram   bytesSent;           ///< Размер запросов, байты.
+    Histogram   bytesReceived;       ///< Размер ответов, байты.
+
+    const Histogram& stage (RequestStage which) const noexcept;
+};
+
+/// \brief Сбор метрик этапов выполнения запросов.
+///
+/// Привязывается к подключению через ConnectionBase::metrics
+/// (один объект может разделяться несколькими подключениями,
+/// все методы потокобезопасны). Метрики группируются по кодам команд.
+/// Позволяет понять, на что уходит время: на разрешение имени,
+/// сеть или работу сервера.
+class IRBIS_API RequestMetrics final
+{
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+public:
+    RequestMetrics             ();
+    RequestMetrics             (const RequestMetrics&) = delete; ///< Конструктор копирования.
+    RequestMetrics             (RequestMetrics&&)      = delete; ///< Конструктор перемещения.
+    ~RequestMetrics            ();
+    RequestMetrics& operator = (const RequestMetrics&) = delete; ///< Оператор копирования.
+    RequestMetrics& operator = (RequestMetrics&&)      = delete; ///< Оператор перемещения.
+
+    void                        record    (const RequestTrace &trace);
+    void                        reset     ();
+    std::vector<CommandMetrics> snapshot  () const;
+    std::string                 toText    () const;
+    void                        writeText (std::ostream &stream) const;
+
+    static const char* stageName (RequestStage stage) noexcept;
+};
+
+//=========================================================
+
 /// \brief Информация о базе данных ИРБИС.
 class IRBIS_API DatabaseInfo final
 {
@@ -2633,6 +3117,50 @@ public:
 
 //=========================================================
 
+/// \brief Результат поиска в одной базе данных (см. ConnectionSearch::searchMany).
+class IRBIS_API DatabaseFound final
+{
+public:
+    String database;              ///< Имя базы данных.
+    int total { -1 };             ///< Общее число найденных записей (-1, если не получено).
+    std::vector<FoundLine> lines; ///< Найденные записи (с текстом, если задан формат).
+    int errorCode { 0 };          ///< Код ошибки (0 -- успех).
+    std::size_t requests { 0 };   ///< Число отосланных команд "K".
+    double firstAnswerMs { 0 };   ///< Время до получения первой порции, миллисекунды.
+    double elapsedMs { 0 };       ///< Время до получения последней порции, миллисекунды.
+
+    /// \brief Поиск завершился успешно?
+    bool success() const noexcept { return this->errorCode == 0; }
+};
+
+/// \brief Результаты поиска в нескольких базах данных.
+class IRBIS_API MultiSearchResult final
+{
+public:
+    /// \brief Найденная запись вместе с именем базы данных.
+    struct Line
+    {
+        String database;    ///< Имя базы данных.
+        Mfn mfn { 0 };      ///< MFN записи.
+        String description; ///< Результат расформатирования (пустой, если формат не задан).
+    };
+
+    /// \brief Получение ключа для устранения дубликатов.
+    using KeyFunction = std::function<String (const Line &line)>;
+
+    std::vector<DatabaseFound> databases; ///< Результаты в порядке перечисления баз данных.
+
+    std::vector<Line>    distinct () const;
+    std::vector<Line>    distinct (const KeyFunction &key) const;
+    const DatabaseFound* find     (const String &database) const;
+    std::vector<Line>    merged   () const;
+    const DatabaseFound* slowest  () const;
+    bool                 success  () const noexcept;
+    int                  total    () const noexcept;
+};
+
+//=========================================================
+
 /// \brief Параметр глобальной корректировки.
 class IRBIS_API GblParameter final
 {
@@ -2818,6 +3346,7 @@ public:
     RecordField&              add         (int tag, String &&value);
     MarcRecord                clone       ()                                          const;
     void                      decode      (const StringList &lines);
+    void                      decode      (const std::vector<ByteSpan> &lines);
     bool                      deleted     ()                                          const noexcept;
     String                    encode      (const String &delimiter = L"\u001F\u001E") const;
     String                    fm          (int tag, Char code = 0)                    const noexcept;
@@ -2901,6 +3430,7 @@ class IRBIS_API NetworkException final
     : public IrbisException
 {
 public:
+    bool sent { false }; ///< Отсылка запроса успела начаться (выставляет ServerResponse).
 };
 
 //=========================================================
@@ -3176,7 +3706,9 @@ public:
     IRBIS_MAYBE_UNUSED RecordField& clear                 ();
                        RecordField  clone                 ()                                   const;
                        void         decode                (const String &line);
+                       void         decode                (ByteSpan line);
                        void         decodeBody            (const String &line);
+                       void         decodeBody            (ByteSpan line);
                        bool         empty                 ()                                   const noexcept;
                        SubField*    getFirstSubfield      (Char code)                          const noexcept;
                        String       getFirstSubfieldValue (Char code)                          const noexcept;
@@ -3285,6 +3817,53 @@ public:
 
 //=========================================================
 
+/// \brief Курсор по результатам поиска.
+///
+/// Выдаёт найденные записи по одной, догружая результаты
+/// порциями (не более MAXPACKET = 32000 строк за команду "K").
+/// Пока вызывающий код обрабатывает текущую порцию,
+/// следующая запрашивается у сервера асинхронно.
+/// В памяти одновременно находятся не более двух порций,
+/// поэтому курсор пригоден для выборок в миллионы записей.
+class IRBIS_API SearchCursor final
+{
+public:
+    static const int PageSize = 32000; ///< Максимальное число строк в ответе сервера.
+
+    SearchCursor  (ConnectionBase &connection, const SearchParameters &parameters, bool prefetch = true);
+    SearchCursor  (const SearchCursor&)            = delete;  ///< Конструктор копирования.
+    SearchCursor  (SearchCursor&&)                 = default; ///< Конструктор перемещения.
+    ~SearchCursor ()                               = default; ///< Деструктор.
+    SearchCursor& operator = (const SearchCursor&) = delete;  ///< Оператор копирования.
+    SearchCursor& operator = (SearchCursor&&)      = default; ///< Оператор перемещения.
+
+    bool        next     (Mfn &mfn);
+    bool        next     (FoundLine &line);
+    std::size_t position () const noexcept { return this->_position; } ///< Число выданных записей.
+    int         total    () const noexcept { return this->_total; }    ///< Общее число найденных записей (-1, пока неизвестно).
+
+private:
+    ConnectionBase *_connection;
+    SearchParameters _parameters;
+    bool _prefetch;
+    bool _finished { false };
+    int _total { -1 };
+    std::size_t _position { 0 };
+    Mfn _nextRecord { 1 };
+    MfnList _mfns;
+    StringList _descriptions;
+    std::size_t _index { 0 };
+    std::future<Bytes> _pending;
+
+    bool _advance();
+    bool _parsePage (ServerResponse &response);
+    void _encode (ClientQuery &query, int count) const;
+    int  _pageCount() const noexcept;
+    void _submitNext();
+};
+
+//=========================================================
+
 /// \brief Сценарий поиска.
 class IRBIS_API SearchScenario final
 {
@@ -3339,6 +3918,7 @@ public:
 
     SubField  clone    ()                    const;
     void      decode   (const String &line);
+    void      decode   (ByteSpan line);
     bool      empty    ()                    const noexcept;
     String    toString ()                    const;
     bool      verify   (bool throwOnError)   const;
@@ -3392,6 +3972,7 @@ public:
     ~TermInfo            ()                              = default; ///< Деструктор.
 
     static std::vector<TermInfo> parse (const StringList &lines);
+    static std::vector<TermInfo> parse (const std::vector<ByteSpan> &lines);
     String toString() const;
 };
 
@@ -3410,6 +3991,58 @@ public:
 
 //=========================================================
 
+/// \brief Курсор по терминам поискового словаря.
+///
+/// Выдаёт термины по одному, запрашивая их порциями командой "H"
+/// (либо "P", если задан обратный порядок). Пока вызывающий код
+/// обрабатывает текущую порцию, следующая запрашивается у сервера
+/// асинхронно. Обход заканчивается на первом термине, не начинающемся
+/// с префикса, либо в конце словаря; прервать его можно в любой момент,
+/// просто перестав вызывать next().
+class IRBIS_API TermCursor final
+{
+public:
+    static const int DefaultPageSize = 512;   ///< Размер порции по умолчанию.
+    static const int MaxPageSize     = 32000; ///< Наибольший размер порции (MAXPACKET).
+
+    TermCursor  (ConnectionBase &connection, const TermParameters &parameters,
+                 const String &prefix = String(), bool prefetch = true);
+    TermCursor  (const TermCursor&)            = delete;  ///< Конструктор копирования.
+    TermCursor  (TermCursor&&)                 = default; ///< Конструктор перемещения.
+    ~TermCursor ()                             = default; ///< Деструктор.
+    TermCursor& operator = (const TermCursor&) = delete;  ///< Оператор копирования.
+    TermCursor& operator = (TermCursor&&)      = default; ///< Оператор перемещения.
+
+    bool        next     (TermInfo &term);
+    bool        next     (int &count, std::string &text);
+    int         pageSize () const noexcept { return this->_pageSize; } ///< Размер порции.
+    std::size_t position () const noexcept { return this->_position; } ///< Число выданных терминов.
+
+private:
+    ConnectionBase *_connection;
+    String _database;
+    String _format;
+    std::string _prefix;    ///< Префикс в UTF-8.
+    std::string _startTerm; ///< Стартовый термин следующей порции в UTF-8.
+    std::string _lastTerm;  ///< Последний выданный сервером термин.
+    int _pageSize;
+    bool _reverse;
+    bool _prefetch;
+    bool _finished { false };
+    bool _continued { false }; ///< Порция начинается с последнего термина предыдущей.
+    std::size_t _position { 0 };
+    std::vector<std::pair<int, std::string>> _terms;
+    std::size_t _index { 0 };
+    std::future<Bytes> _pending;
+
+    bool _advance();
+    void _encode (ClientQuery &query) const;
+    bool _parsePage (ServerResponse &response);
+    void _submitNext();
+};
+
+//=========================================================
+
 /// \brief Постинг термина.
 class IRBIS_API TermPosting final
 {
@@ -3421,6 +4054,7 @@ public:
     String text       {   };
 
     static std::vector<TermPosting> parse (const StringList &lines);
+    static std::vector<TermPosting> parse (const std::vector<ByteSpan> &lines);
     String toString() const;
 };
 
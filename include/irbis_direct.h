@@ -1,6 +1,7 @@
 #ifndef PLUSIRBIS_IRBIS_DIRECT_H
 #define PLUSIRBIS_IRBIS_DIRECT_H
 
+#include <functional>
 #include <memory>
 
 #include "irbis.h"
@@ -9,15 +10,50 @@ namespace irbis {
 
 //=========================================================
 
+class  DatabaseScanner;
 class  DirectAccess64;
 class  File; // from irbis_private.h
+class  InvertedFile64;
+class  MemoryFile; // from irbis_internal.h
 struct MstControlRecord64;
 struct MstDictionaryEntry64;
 class  MstFile64;
 class  MstRecord64;
 struct MstRecordLeader64;
+class  ScanOptions;
+class  ScanProgress;
 class  XrfFile64;
 class  XrfRecord64;
+class  XrfView;
+
+//=========================================================
+
+/// \brief Ход просмотра базы данных (DirectAccess64::scan).
+class IRBIS_API ScanProgress final
+{
+public:
+    Mfn      total     { 0 };     ///< Сколько MFN предстоит просмотреть.
+    Mfn      processed { 0 };     ///< Сколько MFN уже просмотрено.
+    Mfn      delivered { 0 };     ///< Передано записей обработчику.
+    Mfn      skipped   { 0 };     ///< Пропущено удалённых и отсутствующих записей.
+    Mfn      errors    { 0 };     ///< Записей, которые не удалось прочитать.
+    uint64_t bytes     { 0 };     ///< Прочитано байт MST-файла.
+    bool     cancelled { false }; ///< Просмотр прерван.
+};
+
+/// \brief Настройки просмотра базы данных (DirectAccess64::scan).
+class IRBIS_API ScanOptions final
+{
+public:
+    using ProgressHandler = std::function<bool (const ScanProgress &progress)>;
+
+    Mfn         firstMfn    { 1 };    ///< Первый MFN.
+    Mfn         lastMfn     { 0 };    ///< Последний MFN (0 -- максимальный MFN базы).
+    std::size_t threads     { 0 };    ///< Рабочих потоков (0 -- по числу ядер).
+    std::size_t partition   { 4096 }; ///< MFN в одной порции, которую поток читает подряд.
+    bool        skipDeleted { true }; ///< Пропускать удалённые записи.
+    ProgressHandler progress;         ///< Вызывается после каждой порции; false -- прервать просмотр.
+};
 
 //=========================================================
 
@@ -25,19 +61,82 @@ class  XrfRecord64;
 class IRBIS_API DirectAccess64 final
 {
 public:
-    MstFile64 *mst;
-    XrfFile64 *xrf;
+    MstFile64 *mst { nullptr };
+    XrfFile64 *xrf { nullptr };
     String database;
 
-    DirectAccess64 (const String &parPath, const String &systemPath);
+    DirectAccess64 (const String &parPath, const String &systemPath, bool memoryMapped = false);
+    DirectAccess64 (const String &mstPath, const String &xrfPath, DirectAccessMode mode, bool memoryMapped = false);
     DirectAccess64 (const DirectAccess64 &) = delete; ///< Конструктор копирования.
     DirectAccess64 (const DirectAccess64 &&) = delete; ///< Конструктор перемещения.
     DirectAccess64& operator = (const DirectAccess64 &) = delete; ///< Оператор копирования.
     DirectAccess64& operator = (const DirectAccess64 &&) = delete; ///< Оператор перемещения.
     ~DirectAccess64();
 
-    MstRecord64 readMstRecord (Mfn mfn);
-    MarcRecord readRecord     (Mfn mfn);
+    using ScanHandler = std::function<bool (const MstRecord64 &record)>;
+
+    DatabaseInfo getDatabaseInfo () const;
+    Mfn          getMaxMfn       () const;
+    MstRecord64  readMstRecord   (Mfn mfn);
+    MarcRecord   readRecord      (Mfn mfn);
+    ScanProgress scan            (const ScanHandler &handler, const ScanOptions &options = ScanOptions());
+
+private:
+    void _open (const String &mstPath, const String &xrfPath, DirectAccessMode mode, bool memoryMapped);
+};
+
+//=========================================================
+
+/// \brief Просмотр базы данных с выдачей записей по одной.
+///
+/// Фоновый DirectAccess64::scan() складывает записи в очередь
+/// ограниченной длины, next() забирает их оттуда. Если потребитель
+/// не успевает, рабочие потоки ждут.
+class IRBIS_API DatabaseScanner final
+{
+public:
+    DatabaseScanner (DirectAccess64 &access, const ScanOptions &options = ScanOptions(),
+                     std::size_t capacity = 1024);
+    DatabaseScanner (const DatabaseScanner &) = delete;
+    DatabaseScanner (DatabaseScanner &&)      = delete;
+    DatabaseScanner& operator = (const DatabaseScanner &) = delete;
+    DatabaseScanner& operator = (DatabaseScanner &&)      = delete;
+    ~DatabaseScanner();
+
+    void         cancel   ();
+    bool         next     (MstRecord64 &record);
+    ScanProgress progress () const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+//=========================================================
+
+/// \brief Поисковый словарь (файлы L01, N01 и IFP).
+class IRBIS_API InvertedFile64 final
+{
+public:
+    String fileName; ///< Путь к IFP-файлу.
+
+    explicit InvertedFile64 (const String &fileName);
+    InvertedFile64             (const InvertedFile64 &) = delete;
+    InvertedFile64             (InvertedFile64 &&)      = delete;
+    InvertedFile64& operator = (const InvertedFile64 &) = delete;
+    InvertedFile64& operator = (InvertedFile64 &&)      = delete;
+    ~InvertedFile64();
+
+    bool                     findTerm      (const String &term, TermInfo &info) const;
+    std::vector<TermInfo>    listTerms     (const String &prefix, int limit = 0) const;
+    std::vector<TermPosting> readPostings  (const String &term, int first = 1, int count = 0) const;
+    std::vector<TermPosting> readPostings  (const PostingParameters &parameters) const;
+    std::vector<TermInfo>    readTermRange (const String &from, const String &to, int limit = 0) const;
+    std::vector<TermInfo>    readTerms     (const String &startTerm, int count, bool reverse = false) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
 };
 
 //=========================================================
@@ -73,6 +172,7 @@ struct IRBIS_API MstControlRecord64 final
     uint32_t locked       { 0 };
 
     void read (File *file);
+    void read (const Byte *bytes) noexcept;
 };
 #pragma pack(pop)
 
@@ -88,6 +188,7 @@ struct IRBIS_API MstDictionaryEntry64 final
     int32_t  length   { 0 };
 
     void read (File *file);
+    void read (const Byte *bytes) noexcept;
 };
 #pragma pack(pop)
 
@@ -100,17 +201,19 @@ public:
     MstControlRecord64 control;
     String fileName;
 
-    MstFile64 (const String &fileName, DirectAccessMode mode = DirectAccessMode::ReadOnly);
+    MstFile64 (const String &fileName, DirectAccessMode mode = DirectAccessMode::ReadOnly, bool memoryMapped = false);
     MstFile64 (const MstFile64 &)              = delete;
     MstFile64 (const MstFile64 &&)             = delete;
     MstFile64& operator = (const MstFile64 &)  = delete;
     MstFile64& operator = (const MstFile64 &&) = delete;
     ~MstFile64()                               = default;
 
-    MstRecord64 readRecord (int64_t position);
+    bool        memoryMapped () const noexcept { return static_cast<bool> (this->_memory); } ///< Файл спроецирован в память?
+    MstRecord64 readRecord   (int64_t position);
 
 private:
-    std::unique_ptr<File> _file;
+    std::unique_ptr<File> _file;             ///< Файл (если не спроецирован в память).
+    std::shared_ptr<MemoryFile> _memory;     ///< Проекция (разделяется с прочитанными записями).
 };
 
 //=========================================================
@@ -125,27 +228,44 @@ struct IRBIS_API MstRecordLeader64 final
     uint64_t     previous { 0 };
     uint32_t     base     { 0 };
     uint32_t     nvf      { 0 };
-    RecordStatus status   { RecordStatus::None };
     uint32_t     version  { 0 };
+    RecordStatus status   { RecordStatus::None };
 
     void read (File *file);
+    void read (const Byte *bytes) noexcept;
 };
 #pragma pack(pop)
 
 //=========================================================
 
-#pragma pack(push, 1)
+/// \brief Запись мастер-файла.
+///
+/// Справочник и поля не копируются: запись ссылается на байты
+/// в формате файла (в проекции файла либо в собственном буфере)
+/// и удерживает их, пока жива она сама или её копии.
+/// Преобразование в MarcRecord, LiteRecord и PhantomRecord
+/// выполняется по требованию.
 class IRBIS_API MstRecord64 final
 {
 public:
     MstRecordLeader64 leader;
-    uint64_t offset { 0 };
-    std::vector<MstDictionaryEntry64> dictionary;
+    uint64_t offset { 0 }; ///< Смещение записи в MST-файле.
+
+    bool                 deleted         () const;
+    MstDictionaryEntry64 entry           (std::size_t index) const noexcept;
+    std::size_t          fieldCount      () const noexcept;
+    ByteSpan             fieldData       (std::size_t index) const noexcept;
+    LiteRecord           toLiteRecord    () const;
+    MarcRecord           toMarcRecord    () const;
+    PhantomRecord        toPhantomRecord () const;
 
-    bool deleted() const;
-    MarcRecord toMarcRecord() const;
+private:
+    friend class MstFile64;
+
+    std::shared_ptr<const void> _owner; ///< Владелец байтов записи.
+    ByteSpan _dictionary;               ///< Справочник (в формате файла).
+    ByteSpan _data;                     ///< Поля переменной длины (начиная с базового адреса).
 };
-#pragma pack(pop)
 
 //=========================================================
 
@@ -161,8 +281,11 @@ public:
     XrfFile64& operator = (XrfFile64 &&)      = delete;
     ~XrfFile64()                              = default;
 
-    XrfRecord64 readRecord (Mfn mfn);
-    void writeRecord (Mfn mfn, XrfRecord64 record);
+    std::size_t   count      ();
+    const String& fileName   () const noexcept { return this->_fileName; } ///< Имя файла.
+    std::size_t   readRange  (Mfn firstMfn, std::size_t count, XrfRecord64 *records);
+    XrfRecord64   readRecord (Mfn mfn);
+    void          writeRecord (Mfn mfn, XrfRecord64 record);
 
     static XrfFile64 create (const String &fileName);
 
@@ -171,7 +294,7 @@ private:
     String _fileName;
     std::unique_ptr<File> _file;
     DirectAccessMode _mode;
-    std::mutex _mutex;
+    std::mutex _writeMutex; ///< Чтение идёт без блокировок, запись -- под ней.
 
     static Offset getOffset (Mfn mfn) noexcept;
 };
@@ -190,6 +313,38 @@ public:
     bool   deleted()  const noexcept;
     bool   locked()   const noexcept;
     String toString() const;
+
+    static void decode (const Byte *data, std::size_t count, XrfRecord64 *records) noexcept;
+};
+
+//=========================================================
+
+/// rief XRF-файл, спроецированный в память.
+class IRBIS_API XrfView final
+{
+public:
+
+    explicit XrfView (const String &fileName);
+    XrfView             (const XrfView &) = delete;
+    XrfView             (XrfView &&)      noexcept;
+    XrfView& operator = (const XrfView &) = delete;
+    XrfView& operator = (XrfView &&)      noexcept;
+    ~XrfView();
+
+    std::size_t  count        () const noexcept;
+    std::size_t  countStatus  (RecordStatus flags, Mfn maxMfn = 0) const noexcept;
+    DatabaseInfo databaseInfo (Mfn maxMfn = 0) const;
+    MfnList      listStatus   (RecordStatus flags, Mfn maxMfn = 0) const;
+    std::size_t  readRange    (Mfn firstMfn, std::size_t count, XrfRecord64 *records) const noexcept;
+    XrfRecord64  readRecord   (Mfn mfn) const;
+    RecordStatus status       (Mfn mfn) const;
+
+private:
+
+    std::unique_ptr<MemoryFile> _memory;
+    std::size_t _count { 0 };
+
+    std::size_t _limit (Mfn maxMfn) const noexcept;
 };
 
 //=========================================================
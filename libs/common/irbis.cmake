@@ -6,9 +6,12 @@ set(HeaderFiles
 
 set(CppFiles
     ../irbis/src/Address.cpp
+    ../irbis/src/AddressResolver.cpp
     ../irbis/src/AlphabetTable.cpp
+    ../irbis/src/AsyncEngine.cpp
     ../irbis/src/Author.cpp
     ../irbis/src/BookInfo.cpp
+    ../irbis/src/BulkWriter.cpp
     ../irbis/src/ByteNavigator.cpp
     ../irbis/src/ChunkedBuffer.cpp
     ../irbis/src/ClientQuery.cpp
@@ -22,8 +25,10 @@ set(CppFiles
     ../irbis/src/ConnectionFull.cpp
     ../irbis/src/ConnectionLite.cpp
     ../irbis/src/ConnectionPhantom.cpp
+    ../irbis/src/ConnectionPool.cpp
     ../irbis/src/ConnectionSearch.cpp
     ../irbis/src/DatabaseInfo.cpp
+    ../irbis/src/DatabaseScanner.cpp
     ../irbis/src/Date.cpp
     ../irbis/src/DirectAccess.cpp
     ../irbis/src/Directory.cpp
@@ -39,8 +44,10 @@ set(CppFiles
     ../irbis/src/FileSpecification.cpp
     ../irbis/src/FoundLine.cpp
     ../irbis/src/Gbl.cpp
+    ../irbis/src/Hedging.cpp
     ../irbis/src/IlfFile.cpp
     ../irbis/src/IniFile.cpp
+    ../irbis/src/InvertedFile.cpp
     ../irbis/src/IO.cpp
     ../irbis/src/irbis.cpp
     ../irbis/src/Isbn.cpp
@@ -48,9 +55,11 @@ set(CppFiles
     ../irbis/src/Lite.cpp
     ../irbis/src/Log.cpp
     ../irbis/src/MarcRecord.cpp
+    ../irbis/src/MemoryFile.cpp
     ../irbis/src/MemoryPool.cpp
     ../irbis/src/Menu.cpp
     ../irbis/src/Mst.cpp
+    ../irbis/src/MultiSearchResult.cpp
     ../irbis/src/NumberText.cpp
     ../irbis/src/OptFile.cpp
     ../irbis/src/ParFile.cpp
@@ -59,16 +68,21 @@ set(CppFiles
     ../irbis/src/ProcessInfo.cpp
     ../irbis/src/RawRecord.cpp
     ../irbis/src/Reader.cpp
+    ../irbis/src/RecordCache.cpp
     ../irbis/src/RecordField.cpp
     ../irbis/src/RecordSerializer.cpp
     ../irbis/src/RecordStatus.cpp
     ../irbis/src/Registration.cpp
+    ../irbis/src/RequestMetrics.cpp
+    ../irbis/src/RetryPolicy.cpp
     ../irbis/src/Search.cpp
+    ../irbis/src/SearchCursor.cpp
     ../irbis/src/ServerResponse.cpp
     ../irbis/src/ServerStat.cpp
     ../irbis/src/Span.cpp
     ../irbis/src/SubField.cpp
     ../irbis/src/Tcp4Socket.cpp
+    ../irbis/src/TermCursor.cpp
     ../irbis/src/TermInfo.cpp
     ../irbis/src/TermPosting.cpp
     ../irbis/src/Text.cpp
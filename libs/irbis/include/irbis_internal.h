@@ -586,6 +586,7 @@ public:
     static File openWrite       (const String &fileName);
     static File openWrite       (const std::string &fileName);
     int64_t     read            (Byte *buffer, int64_t nbytes);
+    int64_t     readAt          (uint64_t offset, Byte *buffer, int64_t nbytes);
     std::string readAll         ();
     static std::string readAll  (const String &fileName);
     int         readByte        ();
@@ -598,6 +599,7 @@ public:
     void        seek            (int64_t offset);
     File*       toHeap          ();
     int64_t     write           (const Byte* buffer, int64_t nbytes);
+    void        writeAt         (uint64_t offset, const Byte *buffer, int64_t nbytes);
     void        writeInt32      (uint32_t number);
     void        writeInt64      (uint64_t number);
 
@@ -614,6 +616,38 @@ private:
 
 //=========================================================
 
+/// \brief Файл, целиком спроецированный в память (только чтение).
+///
+/// Содержимое доступно без системных вызовов и без блокировок,
+/// поэтому читать его можно из любого числа потоков одновременно.
+/// Указатели на содержимое действительны, пока файл не закрыт.
+class IRBIS_API MemoryFile final
+{
+public:
+
+    MemoryFile() noexcept = default; ///< Конструктор по умолчанию.
+    explicit MemoryFile (const String &fileName);
+    MemoryFile (const MemoryFile &) = delete;
+    MemoryFile (MemoryFile &&other) noexcept;
+    ~MemoryFile() noexcept;
+    MemoryFile& operator = (const MemoryFile &) = delete;
+    MemoryFile& operator = (MemoryFile &&other) noexcept;
+
+    void        close  () noexcept;
+    const Byte* data   () const noexcept { return this->_data; } ///< Начало содержимого.
+    ByteSpan    slice  (uint64_t offset, uint64_t size) const;
+    uint64_t    size   () const noexcept { return this->_size; } ///< Размер файла в байтах.
+
+private:
+    Byte *_data { nullptr };
+    uint64_t _size { 0 };
+#ifdef IRBIS_WINDOWS
+    void *_mapping { nullptr };
+#endif
+};
+
+//=========================================================
+
 /// \brief Буфер, состоящий из мелких блоков.
 class IRBIS_API ChunkedBuffer final
 {
@@ -677,6 +711,23 @@ private:
 
 //=========================================================
 
+/// \brief Накопленная статистика работы клиентского сокета.
+class IRBIS_API SocketStatistics final
+{
+public:
+    uint64_t connects         { 0 }; ///< Успешных подключений к серверу.
+    uint64_t failures         { 0 }; ///< Неудачных подключений к серверу.
+    uint64_t timeouts         { 0 }; ///< Операций, прерванных по таймауту.
+    uint64_t resolveCacheHits { 0 }; ///< Имён, найденных в кэше разрешения.
+    uint64_t bytesSent        { 0 }; ///< Отослано байт.
+    uint64_t bytesReceived    { 0 }; ///< Получено байт.
+    double   resolveMs        { 0 }; ///< Суммарное время разрешения имён, миллисекунды.
+    double   connectMs        { 0 }; ///< Суммарное время установки подключений, миллисекунды.
+    double   transferMs       { 0 }; ///< Суммарное время обмена данными, миллисекунды.
+};
+
+//=========================================================
+
 /// \brief Абстрактный клиентский сокет.
 ///
 /// Наследники обязательно должны переопределить методы send и receive.
@@ -684,8 +735,14 @@ private:
 class IRBIS_API ClientSocket // abstract
 {
 public:
-    String host { L"localhost" }; ///< Адрес сервера в виде строки.
-    short port { 6666 }; ///< Номер порта сервера.
+    String host { L"localhost" };  ///< Адрес сервера в виде строки.
+    short port { 6666 };           ///< Номер порта сервера.
+    int connectTimeout { 0 };      ///< Таймаут подключения, миллисекунды (0 -- без ограничения).
+    int receiveTimeout { 0 };      ///< Предельное время получения ответа, миллисекунды (0 -- без ограничения).
+    bool noDelay { true };         ///< Отключить алгоритм Нейгла (TCP_NODELAY).
+    int receiveBufferSize { 0 };   ///< Размер приёмного буфера сокета (0 -- по умолчанию).
+    bool abortable { false };      ///< Ожидание ответа может прервать abort() из другого потока.
+    SocketStatistics statistics;   ///< Накопленная статистика.
 
     ClientSocket() = default;
     ClientSocket (ClientSocket &) = delete;
@@ -694,6 +751,7 @@ public:
     ClientSocket& operator = (ClientSocket &&) = delete;
     virtual ~ClientSocket() = default;
 
+    virtual void abort() noexcept;
     virtual void open();
     virtual void close();
 
@@ -711,6 +769,9 @@ public:
     /// Положительное число означает, что приём продолжается,
     /// и вызов нужно будет повторить для получения следующей порции.
     virtual std::size_t receive (Byte *buffer, std::size_t size) = 0;
+
+    virtual void sendParts (ByteSpan header, ByteSpan body);
+    virtual bool waitAnswer (std::chrono::steady_clock::time_point until);
 };
 
 //=========================================================
@@ -721,17 +782,21 @@ public:
 class IRBIS_API ClientQuery final
 {
     std::vector<Byte> _content;
+    std::chrono::steady_clock::time_point _started;
 
-    void _write (const Byte *bytes, std::size_t size);
-    void _write (Byte byte);
+    Byte* _grow  (std::size_t size);
+    void  _write (const Byte *bytes, std::size_t size);
+    void  _write (Byte byte);
 
 public:
+    static const std::size_t HeaderCapacity = 24; ///< Размер буфера, достаточный для заголовка пакета.
+
     ClientQuery (const ConnectionBase &connection, const std::string &commandCode);
     ClientQuery (ClientQuery &) = delete;
     ClientQuery (ClientQuery &&) = delete;
     ClientQuery& operator = (ClientQuery &) = delete;
     ClientQuery& operator = (ClientQuery &&) = delete;
-    ~ClientQuery() = default;
+    ~ClientQuery();
 
     ClientQuery& add       (int value);
     ClientQuery& add       (const FileSpecification &specification);
@@ -740,9 +805,12 @@ public:
     ClientQuery& addAnsi   (const String &text);
     bool         addFormat (const String &format);
     ClientQuery& addUtf    (const String &text);
+    ByteSpan     body      () const noexcept;
     void         dump      (std::ostream &stream) const;
     Bytes        encode    () const;
+    std::size_t  header    (Byte *buffer) const noexcept;
     ClientQuery& newLine   ();
+    std::chrono::steady_clock::time_point started () const noexcept { return this->_started; } ///< Момент начала формирования запроса.
 };
 
 //=========================================================
@@ -860,9 +928,10 @@ public:
     String serverVersion; ///< Версия сервера (в некоторых сценариях отсутствует).
 
     ServerResponse (ConnectionBase &connection, ClientQuery &query);
+    ServerResponse (ConnectionBase &connection, Bytes &&answer);
     ServerResponse (ServerResponse &)              = delete;  ///< Конструктор копирования.
     ServerResponse (ServerResponse &&)             = delete;  ///< Конструктор перемещения.
-    ~ServerResponse ()                             = default; ///< Деструктор.
+    ~ServerResponse ();
     ServerResponse& operator = (ServerResponse &)  = delete;  ///< Оператор копирования.
     ServerResponse& operator = (ServerResponse &&) = delete;  ///< Оператор перемещения.
 
@@ -870,11 +939,15 @@ public:
     bool                     checkReturnCode        (int nargs, ...);
     static ServerResponse*   emptyResonse           ();
     bool                     eot                    () const;
+    static std::size_t       expectedSize           (const Byte *data, std::size_t size) noexcept;
     std::string              getLine                ();
     std::string              getRemaining           ();
     int                      getReturnCode          ();
     String                   readAnsi               ();
     int                      readInteger            ();
+    ByteSpan                 readLineSpan           () noexcept;
+    ByteSpan                 readRemainingSpan      () noexcept;
+    std::vector<ByteSpan>    readRemainingSpans     ();
     StringList               readRemainingAnsiLines ();
     String                   readRemainingAnsiText  ();
     StringList               readRemainingUtfLines  ();
@@ -884,25 +957,77 @@ public:
     bool                     success                () const;
 
 private:
-    ConnectionBase *_connection;
-    bool _success;
-    std::size_t _position;
+    ConnectionBase *_connection { nullptr };
+    bool _success { false };
+    std::size_t _position { 0 };
     Bytes _content;
+    std::unique_ptr<RequestTrace> _trace; ///< Заполняется, только если включён сбор метрик.
 
     ServerResponse() = default; ///< Конструктор по умолчанию (для тестов)
 
+    void _enter (RequestStage stage) noexcept;
+    void _exchange (ByteSpan header, ByteSpan body, std::chrono::steady_clock::time_point deadline, bool &sent,
+                    std::chrono::steady_clock::time_point slowAt = std::chrono::steady_clock::time_point::max(),
+                    const std::function<void()> &onSlow = nullptr);
+    void _finishTrace (bool failed) noexcept;
+    void _hedgedExchange (ByteSpan header, ByteSpan body, const std::string &code,
+                          std::chrono::steady_clock::time_point deadline, bool &sent);
+    void _parseHeader();
     void _write(const Byte *bytes, std::size_t size);
 };
 
 //=========================================================
 
-/// \brief Клиентский сокет, работающий по TCP/IP v4.
+/// \brief Адрес сервера, полученный при разрешении имени.
+struct IRBIS_API ResolvedAddress final
+{
+    int family { 0 }; ///< Семейство адресов (AF_INET либо AF_INET6).
+    Bytes address;    ///< Содержимое структуры sockaddr.
+};
+
+/// \brief Разрешение имён серверов с кэшированием.
+///
+/// Использует getaddrinfo (IPv4 и IPv6). Успешные результаты хранятся
+/// в течение заданного времени, неудачные не кэшируются.
+/// Все методы потокобезопасны.
+class IRBIS_API AddressResolver final
+{
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+public:
+    explicit AddressResolver (std::chrono::milliseconds ttl = std::chrono::seconds (60));
+    AddressResolver (const AddressResolver&) = delete;
+    AddressResolver (AddressResolver&&) = delete;
+    AddressResolver& operator = (const AddressResolver&) = delete;
+    AddressResolver& operator = (AddressResolver&&) = delete;
+    ~AddressResolver();
+
+    void                         clear    ();
+    uint64_t                     hits     () const;
+    static AddressResolver&      instance ();
+    uint64_t                     misses   () const;
+    std::vector<ResolvedAddress> resolve  (const String &host, short port, bool *cached = nullptr);
+    void                         setTtl   (std::chrono::milliseconds ttl);
+    std::chrono::milliseconds    ttl      () const;
+};
+
+//=========================================================
+
+/// \brief Сокет TCP (IPv4 либо IPv6, несмотря на название).
+///
+/// Адрес сервера берётся из AddressResolver, подключение выполняется
+/// в неблокирующем режиме с таймаутом connectTimeout, получение
+/// ответа ограничено сроком receiveTimeout, отсчитываемым от конца
+/// отсылки запроса.
 class IRBIS_API Tcp4Socket final
     : public ClientSocket
 {
     struct TcpInternals;
     std::unique_ptr<TcpInternals> _impl;
 
+    void _startDeadline() noexcept;
+
 public:
     explicit Tcp4Socket (const String &host=L"localhost", short port=6666); ///< Конструктор
     Tcp4Socket (const Tcp4Socket &) = delete; ///< Конструктор копирования.
@@ -911,10 +1036,71 @@ public:
     Tcp4Socket& operator = (const Tcp4Socket &) = delete; ///< Оператор коприрования.
     Tcp4Socket& operator = (Tcp4Socket &&)      = delete; ///< Оператор перемещения.
 
+    void abort () noexcept override;
     void open () override;
     void close () override;
     void send (const Byte *buffer, std::size_t size) override;
     std::size_t receive(Byte *buffer, std::size_t size) override;
+    void sendParts (ByteSpan header, ByteSpan body) override;
+    bool waitAnswer (std::chrono::steady_clock::time_point until) override;
+};
+
+//=========================================================
+
+/// \brief Параметры исполнения отдельного запроса движком AsyncEngine.
+struct IRBIS_API AsyncOptions final
+{
+    int  connectTimeout    { 0 };    ///< Таймаут подключения, миллисекунды (0 -- без ограничения).
+    int  receiveTimeout    { 0 };    ///< Предельное время обмена после подключения, миллисекунды (0 -- без ограничения).
+    bool noDelay           { true }; ///< Отключить алгоритм Нейгла (TCP_NODELAY).
+    int  receiveBufferSize { 0 };    ///< Размер приёмного буфера сокета (0 -- по умолчанию).
+
+    static AsyncOptions from (const ConnectionBase &connection) noexcept;
+};
+
+//=========================================================
+
+/// \brief Движок асинхронного выполнения клиентских запросов.
+///
+/// Закодированные пакеты запросов передаются реактору, который
+/// на неблокирующих сокетах (epoll в Linux) подключается к серверу,
+/// отсылает пакет, вычитывает ответ до закрытия соединения сервером
+/// и вызывает обработчик завершения. Число одновременно открытых
+/// сокетов на один сервер ограничено, лишние запросы ждут в очереди.
+/// На прочих платформах те же запросы выполняются блокирующими
+/// сокетами на фиксированном пуле потоков.
+///
+/// Обработчики завершения вызываются в потоке реактора,
+/// поэтому они должны быть короткими и не должны блокироваться.
+///
+/// Сроки из AsyncOptions соблюдает сам реактор: запрос, не успевший
+/// подключиться либо обменяться данными, завершается с NetworkException.
+class IRBIS_API AsyncEngine final
+{
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+
+public:
+    /// \brief Обработчик завершения: ответ сервера либо исключение.
+    using Completion = std::function<void (Bytes &&answer, std::exception_ptr error)>;
+
+    explicit AsyncEngine (std::size_t threadCount = 2, std::size_t socketsPerServer = 32);
+    AsyncEngine (const AsyncEngine &) = delete; ///< Конструктор копирования.
+    AsyncEngine (AsyncEngine &&)      = delete; ///< Конструктор перемещения.
+    ~AsyncEngine();
+    AsyncEngine& operator = (const AsyncEngine &) = delete; ///< Оператор копирования.
+    AsyncEngine& operator = (AsyncEngine &&)      = delete; ///< Оператор перемещения.
+
+    static AsyncEngine& instance();
+
+    std::size_t        inFlight         () const;
+    std::size_t        queued           () const;
+    std::size_t        socketsPerServer () const noexcept;
+    void               submit           (const String &host, short port, Bytes &&packet, Completion completion,
+                                         const AsyncOptions &options = AsyncOptions());
+    std::future<Bytes> submit           (const String &host, short port, Bytes &&packet,
+                                         const AsyncOptions &options = AsyncOptions());
+    std::size_t        threadCount      () const noexcept;
 };
 
 //=========================================================
@@ -1235,6 +1421,7 @@ IRBIS_API String trim      (const String &text);
 IRBIS_API int IRBIS_CALL fastParse32 (const String &text)                   noexcept;
 IRBIS_API int IRBIS_CALL fastParse32 (CharSpan text)                        noexcept;
 IRBIS_API int IRBIS_CALL fastParse32 (WideSpan text)                        noexcept;
+IRBIS_API int IRBIS_CALL fastParse32 (ByteSpan text)                        noexcept;
 IRBIS_API int IRBIS_CALL fastParse32 (const Char *text)                     noexcept;
 IRBIS_API int IRBIS_CALL fastParse32 (const Char *text, std::size_t length) noexcept;
 IRBIS_API int IRBIS_CALL fastParse32 (const std::string &text)              noexcept;
@@ -1292,6 +1479,23 @@ IRBIS_API String IRBIS_CALL prepareFormat  (const String &text);
 template<typename T>
 bool isDigit(T c)  { return (c >= '0') && (c <= '9'); }
 
+// Числа в MST- и XRF-файлах хранятся в сетевом порядке байт,
+// 64-битные -- двумя 32-битными словами, младшее первым.
+// Компилятор сводит сдвиги к одной инструкции перестановки байт.
+
+inline uint32_t readBig32 (const Byte *bytes) noexcept
+{
+    return (static_cast<uint32_t> (bytes[0]) << 24u)
+           | (static_cast<uint32_t> (bytes[1]) << 16u)
+           | (static_cast<uint32_t> (bytes[2]) << 8u)
+           | static_cast<uint32_t> (bytes[3]);
+}
+
+inline uint64_t readBig64 (const Byte *bytes) noexcept
+{
+    return (static_cast<uint64_t> (readBig32 (bytes + 4)) << 32u) + readBig32 (bytes);
+}
+
 //=========================================================
 // borrow from C++14
 
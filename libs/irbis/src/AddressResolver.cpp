@@ -0,0 +1,198 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <unordered_map>
+
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#ifdef IRBIS_WINDOWS
+#pragma comment (lib, "ws2_32.lib")
+#endif
+
+#else
+
+#include <sys/socket.h>
+#include <netdb.h>
+
+#endif
+
+///
+/// \file AddressResolver.cpp
+/// \brief Разрешение имён серверов с кэшированием.
+///
+
+/// \class irbis::AddressResolver
+/// \details Каждая команда ИРБИС64 выполняется на свежем
+/// TCP-подключении, поэтому без кэша имя сервера разрешалось бы
+/// заново на каждую команду (с походом к DNS-серверу).
+/// Кэш хранит все адреса, возвращённые getaddrinfo, в течение
+/// ttl() после разрешения.
+
+namespace irbis {
+
+/// \brief Внутреннее состояние кэша имён.
+struct AddressResolver::Impl
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        Clock::time_point expires;
+        std::vector<ResolvedAddress> addresses;
+    };
+
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
+
+    WSADATA wsaData;
+
+#endif
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::chrono::milliseconds ttl;
+    uint64_t hits { 0 };
+    uint64_t misses { 0 };
+};
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param ttl Время хранения разрешённого имени.
+AddressResolver::AddressResolver (std::chrono::milliseconds ttl)
+    : _impl { new Impl }
+{
+    this->_impl->ttl = ttl;
+
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
+
+    if (WSAStartup (0x0202, &this->_impl->wsaData)) {
+        throw NetworkException();
+    }
+
+#endif
+}
+
+/// \brief Деструктор.
+AddressResolver::~AddressResolver()
+{
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
+
+    WSACleanup();
+
+#endif
+}
+
+/// \brief Очистка кэша.
+void AddressResolver::clear()
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    this->_impl->entries.clear();
+}
+
+/// \brief Число обращений, обслуженных кэшем.
+uint64_t AddressResolver::hits() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->hits;
+}
+
+/// \brief Общий для всего процесса экземпляр.
+AddressResolver& AddressResolver::instance()
+{
+    static AddressResolver result;
+    return result;
+}
+
+/// \brief Число обращений, потребовавших вызова getaddrinfo.
+uint64_t AddressResolver::misses() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->misses;
+}
+
+/// \brief Разрешение имени сервера.
+/// \param host Имя либо адрес (IPv4 или IPv6) сервера.
+/// \param port Номер порта.
+/// \param cached Сюда помещается признак того, что адреса взяты из кэша
+/// (может быть nullptr).
+/// \return Непустой список адресов в порядке, предложенном системой.
+/// \throw NetworkException Имя не удалось разрешить.
+std::vector<ResolvedAddress> AddressResolver::resolve (const String &host, short port, bool *cached)
+{
+    auto &impl = *this->_impl;
+    const auto name = unicode_to_cp1251 (host);
+    const auto service = std::to_string (static_cast<unsigned short> (port));
+    const auto key = name + ":" + service;
+
+    {
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        const auto found = impl.entries.find (key);
+        if (found != impl.entries.end()) {
+            if (found->second.expires > Impl::Clock::now()) {
+                impl.hits++;
+                if (cached != nullptr) {
+                    *cached = true;
+                }
+                return found->second.addresses;
+            }
+            impl.entries.erase (found);
+        }
+        impl.misses++;
+    }
+
+    if (cached != nullptr) {
+        *cached = false;
+    }
+
+    // Разрешение выполняется без блокировки: оно может быть долгим.
+    addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *list = nullptr;
+    if (::getaddrinfo (name.c_str(), service.c_str(), &hints, &list) != 0 || list == nullptr) {
+        throw NetworkException();
+    }
+
+    std::vector<ResolvedAddress> result;
+    for (auto item = list; item != nullptr; item = item->ai_next) {
+        ResolvedAddress address;
+        address.family = item->ai_family;
+        const auto start = reinterpret_cast<const Byte*> (item->ai_addr);
+        address.address.assign (start, start + item->ai_addrlen);
+        result.push_back (std::move (address));
+    }
+    ::freeaddrinfo (list);
+
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    if (impl.ttl.count() > 0) {
+        impl.entries[key] = Impl::Entry { Impl::Clock::now() + impl.ttl, result };
+    }
+
+    return result;
+}
+
+/// \brief Установка времени хранения разрешённых имён.
+/// \param ttl Время хранения (0 отключает кэширование).
+///
+/// Уже сохранённые имена не затрагиваются.
+void AddressResolver::setTtl (std::chrono::milliseconds ttl)
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    this->_impl->ttl = ttl;
+}
+
+/// \brief Время хранения разрешённых имён.
+std::chrono::milliseconds AddressResolver::ttl() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->ttl;
+}
+
+}
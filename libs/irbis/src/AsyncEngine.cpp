@@ -0,0 +1,665 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <set>
+
+#if defined(__linux__)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+#define IRBIS_EPOLL
+
+#endif
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4068)
+#endif
+
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+namespace irbis {
+
+using Clock = std::chrono::steady_clock;
+
+/// \brief Запрос, находящийся в обработке.
+struct AsyncOperation final
+{
+    std::string server;                ///< Ключ сервера: "host:port".
+    String host;                       ///< Адрес сервера.
+    short port { 0 };                  ///< Порт сервера.
+    Bytes packet;                      ///< Закодированный пакет запроса.
+    std::size_t sent { 0 };            ///< Сколько байт уже отослано.
+    Bytes answer;                      ///< Накопленный ответ сервера.
+    AsyncEngine::Completion completion;
+    AsyncOptions options;              ///< Сроки и параметры сокета.
+
+#ifdef IRBIS_EPOLL
+
+    sockaddr_storage address {};
+    socklen_t addressLength { 0 };
+    int socket { -1 };
+    bool connected { false };
+    bool receiving { false };
+    Clock::time_point deadline { Clock::time_point::max() }; ///< Срок текущей стадии.
+
+#endif
+};
+
+/// \brief Очередь и счётчик открытых сокетов для одного сервера.
+struct AsyncServer final
+{
+    std::size_t active { 0 };
+    std::deque<AsyncOperation*> pending;
+};
+
+//=========================================================
+
+#ifdef IRBIS_EPOLL
+
+/// \brief Реактор: поток с собственным экземпляром epoll.
+struct AsyncReactor final
+{
+    int epoll { -1 };
+    int wakeup { -1 };
+    std::mutex mutex;
+    std::vector<AsyncOperation*> incoming;
+    std::set<AsyncOperation*> live; ///< Запросы с открытыми сокетами.
+    std::thread thread;
+};
+
+#endif
+
+struct AsyncEngine::Impl
+{
+    std::size_t threadCount;
+    std::size_t socketsPerServer;
+
+    mutable std::mutex mutex;
+    std::map<std::string, AsyncServer> servers;
+    std::size_t inFlight { 0 };
+    std::size_t queued { 0 };
+    std::atomic<bool> stopping { false };
+
+#ifdef IRBIS_EPOLL
+
+    std::vector<std::unique_ptr<AsyncReactor>> reactors;
+    std::size_t nextReactor { 0 };
+
+    void run (AsyncReactor &reactor);
+    void start (AsyncReactor &reactor, AsyncOperation *operation);
+    bool pump (AsyncOperation *operation, uint32_t events);
+    void close (AsyncReactor &reactor, AsyncOperation *operation);
+    int  timeout (const AsyncReactor &reactor) const;
+    void expire (AsyncReactor &reactor);
+
+#else
+
+    std::condition_variable ready;
+    std::deque<AsyncOperation*> runnable;
+    std::vector<std::thread> workers;
+
+    void work();
+
+#endif
+
+    void dispatch (AsyncOperation *operation);
+    void finish (AsyncOperation *operation, std::exception_ptr error);
+};
+
+/// \brief Передача запроса на исполнение (место для сокета уже выделено).
+/// \warning Вызывается под захватом мьютекса.
+void AsyncEngine::Impl::dispatch (AsyncOperation *operation)
+{
+#ifdef IRBIS_EPOLL
+
+    auto &reactor = *this->reactors [this->nextReactor++ % this->reactors.size()];
+    {
+        std::lock_guard<std::mutex> guard (reactor.mutex);
+        reactor.incoming.push_back (operation);
+    }
+    const uint64_t one = 1;
+    const auto written = ::write (reactor.wakeup, &one, sizeof (one));
+    (void) written;
+
+#else
+
+    this->runnable.push_back (operation);
+    this->ready.notify_one();
+
+#endif
+}
+
+/// \brief Завершение запроса: освобождение места для сокета,
+/// запуск следующего запроса из очереди и вызов обработчика.
+void AsyncEngine::Impl::finish (AsyncOperation *operation, std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> guard (this->mutex);
+        this->inFlight--;
+        auto &server = this->servers [operation->server];
+        server.active--;
+        if (!server.pending.empty() && !this->stopping) {
+            auto next = server.pending.front();
+            server.pending.pop_front();
+            server.active++;
+            this->queued--;
+            this->inFlight++;
+            this->dispatch (next);
+        }
+    }
+
+    std::unique_ptr<AsyncOperation> guard (operation);
+    try {
+        operation->completion (std::move (operation->answer), error);
+    }
+    catch (...) {
+        // Исключения из обработчика некому перехватить
+    }
+}
+
+//=========================================================
+
+#ifdef IRBIS_EPOLL
+
+/// \brief Открытие неблокирующего сокета и начало подключения.
+void AsyncEngine::Impl::start (AsyncReactor &reactor, AsyncOperation *operation)
+{
+    const auto family = operation->address.ss_family;
+    operation->socket = ::socket (family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (operation->socket < 0) {
+        this->finish (operation, std::make_exception_ptr (NetworkException()));
+        return;
+    }
+
+    const auto &options = operation->options;
+    if (options.noDelay) {
+        const int flag = 1;
+        ::setsockopt (operation->socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof (flag));
+    }
+    if (options.receiveBufferSize > 0) {
+        const int size = options.receiveBufferSize;
+        ::setsockopt (operation->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+    }
+    if (options.connectTimeout > 0) {
+        operation->deadline = Clock::now() + std::chrono::milliseconds (options.connectTimeout);
+    }
+
+    const auto address = reinterpret_cast<const sockaddr*> (&operation->address);
+    if (::connect (operation->socket, address, operation->addressLength) != 0
+        && errno != EINPROGRESS) {
+        this->close (reactor, operation);
+        this->finish (operation, std::make_exception_ptr (NetworkException()));
+        return;
+    }
+
+    epoll_event event {};
+    event.events = EPOLLOUT;
+    event.data.ptr = operation;
+    if (::epoll_ctl (reactor.epoll, EPOLL_CTL_ADD, operation->socket, &event) != 0) {
+        this->close (reactor, operation);
+        this->finish (operation, std::make_exception_ptr (NetworkException()));
+        return;
+    }
+    reactor.live.insert (operation);
+}
+
+/// \brief Продвижение запроса по событию epoll.
+/// \return true, если запрос ещё не завершён.
+/// \throw NetworkException Ошибка сети.
+bool AsyncEngine::Impl::pump (AsyncOperation *operation, uint32_t events)
+{
+    if (!operation->receiving) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            throw NetworkException();
+        }
+
+        if (!operation->connected) {
+            int error = 0;
+            socklen_t length = sizeof (error);
+            ::getsockopt (operation->socket, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                throw NetworkException();
+            }
+
+            // Подключились: дальше срок отсчитывается на весь обмен.
+            operation->connected = true;
+            const auto receiveTimeout = operation->options.receiveTimeout;
+            operation->deadline = receiveTimeout > 0
+                    ? Clock::now() + std::chrono::milliseconds (receiveTimeout)
+                    : Clock::time_point::max();
+        }
+
+        while (operation->sent < operation->packet.size()) {
+            const auto data = operation->packet.data() + operation->sent;
+            const auto size = operation->packet.size() - operation->sent;
+            const auto written = ::send (operation->socket, data, size, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw NetworkException();
+            }
+            operation->sent += static_cast<std::size_t> (written);
+        }
+
+        operation->receiving = true;
+        Bytes().swap (operation->packet);
+        return true; // ждём EPOLLIN
+    }
+
+    Byte buffer[16 * 1024];
+    while (true) {
+        const auto received = ::recv (operation->socket, buffer, sizeof (buffer), 0);
+        if (received > 0) {
+            if (operation->answer.empty()) {
+                operation->answer.reserve (ServerResponse::expectedSize (buffer, static_cast<std::size_t> (received)));
+            }
+            operation->answer.insert (operation->answer.end(), buffer, buffer + received);
+            continue;
+        }
+        if (received == 0) {
+            return false; // сервер закончил передачу
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        throw NetworkException();
+    }
+}
+
+/// \brief Закрытие сокета запроса.
+void AsyncEngine::Impl::close (AsyncReactor &reactor, AsyncOperation *operation)
+{
+    if (operation->socket >= 0) {
+        ::epoll_ctl (reactor.epoll, EPOLL_CTL_DEL, operation->socket, nullptr);
+        ::close (operation->socket);
+        operation->socket = -1;
+    }
+    reactor.live.erase (operation);
+}
+
+/// \brief Время до ближайшего срока среди запросов реактора.
+/// \return Миллисекунды для epoll_wait (-1 -- сроков нет).
+int AsyncEngine::Impl::timeout (const AsyncReactor &reactor) const
+{
+    auto nearest = Clock::time_point::max();
+    for (const auto operation : reactor.live) {
+        nearest = std::min (nearest, operation->deadline);
+    }
+    if (nearest == Clock::time_point::max()) {
+        return -1;
+    }
+
+    // Округляем вверх, чтобы не просыпаться чуть раньше срока.
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+            (nearest - Clock::now() + std::chrono::microseconds (999)).count();
+    return static_cast<int> (std::max<int64_t> (0, std::min<int64_t> (left, INT32_MAX)));
+}
+
+/// \brief Завершение запросов, у которых истёк срок, с NetworkException.
+void AsyncEngine::Impl::expire (AsyncReactor &reactor)
+{
+    const auto now = Clock::now();
+    std::vector<AsyncOperation*> expired;
+    for (const auto operation : reactor.live) {
+        if (operation->deadline <= now) {
+            expired.push_back (operation);
+        }
+    }
+    for (const auto operation : expired) {
+        this->close (reactor, operation);
+        this->finish (operation, std::make_exception_ptr (NetworkException()));
+    }
+}
+
+/// \brief Цикл реактора.
+void AsyncEngine::Impl::run (AsyncReactor &reactor)
+{
+    epoll_event events[64];
+    while (!this->stopping) {
+        const auto count = ::epoll_wait (reactor.epoll, events, 64, this->timeout (reactor));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (auto i = 0; i < count; ++i) {
+            const auto &event = events[i];
+            if (event.data.ptr == nullptr) {
+                uint64_t counter;
+                const auto got = ::read (reactor.wakeup, &counter, sizeof (counter));
+                (void) got;
+                std::vector<AsyncOperation*> incoming;
+                {
+                    std::lock_guard<std::mutex> guard (reactor.mutex);
+                    incoming.swap (reactor.incoming);
+                }
+                for (auto operation : incoming) {
+                    this->start (reactor, operation);
+                }
+                continue;
+            }
+
+            const auto operation = static_cast<AsyncOperation*> (event.data.ptr);
+            try {
+                const auto wasReceiving = operation->receiving;
+                if (this->pump (operation, event.events)) {
+                    if (!wasReceiving && operation->receiving) {
+                        epoll_event change {};
+                        change.events = EPOLLIN | EPOLLRDHUP;
+                        change.data.ptr = operation;
+                        ::epoll_ctl (reactor.epoll, EPOLL_CTL_MOD, operation->socket, &change);
+                    }
+                    continue;
+                }
+                this->close (reactor, operation);
+                this->finish (operation, nullptr);
+            }
+            catch (...) {
+                this->close (reactor, operation);
+                this->finish (operation, std::current_exception());
+            }
+        }
+
+        this->expire (reactor);
+    }
+}
+
+#else
+
+/// \brief Рабочий поток для платформ без epoll: блокирующий обмен.
+void AsyncEngine::Impl::work()
+{
+    while (true) {
+        AsyncOperation *operation;
+        {
+            std::unique_lock<std::mutex> lock (this->mutex);
+            this->ready.wait (lock, [this] {
+                return this->stopping || !this->runnable.empty();
+            });
+            if (this->runnable.empty()) {
+                return;
+            }
+            operation = this->runnable.front();
+            this->runnable.pop_front();
+        }
+
+        try {
+            Tcp4Socket socket (operation->host, operation->port);
+            socket.connectTimeout = operation->options.connectTimeout;
+            socket.receiveTimeout = operation->options.receiveTimeout;
+            socket.noDelay = operation->options.noDelay;
+            socket.receiveBufferSize = operation->options.receiveBufferSize;
+            socket.open();
+            socket.send (operation->packet.data(), operation->packet.size());
+            Byte buffer[16 * 1024];
+            while (true) {
+                const auto received = socket.receive (buffer, sizeof (buffer));
+                if (received == 0 || received > sizeof (buffer)) {
+                    break;
+                }
+                operation->answer.insert (operation->answer.end(), buffer, buffer + received);
+            }
+            socket.close();
+            this->finish (operation, nullptr);
+        }
+        catch (...) {
+            this->finish (operation, std::current_exception());
+        }
+    }
+}
+
+#endif
+
+//=========================================================
+
+/// \brief Параметры запроса, взятые из настроек подключения.
+/// \param connection Подключение.
+/// \return Сроки и параметры сокета.
+AsyncOptions AsyncOptions::from (const ConnectionBase &connection) noexcept
+{
+    AsyncOptions result;
+    result.connectTimeout    = connection.connectTimeout;
+    result.receiveTimeout    = connection.receiveTimeout;
+    result.noDelay           = connection.noDelay;
+    result.receiveBufferSize = connection.receiveBufferSize;
+    return result;
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param threadCount Число потоков реактора.
+/// \param socketsPerServer Предельное число одновременно открытых сокетов на один сервер.
+/// \throw NetworkException Не удалось создать epoll.
+AsyncEngine::AsyncEngine (std::size_t threadCount, std::size_t socketsPerServer)
+    : _impl { new Impl }
+{
+    auto &impl = *this->_impl;
+    impl.threadCount = std::max (threadCount, static_cast<std::size_t> (1));
+    impl.socketsPerServer = std::max (socketsPerServer, static_cast<std::size_t> (1));
+
+#ifdef IRBIS_EPOLL
+
+    for (std::size_t i = 0; i < impl.threadCount; ++i) {
+        std::unique_ptr<AsyncReactor> reactor (new AsyncReactor);
+        reactor->epoll = ::epoll_create1 (EPOLL_CLOEXEC);
+        reactor->wakeup = ::eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reactor->epoll < 0 || reactor->wakeup < 0) {
+            throw NetworkException();
+        }
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        ::epoll_ctl (reactor->epoll, EPOLL_CTL_ADD, reactor->wakeup, &event);
+        const auto raw = reactor.get();
+        reactor->thread = std::thread ([this, raw] { this->_impl->run (*raw); });
+        impl.reactors.push_back (std::move (reactor));
+    }
+
+#else
+
+    for (std::size_t i = 0; i < impl.socketsPerServer; ++i) {
+        impl.workers.emplace_back ([this] { this->_impl->work(); });
+    }
+
+#endif
+}
+
+/// \brief Деструктор.
+///
+/// Запросы, не дождавшиеся исполнения, завершаются с NetworkException.
+AsyncEngine::~AsyncEngine()
+{
+    auto &impl = *this->_impl;
+    std::vector<AsyncOperation*> abandoned;
+    {
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        impl.stopping = true;
+        for (auto &pair : impl.servers) {
+            for (auto operation : pair.second.pending) {
+                abandoned.push_back (operation);
+            }
+            pair.second.pending.clear();
+        }
+    }
+
+#ifdef IRBIS_EPOLL
+
+    for (auto &reactor : impl.reactors) {
+        const uint64_t one = 1;
+        const auto written = ::write (reactor->wakeup, &one, sizeof (one));
+        (void) written;
+        if (reactor->thread.joinable()) {
+            reactor->thread.join();
+        }
+    }
+
+    for (auto &reactor : impl.reactors) {
+        for (auto operation : reactor->incoming) {
+            abandoned.push_back (operation);
+        }
+        for (auto operation : reactor->live) {
+            ::close (operation->socket);
+            abandoned.push_back (operation);
+        }
+        ::close (reactor->wakeup);
+        ::close (reactor->epoll);
+    }
+
+#else
+
+    impl.ready.notify_all();
+    for (auto &worker : impl.workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+#endif
+
+    for (auto operation : abandoned) {
+        std::unique_ptr<AsyncOperation> guard (operation);
+        try {
+            operation->completion (Bytes(), std::make_exception_ptr (NetworkException()));
+        }
+        catch (...) {
+            // Do nothing
+        }
+    }
+}
+
+/// \brief Общий для всей программы экземпляр движка.
+AsyncEngine& AsyncEngine::instance()
+{
+    static AsyncEngine engine;
+    return engine;
+}
+
+/// \brief Число запросов, исполняемых в данный момент (с открытыми сокетами).
+std::size_t AsyncEngine::inFlight() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->inFlight;
+}
+
+/// \brief Число запросов, ожидающих свободного сокета.
+std::size_t AsyncEngine::queued() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->queued;
+}
+
+/// \brief Предельное число одновременно открытых сокетов на один сервер.
+std::size_t AsyncEngine::socketsPerServer() const noexcept
+{
+    return this->_impl->socketsPerServer;
+}
+
+/// \brief Постановка запроса в очередь на исполнение.
+/// \param host Адрес сервера.
+/// \param port Порт сервера.
+/// \param packet Закодированный пакет запроса (см. ClientQuery::encode).
+/// \param completion Обработчик завершения.
+/// \param options Сроки и параметры сокета.
+///
+/// Разрешение имени сервера выполняется в вызывающем потоке
+/// (через общий кэш AddressResolver).
+/// Если имя разрешить не удалось, обработчик вызывается немедленно
+/// с NetworkException.
+void AsyncEngine::submit (const String &host, short port, Bytes &&packet, Completion completion,
+        const AsyncOptions &options)
+{
+    std::unique_ptr<AsyncOperation> operation (new AsyncOperation);
+    operation->host = host;
+    operation->port = port;
+    operation->server = toUtf (host) + ":" + std::to_string (port);
+    operation->packet = std::move (packet);
+    operation->completion = std::move (completion);
+    operation->options = options;
+
+#ifdef IRBIS_EPOLL
+
+    std::vector<ResolvedAddress> found;
+    try {
+        found = AddressResolver::instance().resolve (host, port);
+    }
+    catch (...) {
+        operation->completion (Bytes(), std::current_exception());
+        return;
+    }
+    const auto &first = found.front().address;
+    std::memcpy (&operation->address, first.data(), first.size());
+    operation->addressLength = static_cast<socklen_t> (first.size());
+
+#endif
+
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    auto &impl = *this->_impl;
+    if (impl.stopping) {
+        throw NetworkException();
+    }
+
+    auto &server = impl.servers [operation->server];
+    if (server.active < impl.socketsPerServer) {
+        server.active++;
+        impl.inFlight++;
+        impl.dispatch (operation.release());
+    }
+    else {
+        impl.queued++;
+        server.pending.push_back (operation.release());
+    }
+}
+
+/// \brief Постановка запроса в очередь на исполнение.
+/// \param host Адрес сервера.
+/// \param port Порт сервера.
+/// \param packet Закодированный пакет запроса (см. ClientQuery::encode).
+/// \param options Сроки и параметры сокета.
+/// \return Будущий ответ сервера (либо NetworkException).
+std::future<Bytes> AsyncEngine::submit (const String &host, short port, Bytes &&packet,
+        const AsyncOptions &options)
+{
+    auto promise = std::make_shared<std::promise<Bytes>>();
+    auto result = promise->get_future();
+    this->submit (host, port, std::move (packet), [promise] (Bytes &&answer, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception (error);
+        }
+        else {
+            promise->set_value (std::move (answer));
+        }
+    }, options);
+    return result;
+}
+
+/// \brief Число потоков реактора.
+std::size_t AsyncEngine::threadCount() const noexcept
+{
+    return this->_impl->threadCount;
+}
+
+}
@@ -0,0 +1,401 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4068)
+#endif
+
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+///
+/// \file BulkWriter.cpp
+/// \brief Пакетная запись записей через пул подключений.
+///
+
+/// \class irbis::BulkWriter
+/// \details Устройство: add() кладёт запись во входную очередь,
+/// поток кодирования превращает записи в строки команды "6"
+/// и собирает из них пакеты, а connections потоков отсылки
+/// забирают готовые пакеты, арендуя для каждого подключение пула.
+/// Неполный пакет отсылается, если новых записей не поступало
+/// в течение linger, а также по flush() и close().
+
+namespace irbis {
+
+using BulkClock = std::chrono::steady_clock;
+
+/// \brief Внутреннее состояние.
+struct BulkWriter::Impl
+{
+    /// \brief Запись, ожидающая сохранения.
+    struct Item
+    {
+        MarcRecord *record { nullptr };
+        std::unique_ptr<MarcRecord> owned; ///< Запись, переданная во владение.
+        std::string database;              ///< Имя базы в ANSI (пустое -- база подключения).
+        std::string encoded;               ///< Запись в UTF-8 (с разделителями ИРБИС).
+    };
+
+    /// \brief Пакет для одной команды "6".
+    struct Batch
+    {
+        std::vector<Item> items;
+        std::size_t bytes { 0 };
+    };
+
+    ConnectionPool &pool;
+    BulkWriterOptions options;
+    Callback callback;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Item> incoming;
+    std::deque<Batch> batches;
+    std::size_t pending { 0 };  ///< Принятые, но ещё не записанные.
+    std::size_t flushing { 0 }; ///< Потоков, ждущих в flush().
+    bool stopping { false };
+    bool encoded { false };     ///< Поток кодирования завершил работу.
+    bool failedSinceFlush { false };
+    BulkWriterStatistics stats;
+    std::thread encoder;
+    std::vector<std::thread> senders;
+
+    Impl (ConnectionPool &pool_, const BulkWriterOptions &options_)
+        : pool { pool_ }, options { options_ }
+    {
+        this->options.maxBatchRecords = std::max (this->options.maxBatchRecords, static_cast<std::size_t> (1));
+        this->options.maxPending = std::max (this->options.maxPending, static_cast<std::size_t> (1));
+        this->options.connections = std::max (this->options.connections, static_cast<std::size_t> (1));
+    }
+
+    bool accept    (Item &&item);
+    void complete  (Batch &batch, int errorCode);
+    void encodeLoop();
+    int  send      (Batch &batch);
+    void sendLoop  ();
+};
+
+/// \brief Постановка записи во входную очередь.
+/// Ждёт, пока сервер не догонит, если незаписанных записей слишком много.
+bool BulkWriter::Impl::accept (Item &&item)
+{
+    std::unique_lock<std::mutex> lock (this->mutex);
+    if (this->pending >= this->options.maxPending && !this->stopping) {
+        const auto started = BulkClock::now();
+        this->changed.wait (lock, [this] { return this->pending < this->options.maxPending || this->stopping; });
+        this->stats.throttled++;
+        this->stats.throttledMs += std::chrono::duration<double, std::milli> (BulkClock::now() - started).count();
+    }
+    if (this->stopping) {
+        return false;
+    }
+
+    this->incoming.push_back (std::move (item));
+    this->pending++;
+    this->stats.accepted++;
+    this->changed.notify_all();
+    return true;
+}
+
+/// \brief Завершение пакета: уведомление о записях, освобождение места в очереди.
+void BulkWriter::Impl::complete (Batch &batch, int errorCode)
+{
+    Callback handler;
+    {
+        std::lock_guard<std::mutex> guard (this->mutex);
+        handler = this->callback;
+    }
+
+    if (handler) {
+        for (auto &item : batch.items) {
+            try {
+                handler (*item.record, errorCode);
+            }
+            catch (...) {
+                // Ошибка в обработчике не должна останавливать запись.
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> guard (this->mutex);
+    if (errorCode == 0) {
+        this->stats.written += batch.items.size();
+    }
+    else {
+        this->stats.failed += batch.items.size();
+        this->failedSinceFlush = true;
+    }
+    this->pending -= batch.items.size();
+    this->changed.notify_all();
+}
+
+/// \brief Поток кодирования: записи -> строки -> пакеты.
+void BulkWriter::Impl::encodeLoop()
+{
+    const auto delimiterSize = Text::IrbisDelimiter.size() + 1; // и перевод строки
+    Batch current;
+    std::unique_lock<std::mutex> lock (this->mutex);
+
+    const auto ship = [this, &current] () {
+        this->batches.push_back (std::move (current));
+        current = Batch();
+        this->changed.notify_all();
+    };
+
+    while (true) {
+        if (this->incoming.empty()) {
+            if (current.items.empty()) {
+                if (this->stopping) {
+                    break;
+                }
+                this->changed.wait (lock);
+                continue;
+            }
+
+            // Неполный пакет: немного ждём попутных записей.
+            const auto more = this->stopping || this->flushing != 0 ? false
+                    : this->changed.wait_for (lock, this->options.linger,
+                        [this] { return !this->incoming.empty() || this->stopping || this->flushing != 0; });
+            if (!more || this->incoming.empty()) {
+                ship();
+            }
+            continue;
+        }
+
+        auto item = std::move (this->incoming.front());
+        this->incoming.pop_front();
+        lock.unlock();
+
+        item.database = unicode_to_cp1251 (item.record->database);
+        item.encoded = toUtf (item.record->encode (Text::IrbisDelimiter));
+        const auto size = item.database.size() + item.encoded.size() + delimiterSize;
+
+        lock.lock();
+        if (!current.items.empty() && current.bytes + size > this->options.maxBatchBytes) {
+            ship();
+        }
+        current.items.push_back (std::move (item));
+        current.bytes += size;
+        if (current.items.size() >= this->options.maxBatchRecords) {
+            ship();
+        }
+    }
+
+    this->encoded = true;
+    this->changed.notify_all();
+}
+
+/// \brief Отсылка пакета с повторами.
+/// \return 0 либо код ошибки последней попытки.
+///
+/// Повторяется только пакет, который заведомо не дошёл до сервера.
+/// Команда "6" не идемпотентна: после начала отсылки любой сбой
+/// (в том числе ответ о потере сессии) завершает пакет с ошибкой.
+int BulkWriter::Impl::send (Batch &batch)
+{
+    const auto delimiter = unicode_to_cp1251 (Text::IrbisDelimiter);
+    int result = 0;
+    for (unsigned attempt = 0; attempt <= this->options.retries; ++attempt) {
+        {
+            std::lock_guard<std::mutex> guard (this->mutex);
+            if (attempt == 0) {
+                this->stats.batches++;
+            }
+            else {
+                this->stats.retries++;
+            }
+        }
+
+        auto lease = this->pool.acquire();
+        if (!lease) {
+            result = -100003; // нет подключения
+            continue;
+        }
+
+        auto &connection = *lease;
+        auto sent = true; // пока не доказано обратное
+        try {
+            ClientQuery query (connection, "6");
+            query.add (this->options.lockFlag).newLine();
+            query.add (this->options.actualize).newLine();
+            for (const auto &item : batch.items) {
+                if (item.database.empty()) {
+                    query.addAnsi (connection.database);
+                }
+                else {
+                    query.addAnsi (item.database);
+                }
+                query.addAnsi (delimiter).addAnsi (item.encoded).newLine();
+            }
+            const auto bodySize = query.body().size();
+
+            ServerResponse response (connection, query);
+            {
+                std::lock_guard<std::mutex> guard (this->mutex);
+                this->stats.bytesSent += bodySize;
+            }
+            if (!response.checkReturnCode()) {
+                return connection.lastError;
+            }
+
+            const auto lines = this->options.parseResponse ? response.readRemainingUtfLines() : StringList();
+            for (std::size_t i = 0; i < batch.items.size(); ++i) {
+                auto &record = *batch.items[i].record;
+                record.database = choose (record.database, connection.database);
+                if (i < lines.size() && !lines[i].empty()) {
+                    record.fields.clear();
+                    record.decode (Text::fromFullDelimiter (lines[i]));
+                }
+                if (connection.cache && record.mfn != 0) {
+                    connection.cache->invalidate (record.database, record.mfn);
+                }
+            }
+
+            return 0;
+        }
+        catch (const NetworkException &error) {
+            // Подключение с такой ошибкой пул отбросит.
+            connection.lastError = -100002;
+            result = -100002;
+            sent = error.sent;
+        }
+        catch (const std::exception &) {
+            connection.lastError = -100002;
+            result = -100002;
+        }
+
+        if (sent) {
+            // Сервер мог выполнить пакет: повтор создал бы записи заново.
+            return result;
+        }
+    }
+
+    return result;
+}
+
+/// \brief Поток отсылки пакетов.
+void BulkWriter::Impl::sendLoop()
+{
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock (this->mutex);
+            this->changed.wait (lock, [this] { return !this->batches.empty() || this->encoded; });
+            if (this->batches.empty()) {
+                break;
+            }
+            batch = std::move (this->batches.front());
+            this->batches.pop_front();
+        }
+
+        const auto errorCode = this->send (batch);
+        this->complete (batch, errorCode);
+    }
+}
+
+//=========================================================
+
+/// \brief Конструктор: запускает потоки кодирования и отсылки.
+/// \param pool Пул подключений (должен жить дольше объекта).
+/// \param options Настройки.
+BulkWriter::BulkWriter (ConnectionPool &pool, const BulkWriterOptions &options)
+    : _impl { new Impl (pool, options) }
+{
+    auto &impl = *this->_impl;
+    impl.encoder = std::thread ([&impl] { impl.encodeLoop(); });
+    for (std::size_t i = 0; i < impl.options.connections; ++i) {
+        impl.senders.emplace_back ([&impl] { impl.sendLoop(); });
+    }
+}
+
+/// \brief Деструктор. Дописывает принятые записи (см. close()).
+BulkWriter::~BulkWriter()
+{
+    this->close();
+}
+
+/// \brief Добавление записи, остающейся во владении вызывающего кода.
+/// \param record Запись. Не должна изменяться и уничтожаться,
+/// пока о ней не сообщит обработчик (либо до возврата из flush()).
+/// \return false, если BulkWriter уже закрыт.
+bool BulkWriter::add (MarcRecord *record)
+{
+    Impl::Item item;
+    item.record = record;
+    return this->_impl->accept (std::move (item));
+}
+
+/// \brief Добавление записи, передаваемой во владение.
+/// \param record Запись. После сохранения передаётся обработчику
+/// (см. setCallback()) и уничтожается.
+/// \return false, если BulkWriter уже закрыт.
+bool BulkWriter::add (MarcRecord &&record)
+{
+    Impl::Item item;
+    item.owned.reset (new MarcRecord (std::move (record)));
+    item.record = item.owned.get();
+    return this->_impl->accept (std::move (item));
+}
+
+/// \brief Запись всего принятого и остановка потоков.
+///
+/// Последующие вызовы add() возвращают false. Повторные вызовы игнорируются.
+void BulkWriter::close()
+{
+    auto &impl = *this->_impl;
+    {
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        impl.stopping = true;
+        impl.changed.notify_all();
+    }
+
+    if (impl.encoder.joinable()) {
+        impl.encoder.join();
+    }
+    for (auto &sender : impl.senders) {
+        if (sender.joinable()) {
+            sender.join();
+        }
+    }
+}
+
+/// \brief Ожидание записи всех принятых записей.
+/// \return true, если после предыдущего вызова flush() сбоев не было.
+bool BulkWriter::flush()
+{
+    auto &impl = *this->_impl;
+    std::unique_lock<std::mutex> lock (impl.mutex);
+    impl.flushing++;
+    impl.changed.notify_all();
+    impl.changed.wait (lock, [&impl] { return impl.pending == 0; });
+    impl.flushing--;
+
+    const auto result = !impl.failedSinceFlush;
+    impl.failedSinceFlush = false;
+    return result;
+}
+
+/// \brief Установка обработчика завершения записи.
+///
+/// Обработчик вызывается из потоков отсылки для каждой записи пакета.
+void BulkWriter::setCallback (Callback callback)
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    this->_impl->callback = std::move (callback);
+}
+
+/// \brief Снимок статистики.
+BulkWriterStatistics BulkWriter::statistics() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->stats;
+}
+
+}
@@ -4,16 +4,42 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 
 namespace irbis {
 
+namespace {
+
+// Буфер, освобождённый последним запросом в данном потоке.
+// Следующий запрос пишет в него, не обращаясь к распределителю памяти.
+thread_local Bytes spareBuffer;
+
+// Буферы больше этого размера не удерживаются.
+const std::size_t MaxSpareCapacity = 1024 * 1024;
+
+// Запись десятичного представления числа в конец буфера.
+// Возвращает указатель на первую цифру.
+char* formatDecimal (char *end, uint64_t value) noexcept
+{
+    do {
+        *--end = static_cast<char> ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+}
+
 /// \brief Конструктор клиентского запроса.
 /// \param connection Подключение, для которого формируется запрос.
 /// \param commandCode Код команды.
 ClientQuery::ClientQuery (const ConnectionBase &connection, const std::string &commandCode)
+    : _started { std::chrono::steady_clock::now() }
 {
+    this->_content.swap (spareBuffer);
+    this->_content.clear();
     this->addAnsi (commandCode)            .newLine();
     this->addAnsi (connection.workstation) .newLine();
     this->addAnsi (commandCode)            .newLine();
@@ -26,14 +52,31 @@ ClientQuery::ClientQuery (const ConnectionBase &connection, const std::string &c
     this->                                  newLine();
 }
 
+/// \brief Деструктор. Отдаёт буфер следующему запросу в данном потоке.
+ClientQuery::~ClientQuery()
+{
+    if (this->_content.capacity() <= MaxSpareCapacity
+        && this->_content.capacity() > spareBuffer.capacity()) {
+        this->_content.swap (spareBuffer);
+    }
+}
+
+/// \brief Увеличение запроса на указанное число байт.
+/// \param size Количество байт.
+/// \return Указатель на начало добавленного (неинициализированного) места.
+Byte* ClientQuery::_grow (std::size_t size)
+{
+    const auto offset = this->_content.size();
+    this->_content.resize (offset + size);
+    return this->_content.data() + offset;
+}
+
 /// \brief Добавление информации к запросу.
 /// \param bytes Массив с информацией.
 /// \param size Количество байт.
 void ClientQuery::_write (const Byte *bytes, std::size_t size)
 {
-    for (std::size_t i = 0; i < size; i++)     {
-        this->_content.push_back(bytes[i]);
-    }
+    this->_content.insert (this->_content.end(), bytes, bytes + size);
 }
 
 /// \brief Добавление байта к запросу.
@@ -48,8 +91,18 @@ void ClientQuery::_write (Byte byte)
 /// \return this.
 ClientQuery& ClientQuery::add (int value)
 {
-    const auto s = std::to_string (value);
-    return this->addAnsi (s);
+    char buffer[16];
+    char *end = buffer + sizeof (buffer);
+    const auto negative = value < 0;
+    const auto magnitude = negative
+            ? static_cast<uint64_t> (-static_cast<int64_t> (value))
+            : static_cast<uint64_t> (value);
+    auto start = formatDecimal (end, magnitude);
+    if (negative) {
+        *--start = '-';
+    }
+    this->_write (reinterpret_cast<const Byte*> (start), static_cast<std::size_t> (end - start));
+    return *this;
 }
 
 /// \brief Добавление файловой спецификации к запросу.
@@ -95,10 +148,8 @@ ClientQuery& ClientQuery::addAnsi (const String &text)
         return *this;
     }
 
-    const auto *src = text.c_str();
-    Bytes dst(size);
-    unicode_to_cp1251 (dst.data(), src, size);
-    this->_write (dst.data(), size);
+    // Каждый символ занимает ровно один байт -- кодируем сразу в запрос.
+    unicode_to_cp1251 (this->_grow (size), text.c_str(), size);
     return *this;
 }
 
@@ -136,11 +187,10 @@ ClientQuery& ClientQuery::addUtf (const String &text)
         return *this;
     }
 
+    // Сначала считаем точный размер, затем кодируем сразу в запрос.
     const auto src = text.c_str();
     const auto bufSize = countUtf (src, size);
-    Bytes dst (bufSize);
-    toUtf (dst.data(), src, size);
-    this->_write (dst.data(), bufSize);
+    toUtf (this->_grow (bufSize), src, size);
     return *this;
 }
 
@@ -153,23 +203,46 @@ void ClientQuery::dump (std::ostream &stream) const
     }
 }
 
+/// \brief Тело запроса (без заголовка с длиной).
+/// \return Спан, действительный, пока запрос не изменяется.
+ByteSpan ClientQuery::body() const noexcept
+{
+    return ByteSpan (this->_content.data(), this->_content.size());
+}
+
 /// \brief Кодирование запроса.
-/// \return Закодированный запрос.
+/// \return Закодированный запрос (заголовок и тело в одном буфере).
+///
+/// Нужно, когда пакет должен пережить запрос (например,
+/// для AsyncEngine). Для синхронной отсылки заголовок и тело
+/// передаются сокету по отдельности, см. header() и body().
 Bytes ClientQuery::encode() const
 {
+    Byte prefix[HeaderCapacity];
+    const auto prefixSize = this->header (prefix);
     Bytes result;
-    result.reserve (this->_content.size() + 10);
-    const auto prefix = std::to_string (this->_content.size());
-    const auto ptr = prefix.c_str();
-    for (std::size_t i = 0; i < prefix.length(); i++) {
-        result.push_back (static_cast<Byte>(ptr[i]));
-    }
-    result.push_back(0x0a);
+    result.reserve (prefixSize + this->_content.size());
+    result.insert (result.end(), prefix, prefix + prefixSize);
     result.insert (result.end(), this->_content.begin(), this->_content.end());
 
     return result;
 }
 
+/// \brief Формирование заголовка пакета: длина тела и перевод строки.
+/// \param buffer Буфер размером не менее HeaderCapacity байт.
+/// \return Длина заголовка в байтах.
+std::size_t ClientQuery::header (Byte *buffer) const noexcept
+{
+    char digits[HeaderCapacity];
+    char *end = digits + sizeof (digits);
+    const auto start = formatDecimal (end, this->_content.size());
+    const auto length = static_cast<std::size_t> (end - start);
+    std::memcpy (buffer, start, length);
+    buffer[length] = 0x0A;
+
+    return length + 1;
+}
+
 /// \brief Добавление перевода строки.
 /// \return `this`.
 ClientQuery& ClientQuery::newLine()
@@ -12,10 +12,41 @@ void ClientSocket::open()
     // Nothing to do here
 }
 
+/// \brief Прерывание обмена, идущего в другом потоке
+/// (действует, если выставлен флаг abortable).
+///
+/// По умолчанию не поддерживается: обмен завершится сам
+/// (по таймауту либо ответу сервера).
+void ClientSocket::abort() noexcept
+{
+    // Nothing to do here
+}
+
 /// \brief Закрытие сокета.
 void ClientSocket::close()
 {
     // Nothing to do here
 }
 
+/// \brief Отсылка пакета, состоящего из двух частей.
+/// \param header Заголовок пакета.
+/// \param body Тело пакета.
+///
+/// Реализация по умолчанию отсылает части по очереди.
+/// Наследники могут отослать их одним системным вызовом.
+void ClientSocket::sendParts (ByteSpan header, ByteSpan body)
+{
+    this->send (header.cdata(), header.size());
+    this->send (body.cdata(), body.size());
+}
+
+/// \brief Ожидание начала ответа сервера (не дольше until).
+/// \return false, если к моменту until ответ не начал поступать.
+///
+/// Реализация по умолчанию не ждёт и всегда возвращает true.
+bool ClientSocket::waitAnswer (std::chrono::steady_clock::time_point)
+{
+    return true;
+}
+
 }
@@ -4,6 +4,7 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 
+#include <algorithm>
 #include <random>
 
 #if defined(_MSC_VER)
@@ -14,6 +15,15 @@
 
 namespace irbis {
 
+/// \brief Деструктор.
+///
+/// \details Дожидается разбора ответов на запросы connectAsync
+/// и executeAsync, затем (в ConnectionBase) отключается от сервера.
+Connection::~Connection()
+{
+    this->_waitAsync();
+}
+
 /// \brief Актуализация всех неактуализированных записей в указанной базе данных (если таковые имеются).
 /// \param databaseName Имя базы данных.
 /// \return Признак успешного выполнения операции.
@@ -44,29 +54,194 @@ bool Connection::actualizeRecord (const String &databaseName, int mfn)
             .add(mfn);
 
     const auto result = this->execute (query);
+    if (this->cache) {
+        // Актуализация меняет статус записи (а при mfn = 0 -- всех записей базы).
+        if (mfn == 0) {
+            this->cache->invalidateDatabase (databaseName);
+        }
+        else {
+            this->cache->invalidate (databaseName, static_cast<Mfn> (mfn));
+        }
+    }
     LOG_LEAVE
     return result;
 }
 
+/// \brief Асинхронная отсылка запроса на регистрацию клиента.
+/// \param promise Результат connectAsync.
+///
+/// Запрос должен быть учтён вызывающим (_beginAsync). Ответ разбирается
+/// в потоке движка AsyncEngine под блокировкой подключения. Если сервер
+/// отвечает, что клиент с таким идентификатором уже зарегистрирован,
+/// регистрация повторяется с новым идентификатором.
+void Connection::_registerAsync (std::shared_ptr<std::promise<bool>> promise)
+{
+    auto lock = this->_lock();
+    this->clientId = _generateClientId();
+    this->queryId = 1;
+    ClientQuery query (*this, "A");
+    query.addAnsi (this->username).newLine()
+            .addAnsi (this->password);
+    lock.unlock();
+
+    this->_submitAsync (query, [this, promise] (Bytes &&answer, std::exception_ptr error) {
+        auto success = false;
+        auto again = false;
+        {
+            auto guard = this->_lock();
+            try {
+                if (error) {
+                    std::rethrow_exception (error);
+                }
+                ServerResponse response (*this, std::move (answer));
+                const auto returnCode = this->_acceptRegistration (response);
+                again = returnCode == -3337;
+                success = returnCode >= 0;
+            }
+            catch (...) {
+                // Сбой сети либо битый ответ сервера
+                this->lastError = -100002;
+            }
+        }
+
+        if (again) {
+            try {
+                // Учёт запроса переходит к повторному.
+                this->_registerAsync (promise);
+                return;
+            }
+            catch (...) {
+                auto guard = this->_lock();
+                this->lastError = -100002;
+            }
+        }
+
+        this->_endAsync();
+        promise->set_value (success);
+    });
+}
+
 /// \brief Асинхронный вариант connect.
 /// \return Признак успешности выполнения операции.
+///
+/// Запрос исполняется движком AsyncEngine без создания отдельного потока.
+/// Ответ разбирается в потоке движка под блокировкой подключения,
+/// затем результат передаётся в future (так что wait_for() работает
+/// как обычно). Если future выброшен, регистрация всё равно применяется,
+/// и "B" отсылается при отключении; деструктор дожидается ответа.
 std::future<bool> Connection::connectAsync()
 {
-    return std::async (std::launch::async, &Connection::connect, this);
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto result = promise->get_future();
+    if (this->connected()) {
+        promise->set_value (true);
+        return result;
+    }
+
+    this->lastError = 0;
+    this->_beginAsync();
+    try {
+        this->_registerAsync (promise);
+    }
+    catch (...) {
+        this->_endAsync();
+        this->lastError = -100002;
+        promise->set_value (false);
+    }
+    return result;
 }
 
 /// \brief Асинхронный вариант disconnect.
+///
+/// Запрос исполняется движком AsyncEngine без создания отдельного потока.
+/// Сначала дожидается ответов на запросы connectAsync и executeAsync,
+/// иначе регистрация, пришедшая позже, осталась бы без "B".
 std::future<void> Connection::disconnectAsync()
 {
-    return std::async (std::launch::async, &Connection::disconnect, this);
+    this->_waitAsync();
+    auto promise = std::make_shared<std::promise<void>>();
+    auto result = promise->get_future();
+    if (!this->connected()) {
+        promise->set_value();
+        return result;
+    }
+
+    ClientQuery query (*this, "B");
+    query.addAnsi (this->username).newLine();
+    this->_forgetConnection();
+    try {
+        AsyncEngine::instance().submit (this->host, this->port, query.encode(),
+            [promise] (Bytes &&, std::exception_ptr) {
+                promise->set_value();
+            });
+    }
+    catch (...) {
+        promise->set_value();
+    }
+    return result;
 }
 
 /// \brief Асинхронный вариант execute.
 /// \param query Клиентский запрос.
 /// \return Признак успешного выполнения запроса.
+///
+/// Запрос кодируется немедленно, так что после возврата из метода
+/// объект query можно уничтожить.
 std::future<bool> Connection::executeAsync (ClientQuery &query)
 {
-    return std::async (std::launch::async, &Connection::execute, this, std::ref(query));
+    return this->executeAsync (query, nullptr);
+}
+
+/// \brief Асинхронный вариант execute с обработкой ответа сервера.
+/// \param query Клиентский запрос.
+/// \param handler Обработчик ответа (может быть пустым). Вызывается,
+/// если сервер вернул код успеха.
+/// \return Признак успешного выполнения запроса.
+///
+/// Как и в connectAsync, ответ разбирается (а lastError и обработчик
+/// вызываются) в потоке движка AsyncEngine под блокировкой подключения,
+/// до передачи результата в future. Обработчик не должен надолго
+/// задерживать поток движка.
+std::future<bool> Connection::executeAsync (ClientQuery &query, std::function<void (ServerResponse&)> handler)
+{
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto result = promise->get_future();
+    if (!this->_checkConnection()) {
+        promise->set_value (false);
+        return result;
+    }
+
+    this->_beginAsync();
+    try {
+        this->_submitAsync (query, [this, handler, promise] (Bytes &&answer, std::exception_ptr error) {
+            auto success = false;
+            {
+                auto guard = this->_lock();
+                try {
+                    if (error) {
+                        std::rethrow_exception (error);
+                    }
+                    ServerResponse response (*this, std::move (answer));
+                    success = response.checkReturnCode();
+                    if (success && handler) {
+                        handler (response);
+                    }
+                }
+                catch (...) {
+                    this->lastError = -100002;
+                    success = false;
+                }
+            }
+            this->_endAsync();
+            promise->set_value (success);
+        });
+    }
+    catch (...) {
+        this->_endAsync();
+        this->lastError = -100002;
+        promise->set_value (false);
+    }
+    return result;
 }
 
 /// \brief Форматирование записи на сервере по её MFN.
@@ -160,6 +335,125 @@ String Connection::formatRecord (const String &format, const MarcRecord &record)
     return result;
 }
 
+/// \brief Пакетное форматирование записей на сервере по их MFN.
+/// \param format Спецификация формата.
+/// \param mfnList MFN записей, подлежащих расформатированию.
+/// \return Результаты расформатирования в том же порядке, что и mfnList.
+/// Для записей, которые расформатировать не удалось, -- пустые строки.
+///
+/// Формат подготавливается один раз на весь вызов. MFN отсылаются пакетами
+/// по batchSize штук (но не более maxPacketSize байт списка MFN),
+/// не более parallelism пакетов одновременно.
+StringList Connection::formatRecords (const String &format, const MfnList &mfnList)
+{
+    LOG_ENTER
+    StringList result (mfnList.size());
+    if (mfnList.empty() || !this->_checkConnection()) {
+        LOG_LEAVE
+        return result;
+    }
+
+    const auto prepared = prepareFormat (format);
+    const auto database = this->database; // NOLINT(performance-unnecessary-copy-initialization)
+    const auto build = [&] (ClientQuery &query, std::size_t offset, std::size_t count) {
+        query.addAnsi (database).newLine()
+                .addAnsi (prepared).newLine()
+                .add (static_cast<int> (count)).newLine();
+        for (std::size_t i = 0; i < count; ++i) {
+            query.add (static_cast<int> (mfnList[offset + i])).newLine();
+        }
+    };
+
+    const auto consume = [&] (std::size_t offset, std::size_t count, ServerResponse *response) {
+        if (response == nullptr || !response->checkReturnCode()) {
+            return;
+        }
+
+        // Каждая строка ответа: "MFN#текст", где переводы строки
+        // внутри текста заменены символом 0x1F.
+        std::map<Mfn, ByteSpan> found;
+        for (const auto line : response->readRemainingSpans()) {
+            const auto sharp = line.indexOf ('#');
+            if (sharp > 0) {
+                found[static_cast<Mfn> (fastParse32 (line.slice (0, sharp)))] = line.slice (sharp + 1);
+            }
+        }
+
+        for (std::size_t i = offset; i < offset + count; ++i) {
+            const auto it = found.find (mfnList[i]);
+            if (it != found.end()) {
+                auto text = fromUtf (it->second);
+                text = Text::fromIrbisToUnix (text);
+                std::replace (text.begin(), text.end(), L'\x1F', L'\n');
+                result[i] = std::move (text);
+            }
+        }
+    };
+
+    this->_runBatches ("G", mfnList.size(), build, consume, _weighMfns (mfnList));
+
+    LOG_LEAVE
+    return result;
+}
+
+/// \brief Пакетное форматирование записей на сервере по их MFN.
+/// \param format Спецификация формата в кодировке UTF-8.
+/// \param mfnList MFN записей, подлежащих расформатированию.
+/// \return Результаты расформатирования в кодировке UTF-8 в том же порядке,
+/// что и mfnList. Для записей, которые расформатировать не удалось, --
+/// пустые строки.
+///
+/// См. formatRecords (const String&, const MfnList&).
+std::vector<std::string> Connection::formatRecordsLite (const std::string &format, const MfnList &mfnList)
+{
+    LOG_ENTER
+    std::vector<std::string> result (mfnList.size());
+    if (mfnList.empty() || !this->_checkConnection()) {
+        LOG_LEAVE
+        return result;
+    }
+
+    const auto prepared = toUtf (prepareFormat (fromUtf (format)));
+    const auto database = this->database; // NOLINT(performance-unnecessary-copy-initialization)
+    const auto build = [&] (ClientQuery &query, std::size_t offset, std::size_t count) {
+        query.addAnsi (database).newLine()
+                .addAnsi ("!").addAnsi (prepared).newLine()
+                .add (static_cast<int> (count)).newLine();
+        for (std::size_t i = 0; i < count; ++i) {
+            query.add (static_cast<int> (mfnList[offset + i])).newLine();
+        }
+    };
+
+    const auto consume = [&] (std::size_t offset, std::size_t count, ServerResponse *response) {
+        if (response == nullptr || !response->checkReturnCode()) {
+            return;
+        }
+
+        std::map<Mfn, ByteSpan> found;
+        for (const auto line : response->readRemainingSpans()) {
+            const auto sharp = line.indexOf ('#');
+            if (sharp > 0) {
+                found[static_cast<Mfn> (fastParse32 (line.slice (0, sharp)))] = line.slice (sharp + 1);
+            }
+        }
+
+        for (std::size_t i = offset; i < offset + count; ++i) {
+            const auto it = found.find (mfnList[i]);
+            if (it != found.end()) {
+                std::string text (reinterpret_cast<const char*> (it->second.cdata()), it->second.size());
+                text = Text::fromIrbisToUnix (text);
+                std::replace (text.begin(), text.end(), '\x1F', '\n');
+                result[i] = std::move (text);
+            }
+        }
+    };
+
+    this->_runBatches ("G", mfnList.size(), build, consume, _weighMfns (mfnList));
+
+    LOG_LEAVE
+    return result;
+}
+
 /// \brief Получение информации о базе данных с указанным именем.
 /// \param databaseName Имя базы данных.
 /// \return Информация о базе данных.
@@ -235,6 +529,9 @@ GblResult Connection::globalCorrection (const GblSettings &settings)
 
     const auto lines = response.readRemainingAnsiLines();
     result.parse (lines);
+    if (this->cache) {
+        this->cache->invalidateDatabase (db);
+    }
 
     LOG_LEAVE
     return result;
@@ -244,7 +541,8 @@ GblResult Connection::globalCorrection (const GblSettings &settings)
 /// \return Признак успешности выполнения операции.
 std::future<bool> Connection::noOpAsync()
 {
-    return std::async (std::launch::async, &Connection::noOp, this);
+    ClientQuery query (*this, "N");
+    return this->executeAsync (query);
 }
 
 /// \brief Расформатирование таблицы в RTF.
@@ -363,6 +661,17 @@ bool Connection::updateUserList (const std::vector<UserInfo> &users)
     return result;
 }
 
+/// \brief Пакетное сохранение записей.
+/// \param records Записи (база данных берётся из записи либо из подключения).
+/// \param lockFlag Оставить записи заблокированными.
+/// \param actualize Актуализировать записи.
+/// \param dontParseResponse Не разбирать ответ сервера.
+/// \return true, если все записи сохранены.
+///
+/// Записи отсылаются порциями по batchSize штук (одна команда "6"
+/// на порцию), чтобы пакет не разрастался до неприемлемого размера.
+/// При ошибке оставшиеся порции не отсылаются. Для больших объёмов
+/// см. BulkWriter.
 bool Connection::writeRecords (std::vector<MarcRecord*> &records, bool lockFlag, bool actualize, bool dontParseResponse)
 {
     LOG_ENTER
@@ -382,35 +691,47 @@ bool Connection::writeRecords (std::vector<MarcRecord*> &records, bool lockFlag,
         return true;
     }
 
-    ClientQuery query (*this, "6");
-    query.add (lockFlag).newLine();
-    query.add (actualize).newLine();
-    for (const auto record : records) {
-        const auto db = choose (record->database, this->database); // NOLINT(performance-unnecessary-copy-initialization)
-        query.addAnsi (db).addAnsi (Text::IrbisDelimiter)
-            .addUtf (record->encode (Text::IrbisDelimiter)).newLine();
-    }
-    ServerResponse response (*this, query);
-    if (!response.success()) {
-        LOG_LEAVE
-        return false;
-    }
-
-    response.getReturnCode();
+    const auto batch = std::max (this->batchSize, static_cast<std::size_t> (1));
+    for (std::size_t offset = 0; offset < records.size(); offset += batch) {
+        const auto count = std::min (batch, records.size() - offset);
+        ClientQuery query (*this, "6");
+        query.add (lockFlag).newLine();
+        query.add (actualize).newLine();
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto record = records[offset + i];
+            const auto db = choose (record->database, this->database); // NOLINT(performance-unnecessary-copy-initialization)
+            query.addAnsi (db).addAnsi (Text::IrbisDelimiter)
+                .addUtf (record->encode (Text::IrbisDelimiter)).newLine();
+        }
+        ServerResponse response (*this, query);
+        if (!response.checkReturnCode()) {
+            LOG_LEAVE
+            return false;
+        }
 
-    if (!dontParseResponse) {
-        const auto lines = response.readRemainingUtfLines();
-        for (std::size_t i = 0; i < lines.size(); i++) {
-            const auto &line = lines[i];
-            if (line.empty()) {
-                continue;
+        if (!dontParseResponse) {
+            const auto lines = response.readRemainingUtfLines();
+            for (std::size_t i = 0; i < lines.size() && i < count; i++) {
+                const auto &line = lines[i];
+                if (line.empty()) {
+                    continue;
+                }
+
+                auto record = records[offset + i];
+                record->fields.clear();
+                record->database = choose (record->database, this->database);
+                const auto recordLines = Text::fromFullDelimiter (line);
+                record->decode(recordLines);
             }
+        }
 
-            auto record = records[i];
-            record->fields.clear();
-            record->database = choose (record->database, this->database);
-            const auto recordLines = Text::fromFullDelimiter (line);
-            record->decode(recordLines);
+        if (this->cache) {
+            for (std::size_t i = 0; i < count; ++i) {
+                const auto record = records[offset + i];
+                if (record->mfn != 0) {
+                    this->cache->invalidate (choose (record->database, this->database), record->mfn);
+                }
+            }
         }
     }
 
@@ -418,18 +739,16 @@ bool Connection::writeRecords (std::vector<MarcRecord*> &records, bool lockFlag,
     return true;
 }
 
+/// \brief Пакетное сохранение записей (см. вариант с указателями).
 bool Connection::writeRecords (std::vector<MarcRecord> &records, bool lockFlag, bool actualize, bool dontParseResponse)
 {
-    LOG_ENTER
-    if (!this->_checkConnection()) {
-        LOG_LEAVE
-        return false;
+    std::vector<MarcRecord*> pointers;
+    pointers.reserve (records.size());
+    for (auto &record : records) {
+        pointers.push_back (&record);
     }
 
-    // TODO implement
-
-    LOG_LEAVE
-    return false;
+    return this->writeRecords (pointers, lockFlag, actualize, dontParseResponse);
 }
 
 int Connection::writeRawRecord (RawRecord &record, bool lockFlag, bool actualize, bool dontParseResponse)
@@ -465,6 +784,10 @@ int Connection::writeRawRecord (RawRecord &record, bool lockFlag, bool actualize
         }
     }
 
+    if (this->cache && record.mfn != 0) {
+        this->cache->invalidate (db, record.mfn);
+    }
+
     LOG_LEAVE
     return response.returnCode;
 }
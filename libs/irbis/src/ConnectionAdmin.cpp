@@ -66,6 +66,9 @@ bool ConnectionAdmin::deleteDatabase (const String &databaseName)
     ClientQuery query (*this, "Z");
     const auto db = choose (databaseName, this->database);
     query.addAnsi (db).newLine();
+    if (this->cache) {
+        this->cache->invalidateDatabase (db);
+    }
     return this->execute (query);
 }
 
@@ -179,6 +182,9 @@ bool ConnectionAdmin::truncateDatabase (const String &databaseName)
     ClientQuery query (*this, "T");
     const auto db = choose (databaseName, this->database);
     query.addAnsi (db);
+    if (this->cache) {
+        this->cache->invalidateDatabase (db);
+    }
     return execute (query);
 }
 
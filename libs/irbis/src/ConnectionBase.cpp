@@ -4,6 +4,7 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 
+#include <deque>
 #include <random>
 
 #if defined(_MSC_VER)
@@ -17,6 +18,7 @@ namespace irbis {
 /// \brief Единственный конструктор для данного класса.
 ConnectionBase::ConnectionBase()
         : _connected    { false },
+          _pendingAsync { 0 },
           host          { L"127.0.0.1" },
           port          { 6666 },
           username      { },
@@ -29,7 +31,19 @@ ConnectionBase::ConnectionBase()
           serverVersion { },
           interval      { 600 },
           stage         { RequestStage::None },
-          socket        { new Tcp4Socket }
+          batchSize     { 100 },
+          parallelism   { 4 },
+          maxPacketSize { 65536 },
+          connectTimeout { 10000 },
+          receiveTimeout { 0 },
+          noDelay       { true },
+          receiveBufferSize { 0 },
+          socket        { new Tcp4Socket },
+          cache         { },
+          metrics       { },
+          cachePolicy   { CachePolicy::Trust },
+          retryPolicy   { },
+          hedging       { }
 {
 }
 
@@ -41,6 +55,72 @@ ConnectionBase::~ConnectionBase() {
     // this->socket.release();
 }
 
+/// \brief Разбор ответа сервера на команду регистрации клиента.
+/// \param response Ответ сервера на команду "A".
+/// \return Код возврата сервера. -3337 означает, что регистрацию
+/// нужно повторить с другим идентификатором клиента.
+///
+/// При успешной регистрации подключение переходит в состояние "подключено".
+int ConnectionBase::_acceptRegistration (ServerResponse &response)
+{
+    if (!response.success()) {
+        LOG_ERROR (L"Network error")
+        this->lastError = -100002;
+        return this->lastError;
+    }
+
+    response.getReturnCode();
+    if (response.returnCode < 0) {
+        // -3337: клиент с данным идентификатором уже зарегистрирован
+        if (response.returnCode != -3337) {
+            this->lastError = response.returnCode;
+        }
+        return response.returnCode;
+    }
+
+    this->_connected = true;
+    this->serverVersion = response.serverVersion;
+    this->interval = response.readInteger();
+    const auto lines = response.readRemainingAnsiLines();
+    this->iniFile.parse(lines);
+    return response.returnCode;
+}
+
+/// \brief Учёт асинхронного запроса, ответ на который разбирается
+/// в потоке движка AsyncEngine и меняет подключение.
+///
+/// Каждому вызову должен соответствовать ровно один вызов _endAsync().
+void ConnectionBase::_beginAsync()
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    ++this->_pendingAsync;
+}
+
+/// \brief Ответ на учтённый асинхронный запрос разобран.
+///
+/// Вызывается без захвата _lock(). После возврата обращаться
+/// к подключению нельзя: оно может быть уже уничтожено.
+void ConnectionBase::_endAsync()
+{
+    std::lock_guard<std::mutex> guard (this->_mutex);
+    --this->_pendingAsync;
+    this->_asyncDone.notify_all();
+}
+
+/// \brief Захват подключения на время разбора ответа сервера.
+/// \return Блокировка того же мьютекса, что захватывает ServerResponse.
+std::unique_lock<std::mutex> ConnectionBase::_lock()
+{
+    return std::unique_lock<std::mutex> (this->_mutex);
+}
+
+/// \brief Ожидание разбора ответов на все учтённые асинхронные запросы.
+void ConnectionBase::_waitAsync()
+{
+    std::unique_lock<std::mutex> lock (this->_mutex);
+    this->_asyncDone.wait (lock, [this] { return this->_pendingAsync == 0; });
+}
+
 /// \brief Проверка, подключены ли мы к серверу.
 /// \return `false` если не подключены.
 ///
@@ -56,6 +136,178 @@ bool ConnectionBase::_checkConnection()
     return true;
 }
 
+/// \brief Пометка подключения как отключенного (без обращения к серверу).
+void ConnectionBase::_forgetConnection() noexcept
+{
+    this->_connected = false;
+}
+
+/// \brief Генерация случайного идентификатора клиента.
+/// \return Идентификатор в диапазоне 100000..900000.
+int ConnectionBase::_generateClientId()
+{
+    std::random_device rd;  //Will be used to obtain a seed for the random number engine
+    std::mt19937 gen (rd()); //Standard mersenne_twister_engine seeded with rd()
+    std::uniform_int_distribution<> dis (100000, 900000);
+    return dis (gen);
+}
+
+/// \brief Выполнение пакетной операции.
+/// \param command Код команды.
+/// \param total Общее число элементов.
+/// \param build Заполняет запрос для очередного пакета.
+/// \param consume Разбирает ответ на пакет.
+/// \param weigh Размер элемента в запросе (может быть пустым).
+///
+/// Элементы разбиваются на пакеты по batchSize штук. Если задан weigh,
+/// пакет закрывается раньше, как только список его элементов превысил бы
+/// maxPacketSize байт (но в пакете всегда есть хотя бы один элемент). Пакеты отсылаются
+/// одновременно (не более parallelism пакетов в полёте), а ответы
+/// разбираются в вызывающем потоке строго в порядке следования пакетов,
+/// пока сеть занята следующими. Если ответ на пакет не получен,
+/// lastError выставляется в -100002, а consume получает nullptr.
+void ConnectionBase::_runBatches (const std::string &command, std::size_t total,
+        const BatchBuilder &build, const BatchConsumer &consume, const BatchWeigher &weigh)
+{
+    const auto batch = std::max (this->batchSize, static_cast<std::size_t> (1));
+    const auto window = std::max (this->parallelism, static_cast<std::size_t> (1));
+    const auto budget = weigh ? this->maxPacketSize : 0;
+
+    struct Batch
+    {
+        std::size_t offset, count;
+        std::future<Bytes> answer;
+    };
+
+    std::deque<Batch> pending;
+    std::size_t next = 0;
+    const auto submit = [&] () {
+        auto count = std::min (batch, total - next);
+        if (budget != 0) {
+            std::size_t bytes = weigh (next), taken = 1;
+            while (taken < count) {
+                const auto size = weigh (next + taken);
+                if (bytes + size > budget) {
+                    break;
+                }
+                bytes += size;
+                ++taken;
+            }
+            count = taken;
+        }
+        ClientQuery query (*this, command);
+        build (query, next, count);
+        pending.push_back (Batch { next, count, this->_submitAsync (query) });
+        next += count;
+    };
+
+    while (next < total && pending.size() < window) {
+        submit();
+    }
+
+    while (!pending.empty()) {
+        const auto offset = pending.front().offset;
+        const auto count = pending.front().count;
+        Bytes answer;
+        auto failed = false;
+        try {
+            answer = pending.front().answer.get();
+        }
+        catch (...) {
+            failed = true;
+        }
+        pending.pop_front();
+
+        // Пока разбираем этот пакет, сеть занята следующими.
+        if (next < total) {
+            submit();
+        }
+
+        if (failed) {
+            this->lastError = -100002;
+            consume (offset, count, nullptr);
+            continue;
+        }
+
+        ServerResponse response (*this, std::move (answer));
+        consume (offset, count, &response);
+    }
+}
+
+/// \brief Размер MFN в списке пакетного запроса.
+/// \param mfnList Список MFN (должен пережить возвращённую функцию).
+/// \return Функция, возвращающая число байт, занимаемых MFN
+/// с указанным индексом (десятичные цифры и перевод строки).
+ConnectionBase::BatchWeigher ConnectionBase::_weighMfns (const MfnList &mfnList)
+{
+    return [&mfnList] (std::size_t index) {
+        std::size_t result = 2; // "\n" и хотя бы одна цифра
+        for (auto mfn = mfnList[index]; mfn >= 10; mfn /= 10) {
+            ++result;
+        }
+        return result;
+    };
+}
+
+/// \brief Асинхронная отсылка запроса через общий движок AsyncEngine.
+/// \param query Полностью сформированный клиентский запрос.
+/// \return Будущий ответ сервера (либо NetworkException).
+///
+/// Мьютекс подключения не захватывается, поэтому несколько
+/// таких запросов могут исполняться одновременно. Ответ разбирается
+/// конструктором ServerResponse (ConnectionBase&, Bytes&&)
+/// в вызывающем потоке.
+std::future<Bytes> ConnectionBase::_submitAsync (ClientQuery &query)
+{
+    auto promise = std::make_shared<std::promise<Bytes>>();
+    auto result = promise->get_future();
+    this->_submitAsync (query, [promise] (Bytes &&answer, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception (error);
+        }
+        else {
+            promise->set_value (std::move (answer));
+        }
+    });
+    return result;
+}
+
+/// \brief Асинхронная отсылка запроса через общий движок AsyncEngine.
+/// \param query Полностью сформированный клиентский запрос.
+/// \param completion Обработчик завершения. Вызывается в потоке
+/// движка и не должен обращаться к подключению.
+///
+/// Сроки и параметры сокета берутся из подключения (AsyncOptions::from).
+/// Если включён сбор метрик, всё время от формирования запроса
+/// до получения ответа засчитывается этапу Waiting: движок
+/// не различает этапы обмена.
+void ConnectionBase::_submitAsync (ClientQuery &query, AsyncCompletion completion)
+{
+    auto packet = query.encode();
+    const auto options = AsyncOptions::from (*this);
+    if (!this->metrics) {
+        AsyncEngine::instance().submit (this->host, this->port, std::move (packet), std::move (completion), options);
+        return;
+    }
+
+    const auto body = query.body();
+    const auto newline = body.indexOf ('\n');
+    const auto code = newline < 0 ? body : body.slice (0, newline);
+    auto trace = std::make_shared<RequestTrace> (std::string (reinterpret_cast<const char*> (code.cdata()), code.size()),
+            RequestStage::Waiting, query.started());
+    trace->bytesSent = packet.size();
+
+    auto metrics_ = this->metrics;
+    AsyncEngine::instance().submit (this->host, this->port, std::move (packet),
+        [completion, trace, metrics_] (Bytes &&answer, std::exception_ptr error) {
+            trace->enter (RequestStage::None);
+            trace->bytesReceived = answer.size();
+            trace->failed = error != nullptr;
+            metrics_->record (*trace);
+            completion (std::move (answer), error);
+        }, options);
+}
+
 /// \brief Подключение к серверу.
 /// \return Признак успешности выполнения операции.
 /// \warning Подключение некоторыми типами клиентов увеличивает на сервере счетчик использованных лицензий!
@@ -72,11 +324,7 @@ bool ConnectionBase::connect()
 
     this->lastError = 0;
 
-    std::random_device rd;  //Will be used to obtain a seed for the random number engine
-    std::mt19937 gen (rd()); //Standard mersenne_twister_engine seeded with rd()
-    std::uniform_int_distribution<> dis (100000, 900000);
-
-    AGAIN: this->clientId = dis (gen);
+    AGAIN: this->clientId = _generateClientId();
     this->queryId = 1;
     ClientQuery query (*this, "A");
     query.addAnsi (this->username).newLine()
@@ -84,28 +332,16 @@ bool ConnectionBase::connect()
 
     try {
         ServerResponse response (*this, query);
-        if (!response.success()) {
-            LOG_ERROR (L"Network error")
-            LOG_LEAVE
-            return false;
-        }
-
-        response.getReturnCode();
-        if (response.returnCode == -3337) {
+        const auto returnCode = this->_acceptRegistration (response);
+        if (returnCode == -3337) {
             // клиент с данным идентификатором уже зарегистрирован
             goto AGAIN;
         }
 
-        if (response.returnCode < 0) {
+        if (returnCode < 0) {
             LOG_LEAVE
             return false;
         }
-
-        this->_connected = true;
-        this->serverVersion = response.serverVersion;
-        this->interval = response.readInteger();
-        const auto lines = response.readRemainingAnsiLines();
-        this->iniFile.parse(lines);
     }
     catch (...) {
         this->lastError = -100002;
@@ -158,7 +394,7 @@ bool ConnectionBase::execute (ClientQuery &query)
         result = response.checkReturnCode();
     }
     catch (...) {
-        // Do nothing
+        this->lastError = -100002;
     }
 
     LOG_LEAVE
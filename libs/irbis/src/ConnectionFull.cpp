@@ -22,11 +22,15 @@ bool ConnectionFull::deleteRecord(Mfn mfn) {
         return false;
     }
 
-    auto record = readRecord(mfn);
+    // Удаляем то, что лежит на сервере, а не в кэше.
+    auto record = this->readRecord (this->database, mfn, CachePolicy::Bypass);
     if (!record.deleted()) {
         record.status = record.status | RecordStatus::LogicallyDeleted;
         this->writeRecord(record, false, true, true);
     }
+    if (this->cache) {
+        this->cache->invalidate (this->database, mfn);
+    }
 
     return true;
 }
@@ -36,22 +40,7 @@ bool ConnectionFull::deleteRecord(Mfn mfn) {
 /// \return Запись.
 MarcRecord ConnectionFull::readRecord (Mfn mfn)
 {
-    MarcRecord result;
-    if (!this->_checkConnection()) {
-        return result;
-    }
-
-    ClientQuery query (*this, "C");
-    query.addAnsi (this->database).newLine()
-            .add(mfn);
-
-    ServerResponse response (*this, query);
-    if (response.checkReturnCode (4, -201, -600, -602, -603)) {
-        const auto lines = response.readRemainingUtfLines();
-        result.decode (lines);
-        result.database = this->database;
-    }
-    return result;
+    return this->readRecord (this->database, mfn, this->cachePolicy);
 }
 
 /// \brief Чтение записи с сервера.
@@ -59,21 +48,49 @@ MarcRecord ConnectionFull::readRecord (Mfn mfn)
 /// \param mfn MFN записи.
 /// \return Запись.
 MarcRecord ConnectionFull::readRecord (const String &databaseName, Mfn mfn)
+{
+    return this->readRecord (databaseName, mfn, this->cachePolicy);
+}
+
+/// \brief Чтение записи с сервера с учётом кэша.
+/// \param databaseName Имя базы данных.
+/// \param mfn MFN записи.
+/// \param policy Политика использования кэша (если кэш не назначен,
+/// запись всегда читается с сервера).
+/// \return Запись.
+MarcRecord ConnectionFull::readRecord (const String &databaseName, Mfn mfn, CachePolicy policy)
 {
     MarcRecord result;
     if (!this->_checkConnection()) {
         return result;
     }
 
+    const auto cache = this->cache; // подключение может сменить кэш
+    if (!cache) {
+        policy = CachePolicy::Bypass;
+    }
+    if (policy == CachePolicy::Trust && cache->get (databaseName, mfn, result)) {
+        return result;
+    }
+
     ClientQuery query (*this, "C");
     query.addAnsi (databaseName).newLine()
             .add (mfn);
 
     ServerResponse response (*this, query);
     if (response.checkReturnCode (4, -201, -600, -602, -603)) {
-        const auto lines = response.readRemainingUtfLines();
-        result.decode(lines);
-        result.database = this->database;
+        const auto lines = response.readRemainingSpans();
+        if (policy == CachePolicy::Revalidate) {
+            const auto version = RecordCache::versionOf (lines);
+            if (version >= 0 && cache->revalidate (databaseName, mfn, static_cast<unsigned int> (version), result)) {
+                return result;
+            }
+        }
+        result.decode (lines);
+        result.database = databaseName;
+        if (policy != CachePolicy::Bypass) {
+            cache->put (databaseName, result);
+        }
     }
 
     return result;
@@ -98,7 +115,7 @@ MarcRecord ConnectionFull::readRecord (const String &databaseName, Mfn mfn, int
 
     ServerResponse response (*this, query);
     if (response.checkReturnCode (4, -201, -600, -602, -603)) {
-        const auto lines = response.readRemainingUtfLines();
+        const auto lines = response.readRemainingSpans();
         result.decode (lines);
         result.database = this->database;
     }
@@ -114,15 +131,92 @@ MarcRecord ConnectionFull::readRecord (const String &databaseName, Mfn mfn, int
 
 /// \brief Считывание нескольких записей за один раз.
 /// \param mfnList Вектор MFN.
-/// \return Вектор прочитанных записей.
+/// \return Вектор прочитанных записей (в порядке следования MFN).
+///
+/// Записи, которые прочитать не удалось, в результат не попадают.
+/// Чтобы узнать, какие именно записи не прочитаны, используйте
+/// перегрузку с вектором кодов ошибок.
 std::vector<MarcRecord> ConnectionFull::readRecords (const MfnList &mfnList)
 {
-    // TODO implement
+    std::vector<int> errors;
+    auto records = this->readRecords (mfnList, errors);
     std::vector<MarcRecord> result;
+    result.reserve (records.size());
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (errors[i] == 0) {
+            result.push_back (std::move (records[i]));
+        }
+    }
+    return result;
+}
+
+/// \brief Считывание нескольких записей за один раз.
+/// \param mfnList Вектор MFN.
+/// \param errors Коды ошибок для каждого MFN (0 означает успешное чтение).
+/// \return Вектор записей той же длины, что и mfnList, в том же порядке.
+/// На месте непрочитанных записей находятся пустые записи.
+///
+/// Список MFN разбивается на пакеты по batchSize записей (но не более
+/// maxPacketSize байт списка MFN). Пакеты
+/// запрашиваются у сервера командой форматирования в формате ALL
+/// одновременно (не более parallelism пакетов в полёте), а разбираются
+/// в вызывающем потоке по мере поступления, пока сеть занята следующими.
+std::vector<MarcRecord> ConnectionFull::readRecords (const MfnList &mfnList, std::vector<int> &errors)
+{
+    const auto total = mfnList.size();
+    std::vector<MarcRecord> result (total);
+    errors.assign (total, 0);
     if (!this->_checkConnection()) {
+        errors.assign (total, this->lastError);
         return result;
     }
 
+    const auto database = this->database; // NOLINT(performance-unnecessary-copy-initialization)
+    const auto build = [&] (ClientQuery &query, std::size_t offset, std::size_t count) {
+        query.addAnsi (database).newLine();
+        query.addFormat (L"&uf('+0')");
+        query.add (static_cast<int> (count)).newLine();
+        for (std::size_t i = 0; i < count; ++i) {
+            query.add (static_cast<int> (mfnList[offset + i])).newLine();
+        }
+    };
+
+    const auto consume = [&] (std::size_t offset, std::size_t count, ServerResponse *response) {
+        if (response == nullptr || !response->checkReturnCode()) {
+            std::fill_n (errors.begin() + offset, count, this->lastError);
+            return;
+        }
+
+        // Каждая строка ответа: "MFN#текст", где строки текста
+        // разделены символом 0x1F.
+        std::map<Mfn, ByteSpan> found;
+        for (const auto line : response->readRemainingSpans()) {
+            const auto sharp = line.indexOf ('#');
+            if (sharp > 0) {
+                const auto mfn = static_cast<Mfn> (fastParse32 (line.slice (0, sharp)));
+                found[mfn] = line;
+            }
+        }
+
+        for (std::size_t i = offset; i < offset + count; ++i) {
+            const auto it = found.find (mfnList[i]);
+            if (it == found.end()) {
+                errors[i] = -140; // MFN вне пределов БД
+                continue;
+            }
+            const auto parts = it->second.split (0x1F);
+            if (parts.size() < 3) {
+                errors[i] = -140;
+                continue;
+            }
+            const std::vector<ByteSpan> lines (parts.begin() + 1, parts.end());
+            result[i].decode (lines);
+            result[i].database = database;
+        }
+    };
+
+    this->_runBatches ("G", total, build, consume, _weighMfns (mfnList));
+
     return result;
 }
 
@@ -162,6 +256,17 @@ int ConnectionFull::writeRecord (MarcRecord &record, bool lockFlag, bool actuali
         }
     }
 
+    if (this->cache && record.mfn != 0) {
+        // Сервер вернул запись в том виде, в котором она сохранена,
+        // поэтому её можно сразу положить в кэш.
+        if (!dontParseResponse && !lockFlag) {
+            this->cache->put (db, record);
+        }
+        else {
+            this->cache->invalidate (db, record.mfn);
+        }
+    }
+
     return response.returnCode;
 }
 
@@ -12,22 +12,58 @@
 
 namespace irbis {
 
+/// \brief Чтение записи с сервера.
+/// \param mfn MFN записи.
+/// \return Запись.
 LiteRecord ConnectionLite::readLiteRecord (Mfn mfn)
+{
+    return this->readLiteRecord (mfn, this->cachePolicy);
+}
+
+/// \brief Чтение записи с сервера с учётом кэша.
+/// \param mfn MFN записи.
+/// \param policy Политика использования кэша (если кэш не назначен,
+/// запись всегда читается с сервера).
+/// \return Запись.
+LiteRecord ConnectionLite::readLiteRecord (Mfn mfn, CachePolicy policy)
 {
     LiteRecord result;
     if (!this->_checkConnection()) {
         return result;
     }
 
+    const auto cache = this->cache; // подключение может сменить кэш
+    if (!cache) {
+        policy = CachePolicy::Bypass;
+    }
+    if (policy == CachePolicy::Trust && cache->get (this->database, mfn, result)) {
+        return result;
+    }
+
     ClientQuery query (*this, "C");
     query.addAnsi (this->database).newLine()
             .add (mfn);
 
     ServerResponse response (*this, query);
     if (response.checkReturnCode (4, -201, -600, -602, -603)) {
-        const auto lines = response.readRemainingLinesUtf();
+        const auto spans = response.readRemainingSpans();
+        if (policy == CachePolicy::Revalidate) {
+            const auto version = RecordCache::versionOf (spans);
+            if (version >= 0 && cache->revalidate (this->database, mfn, static_cast<unsigned int> (version), result)) {
+                return result;
+            }
+        }
+
+        std::vector<std::string> lines;
+        lines.reserve (spans.size());
+        for (const auto span : spans) {
+            lines.emplace_back (reinterpret_cast<const char*> (span.cdata()), span.size());
+        }
         result.decode (lines);
         result.database = toUtf (this->database);
+        if (policy != CachePolicy::Bypass) {
+            cache->put (this->database, result);
+        }
     }
     return result;
 }
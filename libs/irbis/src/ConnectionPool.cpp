@@ -0,0 +1,597 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4068)
+#endif
+
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+namespace irbis {
+
+using PoolClock = std::chrono::steady_clock;
+
+static double elapsedMs (PoolClock::time_point since)
+{
+    const auto elapsed = PoolClock::now() - since;
+    return std::chrono::duration<double, std::milli> (elapsed).count();
+}
+
+//=========================================================
+
+/// \brief Среднее время аренды подключения, миллисекунды.
+double PoolStatistics::averageLeaseMs() const noexcept
+{
+    return this->leases == 0 ? 0.0 : this->totalLeaseMs / static_cast<double> (this->leases);
+}
+
+/// \brief Среднее время ожидания подключения, миллисекунды.
+double PoolStatistics::averageWaitMs() const noexcept
+{
+    return this->leases == 0 ? 0.0 : this->totalWaitMs / static_cast<double> (this->leases);
+}
+
+//=========================================================
+
+/// \brief Конструктор пустой аренды.
+ConnectionLease::ConnectionLease() noexcept
+    : _pool { nullptr }, _connection { nullptr }, _since {}
+{
+}
+
+/// \brief Конструктор, используемый пулом.
+/// \param pool Пул, которому принадлежит подключение.
+/// \param connection Арендуемое подключение.
+ConnectionLease::ConnectionLease (ConnectionPool *pool, Connection *connection) noexcept
+    : _pool { pool }, _connection { connection }, _since { PoolClock::now() }
+{
+}
+
+/// \brief Конструктор перемещения.
+ConnectionLease::ConnectionLease (ConnectionLease &&other) noexcept
+    : _pool { other._pool }, _connection { other._connection }, _since { other._since }
+{
+    other._pool = nullptr;
+    other._connection = nullptr;
+}
+
+/// \brief Деструктор. Возвращает подключение в пул.
+ConnectionLease::~ConnectionLease()
+{
+    this->release();
+}
+
+/// \brief Оператор перемещения.
+ConnectionLease& ConnectionLease::operator = (ConnectionLease &&other) noexcept
+{
+    if (this != &other) {
+        this->release();
+        this->_pool = other._pool;
+        this->_connection = other._connection;
+        this->_since = other._since;
+        other._pool = nullptr;
+        other._connection = nullptr;
+    }
+    return *this;
+}
+
+/// \brief Досрочный возврат подключения в пул.
+///
+/// После вызова аренда становится пустой. Повторные вызовы игнорируются.
+void ConnectionLease::release() noexcept
+{
+    if (this->_pool != nullptr && this->_connection != nullptr) {
+        this->_pool->_giveBack (this->_connection, elapsedMs (this->_since));
+    }
+    this->_pool = nullptr;
+    this->_connection = nullptr;
+}
+
+//=========================================================
+
+/// \brief Внутреннее состояние пула.
+struct ConnectionPool::Impl
+{
+    /// \brief Свободное подключение.
+    struct Idle
+    {
+        Connection *connection;
+        PoolClock::time_point lastUsed;
+    };
+
+    String connectionString;
+    String database;
+    std::size_t minSize;
+    std::size_t maxSize;
+    ConnectionFactory *factory;
+    std::unique_ptr<ConnectionFactory> ownFactory;
+    std::shared_ptr<RecordCache> cache;
+    CachePolicy cachePolicy { CachePolicy::Trust };
+    std::shared_ptr<Hedging> hedging;
+    RetryPolicy retryPolicy;
+
+    mutable std::mutex mutex;
+    std::condition_variable available; ///< Освободилось подключение либо место в пуле.
+    std::condition_variable wakeKeeper;
+    std::deque<Idle> idle; ///< Свободные подключения, самые "тёплые" в конце.
+    std::size_t total { 0 }; ///< Все подключения, включая создаваемые и проверяемые.
+    bool stopping { false };
+    PoolStatistics stats;
+    std::thread keeper;
+
+    Connection* create();
+    void destroy (Connection *connection) noexcept;
+    void keepAlive();
+};
+
+/// \brief Создание и регистрация на сервере нового подключения.
+/// \return Подключение либо nullptr, если подключиться не удалось.
+/// \warning Вызывается без захвата мьютекса.
+Connection* ConnectionPool::Impl::create()
+{
+    Connection *result = nullptr;
+    bool success = false;
+    try {
+        result = this->factory->GetConnection();
+        if (result != nullptr) {
+            result->parseConnectionString (this->connectionString);
+            {
+                std::lock_guard<std::mutex> guard (this->mutex);
+                result->cache = this->cache;
+                result->cachePolicy = this->cachePolicy;
+                result->hedging = this->hedging;
+                result->retryPolicy = this->retryPolicy;
+            }
+            success = result->connect();
+        }
+    }
+    catch (...) {
+        success = false;
+    }
+
+    if (!success) {
+        delete result;
+        result = nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard (this->mutex);
+    if (success) {
+        this->stats.handshakes++;
+    }
+    else {
+        this->stats.failedHandshakes++;
+    }
+    return result;
+}
+
+/// \brief Отключение от сервера и удаление подключения.
+/// \warning Вызывается без захвата мьютекса.
+void ConnectionPool::Impl::destroy (Connection *connection) noexcept
+{
+    try {
+        delete connection;
+    }
+    catch (...) {
+        // Do nothing
+    }
+}
+
+/// \brief Тело фонового потока: подтверждение простаивающих
+/// подключений и поддержание минимального числа "тёплых" подключений.
+void ConnectionPool::Impl::keepAlive()
+{
+    std::unique_lock<std::mutex> lock (this->mutex);
+    while (!this->stopping) {
+
+        // Подключения, простаивающие дольше половины серверного интервала,
+        // изымаем из пула на время подтверждения, чтобы их никто не арендовал.
+        std::vector<Connection*> stale;
+        const auto now = PoolClock::now();
+        for (auto it = this->idle.begin(); it != this->idle.end(); ) {
+            const auto interval = std::max (it->connection->interval, 2);
+            const auto limit = std::chrono::seconds (interval / 2);
+            if (now - it->lastUsed >= limit) {
+                stale.push_back (it->connection);
+                it = this->idle.erase (it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        if (!stale.empty()) {
+            lock.unlock();
+            std::vector<Connection*> dead;
+            for (auto connection : stale) {
+                if (!connection->noOp() && ConnectionPool::isDeadSession (connection->lastError)) {
+                    dead.push_back (connection);
+                }
+            }
+            lock.lock();
+            this->stats.keepAlives += stale.size();
+            this->stats.evictions += dead.size();
+            if (this->stopping) {
+                dead = stale; // пул остановили, пока мы ждали ответа
+            }
+            for (auto connection : stale) {
+                if (std::find (dead.begin(), dead.end(), connection) == dead.end()) {
+                    connection->lastError = 0;
+                    this->idle.push_front ({ connection, PoolClock::now() });
+                }
+            }
+            this->total -= dead.size();
+            this->available.notify_all();
+            lock.unlock();
+            for (auto connection : dead) {
+                this->destroy (connection);
+            }
+            lock.lock();
+        }
+
+        // Доводим число подключений до минимального.
+        while (!this->stopping && this->total < this->minSize) {
+            this->total++;
+            lock.unlock();
+            const auto connection = this->create();
+            lock.lock();
+            if (connection == nullptr || this->stopping) {
+                this->total--;
+                lock.unlock();
+                this->destroy (connection);
+                lock.lock();
+                break; // сервер недоступен, повторим на следующем круге
+            }
+            this->idle.push_back ({ connection, PoolClock::now() });
+            this->available.notify_one();
+        }
+
+        this->wakeKeeper.wait_for (lock, std::chrono::seconds (1),
+                [this] { return this->stopping; });
+    }
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param connectionString Строка подключения (см. ConnectionBase::parseConnectionString).
+/// \param minSize Минимальное число "тёплых" подключений.
+/// \param maxSize Максимальное число подключений.
+/// \param factory Фабрика подключений (nullptr означает фабрику по умолчанию).
+/// Фабрика должна жить дольше пула. Созданные ею подключения пул удаляет сам.
+/// \throw IrbisException Ошибка в строке подключения либо в размерах пула.
+///
+/// Подключение к серверу выполняется фоновым потоком, конструктор не блокируется.
+ConnectionPool::ConnectionPool (const String &connectionString, std::size_t minSize, std::size_t maxSize,
+        ConnectionFactory *factory)
+    : _impl { new Impl }
+{
+    if (maxSize == 0 || minSize > maxSize) {
+        throw IrbisException();
+    }
+
+    // Проверяем строку подключения заранее, чтобы не узнать об ошибке
+    // в фоновом потоке.
+    Connection prototype;
+    prototype.parseConnectionString (connectionString);
+
+    auto &impl = *this->_impl;
+    impl.connectionString = connectionString;
+    impl.database = prototype.database;
+    impl.minSize = minSize;
+    impl.maxSize = maxSize;
+    if (factory == nullptr) {
+        impl.ownFactory.reset (new ConnectionFactory);
+        factory = impl.ownFactory.get();
+    }
+    impl.factory = factory;
+    impl.keeper = std::thread (&Impl::keepAlive, this->_impl.get());
+}
+
+/// \brief Деструктор. Отключает от сервера все свободные подключения.
+/// \warning Все аренды должны быть возвращены до разрушения пула.
+ConnectionPool::~ConnectionPool()
+{
+    this->shutdown();
+}
+
+/// \brief Возврат подключения в пул.
+/// \param connection Возвращаемое подключение.
+/// \param leaseMs Время аренды, миллисекунды.
+///
+/// Подключения с "мёртвой" сессией (см. isDeadSession) отбрасываются.
+void ConnectionPool::_giveBack (Connection *connection, double leaseMs) noexcept
+{
+    auto &impl = *this->_impl;
+    bool discard;
+    {
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        impl.stats.totalLeaseMs += leaseMs;
+        impl.stats.maxLeaseMs = std::max (impl.stats.maxLeaseMs, leaseMs);
+
+        discard = impl.stopping
+                || !connection->connected()
+                || isDeadSession (connection->lastError);
+        if (discard) {
+            impl.total--;
+            if (!impl.stopping) {
+                impl.stats.evictions++;
+            }
+        }
+        else {
+            // Следующий арендатор получает подключение в исходном состоянии.
+            connection->lastError = 0;
+            connection->database = impl.database;
+            connection->cache = impl.cache;
+            connection->cachePolicy = impl.cachePolicy;
+            connection->hedging = impl.hedging;
+            connection->retryPolicy = impl.retryPolicy;
+            impl.idle.push_back ({ connection, PoolClock::now() });
+        }
+        impl.available.notify_one();
+    }
+
+    if (discard) {
+        impl.destroy (connection);
+    }
+}
+
+/// \brief Аренда подключения с неограниченным ожиданием.
+/// \return Аренда. Пустая, если подключиться к серверу не удалось
+/// либо пул остановлен.
+ConnectionLease ConnectionPool::acquire()
+{
+    return this->acquire (std::chrono::milliseconds (-1));
+}
+
+/// \brief Аренда подключения с ограниченным ожиданием.
+/// \param timeout Предельное время ожидания (отрицательное значение -- без ограничения).
+/// \return Аренда. Пустая, если истекло время ожидания, подключиться
+/// к серверу не удалось либо пул остановлен.
+///
+/// Сначала выдаётся свободное подключение, затем, если пул ещё не заполнен,
+/// создаётся новое, иначе вызывающий поток ждёт возврата подключения.
+ConnectionLease ConnectionPool::acquire (std::chrono::milliseconds timeout)
+{
+    auto &impl = *this->_impl;
+    const auto started = PoolClock::now();
+    const auto deadline = started + timeout;
+    std::unique_lock<std::mutex> lock (impl.mutex);
+
+    while (!impl.stopping) {
+        if (!impl.idle.empty()) {
+            const auto connection = impl.idle.back().connection;
+            impl.idle.pop_back();
+            const auto waited = elapsedMs (started);
+            impl.stats.leases++;
+            impl.stats.totalWaitMs += waited;
+            impl.stats.maxWaitMs = std::max (impl.stats.maxWaitMs, waited);
+            return ConnectionLease (this, connection);
+        }
+
+        if (impl.total < impl.maxSize) {
+            impl.total++;
+            lock.unlock();
+            const auto connection = impl.create();
+            lock.lock();
+            if (connection == nullptr) {
+                impl.total--;
+                impl.available.notify_one();
+                return ConnectionLease();
+            }
+            const auto waited = elapsedMs (started);
+            impl.stats.leases++;
+            impl.stats.totalWaitMs += waited;
+            impl.stats.maxWaitMs = std::max (impl.stats.maxWaitMs, waited);
+            return ConnectionLease (this, connection);
+        }
+
+        impl.stats.waiters++;
+        impl.stats.peakWaiters = std::max (impl.stats.peakWaiters, impl.stats.waiters);
+        auto timedOut = false;
+        if (timeout.count() < 0) {
+            impl.available.wait (lock);
+        }
+        else {
+            timedOut = impl.available.wait_until (lock, deadline) == std::cv_status::timeout;
+        }
+        impl.stats.waiters--;
+
+        if (timedOut && impl.idle.empty() && impl.total >= impl.maxSize) {
+            impl.stats.timeouts++;
+            return ConnectionLease();
+        }
+    }
+
+    return ConnectionLease();
+}
+
+/// \brief Проверка, означает ли код ошибки потерю сессии на сервере.
+/// \param errorCode Код ошибки (ConnectionBase::lastError).
+/// \return true, если подключение больше не годится для использования.
+bool ConnectionPool::isDeadSession (int errorCode) noexcept
+{
+    switch (errorCode) {
+        case   -3333: // клиент не в списке
+        case   -3334: // клиент не выполнил вход
+        case   -3335: // неправильный идентификатор клиента
+        case   -3338: // недопустимый клиент
+        case -100001: // ошибка создания сокета
+        case -100002: // сбой сети
+        case -100003: // нет подключения
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// \brief Кэш записей, общий для подключений пула.
+/// \return Кэш (может быть пустым указателем).
+std::shared_ptr<RecordCache> ConnectionPool::cache() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->cache;
+}
+
+/// \brief Максимальное число подключений.
+std::size_t ConnectionPool::maxSize() const noexcept
+{
+    return this->_impl->maxSize;
+}
+
+/// \brief Минимальное число "тёплых" подключений.
+std::size_t ConnectionPool::minSize() const noexcept
+{
+    return this->_impl->minSize;
+}
+
+/// \brief Назначение кэша записей, общего для подключений пула.
+/// \param cache Кэш (пустой указатель отключает кэширование).
+/// \param policy Политика использования кэша.
+///
+/// Свободные подключения получают кэш сразу, арендованные --
+/// при возврате в пул. Запись, сохранённая через любое подключение
+/// пула, сбрасывается в общем кэше.
+void ConnectionPool::setCache (std::shared_ptr<RecordCache> cache, CachePolicy policy)
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.cache = std::move (cache);
+    impl.cachePolicy = policy;
+    for (auto &item : impl.idle) {
+        item.connection->cache = impl.cache;
+        item.connection->cachePolicy = policy;
+    }
+}
+
+/// \brief Включение дублирования медленных запросов на чтение.
+/// \param hedging Общий для подключений пула объект (пустой указатель
+/// выключает дублирование): оценка задержек и статистика общие.
+///
+/// Свободные подключения получают настройку сразу, арендованные --
+/// при возврате в пул. Если у объекта ещё нет пула для дубликатов,
+/// дубликаты отсылаются через подключения данного пула.
+void ConnectionPool::setHedging (std::shared_ptr<Hedging> hedging)
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    if (hedging && hedging->pool() == nullptr) {
+        hedging->setPool (this);
+    }
+    impl.hedging = std::move (hedging);
+    for (auto &item : impl.idle) {
+        item.connection->hedging = impl.hedging;
+    }
+}
+
+/// \brief Назначение политики повторов подключениям пула.
+/// \param policy Политика.
+///
+/// Свободные подключения получают настройку сразу, арендованные --
+/// при возврате в пул.
+void ConnectionPool::setRetryPolicy (const RetryPolicy &policy)
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.retryPolicy = policy;
+    for (auto &item : impl.idle) {
+        item.connection->retryPolicy = policy;
+    }
+}
+
+/// \brief Остановка пула.
+///
+/// Останавливает фоновый поток, будит ожидающие потоки
+/// (они получают пустую аренду) и отключает свободные подключения.
+/// Арендованные подключения отключаются по мере возврата.
+/// Повторные вызовы игнорируются.
+void ConnectionPool::shutdown()
+{
+    auto &impl = *this->_impl;
+    std::deque<Impl::Idle> idle;
+    {
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        impl.stopping = true;
+        if (impl.hedging && impl.hedging->pool() == this) {
+            impl.hedging->setPool (nullptr);
+        }
+        idle.swap (impl.idle);
+        impl.total -= idle.size();
+        impl.wakeKeeper.notify_all();
+        impl.available.notify_all();
+    }
+
+    if (impl.keeper.joinable()) {
+        impl.keeper.join();
+    }
+
+    for (auto &item : idle) {
+        impl.destroy (item.connection);
+    }
+}
+
+/// \brief Снимок статистики пула.
+PoolStatistics ConnectionPool::statistics() const
+{
+    const auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    auto result = impl.stats;
+    result.totalConnections = impl.total;
+    result.idleConnections = impl.idle.size();
+    result.leasedConnections = impl.total >= impl.idle.size()
+            ? impl.total - impl.idle.size()
+            : 0;
+    return result;
+}
+
+/// \brief Аренда без ожидания.
+/// \return Аренда свободного подключения либо пустая аренда,
+/// если свободных подключений нет. Новые подключения не создаются.
+ConnectionLease ConnectionPool::tryAcquire()
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    if (impl.stopping || impl.idle.empty()) {
+        return ConnectionLease();
+    }
+
+    const auto connection = impl.idle.back().connection;
+    impl.idle.pop_back();
+    impl.stats.leases++;
+    return ConnectionLease (this, connection);
+}
+
+/// \brief Синхронное создание минимального числа подключений.
+/// \return Число свободных подключений в пуле после прогрева.
+///
+/// Полезно вызывать при старте приложения, чтобы первые запросы
+/// не платили за регистрацию на сервере.
+std::size_t ConnectionPool::warmUp()
+{
+    auto &impl = *this->_impl;
+    std::unique_lock<std::mutex> lock (impl.mutex);
+    while (!impl.stopping && impl.total < impl.minSize) {
+        impl.total++;
+        lock.unlock();
+        const auto connection = impl.create();
+        lock.lock();
+        if (connection == nullptr || impl.stopping) {
+            impl.total--;
+            lock.unlock();
+            impl.destroy (connection);
+            lock.lock();
+            break;
+        }
+        impl.idle.push_back ({ connection, PoolClock::now() });
+        impl.available.notify_one();
+    }
+    return impl.idle.size();
+}
+
+}
@@ -4,6 +4,8 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 
+#include <condition_variable>
+#include <deque>
 #include <random>
 
 #if defined(_MSC_VER)
@@ -19,6 +21,7 @@ namespace irbis {
 /// \return Термины, очищенные от префикса.
 /// \warning Для больших баз данных выполнение операции может потребовать
 /// много времени и занять слишком много оперативной памяти.
+/// Для обхода больших словарей лучше использовать TermCursor напрямую.
 StringList ConnectionSearch::listTerms(const String &prefix)
 {
     StringList result;
@@ -27,31 +30,18 @@ StringList ConnectionSearch::listTerms(const String &prefix)
         return result;
     }
 
-    const auto prefixSize = prefix.size();
-    String startTerm = prefix;
-    String lastTerm = startTerm;
-    while (true) {
-        const auto terms = this->readTerms(startTerm, 512);
-        if (terms.empty()) {
-            break;
+    TermParameters parameters;
+    parameters.startTerm = prefix;
+    TermCursor cursor (*this, parameters, prefix);
+    const auto prefixSize = toUtf (prefix).size();
+    int count;
+    std::string text;
+    while (cursor.next (count, text)) {
+        if (text.size() > prefixSize) {
+            result.push_back (fromUtf (ByteSpan (reinterpret_cast<Byte*> (&text[prefixSize]), text.size() - prefixSize)));
         }
-
-        for (const auto &term : terms) {
-            String text = term.text;
-            const auto begin = text.substr(0, prefixSize);
-            if (begin != prefix) {
-                goto DONE;
-            }
-            if (text != startTerm) {
-                lastTerm = text;
-                text = text.substr(prefixSize);
-                result.push_back(text);
-            }
-        }
-        startTerm = lastTerm;
     }
 
-    DONE:
     return result;
 }
 
@@ -72,7 +62,7 @@ std::vector<TermPosting> ConnectionSearch::readPostings (const PostingParameters
     query.add (parameters.numberOfPostings).newLine();
     query.add (parameters.firstPosting).newLine();
     query.addFormat (parameters.format);
-    if (!parameters.listOfTerms.empty()) {
+    if (parameters.listOfTerms.empty()) {
         query.addUtf (parameters.term).newLine();
     } else {
         for (const auto &term : parameters.listOfTerms) {
@@ -85,8 +75,8 @@ std::vector<TermPosting> ConnectionSearch::readPostings (const PostingParameters
         return result;
     }
 
-    const auto lines = response.readRemainingUtfLines();
-    result = TermPosting::parse(lines);
+    const auto lines = response.readRemainingSpans();
+    result = TermPosting::parse (lines);
 
     return result;
 }
@@ -130,7 +120,7 @@ std::vector<TermInfo> ConnectionSearch::readTerms (const TermParameters &paramet
         return result;
     }
 
-    const auto lines = response.readRemainingUtfLines();
+    const auto lines = response.readRemainingSpans();
     result = TermInfo::parse (lines);
 
     return result;
@@ -167,6 +157,10 @@ MfnList ConnectionSearch::search (const String &expression)
 /// \brief Поиск записей.
 /// \param parameters Поисковое выражение.
 /// \return Вектор найденных MFN (возможно, пустой).
+///
+/// Если найдено больше записей, чем помещается в один пакет
+/// (MAXPACKET), результаты дочитываются дополнительными запросами.
+/// Для очень больших выборок лучше использовать SearchCursor напрямую.
 MfnList ConnectionSearch::search (const SearchParameters &parameters)
 {
     MfnList result {};
@@ -174,33 +168,200 @@ MfnList ConnectionSearch::search (const SearchParameters &parameters)
         return result;
     }
 
-    const auto &databaseName = choose (parameters.database, this->database);
-    ClientQuery query (*this, "K");
-    query.addAnsi (databaseName).newLine()
-            .addUtf (parameters.searchExpression).newLine()
-            .add (parameters.numberOfRecords).newLine()
-            .add (parameters.firstRecord).newLine()
-            .addAnsi (parameters.formatSpecification).newLine()
-            .add (parameters.minMfn).newLine()
-            .add (parameters.maxMfn).newLine()
-            .addAnsi (parameters.sequentialSpecification);
+    SearchCursor cursor (*this, parameters);
+    Mfn mfn;
+    while (cursor.next (mfn)) {
+        if (result.empty()) {
+            auto expected = static_cast<std::size_t> (std::max (cursor.total(), 0));
+            if (parameters.numberOfRecords != 0) {
+                expected = std::min (expected, static_cast<std::size_t> (parameters.numberOfRecords));
+            }
+            result.reserve (expected);
+        }
+        result.push_back (mfn);
+    }
 
-    ServerResponse response (*this, query);
-    if (!response.checkReturnCode()) {
+    return result;
+}
+
+
+/// \brief Поиск записей сразу в нескольких базах данных.
+/// \param expression Поисковое выражение.
+/// \param databases Имена баз данных.
+/// \param handler Обработчик, получающий результат по каждой базе,
+/// как только он готов (может быть пустым).
+/// \return Результаты по всем базам.
+MultiSearchResult ConnectionSearch::searchMany (const String &expression, const StringList &databases,
+                                                const std::function<void (const DatabaseFound&)> &handler)
+{
+    SearchParameters parameters {};
+    parameters.searchExpression = expression;
+    parameters.numberOfRecords  = 0;
+    parameters.firstRecord      = 1;
+
+    return this->searchMany (parameters, databases, handler);
+}
+
+/// \brief Поиск записей сразу в нескольких базах данных.
+/// \param parameters Параметры поиска (имя базы игнорируется).
+/// Ограничение numberOfRecords действует для каждой базы отдельно.
+/// \param databases Имена баз данных.
+/// \param handler Обработчик, получающий результат по каждой базе,
+/// как только он готов (может быть пустым). Вызывается в вызывающем потоке
+/// в порядке готовности результатов.
+/// \return Результаты по всем базам в порядке их перечисления.
+/// Код первой из ошибок попадает в lastError.
+///
+/// Команды "K" для всех баз отсылаются одновременно через _submitAsync
+/// (каждая -- по своему соединению движка AsyncEngine, с метриками
+/// и сроками подключения), порции сверх MAXPACKET дочитываются
+/// по мере получения предыдущих.
+MultiSearchResult ConnectionSearch::searchMany (const SearchParameters &parameters, const StringList &databases,
+                                                const std::function<void (const DatabaseFound&)> &handler)
+{
+    using Clock = std::chrono::steady_clock;
+
+    /// Ответ на одну из команд.
+    struct Arrival
+    {
+        std::size_t index;
+        Bytes answer;
+        bool failed;
+    };
+
+    /// Ответы, ожидающие разбора.
+    struct Inbox
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Arrival> arrivals;
+    };
+
+    MultiSearchResult result;
+    result.databases.resize (databases.size());
+    for (std::size_t i = 0; i < databases.size(); ++i) {
+        result.databases[i].database = databases[i];
+    }
+
+    if (!this->_checkConnection()) {
+        for (auto &one : result.databases) {
+            one.errorCode = this->lastError;
+        }
         return result;
     }
-    const auto expected = response.readInteger();
-    auto batchSize = 32000; // MAXPACKET
-    if (expected < batchSize) {
-        batchSize = expected;
+
+    const auto first = std::max (parameters.firstRecord, static_cast<Mfn> (1));
+    const auto limit = static_cast<std::size_t> (parameters.numberOfRecords);
+    const auto withText = !parameters.formatSpecification.empty();
+    const auto started = Clock::now();
+    const auto inbox = std::make_shared<Inbox>();
+    std::vector<Mfn> nextRecord (databases.size(), first);
+
+    // Сколько записей запрашивать в очередной порции (0 -- сколько влезет).
+    const auto pageCount = [&] (std::size_t index) {
+        if (limit == 0) {
+            return 0;
+        }
+        const auto fetched = result.databases[index].lines.size();
+        const auto remaining = limit > fetched ? limit - fetched : 0;
+        return static_cast<int> (std::min (remaining, static_cast<std::size_t> (SearchCursor::PageSize)));
+    };
+
+    const auto submit = [&] (std::size_t index) {
+        ClientQuery query (*this, "K");
+        query.addAnsi (databases[index]).newLine()
+                .addUtf (parameters.searchExpression).newLine()
+                .add (pageCount (index)).newLine()
+                .add (static_cast<int> (nextRecord[index])).newLine()
+                .addAnsi (parameters.formatSpecification).newLine()
+                .add (parameters.minMfn).newLine()
+                .add (parameters.maxMfn).newLine()
+                .addAnsi (parameters.sequentialSpecification);
+        result.databases[index].requests++;
+        const auto shared = inbox;
+        this->_submitAsync (query, [shared, index] (Bytes &&answer, std::exception_ptr error) {
+            std::lock_guard<std::mutex> guard (shared->mutex);
+            shared->arrivals.push_back (Arrival { index, std::move (answer), error != nullptr });
+            shared->changed.notify_one();
+        });
+    };
+
+    for (std::size_t i = 0; i < databases.size(); ++i) {
+        submit (i);
     }
-    for (auto i = 0; i < batchSize; i++) {
-        const auto line = response.readAnsi();
-        StringList parts = maxSplit (line, '#', 2);
-        const auto mfn = fastParse32 (parts[0]);
-        result.push_back (mfn);
+
+    auto outstanding = databases.size();
+    auto firstError = 0;
+    while (outstanding != 0) {
+        Arrival arrival;
+        {
+            std::unique_lock<std::mutex> lock (inbox->mutex);
+            inbox->changed.wait (lock, [&inbox] { return !inbox->arrivals.empty(); });
+            arrival = std::move (inbox->arrivals.front());
+            inbox->arrivals.pop_front();
+        }
+
+        const auto index = arrival.index;
+        auto &found = result.databases[index];
+        const auto elapsed = std::chrono::duration<double, std::milli> (Clock::now() - started).count();
+        if (found.requests == 1) {
+            found.firstAnswerMs = elapsed;
+        }
+
+        auto more = false;
+        if (arrival.failed) {
+            found.errorCode = -100002;
+        }
+        else {
+            ServerResponse response (*this, std::move (arrival.answer));
+            if (!response.checkReturnCode()) {
+                found.errorCode = this->lastError;
+            }
+            else {
+                const auto total = response.readInteger();
+                if (found.requests == 1) {
+                    found.total = total;
+                }
+                const auto wanted = pageCount (index);
+                std::size_t received = 0;
+                for (const auto line : response.readRemainingSpans()) {
+                    if (line.empty()) {
+                        continue;
+                    }
+                    if (wanted != 0 && received == static_cast<std::size_t> (wanted)) {
+                        break;
+                    }
+
+                    const auto sharp = line.indexOf ('#');
+                    const auto mfn = static_cast<Mfn> (fastParse32 (sharp < 0 ? line : line.slice (0, sharp)));
+                    found.lines.emplace_back (mfn, withText && sharp >= 0 ? fromUtf (line.slice (sharp + 1)) : String());
+                    ++received;
+                }
+
+                nextRecord[index] += static_cast<Mfn> (received);
+                more = received != 0
+                       && total >= 0
+                       && nextRecord[index] <= static_cast<Mfn> (total)
+                       && (limit == 0 || pageCount (index) != 0);
+            }
+        }
+
+        if (more) {
+            submit (index);
+            continue;
+        }
+
+        found.elapsedMs = elapsed;
+        if (firstError == 0) {
+            firstError = found.errorCode;
+        }
+        --outstanding;
+        if (handler) {
+            handler (found);
+        }
     }
 
+    this->lastError = firstError;
     return result;
 }
 
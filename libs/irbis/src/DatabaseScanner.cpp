@@ -0,0 +1,146 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_direct.h"
+#include "irbis_internal.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <thread>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4068)
+#endif
+
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+///
+/// \file DatabaseScanner.cpp
+/// \brief Просмотр базы данных с выдачей записей через очередь.
+///
+
+namespace irbis {
+
+/// \brief Внутреннее состояние.
+struct DatabaseScanner::Impl
+{
+    std::size_t capacity;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<MstRecord64> queue;
+    ScanProgress last;            ///< Последний известный ход просмотра.
+    std::exception_ptr failure;   ///< Исключение, прервавшее просмотр.
+    bool cancelled { false };
+    bool finished { false };
+    std::thread producer;
+
+    explicit Impl (std::size_t capacity_)
+        : capacity { std::max (capacity_, static_cast<std::size_t> (1)) }
+    {
+    }
+};
+
+//=========================================================
+
+/// \brief Конструктор: запускает просмотр в фоновом потоке.
+/// \param access Открытая база данных (должна жить дольше объекта).
+/// \param options Настройки просмотра. Обработчик хода просмотра,
+/// если он задан, вызывается из рабочих потоков.
+/// \param capacity Предельная длина очереди прочитанных записей.
+DatabaseScanner::DatabaseScanner (DirectAccess64 &access, const ScanOptions &options, std::size_t capacity)
+    : _impl { new Impl (capacity) }
+{
+    auto &impl = *this->_impl;
+    impl.producer = std::thread ([&impl, &access, options] () {
+        auto settings = options;
+        settings.progress = [&impl, &options] (const ScanProgress &progress) {
+            {
+                std::lock_guard<std::mutex> guard (impl.mutex);
+                impl.last = progress;
+                if (impl.cancelled) {
+                    return false;
+                }
+            }
+            return !options.progress || options.progress (progress);
+        };
+
+        try {
+            const auto result = access.scan ([&impl] (const MstRecord64 &record) {
+                std::unique_lock<std::mutex> lock (impl.mutex);
+                impl.changed.wait (lock, [&impl] { return impl.queue.size() < impl.capacity || impl.cancelled; });
+                if (impl.cancelled) {
+                    return false;
+                }
+                impl.queue.push_back (record);
+                impl.changed.notify_all();
+                return true;
+            }, settings);
+
+            std::lock_guard<std::mutex> guard (impl.mutex);
+            impl.last = result;
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard (impl.mutex);
+            impl.failure = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        impl.finished = true;
+        impl.changed.notify_all();
+    });
+}
+
+/// \brief Деструктор. Прерывает просмотр и дожидается его окончания.
+DatabaseScanner::~DatabaseScanner()
+{
+    this->cancel();
+    if (this->_impl->producer.joinable()) {
+        this->_impl->producer.join();
+    }
+}
+
+/// \brief Прерывание просмотра. Записи, ещё не выбранные из очереди, отбрасываются.
+void DatabaseScanner::cancel()
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    this->_impl->cancelled = true;
+    this->_impl->queue.clear();
+    this->_impl->changed.notify_all();
+}
+
+/// \brief Получение очередной записи (ждёт, пока она не будет прочитана).
+/// \param record Куда поместить запись.
+/// \return false, если записи кончились либо просмотр прерван.
+/// \throw Исключение, прервавшее просмотр (выбрасывается один раз).
+bool DatabaseScanner::next (MstRecord64 &record)
+{
+    auto &impl = *this->_impl;
+    std::unique_lock<std::mutex> lock (impl.mutex);
+    impl.changed.wait (lock, [&impl] { return !impl.queue.empty() || impl.finished || impl.cancelled; });
+    if (!impl.queue.empty()) {
+        record = std::move (impl.queue.front());
+        impl.queue.pop_front();
+        impl.changed.notify_all();
+        return true;
+    }
+
+    if (impl.failure) {
+        auto failure = impl.failure;
+        impl.failure = nullptr;
+        std::rethrow_exception (failure);
+    }
+
+    return false;
+}
+
+/// \brief Снимок хода просмотра (обновляется после каждой порции MFN).
+ScanProgress DatabaseScanner::progress() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->last;
+}
+
+}
@@ -5,12 +5,26 @@
 #include "irbis_direct.h"
 #include "irbis_internal.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+/// \class irbis::DirectAccess64
+/// \details Просмотр всей базы (scan()) устроен так: диапазон MFN
+/// режется на порции, рабочие потоки разбирают их по очереди.
+/// Поток читает XRF-ссылки порции одним блоком, отбрасывает удалённые
+/// и отсутствующие записи по флагам и читает MST-записи в порядке
+/// возрастания смещения, чтобы файл читался подряд и работало
+/// упреждающее чтение операционной системы.
+
 namespace irbis {
 
 /// \brief Конструктор.
 /// \param parPath Путь до PAR-файла.
 /// \param systemPath Системный путь.
-DirectAccess64::DirectAccess64 (const String &parPath, const String &systemPath)
+/// \param memoryMapped Спроецировать MST-файл в память (см. MstFile64).
+DirectAccess64::DirectAccess64 (const String &parPath, const String &systemPath, bool memoryMapped)
 {
     const auto par = ParFile::readLocalFile (parPath);
     auto databaseName = IO::getFileName (parPath);
@@ -29,8 +43,35 @@ DirectAccess64::DirectAccess64 (const String &parPath, const String &systemPath)
         throw IrbisException();
     }
 
-    this->mst = new MstFile64 (mstPath, DirectAccessMode::ReadOnly);
-    this->xrf = new XrfFile64 (xrfPath, DirectAccessMode::ReadOnly);
+    this->_open (mstPath, xrfPath, DirectAccessMode::ReadOnly, memoryMapped);
+}
+
+/// \brief Конструктор.
+/// \param mstPath Путь до MST-файла.
+/// \param xrfPath Путь до XRF-файла.
+/// \param mode Режим доступа.
+/// \param memoryMapped Спроецировать MST-файл в память (см. MstFile64).
+/// \details Имя базы данных берётся из имени MST-файла.
+/// Удобен, когда PAR-файла нет либо пути в нём не годятся
+/// для файловой системы, чувствительной к регистру символов.
+DirectAccess64::DirectAccess64 (const String &mstPath, const String &xrfPath, DirectAccessMode mode,
+                                bool memoryMapped)
+{
+    if (!IO::fileExist (mstPath) || !IO::fileExist (xrfPath)) {
+        throw IrbisException();
+    }
+
+    this->_open (mstPath, xrfPath, mode, memoryMapped);
+}
+
+void DirectAccess64::_open (const String &mstPath, const String &xrfPath, DirectAccessMode mode,
+                            bool memoryMapped)
+{
+    const auto fileName = IO::getFileName (mstPath);
+    this->database = fileName.substr (0, fileName.size() - IO::getExtension (fileName).size());
+    std::unique_ptr<MstFile64> mst_ { new MstFile64 (mstPath, mode, memoryMapped) };
+    this->xrf = new XrfFile64 (xrfPath, mode);
+    this->mst = mst_.release();
 }
 
 /// \brief Деструктор.
@@ -42,19 +83,189 @@ DirectAccess64::~DirectAccess64()
     this->xrf = nullptr;
 }
 
+/// \brief Сведения о базе данных без обращения к серверу.
+/// \return Списки удалённых, неактуализированных и заблокированных записей,
+/// максимальный MFN и признак блокировки базы.
+/// \details XRF-файл проецируется в память и просматривается за один проход.
+DatabaseInfo DirectAccess64::getDatabaseInfo() const
+{
+    const XrfView view (this->xrf->fileName());
+    const auto maxMfn = this->getMaxMfn();
+    auto result = view.databaseInfo (maxMfn);
+    result.name = this->database;
+    result.maxMfn = maxMfn;
+    result.databaseLocked = this->mst->control.locked != 0;
+    return result;
+}
+
+/// \brief Максимальный MFN.
+/// \return Номер последней записи в базе данных (0 для пустой базы).
+Mfn DirectAccess64::getMaxMfn() const
+{
+    const auto next = this->mst->control.nextMfn;
+    return next == 0 ? 0 : next - 1;
+}
+
 /// \brief Чтение сырой записи.
+/// \param mfn MFN записи.
+/// \return Прочитанная запись.
+/// \throw IrbisException MFN вне диапазона либо запись отсутствует.
 MstRecord64 DirectAccess64::readMstRecord (Mfn mfn)
 {
-    MstRecord64 result;
+    if (mfn == 0 || mfn > this->getMaxMfn()) {
+        throw IrbisException();
+    }
 
-    return result;
+    const auto xrf_ = this->xrf->readRecord (mfn);
+    if (xrf_.offset == 0) {
+        throw IrbisException();
+    }
+
+    return this->mst->readRecord (static_cast<int64_t> (xrf_.offset));
 }
 
+/// \brief Чтение записи.
+/// \param mfn MFN записи.
+/// \return Прочитанная запись.
+/// \throw IrbisException MFN вне диапазона либо запись отсутствует.
 MarcRecord DirectAccess64::readRecord (Mfn mfn)
 {
-    const auto xrf_ = this->xrf->readRecord (mfn);
-    const auto mst_ = this->mst->readRecord (xrf_.offset);
-    return mst_.toMarcRecord();
+    auto result = this->readMstRecord (mfn).toMarcRecord();
+    result.database = this->database;
+    return result;
+}
+
+/// \brief Просмотр всех записей базы данных несколькими потоками.
+/// \param handler Обработчик записи. Вызывается одновременно из рабочих
+/// потоков в произвольном порядке MFN. Вернув false, прерывает просмотр.
+/// \param options Настройки.
+/// \return Итог просмотра.
+/// \throw Исключение, выброшенное обработчиком либо при чтении XRF-файла.
+/// Повреждённые MST-записи не прерывают просмотр, а учитываются в ScanProgress::errors.
+ScanProgress DirectAccess64::scan (const ScanHandler &handler, const ScanOptions &options)
+{
+    const auto maxMfn = this->getMaxMfn();
+    const auto first = std::max (options.firstMfn, static_cast<Mfn> (1));
+    const auto last = options.lastMfn == 0 ? maxMfn : std::min (options.lastMfn, maxMfn);
+    ScanProgress progress;
+    if (first > last) {
+        return progress;
+    }
+
+    progress.total = last - first + 1;
+    const auto partition = std::max (options.partition, static_cast<std::size_t> (1));
+    const auto partitions = (static_cast<std::size_t> (progress.total) + partition - 1) / partition;
+    auto threads = options.threads != 0 ? options.threads
+            : static_cast<std::size_t> (std::max (std::thread::hardware_concurrency(), 1u));
+    threads = std::min (threads, partitions);
+
+    const auto skipMask = RecordStatus::Deleted | RecordStatus::Absent;
+    std::atomic<std::size_t> nextPartition { 0 };
+    std::atomic<bool> stop { false };
+    std::mutex mutex; // progress, failure и вызовы options.progress
+    std::exception_ptr failure;
+
+    const auto worker = [&] () {
+        std::vector<XrfRecord64> entries (std::min (partition, static_cast<std::size_t> (progress.total)));
+        std::vector<std::size_t> order;
+        while (!stop) {
+            const auto index = nextPartition++;
+            if (index >= partitions) {
+                break;
+            }
+
+            const auto start = static_cast<Mfn> (first + index * partition);
+            const auto count = std::min (partition, static_cast<std::size_t> (last - start) + 1);
+            ScanProgress local;
+            local.processed = static_cast<Mfn> (count);
+            try {
+                const auto got = this->xrf->readRange (start, count, entries.data());
+                local.skipped = static_cast<Mfn> (count - got);
+                order.clear();
+                for (std::size_t i = 0; i < got; ++i) {
+                    const auto &entry = entries[i];
+                    if (entry.offset == 0
+                        || (options.skipDeleted && (entry.status & skipMask) != RecordStatus::None)) {
+                        ++local.skipped;
+                    }
+                    else {
+                        order.push_back (i);
+                    }
+                }
+                std::sort (order.begin(), order.end(), [&entries] (std::size_t left, std::size_t right) {
+                    return entries[left].offset < entries[right].offset;
+                });
+
+                for (const auto i : order) {
+                    if (stop) {
+                        break;
+                    }
+                    MstRecord64 record;
+                    try {
+                        record = this->mst->readRecord (static_cast<int64_t> (entries[i].offset));
+                    }
+                    catch (const IrbisException &) {
+                        ++local.errors;
+                        continue;
+                    }
+                    local.bytes += record.leader.length;
+                    if (options.skipDeleted && record.deleted()) {
+                        ++local.skipped;
+                        continue;
+                    }
+                    ++local.delivered;
+                    if (!handler (record)) {
+                        local.cancelled = true;
+                        stop = true;
+                    }
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard (mutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+                stop = true;
+                return;
+            }
+
+            std::lock_guard<std::mutex> guard (mutex);
+            progress.processed += local.processed;
+            progress.delivered += local.delivered;
+            progress.skipped += local.skipped;
+            progress.errors += local.errors;
+            progress.bytes += local.bytes;
+            progress.cancelled = progress.cancelled || local.cancelled;
+            if (options.progress && !failure) {
+                try {
+                    if (!options.progress (progress)) {
+                        progress.cancelled = true;
+                        stop = true;
+                    }
+                }
+                catch (...) {
+                    failure = std::current_exception();
+                    stop = true;
+                }
+            }
+        }
+    };
+
+    // Вызывающий поток работает наравне с остальными.
+    std::vector<std::thread> helpers;
+    for (std::size_t i = 1; i < threads; ++i) {
+        helpers.emplace_back (worker);
+    }
+    worker();
+    for (auto &helper : helpers) {
+        helper.join();
+    }
+
+    if (failure) {
+        std::rethrow_exception (failure);
+    }
+
+    return progress;
 }
 
 }
@@ -19,6 +19,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
+#include <cerrno>
 
 #endif
 
@@ -465,6 +466,66 @@ int64_t File::read (Byte *buffer, int64_t nbytes)
 #endif
 }
 
+/// \brief Чтение с указанного смещения.
+/// \param offset Смещение от начала файла.
+/// \param buffer Буфер.
+/// \param nbytes Количество считываемых байт.
+/// \return Количество прочитанных байт (меньше nbytes только в конце файла).
+/// \throw IrbisException Ошибка чтения.
+/// \details Может вызываться из нескольких потоков одновременно.
+/// Под POSIX (pread) текущая позиция не меняется, а под Windows
+/// ReadFile с OVERLAPPED на неасинхронном дескрипторе сдвигает её.
+/// Поэтому после readAt текущая позиция не определена: перед read
+/// и write нужен seek.
+int64_t File::readAt (uint64_t offset, Byte *buffer, int64_t nbytes)
+{
+    int64_t result = 0;
+    while (result < nbytes) {
+
+#ifdef IRBIS_WINDOWS
+
+        OVERLAPPED overlapped {};
+        overlapped.Offset = static_cast<DWORD> (offset & 0xFFFFFFFFull);
+        overlapped.OffsetHigh = static_cast<DWORD> (offset >> 32u);
+        DWORD numberOfBytesRead = 0;
+        if (!::ReadFile (this->_handle, buffer + result, static_cast<DWORD> (nbytes - result),
+                         &numberOfBytesRead, &overlapped)) {
+            if (::GetLastError() == ERROR_HANDLE_EOF) {
+                break;
+            }
+            DisplayError();
+            throw IrbisException();
+        }
+        const auto portion = static_cast<int64_t> (numberOfBytesRead);
+
+#else
+
+#if defined (IRBIS_APPLE) || defined (IRBIS_FREEBSD)
+        const auto portion = static_cast<int64_t> (::pread (this->_handle, buffer + result,
+                static_cast<std::size_t> (nbytes - result), static_cast<off_t> (offset)));
+#else
+        const auto portion = static_cast<int64_t> (::pread64 (this->_handle, buffer + result,
+                static_cast<std::size_t> (nbytes - result), static_cast<off64_t> (offset)));
+#endif
+        if (portion < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw IrbisException();
+        }
+
+#endif
+
+        if (portion == 0) {
+            break;
+        }
+        result += portion;
+        offset += static_cast<uint64_t> (portion);
+    }
+
+    return result;
+}
+
 /// \brief Чтение от текущей позиции до конца файла.
 /// \return Строка, возможно, пустая.
 std::string File::readAll ()
@@ -735,6 +796,54 @@ int64_t File::write (const Byte* buffer, int64_t nbytes)
 #endif
 }
 
+/// \brief Запись по указанному смещению.
+/// \param offset Смещение от начала файла.
+/// \param buffer Буфер.
+/// \param nbytes Количество записываемых байт.
+/// \throw IrbisException Записать все байты не удалось.
+/// \details Как и после readAt, текущая позиция после writeAt
+/// не определена (под Windows она сдвигается): перед read и write нужен seek.
+void File::writeAt (uint64_t offset, const Byte *buffer, int64_t nbytes)
+{
+    int64_t done = 0;
+    while (done < nbytes) {
+
+#ifdef IRBIS_WINDOWS
+
+        OVERLAPPED overlapped {};
+        overlapped.Offset = static_cast<DWORD> (offset & 0xFFFFFFFFull);
+        overlapped.OffsetHigh = static_cast<DWORD> (offset >> 32u);
+        DWORD numberOfBytesWritten = 0;
+        if (!::WriteFile (this->_handle, buffer + done, static_cast<DWORD> (nbytes - done),
+                          &numberOfBytesWritten, &overlapped)) {
+            DisplayError();
+            throw IrbisException();
+        }
+        const auto portion = static_cast<int64_t> (numberOfBytesWritten);
+
+#else
+
+#if defined (IRBIS_APPLE) || defined (IRBIS_FREEBSD)
+        const auto portion = static_cast<int64_t> (::pwrite (this->_handle, buffer + done,
+                static_cast<std::size_t> (nbytes - done), static_cast<off_t> (offset)));
+#else
+        const auto portion = static_cast<int64_t> (::pwrite64 (this->_handle, buffer + done,
+                static_cast<std::size_t> (nbytes - done), static_cast<off64_t> (offset)));
+#endif
+        if (portion < 0 && errno == EINTR) {
+            continue;
+        }
+
+#endif
+
+        if (portion <= 0) {
+            throw IrbisException();
+        }
+        done += portion;
+        offset += static_cast<uint64_t> (portion);
+    }
+}
+
 /// \brief Запись беззнакового 32-битного целого в сетевом формате.
 /// \param number Записываемое значение.
 void File::writeInt32 (uint32_t number)
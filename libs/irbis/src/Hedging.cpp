@@ -0,0 +1,151 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+///
+/// \file Hedging.cpp
+/// \brief Дублирование медленных запросов на чтение.
+///
+
+/// \class irbis::Hedging
+/// \details Порог дублирования -- заданный перцентиль задержек последних
+/// window запросов (точный, по кольцевому буферу), ограниченный снизу
+/// и сверху. Пока замеров меньше MinSamples, порог равен maxDelay.
+/// Сам дубликат отсылается из ServerResponse через AsyncEngine
+/// по подключению, арендованному у пула.
+
+namespace irbis {
+
+namespace {
+
+const std::size_t MinSamples = 16;
+
+}
+
+//=========================================================
+
+/// \brief Доля запросов, для которых был отослан дубликат.
+double HedgingStatistics::hedgeRate() const noexcept
+{
+    return this->requests == 0 ? 0.0 : static_cast<double> (this->hedged) / static_cast<double> (this->requests);
+}
+
+/// \brief Доля дубликатов, ответивших первыми.
+double HedgingStatistics::winRate() const noexcept
+{
+    return this->hedged == 0 ? 0.0 : static_cast<double> (this->wins) / static_cast<double> (this->hedged);
+}
+
+//=========================================================
+
+/// \brief Внутреннее состояние.
+struct Hedging::Impl
+{
+    double percentile;
+    std::chrono::microseconds minDelay;
+    std::chrono::microseconds maxDelay;
+    std::vector<uint64_t> samples; ///< Кольцевой буфер задержек, микросекунды.
+    std::size_t capacity;
+    std::size_t next { 0 };
+    HedgingStatistics stats;
+    std::atomic<ConnectionPool*> pool { nullptr };
+    mutable std::mutex mutex;
+};
+
+/// \brief Конструктор.
+/// \param percentile Перцентиль задержек, по истечении которого отсылается дубликат.
+/// \param minDelay Нижняя граница порога.
+/// \param maxDelay Верхняя граница порога.
+/// \param window Число последних запросов, по которым оценивается перцентиль.
+Hedging::Hedging (double percentile, std::chrono::milliseconds minDelay, std::chrono::milliseconds maxDelay,
+                  std::size_t window)
+    : _impl { new Impl }
+{
+    auto &impl = *this->_impl;
+    impl.percentile = std::min (std::max (percentile, 0.0), 1.0);
+    impl.minDelay = minDelay;
+    impl.maxDelay = std::max (maxDelay, minDelay);
+    impl.capacity = std::max (window, MinSamples);
+    impl.samples.reserve (impl.capacity);
+}
+
+/// \brief Деструктор.
+Hedging::~Hedging() = default;
+
+/// \brief Текущий порог: время, по истечении которого отсылается дубликат.
+std::chrono::microseconds Hedging::delay() const
+{
+    const auto &impl = *this->_impl;
+    std::vector<uint64_t> sorted;
+    {
+        std::lock_guard<std::mutex> guard (impl.mutex);
+        if (impl.samples.size() < MinSamples) {
+            return impl.maxDelay;
+        }
+        sorted = impl.samples;
+    }
+
+    const auto rank = static_cast<std::size_t> (std::ceil (impl.percentile * static_cast<double> (sorted.size())));
+    const auto index = std::min (std::max (rank, static_cast<std::size_t> (1)), sorted.size()) - 1;
+    std::nth_element (sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t> (index), sorted.end());
+    const std::chrono::microseconds result (static_cast<int64_t> (sorted[index]));
+    return std::min (std::max (result, impl.minDelay), impl.maxDelay);
+}
+
+/// \brief Пул, подключения которого используются для дубликатов.
+/// \return Пул либо nullptr.
+ConnectionPool* Hedging::pool() const noexcept
+{
+    return this->_impl->pool;
+}
+
+/// \brief Учёт выполненного запроса.
+/// \param micros Задержка ответа, использованного клиентом, микросекунды.
+/// \param hedged Был ли отослан дубликат.
+/// \param hedgeWon Дубликат ответил первым.
+void Hedging::record (uint64_t micros, bool hedged, bool hedgeWon)
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    if (impl.samples.size() < impl.capacity) {
+        impl.samples.push_back (micros);
+    }
+    else {
+        impl.samples[impl.next] = micros;
+        impl.next = (impl.next + 1) % impl.capacity;
+    }
+
+    impl.stats.requests++;
+    if (hedged) {
+        impl.stats.hedged++;
+    }
+    if (hedgeWon) {
+        impl.stats.wins++;
+    }
+}
+
+/// \brief Назначение пула для дубликатов.
+/// \param pool Пул (nullptr -- дубликаты не отсылаются).
+/// Должен жить дольше подключений, использующих данный объект.
+///
+/// Дубликат отсылается, только если в пуле есть свободное подключение:
+/// ожидания освобождения подключения нет.
+void Hedging::setPool (ConnectionPool *pool) noexcept
+{
+    this->_impl->pool = pool;
+}
+
+/// \brief Снимок статистики.
+HedgingStatistics Hedging::statistics() const
+{
+    std::lock_guard<std::mutex> guard (this->_impl->mutex);
+    return this->_impl->stats;
+}
+
+}
@@ -0,0 +1,510 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_direct.h"
+#include "irbis_internal.h"
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4068)
+#endif
+
+#include <cstring>
+
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/*!
+    \file InvertedFile.cpp
+
+    Чтение поискового словаря напрямую.
+
+    \class irbis::InvertedFile64
+    \details Словарь состоит из трёх файлов:
+
+    * N01 -- узлы B*-дерева (блоки по 2048 байт),
+      элементы которых ссылаются на нижележащие узлы
+      либо (отрицательным числом) на листья;
+    * L01 -- листья (блоки по 2048 байт), в которых хранятся
+      сами термины в порядке возрастания и смещения их
+      списков ссылок в IFP-файле; листья связаны в цепочку;
+    * IFP -- списки ссылок (постингов), блоки которых также
+      могут быть связаны в цепочку; для терминов с большим
+      числом ссылок используется специальный блок,
+      начинающийся с маркера -1001.
+
+    Все числа хранятся в сетевом порядке байтов,
+    термины -- в кодировке UTF-8.
+
+    Все три файла проецируются в память. Узлы разбираются на месте,
+    без копирования терминов, поиск внутри узла двоичный, а чтение
+    не требует блокировок, так что словарь можно читать из многих
+    потоков одновременно.
+
+    \warning Объекты данного типа -- неперемещаемые и некопируемые!
+
+ */
+
+namespace irbis {
+
+namespace {
+
+const int     NodeLength   = 2048;  // Длина узла N01/L01.
+const int     NodeHeader   = 16;    // Длина заголовка узла.
+const int     ItemLength   = 12;    // Длина элемента узла.
+const int     BlockHeader  = 20;    // Длина заголовка блока IFP.
+const int     LinkLength   = 16;    // Длина ссылки в блоке IFP.
+const int     SlotLength   = 24;    // Длина элемента специального блока.
+const int32_t SpecialBlock = -1001; // Маркер специального блока.
+
+int32_t bigEndian32 (const Byte *ptr) noexcept
+{
+    return static_cast<int32_t> (readBig32 (ptr));
+}
+
+int bigEndian16 (const Byte *ptr) noexcept
+{
+    return static_cast<int> ((static_cast<unsigned> (ptr[0]) << 8u) | ptr[1]);
+}
+
+int64_t makeOffset (int32_t low, int32_t high) noexcept
+{
+    return static_cast<int64_t> ((static_cast<uint64_t> (static_cast<uint32_t> (high)) << 32u)
+        | static_cast<uint32_t> (low));
+}
+
+// Узел N01 либо лист L01, разбираемый прямо в проекции файла.
+struct Node
+{
+    const Byte *data { nullptr };
+    int32_t number   { 0 };
+    int32_t previous { -1 };
+    int32_t next     { -1 };
+    std::size_t count { 0 };
+
+    const Byte* item (std::size_t index) const noexcept
+    {
+        return this->data + NodeHeader + index * ItemLength;
+    }
+
+    int32_t low  (std::size_t index) const noexcept { return bigEndian32 (this->item (index) + 4); }
+    int32_t high (std::size_t index) const noexcept { return bigEndian32 (this->item (index) + 8); }
+
+    std::string key (std::size_t index) const
+    {
+        const auto one = this->item (index);
+        return std::string (reinterpret_cast<const char*> (this->data + bigEndian16 (one + 2)),
+                            static_cast<std::size_t> (bigEndian16 (one)));
+    }
+
+    // Сравнение ключа элемента с заданным (побайтно, как std::string).
+    int compare (std::size_t index, const std::string &key) const noexcept
+    {
+        const auto one = this->item (index);
+        const auto length = static_cast<std::size_t> (bigEndian16 (one));
+        const auto common = std::min (length, key.size());
+        const auto result = common == 0 ? 0
+                : std::memcmp (this->data + bigEndian16 (one + 2), key.data(), common);
+        if (result != 0) {
+            return result;
+        }
+        return length < key.size() ? -1 : (length > key.size() ? 1 : 0);
+    }
+
+    // Индекс первого элемента, ключ которого не меньше заданного.
+    std::size_t lowerBound (const std::string &key) const noexcept
+    {
+        std::size_t left = 0, right = this->count;
+        while (left < right) {
+            const auto middle = left + (right - left) / 2;
+            if (this->compare (middle, key) < 0) {
+                left = middle + 1;
+            }
+            else {
+                right = middle;
+            }
+        }
+        return left;
+    }
+
+    // Индекс первого элемента, ключ которого больше заданного.
+    std::size_t upperBound (const std::string &key) const noexcept
+    {
+        std::size_t left = 0, right = this->count;
+        while (left < right) {
+            const auto middle = left + (right - left) / 2;
+            if (this->compare (middle, key) <= 0) {
+                left = middle + 1;
+            }
+            else {
+                right = middle;
+            }
+        }
+        return left;
+    }
+};
+
+}
+
+//=========================================================
+
+/// \brief Внутреннее состояние словаря.
+struct InvertedFile64::Impl
+{
+    MemoryFile ifp, l01, n01;
+    int32_t nodeCount { 0 };
+    int32_t root { 0 };
+
+    Node readNode (const MemoryFile &file, int32_t number) const;
+    bool findLeaf (const std::string &key, Node &leaf, std::size_t &index) const;
+    bool nextItem (Node &leaf, std::size_t &index) const;
+    bool previousItem (Node &leaf, std::size_t &index) const;
+    int  postingCount (const Node &leaf, std::size_t index) const;
+    void readPostings (const Node &leaf, std::size_t index, int first, int count,
+                       std::vector<TermPosting> &result) const;
+    bool lastItem (Node &leaf, std::size_t &index) const;
+};
+
+Node InvertedFile64::Impl::readNode (const MemoryFile &file, int32_t number) const
+{
+    const auto start = static_cast<uint64_t> (number - 1) * NodeLength;
+    if (number < 1 || start + NodeHeader > file.size()) {
+        throw IrbisException();
+    }
+
+    // Последний узел файла может быть неполным.
+    const auto available = static_cast<int> (std::min (file.size() - start, static_cast<uint64_t> (NodeLength)));
+    Node result;
+    result.data     = file.data() + start;
+    result.number   = bigEndian32 (result.data);
+    result.previous = bigEndian32 (result.data + 4);
+    result.next     = bigEndian32 (result.data + 8);
+    const auto termCount = bigEndian16 (result.data + 12);
+    if (NodeHeader + termCount * ItemLength > available) {
+        throw IrbisException();
+    }
+
+    result.count = static_cast<std::size_t> (termCount);
+    for (std::size_t i = 0; i < result.count; ++i) {
+        const auto item = result.item (i);
+        if (bigEndian16 (item + 2) + bigEndian16 (item) > available) {
+            throw IrbisException();
+        }
+    }
+
+    return result;
+}
+
+// Поиск листа и позиции в нём первого термина, не меньшего заданного.
+bool InvertedFile64::Impl::findLeaf (const std::string &key, Node &leaf, std::size_t &index) const
+{
+    int32_t leafNumber = 1;
+    if (this->nodeCount != 0) {
+        auto node = this->readNode (this->n01, this->root);
+        while (true) {
+            if (node.count == 0) {
+                return false;
+            }
+            // Последний элемент с ключом не больше заданного (либо первый).
+            const auto bound = node.upperBound (key);
+            const auto link = node.low (bound == 0 ? 0 : bound - 1);
+            if (link < 0) {
+                leafNumber = -link;
+                break;
+            }
+            node = this->readNode (this->n01, link);
+        }
+    }
+
+    leaf = this->readNode (this->l01, leafNumber);
+    while (true) {
+        index = leaf.lowerBound (key);
+        if (index < leaf.count) {
+            return true;
+        }
+        if (leaf.next <= 0) {
+            return false;
+        }
+        leaf = this->readNode (this->l01, leaf.next);
+    }
+}
+
+// Переход к следующему термину (с переходом на следующий лист).
+bool InvertedFile64::Impl::nextItem (Node &leaf, std::size_t &index) const
+{
+    ++index;
+    while (index >= leaf.count) {
+        if (leaf.next <= 0) {
+            return false;
+        }
+        leaf = this->readNode (this->l01, leaf.next);
+        index = 0;
+    }
+    return true;
+}
+
+// Переход к предыдущему термину (с переходом на предыдущий лист).
+bool InvertedFile64::Impl::previousItem (Node &leaf, std::size_t &index) const
+{
+    while (index == 0) {
+        if (leaf.previous <= 0) {
+            return false;
+        }
+        leaf = this->readNode (this->l01, leaf.previous);
+        index = leaf.count;
+    }
+    --index;
+    return true;
+}
+
+// Переход к последнему термину словаря.
+bool InvertedFile64::Impl::lastItem (Node &leaf, std::size_t &index) const
+{
+    if (!this->findLeaf (std::string(), leaf, index)) {
+        return false;
+    }
+    while (leaf.next > 0) {
+        leaf = this->readNode (this->l01, leaf.next);
+    }
+    index = leaf.count;
+    return this->previousItem (leaf, index);
+}
+
+// Число ссылок термина (из заголовка его первого блока IFP).
+int InvertedFile64::Impl::postingCount (const Node &leaf, std::size_t index) const
+{
+    const auto offset = makeOffset (leaf.low (index), leaf.high (index));
+    return bigEndian32 (this->ifp.slice (static_cast<uint64_t> (offset), BlockHeader).cdata() + 8);
+}
+
+// Ссылки термина, начиная с first-й (с 1), не более count (0 -- все).
+void InvertedFile64::Impl::readPostings (const Node &leaf, std::size_t index, int first, int count,
+                                         std::vector<TermPosting> &result) const
+{
+    auto offset = makeOffset (leaf.low (index), leaf.high (index));
+    auto header = this->ifp.slice (static_cast<uint64_t> (offset), BlockHeader).cdata();
+    if (bigEndian32 (header) == SpecialBlock && bigEndian32 (header + 4) == SpecialBlock) {
+        // Специальный блок: первый элемент указывает на первый обычный блок.
+        const auto slot = this->ifp.slice (static_cast<uint64_t> (offset) + BlockHeader, SlotLength).cdata();
+        offset = makeOffset (bigEndian32 (slot + 16), bigEndian32 (slot + 20));
+    }
+
+    auto skip = static_cast<int64_t> (std::max (first, 1) - 1);
+    std::size_t taken = 0;
+    while (true) {
+        header = this->ifp.slice (static_cast<uint64_t> (offset), BlockHeader).cdata();
+        const auto nextLow  = bigEndian32 (header);
+        const auto nextHigh = bigEndian32 (header + 4);
+        const auto blockLinks = bigEndian32 (header + 12);
+        if (blockLinks < 0) {
+            throw IrbisException();
+        }
+
+        // Блоки, целиком попадающие в пропуск, не разбираются.
+        if (skip >= blockLinks) {
+            skip -= blockLinks;
+        }
+        else {
+            const auto links = this->ifp.slice (static_cast<uint64_t> (offset) + BlockHeader,
+                    static_cast<uint64_t> (blockLinks) * LinkLength).cdata();
+            for (auto position = skip; position < blockLinks; ++position) {
+                const auto link = links + position * LinkLength;
+                TermPosting posting;
+                posting.mfn        = static_cast<Mfn> (bigEndian32 (link));
+                posting.tag        = static_cast<Mfn> (bigEndian32 (link + 4));
+                posting.occurrence = static_cast<Mfn> (bigEndian32 (link + 8));
+                posting.count      = static_cast<Mfn> (bigEndian32 (link + 12));
+                result.push_back (std::move (posting));
+                if (count > 0 && ++taken >= static_cast<std::size_t> (count)) {
+                    return;
+                }
+            }
+            skip = 0;
+        }
+
+        if (nextLow == -1 && nextHigh == -1) {
+            break;
+        }
+        offset = makeOffset (nextLow, nextHigh);
+    }
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param fileName Путь к IFP-файлу. Файлы L01 и N01
+/// должны находиться рядом с ним.
+/// \throw IrbisException Не найден либо не проецируется один из файлов словаря.
+InvertedFile64::InvertedFile64 (const String &fileName)
+    : fileName { fileName }, _impl { new Impl }
+{
+    const auto stem = fileName.substr (0, fileName.size() - IO::getExtension (fileName).size());
+    const auto l01Path = stem + L".l01";
+    const auto n01Path = stem + L".n01";
+    if (!IO::fileExist (fileName) || !IO::fileExist (l01Path) || !IO::fileExist (n01Path)) {
+        throw IrbisException();
+    }
+
+    auto &impl = *this->_impl;
+    impl.ifp = MemoryFile (fileName);
+    impl.l01 = MemoryFile (l01Path);
+    impl.n01 = MemoryFile (n01Path);
+
+    // Управляющая запись IFP: смещение свободного места,
+    // число узлов N01 и число листьев L01.
+    impl.nodeCount = bigEndian32 (impl.ifp.slice (0, 12).cdata() + 8);
+    if (impl.nodeCount != 0) {
+        impl.root = impl.readNode (impl.n01, 1).number;
+    }
+}
+
+/// \brief Деструктор.
+InvertedFile64::~InvertedFile64() = default;
+
+/// \brief Поиск термина по точному совпадению.
+/// \param term Термин.
+/// \param info Куда поместить термин и число ссылок на него.
+/// \return true, если термин найден.
+/// \throw IrbisException Файлы словаря повреждены.
+bool InvertedFile64::findTerm (const String &term, TermInfo &info) const
+{
+    const auto key = toUtf (term);
+    const auto &impl = *this->_impl;
+    Node leaf;
+    std::size_t index;
+    if (!impl.findLeaf (key, leaf, index) || leaf.compare (index, key) != 0) {
+        return false;
+    }
+
+    info.count = impl.postingCount (leaf, index);
+    info.text = term;
+    return true;
+}
+
+/// \brief Перечень терминов, начинающихся с указанного префикса.
+/// \param prefix Префикс (например, "K=").
+/// \param limit Максимальное число терминов (0 -- все).
+/// \return Термины в порядке возрастания.
+/// \throw IrbisException Файлы словаря повреждены.
+std::vector<TermInfo> InvertedFile64::listTerms (const String &prefix, int limit) const
+{
+    std::vector<TermInfo> result;
+    const auto key = toUtf (prefix);
+    const auto &impl = *this->_impl;
+    Node leaf;
+    std::size_t index;
+    auto found = impl.findLeaf (key, leaf, index);
+    while (found && (limit <= 0 || result.size() < static_cast<std::size_t> (limit))) {
+        const auto text = leaf.key (index);
+        if (text.compare (0, key.size(), key) != 0) {
+            break;
+        }
+        result.emplace_back (impl.postingCount (leaf, index), fromUtf (text));
+        found = impl.nextItem (leaf, index);
+    }
+
+    return result;
+}
+
+/// \brief Чтение ссылок для указанного термина.
+/// \param term Термин (точное совпадение).
+/// \param first Номер первой возвращаемой ссылки (нумерация с 1).
+/// \param count Максимальное число ссылок (0 -- все).
+/// \return Ссылки (пустой вектор, если термин не найден).
+/// \throw IrbisException Файлы словаря повреждены.
+std::vector<TermPosting> InvertedFile64::readPostings (const String &term, int first, int count) const
+{
+    std::vector<TermPosting> result;
+    const auto key = toUtf (term);
+    const auto &impl = *this->_impl;
+    Node leaf;
+    std::size_t index;
+    if (impl.findLeaf (key, leaf, index) && leaf.compare (index, key) == 0) {
+        impl.readPostings (leaf, index, first, count, result);
+    }
+
+    return result;
+}
+
+/// \brief Чтение ссылок, как это делает Connection::readPostings.
+/// \param parameters Параметры: термин либо перечень терминов,
+/// номер первой ссылки и их число (для каждого термина).
+/// Формат и имя базы данных не используются.
+/// \return Ссылки всех терминов подряд.
+/// \throw IrbisException Файлы словаря повреждены.
+std::vector<TermPosting> InvertedFile64::readPostings (const PostingParameters &parameters) const
+{
+    std::vector<TermPosting> result;
+    const auto &terms = parameters.listOfTerms.empty() ? StringList { parameters.term } : parameters.listOfTerms;
+    for (const auto &term : terms) {
+        auto portion = this->readPostings (term, parameters.firstPosting, parameters.numberOfPostings);
+        result.insert (result.end(), std::make_move_iterator (portion.begin()),
+                       std::make_move_iterator (portion.end()));
+    }
+
+    return result;
+}
+
+/// \brief Чтение терминов из диапазона.
+/// \param from Нижняя граница (включительно).
+/// \param to Верхняя граница (включительно).
+/// \param limit Максимальное число терминов (0 -- все).
+/// \return Термины в порядке возрастания.
+/// \throw IrbisException Файлы словаря повреждены.
+std::vector<TermInfo> InvertedFile64::readTermRange (const String &from, const String &to, int limit) const
+{
+    std::vector<TermInfo> result;
+    const auto key = toUtf (from);
+    const auto upper = toUtf (to);
+    const auto &impl = *this->_impl;
+    Node leaf;
+    std::size_t index;
+    auto found = impl.findLeaf (key, leaf, index);
+    while (found && (limit <= 0 || result.size() < static_cast<std::size_t> (limit))) {
+        if (leaf.compare (index, upper) > 0) {
+            break;
+        }
+        result.emplace_back (impl.postingCount (leaf, index), fromUtf (leaf.key (index)));
+        found = impl.nextItem (leaf, index);
+    }
+
+    return result;
+}
+
+/// \brief Чтение терминов словаря.
+/// \param startTerm Стартовый термин.
+/// \param count Максимальное число терминов.
+/// \param reverse Перебирать термины в обратном порядке?
+/// \return Термины, начиная с первого не меньшего стартового
+/// (в обратном порядке -- с последнего не большего стартового).
+/// \throw IrbisException Файлы словаря повреждены.
+std::vector<TermInfo> InvertedFile64::readTerms (const String &startTerm, int count, bool reverse) const
+{
+    std::vector<TermInfo> result;
+    if (count <= 0) {
+        return result;
+    }
+
+    const auto key = toUtf (startTerm);
+    const auto &impl = *this->_impl;
+    Node leaf;
+    std::size_t index;
+    auto found = impl.findLeaf (key, leaf, index);
+    if (reverse) {
+        if (!found) {
+            // Все термины меньше стартового: начинаем с последнего.
+            found = impl.lastItem (leaf, index);
+        }
+        else if (leaf.compare (index, key) != 0) {
+            found = impl.previousItem (leaf, index);
+        }
+    }
+
+    while (found && result.size() < static_cast<std::size_t> (count)) {
+        result.emplace_back (impl.postingCount (leaf, index), fromUtf (leaf.key (index)));
+        found = reverse ? impl.previousItem (leaf, index) : impl.nextItem (leaf, index);
+    }
+
+    return result;
+}
+
+}
@@ -115,6 +115,42 @@ void MarcRecord::decode (const StringList &lines)
     }
 }
 
+/// \brief Декодирование ответа сервера без промежуточных строк.
+/// \param lines Строки ответа сервера в кодировке UTF-8
+/// (см. ServerResponse::readRemainingSpans).
+void MarcRecord::decode (const std::vector<ByteSpan> &lines)
+{
+    if (lines.size() < 2) {
+        return;
+    }
+
+    // mfn and status of the record
+    const auto firstLine = lines[0];
+    const auto sharp1 = firstLine.indexOf ('#');
+    if (sharp1 < 0) {
+        this->mfn = static_cast<Mfn> (fastParse32 (firstLine));
+        this->status = RecordStatus::None;
+    }
+    else {
+        this->mfn = static_cast<Mfn> (fastParse32 (firstLine.slice (0, sharp1)));
+        this->status = static_cast<RecordStatus> (fastParse32 (firstLine.slice (sharp1 + 1)));
+    }
+
+    // version of the record
+    const auto secondLine = lines[1];
+    const auto sharp2 = secondLine.indexOf ('#');
+    this->version = sharp2 < 0 ? 0 : fastParse32 (secondLine.slice (sharp2 + 1));
+
+    // fields
+    for (std::size_t i = 2; i < lines.size(); i++) {
+        const auto line = lines[i];
+        if (!line.empty()) {
+            this->fields.emplace_back();
+            this->fields.back().decode (line);
+        }
+    }
+}
+
 /// \brief Запись удалена (логически или физически)?
 /// \return true если удалена.
 bool MarcRecord::deleted() const noexcept
@@ -0,0 +1,195 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <limits>
+
+#ifdef IRBIS_WINDOWS
+
+#include <windows.h>
+
+#else
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#endif
+
+///
+/// \file MemoryFile.cpp
+/// \brief Проецирование файлов в память.
+///
+
+/// \class irbis::MemoryFile
+/// \details Файл проецируется целиком, поэтому на 32-битных платформах
+/// размер файла ограничен адресным пространством процесса.
+/// Пустой файл не проецируется: data() возвращает nullptr, size() -- 0.
+
+namespace irbis {
+
+/// \brief Конструктор: открытие и проецирование файла.
+/// \param fileName Имя файла.
+/// \throw IrbisException Файл не удалось открыть либо спроецировать.
+MemoryFile::MemoryFile (const String &fileName)
+{
+#ifdef IRBIS_WINDOWS
+
+    const auto handle = ::CreateFileW (fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                       nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        throw IrbisException();
+    }
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx (handle, &size)) {
+        ::CloseHandle (handle);
+        throw IrbisException();
+    }
+    this->_size = static_cast<uint64_t> (size.QuadPart);
+    if (this->_size == 0) {
+        ::CloseHandle (handle);
+        return;
+    }
+    if (this->_size > std::numeric_limits<std::size_t>::max()) {
+        ::CloseHandle (handle);
+        throw IrbisException();
+    }
+
+    this->_mapping = ::CreateFileMappingW (handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    // Проекция удерживает файл сама.
+    ::CloseHandle (handle);
+    if (this->_mapping == nullptr) {
+        throw IrbisException();
+    }
+
+    this->_data = static_cast<Byte*> (::MapViewOfFile (this->_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (this->_data == nullptr) {
+        ::CloseHandle (this->_mapping);
+        this->_mapping = nullptr;
+        throw IrbisException();
+    }
+
+#else
+
+    const auto utfName = toUtf (fileName);
+#if defined (IRBIS_APPLE) || defined (IRBIS_FREEBSD) || defined (IRBIS_ANDROID)
+    const auto handle = ::open (utfName.c_str(), O_RDONLY);
+    struct stat info {};
+    const auto statResult = handle < 0 ? -1 : ::fstat (handle, &info);
+#else
+    const auto handle = ::open64 (utfName.c_str(), O_RDONLY);
+    struct stat64 info {};
+    const auto statResult = handle < 0 ? -1 : ::fstat64 (handle, &info);
+#endif
+    if (handle < 0) {
+        throw IrbisException();
+    }
+    if (statResult < 0) {
+        ::close (handle);
+        throw IrbisException();
+    }
+
+    this->_size = static_cast<uint64_t> (info.st_size);
+    if (this->_size == 0) {
+        ::close (handle);
+        return;
+    }
+    if (this->_size > std::numeric_limits<std::size_t>::max()) {
+        ::close (handle);
+        throw IrbisException();
+    }
+
+    const auto address = ::mmap (nullptr, static_cast<std::size_t> (this->_size), PROT_READ, MAP_SHARED, handle, 0);
+
+    // Проекция удерживает файл сама.
+    ::close (handle);
+    if (address == MAP_FAILED) {
+        this->_size = 0;
+        throw IrbisException();
+    }
+    this->_data = static_cast<Byte*> (address);
+
+#endif
+}
+
+/// \brief Конструктор перемещения.
+MemoryFile::MemoryFile (MemoryFile &&other) noexcept
+    : _data { other._data }, _size { other._size }
+{
+    other._data = nullptr;
+    other._size = 0;
+#ifdef IRBIS_WINDOWS
+    this->_mapping = other._mapping;
+    other._mapping = nullptr;
+#endif
+}
+
+/// \brief Деструктор.
+MemoryFile::~MemoryFile() noexcept
+{
+    this->close();
+}
+
+/// \brief Оператор перемещения.
+MemoryFile& MemoryFile::operator = (MemoryFile &&other) noexcept
+{
+    if (&other != this) {
+        this->close();
+        this->_data = other._data;
+        this->_size = other._size;
+        other._data = nullptr;
+        other._size = 0;
+#ifdef IRBIS_WINDOWS
+        this->_mapping = other._mapping;
+        other._mapping = nullptr;
+#endif
+    }
+
+    return *this;
+}
+
+/// \brief Закрытие файла. Указатели на содержимое становятся недействительными.
+void MemoryFile::close() noexcept
+{
+#ifdef IRBIS_WINDOWS
+
+    if (this->_data != nullptr) {
+        ::UnmapViewOfFile (this->_data);
+    }
+    if (this->_mapping != nullptr) {
+        ::CloseHandle (this->_mapping);
+    }
+    this->_mapping = nullptr;
+
+#else
+
+    if (this->_data != nullptr) {
+        ::munmap (this->_data, static_cast<std::size_t> (this->_size));
+    }
+
+#endif
+
+    this->_data = nullptr;
+    this->_size = 0;
+}
+
+/// \brief Фрагмент содержимого.
+/// \param offset Смещение от начала файла.
+/// \param size Длина фрагмента.
+/// \return Фрагмент, указывающий прямо в проекцию.
+/// \throw IrbisException Фрагмент выходит за пределы файла.
+ByteSpan MemoryFile::slice (uint64_t offset, uint64_t size) const
+{
+    if (offset > this->_size || size > this->_size - offset) {
+        throw IrbisException();
+    }
+
+    return { this->_data + offset, static_cast<std::size_t> (size) };
+}
+
+}
@@ -1,10 +1,13 @@
-// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+﻿// This is an open source non-commercial project. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
 #include "irbis.h"
 #include "irbis_direct.h"
 #include "irbis_internal.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <sys/stat.h>
 #include <fcntl.h>
 
@@ -127,50 +130,162 @@
 
 namespace irbis {
 
+/// \brief Размер управляющей записи.
+const int MstControlRecord64::RecordSize = 36;
+
+/// \brief Позиция индикатора блокировки базы данных.
+const long MstControlRecord64::LockFlagPosition = 32;
+
 /// \brief Длина элемента справочника MST-записи.
 const int MstDictionaryEntry64::EntrySize = 12;
 
+/// \brief Длина лидера MST-записи.
+const int MstRecordLeader64::LeaderSize = 32;
+
 //=========================================================
 
 /// \brief Считывание управляющей записи с диска.
-/// \param file
-void MstControlRecord64::read (File *file) {
-    //fread (this, sizeof(MstControlRecord64), 1, file);
-    throw NotImplementedException();
+/// \param file Файл, спозиционированный на начало управляющей записи.
+void MstControlRecord64::read (File *file)
+{
+    this->ctlMfn       = file->readInt32();
+    this->nextMfn      = file->readInt32();
+    this->nextPosition = static_cast<int64_t> (file->readInt64());
+    this->mftType      = file->readInt32();
+    this->recCnt       = file->readInt32();
+    this->reserv1      = file->readInt32();
+    this->reserv2      = file->readInt32();
+    this->locked       = file->readInt32();
 }
 
-//=========================================================
-
-void MstDictionaryEntry64::read (File *file) {
-    //fread (this, sizeof(MstDictionaryEntry64), 1, file);
-    throw NotImplementedException();
+/// \brief Разбор управляющей записи, находящейся в памяти.
+/// \param bytes Начало управляющей записи (не менее RecordSize байт).
+void MstControlRecord64::read (const Byte *bytes) noexcept
+{
+    this->ctlMfn       = readBig32 (bytes);
+    this->nextMfn      = readBig32 (bytes + 4);
+    this->nextPosition = static_cast<int64_t> (readBig64 (bytes + 8));
+    this->mftType      = readBig32 (bytes + 16);
+    this->recCnt       = readBig32 (bytes + 20);
+    this->reserv1      = readBig32 (bytes + 24);
+    this->reserv2      = readBig32 (bytes + 28);
+    this->locked       = readBig32 (bytes + 32);
 }
 
 //=========================================================
 
-static File* getFile (const String &fileName, DirectAccessMode mode)
+/// \brief Считывание элемента справочника с диска.
+/// \param file Файл.
+void MstDictionaryEntry64::read (File *file)
+{
+    this->tag      = static_cast<int32_t> (file->readInt32());
+    this->position = static_cast<int32_t> (file->readInt32());
+    this->length   = static_cast<int32_t> (file->readInt32());
+}
+
+/// \brief Разбор элемента справочника, находящегося в памяти.
+/// \param bytes Начало элемента (не менее EntrySize байт).
+void MstDictionaryEntry64::read (const Byte *bytes) noexcept
 {
-    File file = File::openRead (fileName);
-    return file.toHeap();
+    this->tag      = static_cast<int32_t> (readBig32 (bytes));
+    this->position = static_cast<int32_t> (readBig32 (bytes + 4));
+    this->length   = static_cast<int32_t> (readBig32 (bytes + 8));
 }
 
+//=========================================================
+
 /// \brief Конструктор.
-/// \param fileName
-/// \param mode
-MstFile64::MstFile64 (const String &fileName, DirectAccessMode mode)
-    : _file (getFile (fileName, mode))
+/// \param fileName Имя файла.
+/// \param mode Режим доступа.
+/// \param memoryMapped Спроецировать файл в память. Тогда записи
+/// читаются без системных вызовов и блокировок, а их справочник
+/// и поля указывают прямо в проекцию.
+/// \details Управляющая запись считывается сразу при открытии файла.
+MstFile64::MstFile64 (const String &fileName, DirectAccessMode mode, bool memoryMapped)
 {
+    (void) mode; // пока поддерживается только чтение
     this->fileName = fileName;
+    if (memoryMapped) {
+        this->_memory = std::make_shared<MemoryFile> (fileName);
+        const auto control = this->_memory->slice (0, static_cast<uint64_t> (MstControlRecord64::RecordSize));
+        this->control.read (control.cdata());
+    }
+    else {
+        this->_file.reset (File::openRead (fileName).toHeap());
+        this->_file->seek (0);
+        this->control.read (this->_file.get());
+    }
 }
 
 /// \brief Чтение записи.
-/// \param position Позиция
-/// \return
+/// \param position Смещение записи в файле (берётся из XRF).
+/// \return Прочитанная запись.
+/// \throw IrbisException Запись повреждена.
+///
+/// Для спроецированного файла запись не копируется и удерживает
+/// проекцию, поэтому может пережить сам MstFile64.
+/// Для обычного файла запись считывается позиционным чтением
+/// (обычно одним вызовом), так что читать можно из многих потоков сразу.
 MstRecord64 MstFile64::readRecord (int64_t position)
 {
-    this->_file->seek(position);
-    //fseek (this->_file, position, SEEK_SET);
-    throw NotImplementedException();
+    if (position < 0) {
+        throw IrbisException();
+    }
+
+    MstRecord64 result;
+    result.offset = static_cast<uint64_t> (position);
+    ByteSpan bytes;
+    if (this->_memory) {
+        const auto leader = this->_memory->slice (result.offset, static_cast<uint64_t> (MstRecordLeader64::LeaderSize));
+        result.leader.read (leader.cdata());
+        bytes = this->_memory->slice (result.offset, result.leader.length);
+        result._owner = this->_memory;
+    }
+    else {
+        // Обычно запись целиком умещается в первую порцию.
+        Byte head[2048];
+        const auto got = this->_file->readAt (result.offset, head, sizeof (head));
+        if (got < MstRecordLeader64::LeaderSize) {
+            throw IrbisException();
+        }
+        result.leader.read (head);
+        if (result.leader.length < static_cast<uint32_t> (MstRecordLeader64::LeaderSize)) {
+            throw IrbisException();
+        }
+
+        auto buffer = std::make_shared<Bytes> (result.leader.length);
+        const auto ready = std::min (static_cast<std::size_t> (got), buffer->size());
+        std::memcpy (buffer->data(), head, ready);
+        const auto rest = static_cast<int64_t> (buffer->size() - ready);
+        if (rest != 0 && this->_file->readAt (result.offset + ready, buffer->data() + ready, rest) != rest) {
+            throw IrbisException();
+        }
+        bytes = ByteSpan (buffer->data(), buffer->size());
+        result._owner = buffer;
+    }
+
+    // Справочник может быть выровнен, поэтому поля берём от базового адреса.
+    const auto &leader = result.leader;
+    const auto dictionaryEnd = static_cast<uint64_t> (MstRecordLeader64::LeaderSize)
+            + static_cast<uint64_t> (leader.nvf) * MstDictionaryEntry64::EntrySize;
+    if (leader.base < dictionaryEnd || leader.length < leader.base) {
+        throw IrbisException();
+    }
+
+    result._dictionary = bytes.slice (MstRecordLeader64::LeaderSize,
+            static_cast<std::ptrdiff_t> (dictionaryEnd - MstRecordLeader64::LeaderSize));
+    result._data = bytes.slice (leader.base);
+
+    const auto dataLength = static_cast<uint64_t> (result._data.size());
+    for (std::size_t index = 0; index < leader.nvf; ++index) {
+        const auto entry = result.entry (index);
+        if (entry.position < 0 || entry.length < 0
+            || static_cast<uint64_t> (entry.position) + static_cast<uint64_t> (entry.length) > dataLength) {
+            throw IrbisException();
+        }
+    }
+
+    return result;
 }
 
 //=========================================================
@@ -182,19 +297,112 @@ bool MstRecord64::deleted() const
     return (this->leader.status & RecordStatus::Deleted) != RecordStatus::None;
 }
 
+/// \brief Элемент справочника.
+/// \param index Индекс элемента (меньше fieldCount()).
+/// \return Элемент, разобранный из байтов записи.
+MstDictionaryEntry64 MstRecord64::entry (std::size_t index) const noexcept
+{
+    MstDictionaryEntry64 result;
+    result.read (this->_dictionary.cdata() + index * static_cast<std::size_t> (MstDictionaryEntry64::EntrySize));
+    return result;
+}
+
+/// \brief Число полей в записи.
+std::size_t MstRecord64::fieldCount() const noexcept
+{
+    return this->_dictionary.size() / static_cast<std::size_t> (MstDictionaryEntry64::EntrySize);
+}
+
+/// \brief Данные поля.
+/// \param index Индекс элемента справочника.
+/// \return Текст поля в кодировке UTF-8 (указывает в байты записи).
+ByteSpan MstRecord64::fieldData (std::size_t index) const noexcept
+{
+    const auto one = this->entry (index);
+    return this->_data.slice (one.position, one.length);
+}
+
+/// \brief Превращение в облегчённую запись.
+/// \return Запись с номером, статусом, версией и полями в UTF-8.
+/// \details Имя базы данных не заполняется.
+LiteRecord MstRecord64::toLiteRecord() const
+{
+    LiteRecord result;
+    result.mfn = this->leader.mfn;
+    result.status = this->leader.status;
+    result.version = this->leader.version;
+    const auto count = this->fieldCount();
+    for (std::size_t index = 0; index < count; ++index) {
+        const auto text = this->fieldData (index);
+        const auto caret = text.indexOf ('^');
+        const auto value = caret < 0 ? text : text.slice (0, caret);
+        result.fields.emplace_back (static_cast<int> (this->entry (index).tag),
+                std::string (reinterpret_cast<const char*> (value.cdata()), value.size()));
+        auto &field = result.fields.back();
+        if (caret >= 0) {
+            for (const auto one : text.slice (caret).split ('^')) {
+                field.subfields.emplace_back (static_cast<char> (one[0]),
+                        std::string (reinterpret_cast<const char*> (one.cdata()) + 1, one.size() - 1));
+            }
+        }
+    }
+
+    return result;
+}
+
 /// \brief Превращение в полноценную запись.
-/// \return
+/// \return Запись с номером, статусом, версией и полями.
+/// \details Имя базы данных не заполняется.
 MarcRecord MstRecord64::toMarcRecord() const
 {
     MarcRecord result;
-    result.status = RecordStatus::None; // TODO obtain the status
-    result.version = 0; // TODO obtain the version
-    //result.fields.reserve(dictionary.size());
-    for (const auto &entry : dictionary) {
-        RecordField field;
-        field.tag = entry.tag;
-        // field.parse(entry.text); // TODO parse the field
-        result.fields.push_back(field);
+    result.mfn = this->leader.mfn;
+    result.status = this->leader.status;
+    result.version = this->leader.version;
+    const auto count = this->fieldCount();
+    for (std::size_t index = 0; index < count; ++index) {
+        const auto text = this->fieldData (index);
+        result.fields.emplace_back (static_cast<int> (this->entry (index).tag));
+        auto &field = result.fields.back();
+
+        // Значение до первого подполя, затем подполя.
+        const auto caret = text.indexOf ('^');
+        if (caret < 0) {
+            field.value = fromUtf (text);
+        }
+        else {
+            field.value = fromUtf (text.slice (0, caret));
+            for (const auto one : text.slice (caret).split ('^')) {
+                field.subfields.emplace_back();
+                field.subfields.back().decode (one);
+            }
+        }
+    }
+
+    return result;
+}
+
+/// \brief Превращение в фантомную запись.
+/// \return Запись, поля и подполя которой указывают в байты этой записи.
+/// \warning Фантомная запись действительна, пока жива эта запись
+/// (или её копия). Имя базы данных не заполняется.
+PhantomRecord MstRecord64::toPhantomRecord() const
+{
+    PhantomRecord result;
+    result.mfn = this->leader.mfn;
+    result.status = this->leader.status;
+    result.version = this->leader.version;
+    const auto count = this->fieldCount();
+    for (std::size_t index = 0; index < count; ++index) {
+        const auto text = this->fieldData (index);
+        const auto caret = text.indexOf ('^');
+        result.fields.emplace_back (static_cast<int> (this->entry (index).tag), caret < 0 ? text : text.slice (0, caret));
+        if (caret >= 0) {
+            auto &field = result.fields.back();
+            for (const auto one : text.slice (caret).split ('^')) {
+                field.add (one[0], one.slice (1));
+            }
+        }
     }
 
     return result;
@@ -206,8 +414,26 @@ MarcRecord MstRecord64::toMarcRecord() const
 /// \param file Файл.
 void MstRecordLeader64::read (File *file)
 {
-    //fread (this, sizeof(MstRecordLeader64), 1, file);
-    throw NotImplementedException();
+    this->mfn      = file->readInt32();
+    this->length   = file->readInt32();
+    this->previous = file->readInt64();
+    this->base     = file->readInt32();
+    this->nvf      = file->readInt32();
+    this->version  = file->readInt32();
+    this->status   = static_cast<RecordStatus> (file->readInt32());
+}
+
+/// \brief Разбор лидера, находящегося в памяти.
+/// \param bytes Начало лидера (не менее LeaderSize байт).
+void MstRecordLeader64::read (const Byte *bytes) noexcept
+{
+    this->mfn      = readBig32 (bytes);
+    this->length   = readBig32 (bytes + 4);
+    this->previous = readBig64 (bytes + 8);
+    this->base     = readBig32 (bytes + 16);
+    this->nvf      = readBig32 (bytes + 20);
+    this->version  = readBig32 (bytes + 24);
+    this->status   = static_cast<RecordStatus> (readBig32 (bytes + 28));
 }
 
-}
\ No newline at end of file
+}
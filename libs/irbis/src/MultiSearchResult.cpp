@@ -0,0 +1,121 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <unordered_set>
+
+///
+/// \file MultiSearchResult.cpp
+/// \brief Результаты поиска в нескольких базах данных.
+///
+
+namespace irbis {
+
+/// \brief Найденные записи без дубликатов.
+/// \return Записи в порядке перечисления баз данных; из одинаковых
+/// по тексту расформатирования оставляется первая. Записи с пустым
+/// текстом не сравниваются.
+///
+/// Чтобы ключом служил, например, ISBN, он должен быть результатом
+/// формата, указанного при поиске.
+std::vector<MultiSearchResult::Line> MultiSearchResult::distinct() const
+{
+    return this->distinct ([] (const Line &line) { return line.description; });
+}
+
+/// \brief Найденные записи без дубликатов.
+/// \param key Получение ключа записи. Записи с пустым ключом не сравниваются.
+/// \return Записи в порядке перечисления баз данных; из записей
+/// с одинаковым ключом оставляется первая.
+std::vector<MultiSearchResult::Line> MultiSearchResult::distinct (const KeyFunction &key) const
+{
+    std::vector<Line> result;
+    std::unordered_set<String> seen;
+    for (auto &line : this->merged()) {
+        const auto value = key (line);
+        if (value.empty() || seen.insert (value).second) {
+            result.push_back (std::move (line));
+        }
+    }
+
+    return result;
+}
+
+/// \brief Поиск результатов для указанной базы данных.
+/// \param database Имя базы данных (регистр не учитывается).
+/// \return Указатель на результат либо nullptr.
+const DatabaseFound* MultiSearchResult::find (const String &database) const
+{
+    for (const auto &one : this->databases) {
+        if (sameString (one.database, database)) {
+            return &one;
+        }
+    }
+
+    return nullptr;
+}
+
+/// \brief Все найденные записи подряд.
+/// \return Записи в порядке перечисления баз данных.
+std::vector<MultiSearchResult::Line> MultiSearchResult::merged() const
+{
+    std::vector<Line> result;
+    std::size_t count = 0;
+    for (const auto &one : this->databases) {
+        count += one.lines.size();
+    }
+    result.reserve (count);
+
+    for (const auto &one : this->databases) {
+        for (const auto &line : one.lines) {
+            Line item;
+            item.database = one.database;
+            item.mfn = line.mfn;
+            item.description = line.description;
+            result.push_back (std::move (item));
+        }
+    }
+
+    return result;
+}
+
+/// \brief База данных, ответ от которой получен последним.
+/// \return Указатель на результат либо nullptr, если баз нет.
+const DatabaseFound* MultiSearchResult::slowest() const
+{
+    const DatabaseFound *result = nullptr;
+    for (const auto &one : this->databases) {
+        if (result == nullptr || one.elapsedMs > result->elapsedMs) {
+            result = &one;
+        }
+    }
+
+    return result;
+}
+
+/// \brief Поиск во всех базах завершился успешно?
+bool MultiSearchResult::success() const noexcept
+{
+    for (const auto &one : this->databases) {
+        if (!one.success()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// \brief Общее число найденных записей во всех базах.
+int MultiSearchResult::total() const noexcept
+{
+    auto result = 0;
+    for (const auto &one : this->databases) {
+        result += std::max (one.total, 0);
+    }
+
+    return result;
+}
+
+}
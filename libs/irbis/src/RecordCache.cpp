@@ -0,0 +1,393 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <unordered_map>
+
+///
+/// \file RecordCache.cpp
+/// \brief Кэш записей на стороне клиента.
+///
+
+namespace irbis {
+
+/// \brief Доля обращений, обслуженных кэшем.
+/// \return Число от 0 до 1.
+double RecordCacheStatistics::hitRatio() const noexcept
+{
+    const auto total = this->hits + this->misses;
+    return total == 0 ? 0.0 : static_cast<double> (this->hits) / static_cast<double> (total);
+}
+
+//=========================================================
+
+namespace {
+
+// Накладные расходы на узел std::list и служебные поля записи.
+const std::size_t NodeOverhead = 2 * sizeof (void*);
+
+template <class T>
+std::size_t stringBytes (const std::basic_string<T> &text) noexcept
+{
+    return text.capacity() * sizeof (T);
+}
+
+std::size_t recordBytes (const MarcRecord &record) noexcept
+{
+    auto result = sizeof (MarcRecord) + stringBytes (record.database);
+    for (const auto &field : record.fields) {
+        result += NodeOverhead + sizeof (RecordField) + stringBytes (field.value);
+        for (const auto &subfield : field.subfields) {
+            result += sizeof (SubField) + stringBytes (subfield.value);
+        }
+    }
+    return result;
+}
+
+std::size_t recordBytes (const LiteRecord &record) noexcept
+{
+    auto result = sizeof (LiteRecord) + stringBytes (record.database);
+    for (const auto &field : record.fields) {
+        result += NodeOverhead + sizeof (LiteField) + stringBytes (field.value);
+        for (const auto &subfield : field.subfields) {
+            result += NodeOverhead + sizeof (LiteSubField) + stringBytes (subfield.value);
+        }
+    }
+    return result;
+}
+
+// Имена баз данных ИРБИС нечувствительны к регистру.
+String normalize (const String &database)
+{
+    String result (database);
+    if (!result.empty()) {
+        toUpper (WideSpan (&result[0], result.size()));
+    }
+    return result;
+}
+
+struct CacheKey
+{
+    String database;
+    Mfn mfn;
+    bool lite;
+
+    bool operator == (const CacheKey &other) const noexcept
+    {
+        return this->mfn == other.mfn
+            && this->lite == other.lite
+            && this->database == other.database;
+    }
+};
+
+struct CacheKeyHash
+{
+    std::size_t operator() (const CacheKey &key) const noexcept
+    {
+        return std::hash<String>() (key.database) * 31u
+            + static_cast<std::size_t> (key.mfn) * 2u
+            + (key.lite ? 1u : 0u);
+    }
+};
+
+struct CacheEntry
+{
+    CacheKey key;
+    unsigned int version;
+    std::size_t bytes;
+    std::unique_ptr<MarcRecord> record;
+    std::unique_ptr<LiteRecord> lite;
+};
+
+}
+
+/// \brief Внутреннее состояние кэша.
+struct RecordCache::Impl
+{
+    using List = std::list<CacheEntry>;
+
+    std::size_t capacity;
+    mutable std::mutex mutex;
+    List entries; ///< Самые "свежие" записи в начале списка.
+    std::unordered_map<CacheKey, List::iterator, CacheKeyHash> index;
+    RecordCacheStatistics stats;
+
+    CacheEntry* find (const CacheKey &key);
+    void insert (CacheEntry &&entry);
+    void remove (List::iterator position);
+};
+
+/// \brief Поиск записи с продвижением её в начало списка.
+/// \warning Вызывается с захваченным мьютексом.
+CacheEntry* RecordCache::Impl::find (const CacheKey &key)
+{
+    const auto found = this->index.find (key);
+    if (found == this->index.end()) {
+        return nullptr;
+    }
+
+    this->entries.splice (this->entries.begin(), this->entries, found->second);
+    return &*found->second;
+}
+
+/// \brief Помещение записи в кэш (с заменой прежней) и вытеснение лишних.
+/// \warning Вызывается с захваченным мьютексом.
+void RecordCache::Impl::insert (CacheEntry &&entry)
+{
+    const auto found = this->index.find (entry.key);
+    if (found != this->index.end()) {
+        this->remove (found->second);
+    }
+
+    if (entry.bytes > this->capacity) {
+        return;
+    }
+
+    this->stats.bytes += entry.bytes;
+    this->entries.push_front (std::move (entry));
+    this->index[this->entries.front().key] = this->entries.begin();
+
+    while (this->stats.bytes > this->capacity && !this->entries.empty()) {
+        this->remove (std::prev (this->entries.end()));
+        this->stats.evictions++;
+    }
+}
+
+/// \brief Удаление записи из кэша.
+/// \warning Вызывается с захваченным мьютексом.
+void RecordCache::Impl::remove (List::iterator position)
+{
+    this->stats.bytes -= position->bytes;
+    this->index.erase (position->key);
+    this->entries.erase (position);
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param capacity Предельная оценка занимаемой памяти, байты.
+RecordCache::RecordCache (std::size_t capacity)
+    : _impl { new Impl }
+{
+    this->_impl->capacity = capacity;
+}
+
+/// \brief Деструктор.
+RecordCache::~RecordCache() = default;
+
+/// \brief Предельная оценка занимаемой памяти.
+/// \return Предел, байты.
+std::size_t RecordCache::capacity() const noexcept
+{
+    return this->_impl->capacity;
+}
+
+/// \brief Очистка кэша.
+void RecordCache::clear()
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.index.clear();
+    impl.entries.clear();
+    impl.stats.bytes = 0;
+}
+
+/// \brief Получение записи из кэша.
+/// \param database Имя базы данных.
+/// \param mfn MFN записи.
+/// \param record Сюда помещается копия записи.
+/// \return true, если запись найдена в кэше.
+bool RecordCache::get (const String &database, Mfn mfn, MarcRecord &record)
+{
+    auto &impl = *this->_impl;
+    const CacheKey key { normalize (database), mfn, false };
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    const auto entry = impl.find (key);
+    if (entry == nullptr) {
+        impl.stats.misses++;
+        return false;
+    }
+
+    impl.stats.hits++;
+    record = *entry->record;
+    return true;
+}
+
+/// \brief Получение записи из кэша.
+/// \param database Имя базы данных.
+/// \param mfn MFN записи.
+/// \param record Сюда помещается копия записи.
+/// \return true, если запись найдена в кэше.
+bool RecordCache::get (const String &database, Mfn mfn, LiteRecord &record)
+{
+    auto &impl = *this->_impl;
+    const CacheKey key { normalize (database), mfn, true };
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    const auto entry = impl.find (key);
+    if (entry == nullptr) {
+        impl.stats.misses++;
+        return false;
+    }
+
+    impl.stats.hits++;
+    record = *entry->lite;
+    return true;
+}
+
+/// \brief Удаление из кэша записи (в обоих представлениях).
+/// \param database Имя базы данных.
+/// \param mfn MFN записи.
+void RecordCache::invalidate (const String &database, Mfn mfn)
+{
+    auto &impl = *this->_impl;
+    const auto name = normalize (database);
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    for (const auto lite : { false, true }) {
+        const auto found = impl.index.find (CacheKey { name, mfn, lite });
+        if (found != impl.index.end()) {
+            impl.remove (found->second);
+            impl.stats.invalidations++;
+        }
+    }
+}
+
+/// \brief Удаление из кэша всех записей указанной базы данных.
+/// \param database Имя базы данных.
+void RecordCache::invalidateDatabase (const String &database)
+{
+    auto &impl = *this->_impl;
+    const auto name = normalize (database);
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    for (auto it = impl.entries.begin(); it != impl.entries.end(); ) {
+        const auto current = it++;
+        if (current->key.database == name) {
+            impl.remove (current);
+            impl.stats.invalidations++;
+        }
+    }
+}
+
+/// \brief Помещение записи в кэш.
+/// \param database Имя базы данных.
+/// \param record Запись (копируется).
+///
+/// Записи, не помещающиеся в кэш целиком, не сохраняются.
+void RecordCache::put (const String &database, const MarcRecord &record)
+{
+    if (record.mfn == 0) {
+        return;
+    }
+
+    CacheEntry entry { { normalize (database), record.mfn, false }, record.version,
+                       recordBytes (record), std::unique_ptr<MarcRecord> (new MarcRecord (record)), nullptr };
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.insert (std::move (entry));
+}
+
+/// \brief Помещение записи в кэш.
+/// \param database Имя базы данных.
+/// \param record Запись (копируется).
+///
+/// Записи, не помещающиеся в кэш целиком, не сохраняются.
+void RecordCache::put (const String &database, const LiteRecord &record)
+{
+    if (record.mfn == 0) {
+        return;
+    }
+
+    CacheEntry entry { { normalize (database), record.mfn, true }, record.version,
+                       recordBytes (record), nullptr, std::unique_ptr<LiteRecord> (new LiteRecord (record)) };
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.insert (std::move (entry));
+}
+
+/// \brief Сверка версии записи, полученной с сервера, с версией в кэше.
+/// \param database Имя базы данных.
+/// \param mfn MFN записи.
+/// \param version Актуальная версия записи на сервере.
+/// \param record Сюда помещается копия записи из кэша, если версии совпали.
+/// \return true, если запись в кэше актуальна.
+///
+/// Устаревшая запись удаляется из кэша.
+bool RecordCache::revalidate (const String &database, Mfn mfn, unsigned int version, MarcRecord &record)
+{
+    auto &impl = *this->_impl;
+    const CacheKey key { normalize (database), mfn, false };
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.stats.revalidations++;
+    const auto entry = impl.find (key);
+    if (entry == nullptr) {
+        impl.stats.misses++;
+        return false;
+    }
+    if (entry->version != version) {
+        impl.stats.stale++;
+        impl.remove (impl.index[key]);
+        return false;
+    }
+
+    impl.stats.hits++;
+    record = *entry->record;
+    return true;
+}
+
+/// \brief Сверка версии записи, полученной с сервера, с версией в кэше.
+/// \param database Имя базы данных.
+/// \param mfn MFN записи.
+/// \param version Актуальная версия записи на сервере.
+/// \param record Сюда помещается копия записи из кэша, если версии совпали.
+/// \return true, если запись в кэше актуальна.
+///
+/// Устаревшая запись удаляется из кэша.
+bool RecordCache::revalidate (const String &database, Mfn mfn, unsigned int version, LiteRecord &record)
+{
+    auto &impl = *this->_impl;
+    const CacheKey key { normalize (database), mfn, true };
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.stats.revalidations++;
+    const auto entry = impl.find (key);
+    if (entry == nullptr) {
+        impl.stats.misses++;
+        return false;
+    }
+    if (entry->version != version) {
+        impl.stats.stale++;
+        impl.remove (impl.index[key]);
+        return false;
+    }
+
+    impl.stats.hits++;
+    record = *entry->lite;
+    return true;
+}
+
+/// \brief Снимок статистики кэша.
+/// \return Статистика.
+RecordCacheStatistics RecordCache::statistics() const
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    auto result = impl.stats;
+    result.entries = impl.entries.size();
+    return result;
+}
+
+/// \brief Версия записи по первым строкам ответа сервера на команду "C".
+/// \param lines Строки ответа (первая -- "MFN#статус", вторая -- "0#версия").
+/// \return Версия записи либо -1, если её не удалось определить.
+int RecordCache::versionOf (const std::vector<ByteSpan> &lines) noexcept
+{
+    if (lines.size() < 2) {
+        return -1;
+    }
+
+    const auto line = lines[1];
+    const auto sharp = line.indexOf ('#');
+    return sharp < 0 ? -1 : fastParse32 (line.slice (sharp + 1));
+}
+
+}
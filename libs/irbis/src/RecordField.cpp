@@ -150,6 +150,46 @@ void RecordField::decode (const String &line)
     this->decodeBody (body);
 }
 
+/// \brief Декодирование тела поля в кодировке UTF-8.
+/// \param body Тело поля (не должно быть пустым).
+///
+/// Текст декодируется кусками, без промежуточного разбиения строк.
+void RecordField::decodeBody (ByteSpan body)
+{
+    ByteSpan rest;
+    if (body[0] == '^') {
+        rest = body;
+    } else {
+        const auto sharp = body.indexOf ('#');
+        if (sharp < 0) {
+            this->value = fromUtf (body);
+            return;
+        }
+        this->value = fromUtf (body.slice (0, sharp));
+        rest = body.slice (sharp + 1);
+    }
+    for (const auto one : rest.split ('^')) {
+        this->subfields.emplace_back();
+        this->subfields.back().decode (one);
+    }
+}
+
+/// \brief Декодирование текстового представления поля в кодировке UTF-8.
+/// \param line Текст для декодирования.
+void RecordField::decode (ByteSpan line)
+{
+    const auto sharp = line.indexOf ('#');
+    if (sharp < 0) {
+        this->tag = fastParse32 (line);
+        return;
+    }
+    this->tag = fastParse32 (line.slice (0, sharp));
+    const auto body = line.slice (sharp + 1);
+    if (!body.empty()) {
+        this->decodeBody (body);
+    }
+}
+
 /// \brief Пустое поле (нет значения и подполей)?
 /// \return true если пустое.
 bool RecordField::empty() const noexcept
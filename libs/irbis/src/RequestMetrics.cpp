@@ -0,0 +1,295 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+///
+/// \file RequestMetrics.cpp
+/// \brief Сбор метрик этапов выполнения запросов.
+///
+
+namespace irbis {
+
+namespace {
+
+// Номер корзины: число значащих битов значения.
+std::size_t bucketOf (uint64_t value) noexcept
+{
+    std::size_t result = 0;
+    while (value != 0) {
+        ++result;
+        value >>= 1;
+    }
+    return std::min (result, Histogram::BucketCount - 1);
+}
+
+std::size_t stageIndex (RequestStage stage) noexcept
+{
+    return static_cast<std::size_t> (stage);
+}
+
+void writeRow (std::ostream &stream, const char *title, const Histogram &histogram)
+{
+    stream << "  " << std::left << std::setw (16) << title << std::right
+           << std::setw (10) << histogram.count
+           << std::setw (14) << std::fixed << std::setprecision (1) << histogram.mean()
+           << std::setw (12) << histogram.percentile (0.5)
+           << std::setw (12) << histogram.percentile (0.9)
+           << std::setw (12) << histogram.percentile (0.99)
+           << std::setw (12) << histogram.maximum
+           << '\n';
+}
+
+}
+
+//=========================================================
+
+/// \brief Добавление значения.
+/// \param value Значение.
+void Histogram::add (uint64_t value) noexcept
+{
+    if (this->count == 0 || value < this->minimum) {
+        this->minimum = value;
+    }
+    if (value > this->maximum) {
+        this->maximum = value;
+    }
+    ++this->count;
+    this->sum += value;
+    ++this->buckets[bucketOf (value)];
+}
+
+/// \brief Среднее значение.
+/// \return Среднее либо 0 для пустой гистограммы.
+double Histogram::mean() const noexcept
+{
+    return this->count == 0 ? 0.0 : static_cast<double> (this->sum) / static_cast<double> (this->count);
+}
+
+/// \brief Объединение с другой гистограммой.
+/// \param other Гистограмма, значения которой добавляются к данной.
+void Histogram::merge (const Histogram &other) noexcept
+{
+    if (other.count == 0) {
+        return;
+    }
+    if (this->count == 0 || other.minimum < this->minimum) {
+        this->minimum = other.minimum;
+    }
+    this->maximum = std::max (this->maximum, other.maximum);
+    this->count += other.count;
+    this->sum += other.sum;
+    for (std::size_t i = 0; i < BucketCount; ++i) {
+        this->buckets[i] += other.buckets[i];
+    }
+}
+
+/// \brief Оценка перцентиля.
+/// \param fraction Доля значений (от 0 до 1), например, 0.99.
+/// \return Верхняя граница корзины, в которую попадает перцентиль
+/// (но не больше максимального значения).
+uint64_t Histogram::percentile (double fraction) const noexcept
+{
+    if (this->count == 0) {
+        return 0;
+    }
+
+    fraction = std::min (std::max (fraction, 0.0), 1.0);
+    const auto wanted = std::max (static_cast<uint64_t> (std::ceil (fraction * static_cast<double> (this->count))),
+                                  static_cast<uint64_t> (1));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < BucketCount; ++i) {
+        seen += this->buckets[i];
+        if (seen >= wanted) {
+            const auto upper = i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (static_cast<uint64_t> (1) << i) - 1);
+            return std::min (std::max (upper, this->minimum), this->maximum);
+        }
+    }
+
+    return this->maximum;
+}
+
+//=========================================================
+
+/// \brief Конструктор.
+/// \param command_ Код команды.
+/// \param stage Начальный этап.
+/// \param started Момент входа в начальный этап.
+RequestTrace::RequestTrace (const std::string &command_, RequestStage stage, Clock::time_point started) noexcept
+    : command { command_ },
+      current { stage },
+      mark    { started }
+{
+}
+
+/// \brief Переход к очередному этапу.
+/// \param stage Этап.
+///
+/// Время, прошедшее с прошлой отметки, засчитывается текущему этапу.
+void RequestTrace::enter (RequestStage stage) noexcept
+{
+    const auto now = Clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds> (now - this->mark).count();
+    this->micros[stageIndex (this->current)] += elapsed > 0 ? static_cast<uint64_t> (elapsed) : 0u;
+    this->current = stage;
+    this->mark = now;
+}
+
+/// \brief Перенос части времени одного этапа на другой.
+/// \param from Этап, которому время было засчитано.
+/// \param to Этап, которому оно принадлежит на самом деле.
+/// \param microseconds Переносимое время (не больше накопленного).
+///
+/// Нужен, когда несколько этапов выполняются одним вызовом
+/// (например, разрешение имени и подключение внутри ClientSocket::open).
+void RequestTrace::move (RequestStage from, RequestStage to, uint64_t microseconds) noexcept
+{
+    auto &source = this->micros[stageIndex (from)];
+    microseconds = std::min (microseconds, source);
+    source -= microseconds;
+    this->micros[stageIndex (to)] += microseconds;
+}
+
+/// \brief Полное время выполнения запроса, микросекунды.
+uint64_t RequestTrace::total() const noexcept
+{
+    uint64_t result = 0;
+    for (const auto value : this->micros) {
+        result += value;
+    }
+    return result;
+}
+
+//=========================================================
+
+/// \brief Гистограмма длительности этапа.
+/// \param which Этап.
+/// \return Гистограмма, микросекунды.
+const Histogram& CommandMetrics::stage (RequestStage which) const noexcept
+{
+    return this->stages[stageIndex (which)];
+}
+
+//=========================================================
+
+/// \brief Внутреннее состояние сборщика метрик.
+struct RequestMetrics::Impl
+{
+    mutable std::mutex mutex;
+    std::map<std::string, CommandMetrics> commands;
+};
+
+/// \brief Конструктор.
+RequestMetrics::RequestMetrics()
+    : _impl { new Impl }
+{
+}
+
+/// \brief Деструктор.
+RequestMetrics::~RequestMetrics() = default;
+
+/// \brief Учёт выполненного запроса.
+/// \param trace Отметки времени этапов запроса.
+void RequestMetrics::record (const RequestTrace &trace)
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    auto &metrics = impl.commands[trace.command];
+    if (metrics.command.empty()) {
+        metrics.command = trace.command;
+    }
+
+    ++metrics.requests;
+    if (trace.failed) {
+        ++metrics.errors;
+    }
+    for (std::size_t i = 0; i < RequestStageCount; ++i) {
+        if (trace.micros[i] != 0) {
+            metrics.stages[i].add (trace.micros[i]);
+        }
+    }
+    metrics.total.add (trace.total());
+    metrics.bytesSent.add (trace.bytesSent);
+    metrics.bytesReceived.add (trace.bytesReceived);
+}
+
+/// \brief Сброс накопленных метрик.
+void RequestMetrics::reset()
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    impl.commands.clear();
+}
+
+/// \brief Снимок накопленных метрик.
+/// \return Метрики по командам (в порядке возрастания кода команды).
+std::vector<CommandMetrics> RequestMetrics::snapshot() const
+{
+    auto &impl = *this->_impl;
+    std::lock_guard<std::mutex> guard (impl.mutex);
+    std::vector<CommandMetrics> result;
+    result.reserve (impl.commands.size());
+    for (const auto &pair : impl.commands) {
+        result.push_back (pair.second);
+    }
+    return result;
+}
+
+/// \brief Наименование этапа выполнения запроса.
+/// \param stage Этап.
+/// \return Наименование (совпадает с именем элемента RequestStage).
+const char* RequestMetrics::stageName (RequestStage stage) noexcept
+{
+    static const char *names[RequestStageCount] = {
+        "None", "BuildPackage", "NameResolution", "Connecting", "Sending", "Waiting",
+        "Receiving", "Shutdown", "ParseHeader", "ParseBody", "Error"
+    };
+    return names[stageIndex (stage)];
+}
+
+/// \brief Текстовое представление накопленных метрик.
+/// \return Таблица (см. writeText).
+std::string RequestMetrics::toText() const
+{
+    std::ostringstream result;
+    this->writeText (result);
+    return result.str();
+}
+
+/// \brief Вывод накопленных метрик в виде текстовой таблицы.
+/// \param stream Поток для вывода.
+///
+/// Для каждой команды выводятся строки по этапам (время
+/// в микросекундах), полное время и размеры запроса и ответа в байтах:
+/// число значений, среднее, 50-й, 90-й и 99-й перцентили и максимум.
+void RequestMetrics::writeText (std::ostream &stream) const
+{
+    for (const auto &metrics : this->snapshot()) {
+        stream << "command " << metrics.command
+               << ": requests " << metrics.requests
+               << ", errors " << metrics.errors << '\n';
+        stream << "  " << std::left << std::setw (16) << "stage" << std::right
+               << std::setw (10) << "count"
+               << std::setw (14) << "mean"
+               << std::setw (12) << "p50"
+               << std::setw (12) << "p90"
+               << std::setw (12) << "p99"
+               << std::setw (12) << "max"
+               << '\n';
+        for (std::size_t i = 0; i < RequestStageCount; ++i) {
+            if (metrics.stages[i].count != 0) {
+                writeRow (stream, stageName (static_cast<RequestStage> (i)), metrics.stages[i]);
+            }
+        }
+        writeRow (stream, "Total", metrics.total);
+        writeRow (stream, "BytesSent", metrics.bytesSent);
+        writeRow (stream, "BytesReceived", metrics.bytesReceived);
+    }
+}
+
+}
@@ -0,0 +1,58 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <cmath>
+#include <random>
+
+///
+/// \file RetryPolicy.cpp
+/// \brief Политика повторов запросов при сбоях сети.
+///
+
+namespace irbis {
+
+namespace {
+
+// Команды, повтор которых не изменяет данных на сервере.
+const char *idempotentCommands[] = { "C", "G", "H", "I", "K", "L", "N", "O" };
+
+}
+
+/// \brief Пауза перед очередным повтором.
+/// \param attempt Номер неудавшейся попытки (начиная с 1).
+/// \return Пауза: половина экспоненциально растущего значения
+/// (не более maxDelay) плюс случайная добавка до другой половины,
+/// чтобы клиенты, столкнувшиеся с одним сбоем, не повторяли запросы
+/// одновременно.
+std::chrono::milliseconds RetryPolicy::backoff (unsigned attempt) const
+{
+    const auto base = static_cast<double> (this->baseDelay.count());
+    const auto limit = static_cast<double> (this->maxDelay.count());
+    const auto exponent = static_cast<double> (attempt == 0 ? 0 : attempt - 1);
+    const auto ceiling = std::min (base * std::pow (std::max (this->multiplier, 1.0), exponent), limit);
+    if (ceiling <= 0) {
+        return std::chrono::milliseconds (0);
+    }
+
+    static thread_local std::mt19937 random { std::random_device{}() };
+    std::uniform_real_distribution<double> jitter (0.0, ceiling / 2);
+    return std::chrono::milliseconds (static_cast<int64_t> (ceiling / 2 + jitter (random)));
+}
+
+/// \brief Можно ли безопасно повторить команду, возможно уже выполненную сервером.
+/// \param command Код команды.
+/// \return true для команд чтения.
+bool RetryPolicy::idempotent (const std::string &command) noexcept
+{
+    for (const auto one : idempotentCommands) {
+        if (command == one) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,207 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+///
+/// \file SearchCursor.cpp
+/// \brief Постраничное чтение результатов поиска.
+///
+
+/// \class irbis::SearchCursor
+/// \details Сервер отдаёт за одну команду "K" не более MAXPACKET
+/// строк, поэтому курсор повторяет команду, сдвигая firstRecord,
+/// пока не будут получены все найденные записи (либо столько,
+/// сколько указано в SearchParameters::numberOfRecords).
+///
+/// Первая порция запрашивается синхронно через сокет подключения,
+/// последующие (при включённой предвыборке) -- через AsyncEngine,
+/// пока вызывающий код разбирает текущую порцию.
+
+namespace irbis {
+
+/// \brief Конструктор.
+/// \param connection Подключение (должно жить дольше курсора).
+/// \param parameters Параметры поиска. Если задан формат,
+/// курсор выдаёт также результат расформатирования записей.
+/// \param prefetch Запрашивать следующую порцию заранее.
+///
+/// Обращение к серверу происходит при первом вызове next().
+SearchCursor::SearchCursor (ConnectionBase &connection, const SearchParameters &parameters, bool prefetch)
+    : _connection { &connection },
+      _parameters { parameters },
+      _prefetch   { prefetch }
+{
+    this->_parameters.database = choose (parameters.database, connection.database);
+    this->_nextRecord = std::max (parameters.firstRecord, static_cast<Mfn> (1));
+}
+
+/// \brief Получение очередной найденной записи.
+/// \param mfn Сюда помещается MFN записи.
+/// \return false, если записи закончились либо произошла ошибка
+/// (код ошибки в lastError подключения).
+bool SearchCursor::next (Mfn &mfn)
+{
+    if (this->_index >= this->_mfns.size() && !this->_advance()) {
+        return false;
+    }
+
+    mfn = this->_mfns[this->_index++];
+    ++this->_position;
+
+    return true;
+}
+
+/// \brief Получение очередной найденной записи вместе с текстом.
+/// \param line Сюда помещается MFN записи и результат её
+/// расформатирования (пустой, если формат не задан).
+/// \return false, если записи закончились либо произошла ошибка
+/// (код ошибки в lastError подключения).
+bool SearchCursor::next (FoundLine &line)
+{
+    if (this->_index >= this->_mfns.size() && !this->_advance()) {
+        return false;
+    }
+
+    line.mfn = this->_mfns[this->_index];
+    if (this->_index < this->_descriptions.size()) {
+        line.description = std::move (this->_descriptions[this->_index]);
+    }
+    else {
+        line.description.clear();
+    }
+    ++this->_index;
+    ++this->_position;
+
+    return true;
+}
+
+/// \brief Переход к следующей порции результатов.
+/// \return false, если порций больше нет.
+bool SearchCursor::_advance()
+{
+    if (this->_finished) {
+        return false;
+    }
+
+    this->_mfns.clear();
+    this->_descriptions.clear();
+    this->_index = 0;
+
+    if (this->_pending.valid()) {
+        Bytes answer;
+        try {
+            answer = this->_pending.get();
+        }
+        catch (...) {
+            this->_connection->lastError = -100002;
+            this->_finished = true;
+            return false;
+        }
+
+        ServerResponse response (*this->_connection, std::move (answer));
+        if (!this->_parsePage (response)) {
+            return false;
+        }
+    }
+    else {
+        if (!this->_connection->_checkConnection()) {
+            this->_finished = true;
+            return false;
+        }
+
+        ClientQuery query (*this->_connection, "K");
+        this->_encode (query, this->_pageCount());
+        ServerResponse response (*this->_connection, query);
+        if (!this->_parsePage (response)) {
+            return false;
+        }
+    }
+
+    // Пока вызывающий код разбирает эту порцию, сервер готовит следующую.
+    if (!this->_finished && this->_prefetch) {
+        this->_submitNext();
+    }
+
+    return !this->_mfns.empty();
+}
+
+/// \brief Формирование команды "K" для очередной порции.
+/// \param query Клиентский запрос.
+/// \param count Требуемое число записей (0 -- сколько влезет в пакет).
+void SearchCursor::_encode (ClientQuery &query, int count) const
+{
+    query.addAnsi (this->_parameters.database).newLine()
+            .addUtf (this->_parameters.searchExpression).newLine()
+            .add (count).newLine()
+            .add (static_cast<int> (this->_nextRecord)).newLine()
+            .addAnsi (this->_parameters.formatSpecification).newLine()
+            .add (this->_parameters.minMfn).newLine()
+            .add (this->_parameters.maxMfn).newLine()
+            .addAnsi (this->_parameters.sequentialSpecification);
+}
+
+/// \brief Сколько записей запрашивать в очередной порции.
+/// \return Число записей (0 означает "сколько влезет в пакет").
+int SearchCursor::_pageCount() const noexcept
+{
+    const auto limit = static_cast<std::size_t> (this->_parameters.numberOfRecords);
+    if (limit == 0) {
+        return 0;
+    }
+
+    const auto fetched = static_cast<std::size_t> (this->_nextRecord - std::max (this->_parameters.firstRecord, static_cast<Mfn> (1)));
+    const auto remaining = limit > fetched ? limit - fetched : 0;
+
+    return static_cast<int> (std::min (remaining, static_cast<std::size_t> (PageSize)));
+}
+
+/// \brief Разбор очередной порции.
+/// \param response Ответ сервера на команду "K".
+/// \return false при ошибке.
+bool SearchCursor::_parsePage (ServerResponse &response)
+{
+    if (!response.checkReturnCode()) {
+        this->_finished = true;
+        return false;
+    }
+
+    this->_total = response.readInteger();
+    const auto withText = !this->_parameters.formatSpecification.empty();
+    const auto wanted = this->_pageCount();
+    for (const auto line : response.readRemainingSpans()) {
+        if (line.empty()) {
+            continue;
+        }
+        if (wanted != 0 && this->_mfns.size() == static_cast<std::size_t> (wanted)) {
+            break;
+        }
+
+        const auto sharp = line.indexOf ('#');
+        this->_mfns.push_back (static_cast<Mfn> (fastParse32 (sharp < 0 ? line : line.slice (0, sharp))));
+        if (withText) {
+            this->_descriptions.push_back (sharp < 0 ? String() : fromUtf (line.slice (sharp + 1)));
+        }
+    }
+
+    this->_nextRecord += static_cast<Mfn> (this->_mfns.size());
+    if (this->_mfns.empty()
+        || this->_total < 0
+        || this->_nextRecord > static_cast<Mfn> (this->_total)
+        || (this->_parameters.numberOfRecords != 0 && this->_pageCount() == 0)) {
+        this->_finished = true;
+    }
+
+    return true;
+}
+
+/// \brief Асинхронный запрос следующей порции.
+void SearchCursor::_submitNext()
+{
+    ClientQuery query (*this->_connection, "K");
+    this->_encode (query, this->_pageCount());
+    this->_pending = this->_connection->_submitAsync (query);
+}
+
+}
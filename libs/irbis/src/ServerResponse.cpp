@@ -4,15 +4,33 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 
+#include <condition_variable>
 #include <cstdarg>
+#include <thread>
 
 namespace irbis {
 
+namespace {
+
+// Предельное ожидание ответа на запрос с дублированием,
+// если ни срок, ни таймаут получения ответа не заданы.
+const std::chrono::milliseconds HedgedWaitLimit { 30000 };
+
+}
+
 /// \brief Конструктор.
 /// \param connection Подключение.
 /// \param query Полностью сформированный клиентский запрос.
 ///
 /// Вычитывает ответ сервера до конца и сохраняет его во внутреннем буфере.
+/// По ходу дела обновляет ConnectionBase::stage, а если к подключению
+/// привязан RequestMetrics, засекает время каждого этапа.
+///
+/// При сбое сети запрос повторяется согласно ConnectionBase::retryPolicy
+/// (запрос, уже отосланный серверу, -- только если он не изменяет данных).
+/// Если к подключению привязан Hedging, запрос на чтение, не получивший
+/// ответа за Hedging::delay(), дублируется через подключение пула
+/// Hedging::pool() и используется ответ, пришедший первым.
 ServerResponse::ServerResponse (ConnectionBase &connection, ClientQuery &query)
 {
     std::lock_guard<std::mutex> guard (connection._mutex);
@@ -22,28 +40,331 @@ ServerResponse::ServerResponse (ConnectionBase &connection, ClientQuery &query)
     this->_success    = false;
     this->_position   = 0;
 
-    // Read the response
+    Byte header[ClientQuery::HeaderCapacity];
+    const auto headerSize = query.header (header);
+    const auto body = query.body();
+    const auto newline = body.indexOf ('\n');
+    const auto codeSpan = newline < 0 ? body : body.slice (0, newline);
+    const std::string code (reinterpret_cast<const char*> (codeSpan.cdata()), codeSpan.size());
+    if (connection.metrics) {
+        this->_trace.reset (new RequestTrace (code, RequestStage::BuildPackage, query.started()));
+        this->_trace->bytesSent = headerSize + body.size();
+    }
+
+    const auto &policy = connection.retryPolicy;
+    const auto idempotent = RetryPolicy::idempotent (code);
+    const auto hedged = connection.hedging && idempotent;
+    const auto deadline = policy.deadline.count() > 0
+            ? std::chrono::steady_clock::now() + policy.deadline
+            : std::chrono::steady_clock::time_point::max();
+
+    try {
+        for (unsigned attempt = 1; ; ++attempt) {
+            auto sent = false;
+            try {
+                if (hedged) {
+                    this->_hedgedExchange (ByteSpan (header, headerSize), body, code, deadline, sent);
+                }
+                else {
+                    this->_exchange (ByteSpan (header, headerSize), body, deadline, sent);
+                }
+                break;
+            }
+            catch (NetworkException &error) {
+                this->_content.clear();
+                error.sent = sent;
+                if (attempt >= policy.maxAttempts || (sent && !idempotent)) {
+                    throw;
+                }
+                const auto pause = policy.backoff (attempt);
+                if (std::chrono::steady_clock::now() + pause >= deadline) {
+                    throw;
+                }
+                std::this_thread::sleep_for (pause);
+            }
+        }
+
+        this->_enter (RequestStage::ParseHeader);
+        this->_parseHeader();
+        this->_enter (RequestStage::ParseBody);
+    }
+    catch (...) {
+        this->_finishTrace (true);
+        throw;
+    }
+}
+
+/// \brief Одна попытка обмена с сервером через сокет подключения.
+/// \param header Заголовок пакета.
+/// \param body Тело пакета.
+/// \param deadline Крайний срок получения ответа.
+/// \param sent Выставляется, как только началась отсылка запроса.
+/// \param slowAt Момент, после которого запрос считается медленным.
+/// \param onSlow Вызывается (в этом же потоке), если к моменту slowAt
+/// ответ не начал поступать; затем ожидание ответа продолжается.
+/// \throw NetworkException Сбой сети либо истёк срок.
+void ServerResponse::_exchange (ByteSpan header, ByteSpan body,
+        std::chrono::steady_clock::time_point deadline, bool &sent,
+        std::chrono::steady_clock::time_point slowAt, const std::function<void()> &onSlow)
+{
+    auto &connection = *this->_connection;
     auto &socket = *connection.socket;
     socket.host  = connection.host;
     socket.port  = connection.port;
+    socket.connectTimeout = connection.connectTimeout;
+    socket.receiveTimeout = connection.receiveTimeout;
+    socket.noDelay = connection.noDelay;
+    socket.receiveBufferSize = connection.receiveBufferSize;
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+                (deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            throw NetworkException();
+        }
+        const auto limit = static_cast<int> (std::min<int64_t> (left, INT32_MAX));
+        socket.connectTimeout = socket.connectTimeout == 0 ? limit : std::min (socket.connectTimeout, limit);
+        socket.receiveTimeout = socket.receiveTimeout == 0 ? limit : std::min (socket.receiveTimeout, limit);
+    }
+
+    // Разрешение имени происходит внутри open(), его длительность
+    // берём из статистики сокета.
+    const auto resolveMs = socket.statistics.resolveMs;
+    this->_enter (RequestStage::Connecting);
     socket.open();
+    this->_enter (RequestStage::Sending);
+    if (this->_trace) {
+        const auto resolved = (socket.statistics.resolveMs - resolveMs) * 1000.0;
+        this->_trace->move (RequestStage::Connecting, RequestStage::NameResolution,
+                static_cast<uint64_t> (resolved));
+    }
 
-    auto encoded    = query.encode();
-    const auto data = encoded.data();
-    const auto size = encoded.size();
-    socket.send (data, size);
+    try {
+        sent = true;
+        socket.sendParts (header, body);
+        this->_enter (RequestStage::Waiting);
+        if (onSlow && !socket.waitAnswer (slowAt)) {
+            onSlow();
+        }
 
-    Byte buffer[2048];
-    while(true) {
-        const auto received = socket.receive(buffer, sizeof(buffer));
-        if (received <= 0) {
-            break;
+        Byte buffer[32 * 1024];
+        while(true) {
+            const auto received = socket.receive(buffer, sizeof(buffer));
+            if (received == 0 || received > sizeof (buffer)) { // ошибка приходит как (size_t) -1
+                break;
+            }
+            if (this->_content.empty()) {
+                // По заголовку первой порции резервируем память под весь ответ.
+                this->_content.reserve (expectedSize (buffer, received));
+                this->_enter (RequestStage::Receiving);
+            }
+            _write(buffer, received);
         }
-        _write(buffer, received);
     }
+    catch (...) {
+        socket.close();
+        throw;
+    }
+    this->_enter (RequestStage::Shutdown);
     socket.close();
+}
 
-    // decode the response
+/// \brief Обмен с сервером с дублированием медленного запроса.
+/// \param header Заголовок пакета.
+/// \param body Тело пакета.
+/// \param code Код команды.
+/// \param deadline Крайний срок получения ответа.
+/// \param sent Выставляется, как только началась отсылка запроса.
+/// \throw NetworkException Ни одна из копий запроса не получила ответа.
+///
+/// Основной запрос идёт обычным путём, через сокет подключения,
+/// в вызывающем потоке. Если за Hedging::delay() ответ не начал
+/// поступать, дубликат отсылается через AsyncEngine по подключению,
+/// арендованному у пула Hedging::pool(), в его сеансе, а ожидание
+/// основного ответа продолжается. Ответ дубликата, пришедший первым,
+/// прерывает это ожидание (ClientSocket::abort()). Аренда возвращается
+/// в пул при выходе отсюда, в вызывающем потоке; опоздавший ответ
+/// дубликата отбрасывается.
+void ServerResponse::_hedgedExchange (ByteSpan header, ByteSpan body, const std::string &code,
+        std::chrono::steady_clock::time_point deadline, bool &sent)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Общее с обработчиком ответа дубликата, который может
+    // сработать в потоке AsyncEngine и после выхода отсюда.
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        ClientSocket *primary { nullptr }; ///< Сокет основного запроса, пока ответ ждут здесь.
+        bool hedgeDone { false };
+        Bytes hedgeAnswer;
+    };
+
+    auto &connection = *this->_connection;
+    const auto hedging = connection.hedging;
+    const auto started = Clock::now();
+
+    // Ожидание ограничено всегда, даже без срока и таймаута подключения.
+    if (deadline == Clock::time_point::max()) {
+        deadline = started + std::chrono::milliseconds (connection.connectTimeout)
+                + (connection.receiveTimeout > 0 ? std::chrono::milliseconds (connection.receiveTimeout)
+                                                 : HedgedWaitLimit);
+    }
+
+    const auto elapsed = [started] () {
+        return static_cast<uint64_t> (std::chrono::duration_cast<std::chrono::microseconds>
+                (Clock::now() - started).count());
+    };
+
+    const auto pool = hedging->pool();
+    if (pool == nullptr) {
+        // Дубликат отослать не через что: только учитываем задержку.
+        this->_exchange (header, body, deadline, sent);
+        hedging->record (elapsed(), false, false);
+        return;
+    }
+
+    const auto state = std::make_shared<State>();
+    state->primary = connection.socket.get();
+    ConnectionLease lease;
+    auto hedged = false;
+
+    // Дубликат: тот же запрос от имени арендованного подключения.
+    const auto hedge = [&] () {
+        try {
+            lease = pool->tryAcquire();
+            if (!lease) {
+                return;
+            }
+
+            auto &other = *lease;
+            auto parameters = body;
+            for (auto line = 0; line < 10; ++line) {
+                const auto newline = parameters.indexOf ('\n');
+                parameters = newline < 0 ? ByteSpan() : parameters.slice (newline + 1);
+            }
+            ClientQuery query (other, code);
+            query.addAnsi (std::string (reinterpret_cast<const char*> (parameters.cdata()), parameters.size()));
+
+            auto options = AsyncOptions::from (other);
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+                    (deadline - Clock::now()).count();
+            const auto limit = static_cast<int> (std::max<int64_t> (std::min<int64_t> (left, INT32_MAX), 1));
+            options.connectTimeout = options.connectTimeout == 0 ? limit : std::min (options.connectTimeout, limit);
+            options.receiveTimeout = options.receiveTimeout == 0 ? limit : std::min (options.receiveTimeout, limit);
+            AsyncEngine::instance().submit (other.host, other.port, query.encode(),
+                [state] (Bytes &&answer, std::exception_ptr error) {
+                    std::lock_guard<std::mutex> guard (state->mutex);
+                    state->hedgeDone = true;
+                    if (!error && !answer.empty()) {
+                        state->hedgeAnswer = std::move (answer);
+                        if (state->primary != nullptr) {
+                            state->primary->abort();
+                        }
+                    }
+                    state->changed.notify_all();
+                }, options);
+            hedged = true;
+            connection.socket->abortable = true;
+        }
+        catch (...) {
+            // Без дубликата ждём основной запрос.
+        }
+    };
+
+    std::exception_ptr primaryError;
+    try {
+        this->_exchange (header, body, deadline, sent, started + hedging->delay(), hedge);
+    }
+    catch (...) {
+        primaryError = std::current_exception();
+    }
+    connection.socket->abortable = false;
+
+    std::unique_lock<std::mutex> lock (state->mutex);
+    state->primary = nullptr;
+    if (primaryError && hedged) {
+        // Основной запрос прерван либо не удался: ответ даст дубликат.
+        state->changed.wait_until (lock, deadline, [&state] { return state->hedgeDone; });
+    }
+    if (primaryError) {
+        if (state->hedgeAnswer.empty()) {
+            this->_content.clear();
+            std::rethrow_exception (primaryError);
+        }
+        this->_content = std::move (state->hedgeAnswer);
+        lock.unlock();
+        this->_enter (RequestStage::Receiving);
+        this->_enter (RequestStage::Shutdown);
+    }
+    hedging->record (elapsed(), hedged, primaryError != nullptr);
+}
+
+/// \brief Деструктор.
+///
+/// Разбор тела ответа считается законченным, когда ответ
+/// больше не нужен: тогда же метрики запроса передаются в RequestMetrics.
+ServerResponse::~ServerResponse()
+{
+    this->_finishTrace (false);
+}
+
+/// \brief Переход к очередному этапу выполнения запроса.
+/// \param stage Этап.
+void ServerResponse::_enter (RequestStage stage) noexcept
+{
+    this->_connection->stage = stage;
+    if (this->_trace) {
+        this->_trace->enter (stage);
+    }
+}
+
+/// \brief Завершение запроса: передача метрик подключению.
+/// \param failed Запрос завершился ошибкой.
+void ServerResponse::_finishTrace (bool failed) noexcept
+{
+    if (this->_connection == nullptr) {
+        return;
+    }
+
+    this->_connection->stage = failed ? RequestStage::Error : RequestStage::None;
+    if (!this->_trace) {
+        return;
+    }
+
+    auto trace = std::move (this->_trace);
+    trace->enter (RequestStage::None);
+    trace->failed = failed;
+    trace->bytesReceived = this->_content.size();
+    const auto metrics = this->_connection->metrics;
+    if (metrics) {
+        try {
+            metrics->record (*trace);
+        }
+        catch (...) {
+            // Сбой при сборе метрик не должен мешать работе с сервером.
+        }
+    }
+}
+
+/// \brief Конструктор для ответа, полученного асинхронно.
+/// \param connection Подключение.
+/// \param answer Полный ответ сервера (вычитанный до конца).
+///
+/// Сеть не используется, мьютекс подключения не захватывается.
+ServerResponse::ServerResponse (ConnectionBase &connection, Bytes &&answer)
+    : _connection { &connection },
+      _success    { false },
+      _position   { 0 },
+      _content    { std::move (answer) }
+{
+    this->returnCode = 0;
+    this->_parseHeader();
+}
+
+/// \brief Разбор заголовка ответа сервера.
+void ServerResponse::_parseHeader()
+{
     this->command       = this->readAnsi();
     this->clientId      = this->readInteger();
     this->queryId       = this->readInteger();
@@ -106,55 +427,40 @@ bool ServerResponse::checkReturnCode (int nargs, ...)
     return result;
 }
 
+/// \brief Оценка полного размера ответа по его первой порции.
+/// \param data Начало ответа сервера.
+/// \param size Размер порции в байтах.
+/// \return Ожидаемый размер ответа в байтах либо 0, если оценить не удалось.
+///
+/// Четвёртая строка заголовка содержит размер ответа (есть не у всех команд).
+std::size_t ServerResponse::expectedSize (const Byte *data, std::size_t size) noexcept
+{
+    ByteNavigator navigator (ByteSpan (data, size));
+    navigator.readLine(); // команда
+    navigator.readLine(); // идентификатор клиента
+    navigator.readLine(); // номер команды
+    const auto line = navigator.readLine();
+    if (navigator.eot() || line.empty() || line.length > 9) {
+        return 0;
+    }
+    const auto answerSize = fastParse32 (line);
+    return answerSize > 0 ? navigator.position() + static_cast<std::size_t> (answerSize) : 0;
+}
+
 /// \brief Чтение строки без преобразования кодировок.
 /// \return Прочитанная строка. Если достигнут конец ответа сервера, строка будет пустая.
 std::string ServerResponse::getLine()
 {
-    std::string result;
-    const auto size = this->_content.size();
-    while (this->_position < size) {
-        auto c = this->_content.at(_position);
-        this->_position++;
-
-        if (c == 13) {
-            if (this->_position < size) {
-                c = this->_content.at(_position);
-                if (c == 10) {
-                    this->_position++;
-                }
-            }
-            break;
-        }
-
-        result.push_back (c);
-    }
-
-    return result;
+    const auto span = this->readLineSpan();
+    return std::string (reinterpret_cast<const char*> (span.cdata()), span.size());
 }
 
 /// \brief Чтение оставшейся части ответа сервера без преобразования кодировок.
 /// \return Прочитанный ответ сервера. Если достигнут конец, строка будет пустая.
 std::string ServerResponse::getRemaining()
 {
-    std::string result;
-    const auto size = this->_content.size();
-    if (this->_position < size) {
-        const auto data = reinterpret_cast<const char*> (_content.data() + this->_position);
-        std::size_t remaining = size - this->_position;
-        // Убираем переводы строки в конце.
-        while (remaining > 0) {
-            const auto c = data[remaining-1];
-            if (c != '\r' && c != '\n') {
-                break;
-            }
-            remaining--;
-        }
-        const std::string s2 (data, remaining);
-        result = s2;
-        this->_position = size;
-    }
-
-    return result;
+    const auto span = this->readRemainingSpan();
+    return std::string (reinterpret_cast<const char*> (span.cdata()), span.size());
 }
 
 /// \brief Получение кода возврата.
@@ -185,6 +491,73 @@ int ServerResponse::readInteger()
     return std::stoi (line);
 }
 
+/// \brief Чтение строки без копирования и преобразования кодировок.
+/// \return Спан, указывающий внутрь ответа сервера (действителен,
+/// пока жив объект ServerResponse). Если достигнут конец ответа,
+/// спан будет пустым.
+///
+/// Строка завершается символом CR (за ним может следовать LF).
+ByteSpan ServerResponse::readLineSpan() noexcept
+{
+    const auto data = this->_content.data();
+    const auto size = this->_content.size();
+    const auto start = this->_position;
+    if (start >= size) {
+        return ByteSpan (data + size, 0);
+    }
+
+    const auto found = static_cast<const Byte*> (std::memchr (data + start, 13, size - start));
+    if (found == nullptr) {
+        this->_position = size;
+        return ByteSpan (data + start, size - start);
+    }
+
+    const auto end = static_cast<std::size_t> (found - data);
+    this->_position = end + 1;
+    if (this->_position < size && data[this->_position] == 10) {
+        this->_position++;
+    }
+    return ByteSpan (data + start, end - start);
+}
+
+/// \brief Чтение оставшейся части ответа сервера без копирования.
+/// \return Спан, указывающий внутрь ответа сервера, без завершающих
+/// переводов строки. Если достигнут конец ответа, спан будет пустым.
+ByteSpan ServerResponse::readRemainingSpan() noexcept
+{
+    const auto size = this->_content.size();
+    if (this->_position >= size) {
+        return ByteSpan (this->_content.data() + size, 0);
+    }
+
+    const auto data = this->_content.data() + this->_position;
+    std::size_t remaining = size - this->_position;
+    // Убираем переводы строки в конце.
+    while (remaining > 0) {
+        const auto c = data[remaining-1];
+        if (c != '\r' && c != '\n') {
+            break;
+        }
+        remaining--;
+    }
+    this->_position = size;
+    return ByteSpan (data, remaining);
+}
+
+/// \brief Чтение оставшихся строк без копирования и преобразования кодировок.
+/// \return Вектор спанов, указывающих внутрь ответа сервера
+/// (действительны, пока жив объект ServerResponse).
+///
+/// Декодирование (fromUtf и т. п.) выполняет тот, кому нужен текст.
+std::vector<ByteSpan> ServerResponse::readRemainingSpans()
+{
+    std::vector<ByteSpan> result;
+    while (!this->eot()) {
+        result.push_back (this->readLineSpan());
+    }
+    return result;
+}
+
 /// \brief Чтение оставшихся строк в кодировке ANSI.
 /// \return Вектор прочитанных строк.
 StringList ServerResponse::readRemainingAnsiLines()
@@ -207,8 +580,7 @@ StringList ServerResponse::readRemainingUtfLines()
 {
     StringList result;
     while (!this->eot()) {
-        const auto line = readUtf();
-        result.push_back (line);
+        result.push_back (fromUtf (this->readLineSpan()));
     }
     return result;
 }
@@ -229,16 +601,14 @@ std::vector<std::string> ServerResponse::readRemainingLinesUtf()
 /// \return Прочитанный текст.
 String ServerResponse::readRemainingUtfText()
 {
-    const auto line = getRemaining();
-    return fromUtf(line);
+    return fromUtf (this->readRemainingSpan());
 }
 
 /// \brief Чтение строки в кодировке UTF-8.
 /// \return Полученная строка. Если достигнут конец ответа, строка будет пустой.
 String ServerResponse::readUtf()
 {
-    const auto line = this->getLine();
-    return fromUtf(line);
+    return fromUtf (this->readLineSpan());
 }
 
 /// \brief Сетевой обмен с сервером завершился успешно?
@@ -250,14 +620,7 @@ bool ServerResponse::success() const
 
 void ServerResponse::_write(const Byte *bytes, std::size_t size)
 {
-    const auto newSize = this->_content.size() + size;
-    if (this->_content.capacity() < newSize) {
-        this->_content.reserve(newSize);
-    }
-
-    for (std::size_t i = 0; i < size; i++) {
-        this->_content.push_back (bytes[i]);
-    }
+    this->_content.insert (this->_content.end(), bytes, bytes + size);
 }
 
 /// \brief Создание пустого ответа сервера (для целей тестирования).
@@ -72,6 +72,22 @@ void SubField::decode (const String &line)
     this->value = line.substr (1);
 }
 
+/// \brief Декодирование подполя из клиентского представления в кодировке UTF-8.
+/// \param line Строка с клиентским представлением (не должна быть пустой).
+void SubField::decode (ByteSpan line)
+{
+    if (line[0] < 0x80) {
+        // обычный случай: код подполя -- латинская буква или цифра
+        this->code  = static_cast<Char> (line[0]);
+        this->value = fromUtf (line.slice (1));
+    }
+    else {
+        const auto text = fromUtf (line);
+        this->code  = text[0];
+        this->value = text.substr (1);
+    }
+}
+
 /// \brief Пустое подполе?
 /// \return true, если подполе пустое.
 bool SubField::empty() const noexcept
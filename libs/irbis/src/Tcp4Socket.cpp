@@ -4,6 +4,8 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 
+#include <atomic>
+
 #if defined(_MSC_VER)
 #pragma warning(disable: 4068)
 #endif
@@ -15,115 +17,433 @@
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 
 #ifdef IRBIS_WINDOWS
 #pragma comment (lib, "ws2_32.lib")
 #endif
 
+#define IRBIS_SOCKET_ERROR_WOULD_BLOCK(__x) ((__x) == WSAEWOULDBLOCK)
+#define IRBIS_SOCKET_LAST_ERROR() WSAGetLastError()
+
 #else
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
 
-#define HOSTENT struct hostent
+#define INVALID_SOCKET (-1)
 #define closesocket(__x) ::close(__x)
+#define IRBIS_SOCKET_ERROR_WOULD_BLOCK(__x) ((__x) == EINPROGRESS)
+#define IRBIS_SOCKET_LAST_ERROR() errno
 
 #endif
 
+/// \class irbis::Tcp4Socket
+/// \details Время, затраченное на разрешение имени, подключение
+/// и обмен данными, а также число переданных байт накапливаются
+/// в ClientSocket::statistics.
+
 namespace irbis {
 
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Если выставлен ClientSocket::abortable, ожидание ответа идёт
+// порциями такой длины, чтобы заметить abort().
+const int AbortCheckMs = 20;
+
+double millisecondsSince (Clock::time_point start) noexcept
+{
+    return std::chrono::duration<double, std::milli> (Clock::now() - start).count();
+}
+
+}
+
 struct Tcp4Socket::TcpInternals
 {
-#ifdef IRBIS_WINDOWS
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
 
-    WSADATA wsaData;
-    SOCKET socket;
+    SOCKET socket { INVALID_SOCKET };
 
 #else
 
-    int socket;
+    int socket { INVALID_SOCKET };
 
 #endif
+
+    Clock::time_point opened;   ///< Момент установки подключения.
+    Clock::time_point deadline; ///< Срок получения ответа.
+    bool hasDeadline { false };
+    std::atomic<bool> aborted { false }; ///< Обмен прерван из другого потока.
+
+    bool setBlocking (bool blocking) noexcept;
+    int wait (bool forWrite, int milliseconds) noexcept;
 };
 
-Tcp4Socket::Tcp4Socket (const String &host_, short port_)
-    : _impl {new TcpInternals}
+/// \brief Переключение сокета в блокирующий либо неблокирующий режим.
+bool Tcp4Socket::TcpInternals::setBlocking (bool blocking) noexcept
 {
-    this->host = host_;
-    this->port = port_;
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
 
-#ifdef IRBIS_WINDOWS
+    u_long mode = blocking ? 0 : 1;
+    return ::ioctlsocket (this->socket, FIONBIO, &mode) == 0;
 
-    if (WSAStartup (0x0202, &this->_impl->wsaData)) {
-        throw NetworkException();
+#else
+
+    const auto flags = ::fcntl (this->socket, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
     }
+    return ::fcntl (this->socket, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK) == 0;
 
 #endif
 }
 
-Tcp4Socket::~Tcp4Socket()
+/// \brief Ожидание готовности сокета.
+/// \param forWrite Ждать готовности к записи (иначе -- к чтению).
+/// \param milliseconds Предельное время ожидания (отрицательное -- без ограничения).
+/// \return 1 -- сокет готов, 0 -- таймаут, -1 -- ошибка.
+int Tcp4Socket::TcpInternals::wait (bool forWrite, int milliseconds) noexcept
 {
-#ifdef IRBIS_WINDOWS
+#if defined(IRBIS_WINDOWS) || defined(IRBIS_MINGW)
 
-    WSACleanup();
+    fd_set set;
+    FD_ZERO (&set);
+    FD_SET (this->socket, &set);
+    fd_set errors;
+    FD_ZERO (&errors);
+    FD_SET (this->socket, &errors);
+    timeval limit {};
+    limit.tv_sec = milliseconds / 1000;
+    limit.tv_usec = (milliseconds % 1000) * 1000;
+    const auto result = ::select (0, forWrite ? nullptr : &set, forWrite ? &set : nullptr,
+            &errors, milliseconds < 0 ? nullptr : &limit);
+    return result == SOCKET_ERROR ? -1 : (result == 0 ? 0 : 1);
+
+#else
+
+    pollfd item {};
+    item.fd = this->socket;
+    item.events = forWrite ? POLLOUT : POLLIN;
+    while (true) {
+        const auto result = ::poll (&item, 1, milliseconds);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        return result < 0 ? -1 : (result == 0 ? 0 : 1);
+    }
 
 #endif
 }
 
+//=========================================================
+
+/// \brief Конструктор.
+/// \param host_ Адрес сервера.
+/// \param port_ Номер порта.
+Tcp4Socket::Tcp4Socket (const String &host_, short port_)
+    : _impl {new TcpInternals}
+{
+    this->host = host_;
+    this->port = port_;
+
+    // Заодно инициализирует WinSock.
+    AddressResolver::instance();
+}
+
+/// \brief Деструктор.
+Tcp4Socket::~Tcp4Socket()
+{
+    this->close();
+}
+
+/// \brief Подключение к серверу.
+///
+/// Адреса, полученные при разрешении имени, перебираются по очереди,
+/// на каждый даётся не более connectTimeout миллисекунд.
+/// \throw NetworkException Не удалось подключиться ни по одному из адресов.
 void Tcp4Socket::open()
 {
-    this->_impl->socket = socket (AF_INET, SOCK_STREAM, 0);
-    //if (internals->socket < 0) {
-    //    throw NetworkException();
-    //}
-
-    sockaddr_in destinationAddress {};
-    destinationAddress.sin_family = AF_INET;
-    destinationAddress.sin_port = htons(this->port);
-    auto ansi = unicode_to_cp1251(this->host);
-    auto inaddr = inet_addr(ansi.c_str());
-    if (inaddr != INADDR_NONE) {
-        destinationAddress.sin_addr.s_addr = inaddr;
+    auto &impl = *this->_impl;
+    this->close();
+    impl.hasDeadline = false;
+    impl.aborted = false;
+
+    auto started = Clock::now();
+    bool cached = false;
+    std::vector<ResolvedAddress> addresses;
+    try {
+        addresses = AddressResolver::instance().resolve (this->host, this->port, &cached);
+    }
+    catch (...) {
+        this->statistics.failures++;
+        throw;
+    }
+    this->statistics.resolveMs += millisecondsSince (started);
+    if (cached) {
+        this->statistics.resolveCacheHits++;
     }
-    else {
 
-        HOSTENT *hostentry = gethostbyname(ansi.c_str());
-        if (hostentry) {
-            ((unsigned long*)&destinationAddress.sin_addr)[0] =
-                    ((unsigned long **)hostentry->h_addr_list)[0][0];
+    started = Clock::now();
+    bool timedOut = false;
+    for (const auto &address : addresses) {
+        impl.socket = ::socket (address.family, SOCK_STREAM, 0);
+        if (impl.socket == INVALID_SOCKET) {
+            continue;
         }
-        else {
-            throw NetworkException();
+
+        if (this->noDelay) {
+            int flag = 1;
+            ::setsockopt (impl.socket, IPPROTO_TCP, TCP_NODELAY,
+                    reinterpret_cast<const char*> (&flag), sizeof (flag));
+        }
+        if (this->receiveBufferSize > 0) {
+            const int size = this->receiveBufferSize;
+            ::setsockopt (impl.socket, SOL_SOCKET, SO_RCVBUF,
+                    reinterpret_cast<const char*> (&size), sizeof (size));
+        }
+
+        const auto target = reinterpret_cast<const sockaddr*> (address.address.data());
+        const auto targetLength = static_cast<int> (address.address.size());
+        bool connected = false;
+        if (this->connectTimeout <= 0) {
+            connected = ::connect (impl.socket, target, targetLength) == 0;
+        }
+        else if (impl.setBlocking (false)) {
+            if (::connect (impl.socket, target, targetLength) == 0) {
+                connected = true;
+            }
+            else if (IRBIS_SOCKET_ERROR_WOULD_BLOCK (IRBIS_SOCKET_LAST_ERROR())) {
+                const auto ready = impl.wait (true, this->connectTimeout);
+                if (ready > 0) {
+                    int error = 0;
+                    socklen_t length = sizeof (error);
+                    connected = ::getsockopt (impl.socket, SOL_SOCKET, SO_ERROR,
+                            reinterpret_cast<char*> (&error), &length) == 0 && error == 0;
+                }
+                else if (ready == 0) {
+                    timedOut = true;
+                }
+            }
+            connected = connected && impl.setBlocking (true);
         }
+
+        if (connected) {
+            this->statistics.connects++;
+            this->statistics.connectMs += millisecondsSince (started);
+            impl.opened = Clock::now();
+            return;
+        }
+
+        closesocket (impl.socket);
+        impl.socket = INVALID_SOCKET;
     }
 
-    if (connect(this->_impl->socket, (sockaddr*)&destinationAddress, sizeof(destinationAddress))) {
-        throw NetworkException();
+    this->statistics.failures++;
+    if (timedOut) {
+        this->statistics.timeouts++;
     }
+    throw NetworkException();
+}
+
+/// \brief Прерывание ожидания ответа, идущего в другом потоке.
+///
+/// Срабатывает, только если выставлен флаг abortable и задан
+/// receiveTimeout: receive() выбрасывает NetworkException не позже
+/// чем через AbortCheckMs. Сброс -- в open().
+void Tcp4Socket::abort() noexcept
+{
+    this->_impl->aborted = true;
 }
 
+/// \brief Закрытие подключения (если оно открыто).
 void Tcp4Socket::close()
 {
-    closesocket(this->_impl->socket);
+    auto &impl = *this->_impl;
+    if (impl.socket != INVALID_SOCKET) {
+        closesocket (impl.socket);
+        impl.socket = INVALID_SOCKET;
+        this->statistics.transferMs += millisecondsSince (impl.opened);
+    }
 }
 
+/// \brief Начало отсчёта срока получения ответа.
+void Tcp4Socket::_startDeadline() noexcept
+{
+    auto &impl = *this->_impl;
+    impl.hasDeadline = this->receiveTimeout > 0;
+    if (impl.hasDeadline) {
+        impl.deadline = Clock::now() + std::chrono::milliseconds (this->receiveTimeout);
+    }
+}
+
+/// \brief Отсылка данных (целиком, с учётом частичной записи).
+/// \throw NetworkException Ошибка сокета.
 void Tcp4Socket::send (const Byte *buffer, std::size_t size)
 {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
     const auto ptr = reinterpret_cast <const char*> (buffer);
-    const auto size2 = static_cast <int> (size);
-    ::send (this->_impl->socket, ptr, size2, 0);
+    std::size_t offset = 0;
+    while (offset < size) {
+        const auto sent = ::send (this->_impl->socket, ptr + offset, static_cast<int> (size - offset), flags);
+        if (sent < 0) {
+#if !defined(IRBIS_WINDOWS) && !defined(IRBIS_MINGW)
+            if (errno == EINTR) {
+                continue;
+            }
+#endif
+            throw NetworkException();
+        }
+        offset += static_cast<std::size_t> (sent);
+    }
+
+    this->statistics.bytesSent += size;
+    this->_startDeadline();
 }
 
+/// \brief Отсылка заголовка и тела пакета одним системным вызовом
+/// (без склеивания их в общий буфер).
+/// \param header Заголовок пакета.
+/// \param body Тело пакета.
+void Tcp4Socket::sendParts (ByteSpan header, ByteSpan body)
+{
+#if defined(IRBIS_WINDOWS)
+
+    WSABUF buffers[2];
+    buffers[0].buf = reinterpret_cast<char*> (header.ptr);
+    buffers[0].len = static_cast<ULONG> (header.size());
+    buffers[1].buf = reinterpret_cast<char*> (body.ptr);
+    buffers[1].len = static_cast<ULONG> (body.size());
+    DWORD sent = 0;
+    if (WSASend (this->_impl->socket, buffers, 2, &sent, 0, nullptr, nullptr) != 0) {
+        throw NetworkException();
+    }
+    this->statistics.bytesSent += sent;
+    this->_startDeadline();
+
+#elif defined(IRBIS_MINGW)
+
+    ClientSocket::sendParts (header, body);
+
+#else
+
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    iovec parts[2];
+    parts[0].iov_base = header.ptr;
+    parts[0].iov_len  = header.size();
+    parts[1].iov_base = body.ptr;
+    parts[1].iov_len  = body.size();
+    iovec *current = parts;
+    std::size_t count = 2;
+    while (count != 0) {
+        msghdr message {};
+        message.msg_iov = current;
+        message.msg_iovlen = count;
+        const auto sent = ::sendmsg (this->_impl->socket, &message, flags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw NetworkException();
+        }
+
+        // Сокет мог принять не всё: пропускаем отосланное.
+        auto left = static_cast<std::size_t> (sent);
+        while (count != 0 && left >= current->iov_len) {
+            left -= current->iov_len;
+            ++current;
+            --count;
+        }
+        if (count != 0) {
+            current->iov_base = static_cast<Byte*> (current->iov_base) + left;
+            current->iov_len -= left;
+        }
+    }
+
+    this->statistics.bytesSent += header.size() + body.size();
+    this->_startDeadline();
+
+#endif
+}
+
+/// \brief Ожидание начала ответа сервера (не дольше until).
+/// \return false, если к моменту until данных нет; true, если данные
+/// либо признак закрытия подключения готовы к чтению.
+bool Tcp4Socket::waitAnswer (Clock::time_point until)
+{
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds> (until - Clock::now()).count();
+    const auto limit = static_cast<int> (std::max<int64_t> (std::min<int64_t> (left, INT32_MAX), 0));
+    return this->_impl->wait (false, limit) != 0;
+}
+
+/// \brief Получение очередной порции ответа.
+/// \return Число полученных байт (0 -- сервер закрыл подключение).
+/// \throw NetworkException Ошибка сокета либо истёк срок receiveTimeout.
 std::size_t Tcp4Socket::receive (Byte *buffer, std::size_t size)
 {
+    auto &impl = *this->_impl;
     const auto ptr = reinterpret_cast <char*> (buffer);
     const auto size2 = static_cast <int> (size);
-    const std::size_t result = ::recv (this->_impl->socket, ptr, size2, 0);
-    return result;
+    while (true) {
+        if (impl.hasDeadline) {
+            const auto slice = this->abortable ? AbortCheckMs : INT32_MAX;
+            auto ready = 0;
+            while (!(this->abortable && impl.aborted)) {
+                const auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+                        (impl.deadline - Clock::now()).count();
+                if (left <= 0) {
+                    break;
+                }
+                ready = impl.wait (false, static_cast<int> (std::min<int64_t> (left, slice)));
+                if (ready != 0) {
+                    break;
+                }
+            }
+            if (this->abortable && impl.aborted) {
+                throw NetworkException();
+            }
+            if (ready == 0) {
+                this->statistics.timeouts++;
+                throw NetworkException();
+            }
+            if (ready < 0) {
+                throw NetworkException();
+            }
+        }
+
+        const auto result = ::recv (impl.socket, ptr, size2, 0);
+        if (result < 0) {
+#if !defined(IRBIS_WINDOWS) && !defined(IRBIS_MINGW)
+            if (errno == EINTR) {
+                continue;
+            }
+#endif
+            throw NetworkException();
+        }
+
+        this->statistics.bytesReceived += static_cast<uint64_t> (result);
+        return static_cast<std::size_t> (result);
+    }
 }
 
 }
@@ -0,0 +1,215 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "irbis.h"
+#include "irbis_internal.h"
+
+///
+/// \file TermCursor.cpp
+/// \brief Постраничное чтение терминов поискового словаря.
+///
+
+/// \class irbis::TermCursor
+/// \details Очередная порция запрашивается, начиная с последнего
+/// термина предыдущей, поэтому её первый термин (повтор) пропускается.
+/// Термины хранятся и сравниваются с префиксом в UTF-8, преобразование
+/// в String выполняет только next (TermInfo&).
+///
+/// Первая порция запрашивается синхронно через сокет подключения,
+/// последующие (при включённой предвыборке) -- через AsyncEngine.
+
+namespace irbis {
+
+const int TermCursor::DefaultPageSize;
+const int TermCursor::MaxPageSize;
+
+/// \brief Конструктор.
+/// \param connection Подключение (должно жить дольше курсора).
+/// \param parameters Параметры: база данных, стартовый термин,
+/// размер порции (numberOfTerms, 0 -- DefaultPageSize; не меньше 2,
+/// так как первый термин порции повторяет последний термин предыдущей),
+/// направление обхода.
+/// \param prefix Префикс терминов. Если стартовый термин не задан,
+/// обход начинается с префикса (при обратном порядке -- с последнего
+/// термина, начинающегося с него).
+/// \param prefetch Запрашивать следующую порцию заранее.
+///
+/// Обращение к серверу происходит при первом вызове next().
+TermCursor::TermCursor (ConnectionBase &connection, const TermParameters &parameters,
+                        const String &prefix, bool prefetch)
+    : _connection { &connection },
+      _database   { choose (parameters.database, connection.database) },
+      _format     { parameters.format },
+      _prefix     { toUtf (prefix) },
+      _startTerm  { toUtf (parameters.startTerm) },
+      _pageSize   { parameters.numberOfTerms == 0 ? DefaultPageSize
+                    : std::max (std::min (static_cast<int> (parameters.numberOfTerms), MaxPageSize), 2) },
+      _reverse    { parameters.reverseOrder },
+      _prefetch   { prefetch }
+{
+    if (this->_startTerm.empty()) {
+        this->_startTerm = this->_prefix;
+        if (this->_reverse && !this->_prefix.empty()) {
+            // U+FFFF в UTF-8: больше любого термина с этим префиксом.
+            this->_startTerm += "\xEF\xBF\xBF";
+        }
+    }
+}
+
+/// \brief Получение очередного термина.
+/// \param term Сюда помещается термин.
+/// \return false, если термины закончились либо произошла ошибка
+/// (код ошибки в lastError подключения).
+bool TermCursor::next (TermInfo &term)
+{
+    if (this->_index >= this->_terms.size() && !this->_advance()) {
+        return false;
+    }
+
+    const auto &one = this->_terms[this->_index++];
+    term.count = one.first;
+    term.text = fromUtf (one.second);
+    ++this->_position;
+
+    return true;
+}
+
+/// \brief Получение очередного термина без преобразования в String.
+/// \param count Сюда помещается количество ссылок на термин.
+/// \param text Сюда помещается текст термина в UTF-8 (вместе с префиксом).
+/// \return false, если термины закончились либо произошла ошибка
+/// (код ошибки в lastError подключения).
+bool TermCursor::next (int &count, std::string &text)
+{
+    if (this->_index >= this->_terms.size() && !this->_advance()) {
+        return false;
+    }
+
+    auto &one = this->_terms[this->_index++];
+    count = one.first;
+    text = std::move (one.second);
+    ++this->_position;
+
+    return true;
+}
+
+/// \brief Переход к следующей порции терминов.
+/// \return false, если порций больше нет.
+bool TermCursor::_advance()
+{
+    while (!this->_finished) {
+        this->_terms.clear();
+        this->_index = 0;
+
+        if (this->_pending.valid()) {
+            Bytes answer;
+            try {
+                answer = this->_pending.get();
+            }
+            catch (...) {
+                this->_connection->lastError = -100002;
+                this->_finished = true;
+                return false;
+            }
+
+            ServerResponse response (*this->_connection, std::move (answer));
+            if (!this->_parsePage (response)) {
+                return false;
+            }
+        }
+        else {
+            if (!this->_connection->_checkConnection()) {
+                this->_finished = true;
+                return false;
+            }
+
+            ClientQuery query (*this->_connection, this->_reverse ? "P" : "H");
+            this->_encode (query);
+            ServerResponse response (*this->_connection, query);
+            if (!this->_parsePage (response)) {
+                return false;
+            }
+        }
+
+        // Пока вызывающий код разбирает эту порцию, сервер готовит следующую.
+        if (!this->_finished && this->_prefetch) {
+            this->_submitNext();
+        }
+
+        if (!this->_terms.empty()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// \brief Формирование команды "H" ("P") для очередной порции.
+/// \param query Клиентский запрос.
+void TermCursor::_encode (ClientQuery &query) const
+{
+    query.addAnsi (this->_database).newLine();
+    query.addAnsi (this->_startTerm).newLine();
+    query.add (this->_pageSize).newLine();
+    query.addFormat (this->_format);
+}
+
+/// \brief Разбор очередной порции.
+/// \param response Ответ сервера на команду "H" ("P").
+/// \return false при ошибке.
+bool TermCursor::_parsePage (ServerResponse &response)
+{
+    // -202..-204: термин не найден либо достигнут конец словаря.
+    if (!response.checkReturnCode (3, -202, -203, -204)) {
+        this->_finished = true;
+        return false;
+    }
+
+    std::size_t received = 0;
+    for (const auto line : response.readRemainingSpans()) {
+        if (line.empty()) {
+            continue;
+        }
+        ++received;
+
+        const auto sharp = line.indexOf ('#');
+        const auto count = fastParse32 (sharp < 0 ? line : line.slice (0, sharp));
+        const auto text = sharp < 0 ? ByteSpan() : line.slice (sharp + 1);
+        if (this->_continued && received == 1
+            && text.size() == this->_lastTerm.size()
+            && std::memcmp (text.cdata(), this->_lastTerm.data(), text.size()) == 0) {
+            continue; // повтор последнего термина предыдущей порции
+        }
+        if (text.size() < this->_prefix.size()
+            || std::memcmp (text.cdata(), this->_prefix.data(), this->_prefix.size()) != 0) {
+            this->_finished = true;
+            break;
+        }
+
+        this->_terms.emplace_back (count, std::string (reinterpret_cast<const char*> (text.cdata()), text.size()));
+    }
+
+    if (received < static_cast<std::size_t> (this->_pageSize)) {
+        this->_finished = true; // словарь исчерпан
+    }
+    if (this->_terms.empty()) {
+        this->_finished = true;
+    }
+    else {
+        this->_lastTerm = this->_terms.back().second;
+        this->_startTerm = this->_lastTerm;
+        this->_continued = true;
+    }
+
+    return true;
+}
+
+/// \brief Асинхронный запрос следующей порции.
+void TermCursor::_submitNext()
+{
+    ClientQuery query (*this->_connection, this->_reverse ? "P" : "H");
+    this->_encode (query);
+    this->_pending = this->_connection->_submitAsync (query);
+}
+
+}
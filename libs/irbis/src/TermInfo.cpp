@@ -33,6 +33,31 @@ std::vector<TermInfo> TermInfo::parse (const StringList &lines)
     return result;
 }
 
+/// \brief Разбор ответа сервера без промежуточных строк.
+/// \param lines Строки ответа сервера в кодировке UTF-8.
+/// \return Вектор терминов.
+std::vector<TermInfo> TermInfo::parse (const std::vector<ByteSpan> &lines)
+{
+    std::vector<TermInfo> result;
+    result.reserve(lines.size());
+    for (const auto line : lines) {
+        if (!line.empty()) {
+            TermInfo term;
+            const auto sharp = line.indexOf ('#');
+            if (sharp < 0) {
+                term.count = fastParse32 (line);
+            }
+            else {
+                term.count = fastParse32 (line.slice (0, sharp));
+                term.text = fromUtf (line.slice (sharp + 1));
+            }
+            result.push_back (std::move (term));
+        }
+    }
+
+    return result;
+}
+
 /// \brief Текстовое представление термина.
 /// \return Текстовое представление.
 String TermInfo::toString() const
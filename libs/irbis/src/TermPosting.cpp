@@ -50,6 +50,47 @@ std::vector<TermPosting> TermPosting::parse (const StringList &lines)
     return result;
 }
 
+/// \brief Разбор ответа сервера без промежуточных строк.
+/// \param lines Строки ответа сервера в кодировке UTF-8.
+/// \return Вектор постингов.
+std::vector<TermPosting> TermPosting::parse (const std::vector<ByteSpan> &lines)
+{
+    std::vector<TermPosting> result;
+    result.reserve(lines.size());
+    for (const auto line : lines) {
+        // MFN#метка#повторение#смещение[#текст]
+        int numbers[4] { 0, 0, 0, 0 };
+        auto rest = line;
+        auto count = 0;
+        auto hasText = false;
+        while (count < 4 && !rest.empty()) {
+            const auto sharp = rest.indexOf ('#');
+            if (sharp < 0) {
+                numbers[count++] = fastParse32 (rest);
+                rest = rest.slice (rest.size());
+                break;
+            }
+            numbers[count++] = fastParse32 (rest.slice (0, sharp));
+            rest = rest.slice (sharp + 1);
+            hasText = count == 4;
+        }
+        if (count < 4) {
+            break;
+        }
+        TermPosting posting;
+        posting.mfn        = numbers[0];
+        posting.tag        = numbers[1];
+        posting.occurrence = numbers[2];
+        posting.count      = numbers[3];
+        if (hasText) {
+            posting.text = fromUtf (rest);
+        }
+        result.push_back (std::move (posting));
+    }
+
+    return result;
+}
+
 /// \brief Текстовое представление постинга.
 /// \return Текстовое представление.
 std::wstring TermPosting::toString() const
@@ -5,7 +5,9 @@
 #include "irbis_direct.h"
 #include "irbis_internal.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #ifdef IRBIS_WINDOWS
 #include <cwchar>
@@ -45,8 +47,21 @@
     Нулевая ссылка соответствует записи файла документов
     с номером 1, первая – 2  и т. д.
 
+    Чтение позиционное и не требует блокировок, поэтому
+    один объект можно читать из многих потоков одновременно.
+
     \warning Объекты данного типа -- неперемещаемые и некопируемые!
 
+    \class irbis::XrfView
+
+    \details Файл проецируется в память целиком, поэтому чтение
+    не требует блокировок, а проверки статусов записей сводятся
+    к проходу по памяти: слово флагов сравнивается с маской
+    в порядке байт файла, без разбора ссылки.
+
+    Изменения, внесённые в файл после проецирования,
+    могут быть не видны (в частности, не видны дописанные ссылки).
+
  */
 
 namespace irbis {
@@ -54,6 +69,34 @@ namespace irbis {
 /// \brief Размер одной записи в XRF-файле.
 const int XrfRecord64::RecordSize = sizeof(Offset) + sizeof (Mfn); //-V119
 
+namespace {
+
+const std::size_t EntrySize = 12;    ///< Размер ссылки (он же XrfRecord64::RecordSize).
+const std::size_t ChunkEntries = 4096; ///< Сколько ссылок читается с диска за раз.
+
+/// \brief Маска флагов в порядке байт файла.
+uint32_t fileOrder (RecordStatus flags) noexcept
+{
+    const auto value = static_cast<uint32_t> (flags);
+    const Byte bytes[4] = {
+        static_cast<Byte> (value >> 24u), static_cast<Byte> (value >> 16u),
+        static_cast<Byte> (value >> 8u), static_cast<Byte> (value)
+    };
+    uint32_t result;
+    std::memcpy (&result, bytes, sizeof (result));
+    return result;
+}
+
+/// \brief Слово флагов ссылки как оно лежит в файле.
+inline uint32_t rawFlags (const Byte *data, std::size_t index) noexcept
+{
+    uint32_t result;
+    std::memcpy (&result, data + index * EntrySize + 8, sizeof (result));
+    return result;
+}
+
+}
+
 /// \brief Запись логически или физически удалена?
 /// \return `true` если запись удалена.
 bool XrfRecord64::deleted() const noexcept
@@ -76,13 +119,25 @@ String XrfRecord64::toString() const
            + String (L", status:=") + std::to_wstring (static_cast<uint32_t> (this->status));
 }
 
+/// \brief Разбор пачки идущих подряд ссылок в формате файла.
+/// \param data Начало первой ссылки.
+/// \param count Число ссылок.
+/// \param records Куда поместить результат (не меньше count элементов).
+void XrfRecord64::decode (const Byte *data, std::size_t count, XrfRecord64 *records) noexcept
+{
+    for (std::size_t index = 0; index < count; ++index, data += EntrySize) {
+        records[index].offset = readBig64 (data);
+        records[index].status = static_cast<RecordStatus> (readBig32 (data + 8));
+    }
+}
+
 //=========================================================
 
 /// \brief Конструктор.
 /// \param fileName Имя файла.
 /// \param mode Режим доступа.
 XrfFile64::XrfFile64 (const String &fileName, DirectAccessMode mode)
-    : _file { File::openRead(fileName).toHeap() },
+    : _file { (mode == DirectAccessMode::ReadOnly ? File::openRead (fileName) : File::openWrite (fileName)).toHeap() },
     _fileName { fileName }, _mode { mode }
 {
 }
@@ -95,34 +150,84 @@ Offset XrfFile64::getOffset(Mfn mfn) noexcept
     return static_cast<Offset> (XrfRecord64::RecordSize) * static_cast<Offset> (mfn - 1);
 }
 
+/// \brief Число ссылок в файле.
+/// \return Число ссылок (может превышать максимальный MFN базы).
+std::size_t XrfFile64::count()
+{
+    return this->_file->size() / EntrySize;
+}
+
+/// \brief Считывание идущих подряд XRF-записей.
+/// \param firstMfn MFN первой записи.
+/// \param count Сколько записей нужно.
+/// \param records Куда поместить записи (не меньше count элементов).
+/// \return Число прочитанных записей (меньше count, если файл кончился).
+/// \throw IrbisException Ошибка чтения.
+/// \details Файл читается блоками по нескольку тысяч ссылок.
+std::size_t XrfFile64::readRange (Mfn firstMfn, std::size_t count, XrfRecord64 *records)
+{
+    assert (firstMfn > 0);
+    Bytes buffer (std::min (count, ChunkEntries) * EntrySize);
+    auto offset = XrfFile64::getOffset (firstMfn);
+    std::size_t done = 0;
+    while (done < count) {
+        const auto portion = std::min (count - done, ChunkEntries);
+        const auto got = this->_file->readAt (offset, buffer.data(), static_cast<int64_t> (portion * EntrySize));
+        const auto entries = static_cast<std::size_t> (got) / EntrySize;
+        XrfRecord64::decode (buffer.data(), entries, records + done);
+        done += entries;
+        if (entries != portion) {
+            break;
+        }
+        offset += portion * EntrySize;
+    }
+
+    return done;
+}
+
 /// \brief Считывание одной XRF-записи.
 /// \param mfn MFN записи.
 /// \return Прочитанная запись.
-/// \warning Очень неэффективно! Лучше читать "пачками".
+/// \throw IrbisException MFN за пределами файла либо ошибка чтения.
+/// \details Для последовательных MFN выгоднее readRange().
 XrfRecord64 XrfFile64::readRecord (Mfn mfn)
 {
     assert (mfn > 0);
-    std::lock_guard<std::mutex> guard (this->_mutex);
-    const auto offset = XrfFile64::getOffset (mfn);
-    this->_file->seek (offset);
+    Byte entry[EntrySize];
+    if (this->_file->readAt (XrfFile64::getOffset (mfn), entry, sizeof (entry))
+        != static_cast<int64_t> (sizeof (entry))) {
+        throw IrbisException();
+    }
+
     XrfRecord64 result;
-    result.offset = this->_file->readInt64();
-    result.status = (RecordStatus) this->_file->readInt32();
+    XrfRecord64::decode (entry, 1, &result);
     return result;
 }
 
 /// \brief Сохранение одной XRF-записи.
 /// \param mfn MFN записи.
 /// \param record Сохраняемая запись.
-/// \warning Очень неэффективно! Лучше писать "пачками".
+/// \details Ссылка записывается одним вызовом; параллельные
+/// писатели упорядочиваются, читатели их не ждут.
 void XrfFile64::writeRecord (Mfn mfn, XrfRecord64 record)
 {
     assert (mfn > 0);
-    std::lock_guard<std::mutex> guard (this->_mutex);
-    const auto offset = XrfFile64::getOffset (mfn);
-    this->_file->seek (offset);
-    this->_file->writeInt64 (record.offset);
-    this->_file->writeInt32 ((uint32_t) record.status);
+    const auto status = static_cast<uint32_t> (record.status);
+    const uint32_t words[3] = {
+        static_cast<uint32_t> (record.offset & 0xFFFFFFFFull),
+        static_cast<uint32_t> (record.offset >> 32u),
+        status
+    };
+    Byte entry[EntrySize];
+    for (std::size_t index = 0; index < 3; ++index) {
+        entry[index * 4]     = static_cast<Byte> (words[index] >> 24u);
+        entry[index * 4 + 1] = static_cast<Byte> (words[index] >> 16u);
+        entry[index * 4 + 2] = static_cast<Byte> (words[index] >> 8u);
+        entry[index * 4 + 3] = static_cast<Byte> (words[index]);
+    }
+
+    std::lock_guard<std::mutex> guard (this->_writeMutex);
+    this->_file->writeAt (XrfFile64::getOffset (mfn), entry, sizeof (entry));
 }
 
 /// \brief Создание XRF-файла. Если файл уже существует, он усекается.
@@ -134,4 +239,151 @@ XrfFile64 XrfFile64::create (const String &fileName)
     return { fileName, DirectAccessMode::Exclusive };
 }
 
+//=========================================================
+
+/// \brief Конструктор: проецирование файла в память.
+/// \param fileName Имя файла.
+/// \throw IrbisException Файл не удалось открыть либо спроецировать.
+XrfView::XrfView (const String &fileName)
+    : _memory { new MemoryFile (fileName) }
+{
+    this->_count = static_cast<std::size_t> (this->_memory->size() / EntrySize);
+}
+
+/// \brief Конструктор перемещения.
+XrfView::XrfView (XrfView &&) noexcept = default;
+
+/// \brief Оператор перемещения.
+XrfView& XrfView::operator = (XrfView &&) noexcept = default;
+
+/// \brief Деструктор.
+XrfView::~XrfView() = default;
+
+/// \brief Число ссылок в файле.
+std::size_t XrfView::count() const noexcept
+{
+    return this->_count;
+}
+
+/// \brief Сколько ссылок просматривать.
+std::size_t XrfView::_limit (Mfn maxMfn) const noexcept
+{
+    return maxMfn == 0 ? this->_count : std::min (this->_count, static_cast<std::size_t> (maxMfn));
+}
+
+/// \brief Подсчёт записей, имеющих хотя бы один из указанных флагов.
+/// \param flags Флаги (например, RecordStatus::Deleted).
+/// \param maxMfn Максимальный MFN (0 -- все ссылки файла).
+/// \return Число записей.
+std::size_t XrfView::countStatus (RecordStatus flags, Mfn maxMfn) const noexcept
+{
+    const auto mask = fileOrder (flags);
+    const auto data = this->_memory->data();
+    const auto limit = this->_limit (maxMfn);
+    std::size_t result = 0;
+    for (std::size_t index = 0; index < limit; ++index) {
+        result += (rawFlags (data, index) & mask) != 0u ? 1u : 0u;
+    }
+
+    return result;
+}
+
+/// \brief Сведения о базе данных, доступные из XRF-файла, за один проход.
+/// \param maxMfn Максимальный MFN (0 -- все ссылки файла).
+/// \return Списки удалённых, неактуализированных и заблокированных записей
+/// и максимальный MFN. Имя базы и признак её блокировки не заполняются.
+DatabaseInfo XrfView::databaseInfo (Mfn maxMfn) const
+{
+    const auto interesting = fileOrder (RecordStatus::Deleted | RecordStatus::NonActualized
+                                        | RecordStatus::Locked);
+    const auto data = this->_memory->data();
+    const auto limit = this->_limit (maxMfn);
+    DatabaseInfo result;
+    result.maxMfn = static_cast<Mfn> (limit);
+    for (std::size_t index = 0; index < limit; ++index) {
+        if ((rawFlags (data, index) & interesting) == 0u) {
+            continue;
+        }
+
+        const auto mfn = static_cast<Mfn> (index + 1);
+        const auto status = readBig32 (data + index * EntrySize + 8);
+        if ((status & static_cast<uint32_t> (RecordStatus::LogicallyDeleted)) != 0u) {
+            result.logicallyDeletedRecords.push_back (mfn);
+        }
+        if ((status & static_cast<uint32_t> (RecordStatus::PhysicallyDeleted)) != 0u) {
+            result.physicallyDeletedRecords.push_back (mfn);
+        }
+        if ((status & static_cast<uint32_t> (RecordStatus::NonActualized)) != 0u) {
+            result.nonActualizedRecords.push_back (mfn);
+        }
+        if ((status & static_cast<uint32_t> (RecordStatus::Locked)) != 0u) {
+            result.lockedRecords.push_back (mfn);
+        }
+    }
+
+    return result;
+}
+
+/// \brief Перечень записей, имеющих хотя бы один из указанных флагов.
+/// \param flags Флаги (например, RecordStatus::Locked).
+/// \param maxMfn Максимальный MFN (0 -- все ссылки файла).
+/// \return MFN записей по возрастанию.
+MfnList XrfView::listStatus (RecordStatus flags, Mfn maxMfn) const
+{
+    const auto mask = fileOrder (flags);
+    const auto data = this->_memory->data();
+    const auto limit = this->_limit (maxMfn);
+    MfnList result;
+    for (std::size_t index = 0; index < limit; ++index) {
+        if ((rawFlags (data, index) & mask) != 0u) {
+            result.push_back (static_cast<Mfn> (index + 1));
+        }
+    }
+
+    return result;
+}
+
+/// \brief Считывание идущих подряд XRF-записей.
+/// \param firstMfn MFN первой записи.
+/// \param count Сколько записей нужно.
+/// \param records Куда поместить записи (не меньше count элементов).
+/// \return Число прочитанных записей (меньше count, если файл кончился).
+std::size_t XrfView::readRange (Mfn firstMfn, std::size_t count, XrfRecord64 *records) const noexcept
+{
+    if (firstMfn == 0 || firstMfn > this->_count) {
+        return 0;
+    }
+
+    count = std::min (count, this->_count - (firstMfn - 1));
+    XrfRecord64::decode (this->_memory->data() + (firstMfn - 1) * EntrySize, count, records);
+    return count;
+}
+
+/// \brief Считывание одной XRF-записи.
+/// \param mfn MFN записи.
+/// \return Прочитанная запись.
+/// \throw IrbisException MFN вне диапазона.
+XrfRecord64 XrfView::readRecord (Mfn mfn) const
+{
+    XrfRecord64 result;
+    if (this->readRange (mfn, 1, &result) != 1) {
+        throw IrbisException();
+    }
+
+    return result;
+}
+
+/// \brief Статус записи.
+/// \param mfn MFN записи.
+/// \return Флаги статуса.
+/// \throw IrbisException MFN вне диапазона.
+RecordStatus XrfView::status (Mfn mfn) const
+{
+    if (mfn == 0 || mfn > this->_count) {
+        throw IrbisException();
+    }
+
+    return static_cast<RecordStatus> (readBig32 (this->_memory->data() + (mfn - 1) * EntrySize + 8));
+}
+
 }
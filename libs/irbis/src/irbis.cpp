@@ -394,6 +394,20 @@ int IRBIS_CALL fastParse32 (const CharSpan text) noexcept
     return result;
 }
 
+/// \brief Быстрый и грязный разбор строки как целого числа без знака.
+/// \param text Текст для разбора (например, строка ответа сервера).
+/// \return Мусор на входе - мусор на выходе!
+int IRBIS_CALL fastParse32 (const ByteSpan text) noexcept
+{
+    auto result = 0;
+    const std::size_t length = text.length;
+    for (std::size_t offset = 0; offset < length; offset++) {
+        result = result * 10 + text[offset] - '0';
+    }
+
+    return result;
+}
+
 /// \brief Быстрый и грязный разбор строки как целого числа без знака.
 /// \param text Текст для разбора.
 /// \return Мусор на входе - мусор на выходе!
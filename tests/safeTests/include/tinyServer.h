@@ -0,0 +1,158 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#ifndef TINYSERVER_H
+#define TINYSERVER_H
+
+#if defined(__linux__)
+
+#define HAVE_TINY_SERVER
+
+#include "irbis.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// Простейший сервер ИРБИС64 на петлевом интерфейсе для тестов:
+// на каждое подключение вычитывает пакет запроса, передаёт строки
+// запроса обработчику и отсылает клиенту заголовок ответа
+// с тем, что вернул обработчик.
+class TinyServer final
+{
+public:
+    // Строки запроса (код команды первой строкой) -> тело ответа
+    // после заголовка (код возврата и далее).
+    using Handler = std::function<std::string (const std::vector<std::string> &lines)>;
+
+    short port { 0 };
+    std::atomic<int> served { 0 };
+
+    explicit TinyServer (Handler handler_ = nullptr)
+        : handler { std::move (handler_) }
+    {
+        this->listener = ::socket (AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        ::bind (this->listener, reinterpret_cast<sockaddr*> (&address), sizeof (address));
+        ::listen (this->listener, 128);
+        socklen_t length = sizeof (address);
+        ::getsockname (this->listener, reinterpret_cast<sockaddr*> (&address), &length);
+        this->port = static_cast<short> (ntohs (address.sin_port));
+        this->thread = std::thread ([this] { this->run(); });
+    }
+
+    TinyServer (const TinyServer &) = delete;
+    TinyServer& operator = (const TinyServer &) = delete;
+
+    // Ответ по умолчанию: успешная регистрация клиента ("A")
+    // либо пустой успешный ответ.
+    static std::string defaultAnswer (const std::string &command)
+    {
+        return command == "A" ? "0\r\n30\r\n" : "0\r\n";
+    }
+
+    // Обработчик, получающий только запросы перечисленных команд;
+    // на прочие отвечает defaultAnswer().
+    static Handler only (std::vector<std::string> commands, Handler handler)
+    {
+        return [commands, handler] (const std::vector<std::string> &lines) -> std::string {
+            if (std::find (commands.begin(), commands.end(), lines[0]) == commands.end()) {
+                return defaultAnswer (lines[0]);
+            }
+            return handler (lines);
+        };
+    }
+
+    // Строка подключения к серверу (для пула подключений).
+    std::wstring connectionString() const
+    {
+        // Эфемерный порт может не уместиться в short со знаком.
+        return L"host=127.0.0.1;port=" + std::to_wstring (static_cast<unsigned short> (this->port))
+               + L";user=librarian;password=secret;db=IBIS;";
+    }
+
+    // Подключение к серверу с регистрацией клиента.
+    bool connect (irbis::ConnectionBase &connection) const
+    {
+        connection.host = L"127.0.0.1";
+        connection.port = this->port;
+        return connection.connect();
+    }
+
+    ~TinyServer()
+    {
+        ::shutdown (this->listener, SHUT_RDWR);
+        this->thread.join();
+        ::close (this->listener);
+    }
+
+private:
+    int listener { -1 };
+    Handler handler;
+    std::thread thread;
+
+    void run()
+    {
+        while (true) {
+            const auto client = ::accept (this->listener, nullptr, nullptr);
+            if (client < 0) {
+                return;
+            }
+
+            std::string packet;
+            char buffer[4096];
+            std::size_t newline = std::string::npos;
+            while (true) {
+                const auto got = ::recv (client, buffer, sizeof (buffer), 0);
+                if (got <= 0) {
+                    break;
+                }
+                packet.append (buffer, static_cast<std::size_t> (got));
+                newline = packet.find ('\n');
+                if (newline != std::string::npos
+                    && packet.size() - newline - 1 >= std::stoul (packet.substr (0, newline))) {
+                    break;
+                }
+            }
+
+            std::vector<std::string> lines;
+            if (newline != std::string::npos) {
+                std::size_t start = newline + 1;
+                while (start <= packet.size()) {
+                    auto end = packet.find ('\n', start);
+                    if (end == std::string::npos) {
+                        end = packet.size();
+                    }
+                    lines.push_back (packet.substr (start, end - start));
+                    start = end + 1;
+                }
+            }
+
+            const auto command = lines.empty() ? std::string() : lines[0];
+            std::string answer = command + "\r\n1\r\n1\r\n0\r\n64.2014\r\n\r\n\r\n\r\n\r\n\r\n";
+            if (this->handler) {
+                answer += this->handler (lines);
+            }
+            else {
+                answer += defaultAnswer (command);
+            }
+            ++this->served;
+            ::send (client, answer.data(), answer.size(), MSG_NOSIGNAL);
+            ::close (client);
+        }
+    }
+};
+
+#endif
+
+#endif
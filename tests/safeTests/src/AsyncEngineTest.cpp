@@ -0,0 +1,132 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include "tinyServer.h"
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("AsyncEngine_submit_1", "[async]")
+{
+    const int count = 20;
+    TinyServer server;
+    irbis::AsyncEngine engine (1, 4);
+    CHECK (engine.threadCount() == 1);
+    CHECK (engine.socketsPerServer() == 4);
+
+    std::vector<std::future<irbis::Bytes>> futures;
+    for (auto i = 0; i < count; ++i) {
+        irbis::Bytes packet { '3', '\n', 'N', '\n', 'C' };
+        futures.push_back (engine.submit (L"127.0.0.1", server.port, std::move (packet)));
+    }
+    CHECK (engine.inFlight() <= 4);
+
+    for (auto &future : futures) {
+        const auto answer = future.get();
+        REQUIRE (answer.size() > 10);
+        CHECK (answer[0] == 'N');
+    }
+    CHECK (server.served == count);
+    CHECK (engine.inFlight() == 0);
+    CHECK (engine.queued() == 0);
+}
+
+TEST_CASE("AsyncEngine_submit_2", "[async]")
+{
+    // Порт гарантированно закрыт: занимаем его и не слушаем.
+    const auto blocker = ::socket (AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    ::bind (blocker, reinterpret_cast<sockaddr*> (&address), sizeof (address));
+    socklen_t length = sizeof (address);
+    ::getsockname (blocker, reinterpret_cast<sockaddr*> (&address), &length);
+    const auto port = static_cast<short> (ntohs (address.sin_port));
+
+    irbis::AsyncEngine engine;
+    auto future = engine.submit (L"127.0.0.1", port, irbis::Bytes { '0', '\n' });
+    CHECK_THROWS_AS (future.get(), irbis::NetworkException);
+    ::close (blocker);
+}
+
+TEST_CASE("AsyncEngine_submit_3", "[async]")
+{
+    // Сервер отвечает через полсекунды, а ждать разрешено 100 мс.
+    TinyServer server ([] (const std::vector<std::string> &) {
+        std::this_thread::sleep_for (std::chrono::milliseconds (500));
+        return std::string ("0\r\n");
+    });
+    irbis::AsyncEngine engine;
+    irbis::AsyncOptions options;
+    options.receiveTimeout = 100;
+    const auto started = std::chrono::steady_clock::now();
+    auto future = engine.submit (L"127.0.0.1", server.port, irbis::Bytes { '3', '\n', 'N', '\n', 'C' }, options);
+    CHECK_THROWS_AS (future.get(), irbis::NetworkException);
+    CHECK (std::chrono::steady_clock::now() - started < std::chrono::milliseconds (450));
+}
+
+TEST_CASE("AsyncEngine_connection_1", "[async]")
+{
+    TinyServer server;
+    irbis::Connection connection;
+    connection.host = L"127.0.0.1";
+    connection.port = server.port;
+    connection.username = L"librarian";
+    connection.password = L"secret";
+    const auto ok = connection.connectAsync().get();
+    INFO (connection.lastError);
+    CHECK (ok);
+    CHECK (connection.connected());
+    CHECK (connection.noOpAsync().get());
+    connection.disconnectAsync().get();
+    CHECK_FALSE (connection.connected());
+}
+
+TEST_CASE("AsyncEngine_connection_2", "[async]")
+{
+    TinyServer server;
+    {
+        irbis::Connection connection;
+        connection.host = L"127.0.0.1";
+        connection.port = server.port;
+        connection.username = L"librarian";
+        connection.password = L"secret";
+
+        // Результат готов без вызова get().
+        auto connecting = connection.connectAsync();
+        REQUIRE (connecting.wait_for (std::chrono::seconds (5)) == std::future_status::ready);
+        CHECK (connection.connected());
+        CHECK (connecting.get());
+
+        // Брошенный результат: подключение уничтожается раньше,
+        // чем движок получит ответ.
+        connection.noOpAsync();
+        connection.noOpAsync();
+    }
+
+    // A, два N и B, отосланная деструктором после ответов на N.
+    CHECK (server.served == 4);
+}
+
+TEST_CASE("AsyncEngine_connection_3", "[async]")
+{
+    TinyServer server;
+    {
+        irbis::Connection connection;
+        connection.host = L"127.0.0.1";
+        connection.port = server.port;
+        connection.username = L"librarian";
+        connection.password = L"secret";
+
+        // Брошенная регистрация всё равно применяется.
+        connection.connectAsync();
+    }
+
+    // A и B, отосланная деструктором.
+    CHECK (server.served == 2);
+}
+
+#endif
@@ -0,0 +1,162 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "tinyServer.h"
+
+#ifdef HAVE_TINY_SERVER
+
+#include <chrono>
+#include <thread>
+
+namespace {
+
+// Сервер, присваивающий записям команды "6" MFN по порядку
+// (либо отвечающий кодом ошибки returnCode).
+TinyServer::Handler writeHandler (std::atomic<int> &batches, std::atomic<int> &nextMfn,
+                                  int returnCode = 0, int delayMs = 0)
+{
+    return TinyServer::only ({ "6" }, [&batches, &nextMfn, returnCode, delayMs]
+                                      (const std::vector<std::string> &lines) -> std::string {
+        ++batches;
+        if (delayMs != 0) {
+            std::this_thread::sleep_for (std::chrono::milliseconds (delayMs));
+        }
+        if (returnCode != 0) {
+            return std::to_string (returnCode) + "\r\n";
+        }
+        std::string result = "0\r\n";
+        for (std::size_t i = 12; i < lines.size(); ++i) {
+            if (!lines[i].empty()) {
+                result += std::to_string (nextMfn++) + "#0\x1F\x1E" "0#1\x1F\x1E" "200#^aTitle\x1F\x1E\r\n";
+            }
+        }
+        return result;
+    });
+}
+
+}
+
+TEST_CASE("BulkWriter_add_1", "[bulk]")
+{
+    std::atomic<int> batches { 0 }, nextMfn { 1 };
+    TinyServer server (writeHandler (batches, nextMfn));
+    irbis::ConnectionPool pool (server.connectionString(), 0, 2);
+
+    irbis::BulkWriterOptions options;
+    options.maxBatchRecords = 3;
+    options.connections = 2;
+    irbis::BulkWriter writer (pool, options);
+
+    std::vector<irbis::MarcRecord> records (10);
+    for (auto &record : records) {
+        record.add (200, L"").add (L'a', L"Title");
+        CHECK (writer.add (&record));
+    }
+    CHECK (writer.flush());
+
+    for (const auto &record : records) {
+        CHECK (record.mfn != 0);
+        CHECK (record.version == 1);
+        CHECK (record.database == L"IBIS");
+    }
+    const auto stats = writer.statistics();
+    CHECK (stats.accepted == 10);
+    CHECK (stats.written == 10);
+    CHECK (stats.failed == 0);
+    CHECK (stats.batches >= 4);
+    CHECK (stats.batches == static_cast<uint64_t> (batches.load()));
+    CHECK (stats.bytesSent > 0);
+}
+
+TEST_CASE("BulkWriter_add_2", "[bulk]")
+{
+    std::atomic<int> batches { 0 }, nextMfn { 1 };
+    TinyServer server (writeHandler (batches, nextMfn, 0, 20));
+    irbis::ConnectionPool pool (server.connectionString(), 0, 1);
+
+    irbis::BulkWriterOptions options;
+    options.maxBatchRecords = 2;
+    options.maxPending = 2;
+    options.connections = 1;
+    std::atomic<int> done { 0 };
+    {
+        irbis::BulkWriter writer (pool, options);
+        writer.setCallback ([&done] (irbis::MarcRecord &record, int errorCode) {
+            if (errorCode == 0 && record.mfn != 0) {
+                ++done;
+            }
+        });
+        for (auto i = 0; i < 6; ++i) {
+            irbis::MarcRecord record;
+            record.add (200, L"").add (L'a', L"Title");
+            CHECK (writer.add (std::move (record)));
+        }
+
+        // Сервер не успевает: add() ждал освобождения места.
+        CHECK (writer.statistics().throttled > 0);
+        writer.close();
+        CHECK_FALSE (writer.add (irbis::MarcRecord()));
+    }
+    CHECK (done == 6);
+}
+
+TEST_CASE("BulkWriter_flush_1", "[bulk]")
+{
+    std::atomic<int> batches { 0 }, nextMfn { 1 };
+    TinyServer server (writeHandler (batches, nextMfn, -608));
+    irbis::ConnectionPool pool (server.connectionString(), 0, 2);
+
+    irbis::BulkWriter writer (pool);
+    std::atomic<int> errors { 0 };
+    writer.setCallback ([&errors] (irbis::MarcRecord &, int errorCode) {
+        if (errorCode == -608) {
+            ++errors;
+        }
+    });
+    irbis::MarcRecord record;
+    CHECK (writer.add (&record));
+    CHECK_FALSE (writer.flush());
+    CHECK (errors == 1);
+
+    // Ошибка, сообщённая сервером, не повторяется.
+    const auto stats = writer.statistics();
+    CHECK (stats.failed == 1);
+    CHECK (stats.retries == 0);
+    CHECK (batches == 1);
+
+    // Сбой учитывается до следующего flush().
+    CHECK (writer.flush());
+}
+
+TEST_CASE("BulkWriter_flush_2", "[bulk]")
+{
+    // Ответ не пришёл в срок: пакет мог быть записан, повтора нет.
+    std::atomic<int> batches { 0 }, nextMfn { 1 };
+    TinyServer server (writeHandler (batches, nextMfn, 0, 300));
+    irbis::ConnectionPool pool (server.connectionString(), 0, 2);
+    irbis::RetryPolicy policy;
+    policy.deadline = std::chrono::milliseconds (100);
+    pool.setRetryPolicy (policy);
+
+    irbis::BulkWriter writer (pool);
+    std::atomic<int> errors { 0 };
+    writer.setCallback ([&errors] (irbis::MarcRecord &, int errorCode) {
+        if (errorCode == -100002) {
+            ++errors;
+        }
+    });
+    irbis::MarcRecord record;
+    CHECK (writer.add (&record));
+    CHECK_FALSE (writer.flush());
+    CHECK (errors == 1);
+    writer.close();
+
+    const auto stats = writer.statistics();
+    CHECK (stats.failed == 1);
+    CHECK (stats.retries == 0);
+    CHECK (batches == 1);
+}
+
+#endif
@@ -0,0 +1,63 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <climits>
+
+namespace {
+
+std::string toString (irbis::ByteSpan span)
+{
+    return std::string (reinterpret_cast<const char*> (span.cdata()), span.size());
+}
+
+}
+
+TEST_CASE("ClientQuery_constructor_1", "[query]")
+{
+    irbis::ConnectionBase connection;
+    connection.username = L"librarian";
+    connection.password = L"secret";
+    connection.clientId = 123456;
+    connection.queryId = 7;
+    irbis::ClientQuery query (connection, "K");
+    CHECK (toString (query.body()) == "K\nC\nK\n123456\n7\nsecret\nlibrarian\n\n\n\n");
+}
+
+TEST_CASE("ClientQuery_add_1", "[query]")
+{
+    irbis::ConnectionBase connection;
+    irbis::ClientQuery query (connection, "K");
+    const auto start = query.body().size();
+    query.add (0).newLine().add (-123).newLine().add (INT_MAX).newLine().add (INT_MIN);
+    const auto text = toString (query.body());
+    CHECK (text.substr (start) == "0\n-123\n2147483647\n-2147483648");
+}
+
+TEST_CASE("ClientQuery_addUtf_1", "[query]")
+{
+    irbis::ConnectionBase connection;
+    irbis::ClientQuery query (connection, "K");
+    const auto start = query.body().size();
+    query.addUtf (L"Привет").newLine()
+         .addAnsi (L"Привет");
+    const auto text = toString (query.body()).substr (start);
+    CHECK (text == "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82\n\xCF\xF0\xE8\xE2\xE5\xF2");
+}
+
+TEST_CASE("ClientQuery_encode_1", "[query]")
+{
+    irbis::ConnectionBase connection;
+    irbis::ClientQuery query (connection, "N");
+    const auto body = toString (query.body());
+    irbis::Byte header[irbis::ClientQuery::HeaderCapacity];
+    const auto headerSize = query.header (header);
+    const std::string prefix (reinterpret_cast<const char*> (header), headerSize);
+    CHECK (prefix == std::to_string (body.size()) + "\n");
+
+    const auto encoded = query.encode();
+    CHECK (std::string (encoded.begin(), encoded.end()) == prefix + body);
+}
@@ -0,0 +1,161 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+std::atomic<int> fakeReturnCode { 0 };
+
+// Сокет, отвечающий на любую команду успехом (либо fakeReturnCode).
+class FakeSocket final : public irbis::ClientSocket
+{
+public:
+    std::string answer;
+    std::size_t position { 0 };
+
+    void open() override
+    {
+        this->answer = "A\r\n123456\r\n1\r\n0\r\n64.2014\r\n\r\n\r\n\r\n\r\n\r\n"
+                + std::to_string (fakeReturnCode.load()) + "\r\n30\r\n";
+        this->position = 0;
+    }
+
+    void send (const irbis::Byte*, std::size_t) override {}
+
+    std::size_t receive (irbis::Byte *buffer, std::size_t size) override
+    {
+        const auto portion = std::min (size, this->answer.size() - this->position);
+        std::memcpy (buffer, this->answer.data() + this->position, portion);
+        this->position += portion;
+        return portion;
+    }
+};
+
+class FakeFactory final : public irbis::ConnectionFactory
+{
+public:
+    irbis::Connection* GetConnection() override
+    {
+        auto result = new irbis::Connection;
+        result->socket.reset (new FakeSocket);
+        return result;
+    }
+};
+
+}
+
+TEST_CASE("ConnectionPool_isDeadSession_1", "[pool]")
+{
+    CHECK (irbis::ConnectionPool::isDeadSession (-3333));
+    CHECK (irbis::ConnectionPool::isDeadSession (-100002));
+    CHECK_FALSE (irbis::ConnectionPool::isDeadSession (0));
+    CHECK_FALSE (irbis::ConnectionPool::isDeadSession (-600));
+}
+
+TEST_CASE("ConnectionPool_constructor_1", "[pool]")
+{
+    CHECK_THROWS_AS (irbis::ConnectionPool (L"host=127.0.0.1", 2, 1), irbis::IrbisException);
+    CHECK_THROWS_AS (irbis::ConnectionPool (L"nonsense", 0, 1), irbis::IrbisException);
+}
+
+TEST_CASE("ConnectionPool_acquire_1", "[pool]")
+{
+    fakeReturnCode = 0;
+    FakeFactory factory;
+    irbis::ConnectionPool pool (L"host=127.0.0.1;user=librarian;password=secret;db=IBIS", 0, 2, &factory);
+    {
+        auto lease = pool.acquire();
+        REQUIRE (lease);
+        CHECK (lease->connected());
+        CHECK (lease->interval == 30);
+        lease->database = L"RDR";
+    }
+    {
+        auto lease = pool.acquire();
+        REQUIRE (lease);
+        CHECK (lease->database == L"IBIS");
+    }
+
+    const auto stats = pool.statistics();
+    CHECK (stats.handshakes == 1);
+    CHECK (stats.leases == 2);
+    CHECK (stats.totalConnections == 1);
+    CHECK (stats.idleConnections == 1);
+    CHECK (stats.leasedConnections == 0);
+}
+
+TEST_CASE("ConnectionPool_acquire_2", "[pool]")
+{
+    fakeReturnCode = 0;
+    FakeFactory factory;
+    irbis::ConnectionPool pool (L"host=127.0.0.1;user=librarian;password=secret", 0, 1, &factory);
+    auto first = pool.acquire();
+    REQUIRE (first);
+    CHECK (!pool.tryAcquire());
+
+    auto second = pool.acquire (std::chrono::milliseconds (20));
+    CHECK (!second);
+    CHECK (pool.statistics().timeouts == 1);
+
+    first.release();
+    CHECK (!first);
+    second = pool.acquire (std::chrono::milliseconds (20));
+    CHECK (second);
+}
+
+TEST_CASE("ConnectionPool_evict_1", "[pool]")
+{
+    fakeReturnCode = 0;
+    FakeFactory factory;
+    irbis::ConnectionPool pool (L"host=127.0.0.1;user=librarian;password=secret", 0, 2, &factory);
+    {
+        auto lease = pool.acquire();
+        REQUIRE (lease);
+        fakeReturnCode = -3333;
+        CHECK_FALSE (lease->noOp());
+        CHECK (lease->lastError == -3333);
+        fakeReturnCode = 0;
+    }
+
+    const auto stats = pool.statistics();
+    CHECK (stats.evictions == 1);
+    CHECK (stats.totalConnections == 0);
+}
+
+TEST_CASE("ConnectionPool_warmUp_1", "[pool]")
+{
+    fakeReturnCode = 0;
+    FakeFactory factory;
+    irbis::ConnectionPool pool (L"host=127.0.0.1;user=librarian;password=secret", 2, 4, &factory);
+    pool.warmUp();
+    CHECK (pool.statistics().totalConnections == 2);
+    pool.shutdown();
+    CHECK (pool.statistics().totalConnections == 0);
+    CHECK (!pool.acquire());
+}
+
+TEST_CASE("ConnectionPool_setCache_1", "[pool]")
+{
+    fakeReturnCode = 0;
+    FakeFactory factory;
+    irbis::ConnectionPool pool (L"host=127.0.0.1;user=librarian;password=secret", 1, 2, &factory);
+    pool.warmUp();
+    CHECK (!pool.cache());
+
+    auto cache = std::make_shared<irbis::RecordCache>();
+    pool.setCache (cache, irbis::CachePolicy::Revalidate);
+    CHECK (pool.cache() == cache);
+    auto first = pool.acquire();
+    auto second = pool.acquire();
+    REQUIRE (first);
+    REQUIRE (second);
+    CHECK (first->cache == cache);
+    CHECK (second->cache == cache);
+    CHECK (second->cachePolicy == irbis::CachePolicy::Revalidate);
+}
@@ -5,6 +5,7 @@
 #include "irbis.h"
 #include "irbis_internal.h"
 #include "safeTests.h"
+#include "tinyServer.h"
 
 TEST_CASE("ConnectionBase_constructor_1", "[connection]")
 {
@@ -12,3 +13,311 @@ TEST_CASE("ConnectionBase_constructor_1", "[connection]")
     CHECK (connection.lastError == 0);
     CHECK_FALSE (connection.connected());
 }
+
+TEST_CASE("ServerResponse_readLineSpan_1", "[connection]")
+{
+    const std::string text = "K\r\n1\r\n2\r\n39\r\n64.2014\r\n\r\n\r\n\r\n\r\n\r\n"
+        "0\r\n2\r\n15#First\r\n16\r\n";
+    CHECK (irbis::ServerResponse::expectedSize (reinterpret_cast<const irbis::Byte*> (text.data()), text.size())
+        == text.size());
+
+    irbis::ConnectionBase connection;
+    irbis::ServerResponse response (connection, irbis::Bytes (text.begin(), text.end()));
+    CHECK (response.command == L"K");
+    CHECK (response.clientId == 1);
+    CHECK (response.queryId == 2);
+    CHECK (response.getReturnCode() == 0);
+    CHECK (response.readInteger() == 2);
+    const auto lines = response.readRemainingSpans();
+    REQUIRE (lines.size() == 2);
+    CHECK (irbis::fastParse32 (lines[0].slice (0, lines[0].indexOf ('#'))) == 15);
+    CHECK (irbis::fastParse32 (lines[1]) == 16);
+    CHECK (response.eot());
+    CHECK (response.readLineSpan().empty());
+}
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("ConnectionFull_readRecords_1", "[connection]")
+{
+    TinyServer server (TinyServer::only ({ "G" }, [] (const std::vector<std::string> &lines) -> std::string {
+        std::string result = "0\r\n";
+        const auto count = std::stoi (lines[12]);
+        for (auto i = 0; i < count; ++i) {
+            const auto mfn = lines[13 + i];
+            if (mfn == "13") {
+                continue; // такой записи нет
+            }
+            result += mfn + "#0\x1F" + mfn + "#0\x1F" "0#1\x1F" "200#^aTitle " + mfn + "\r\n";
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.batchSize = 7;
+    connection.parallelism = 3;
+    REQUIRE (server.connect (connection));
+
+    irbis::MfnList mfnList;
+    for (irbis::Mfn mfn = 50; mfn > 0; --mfn) {
+        mfnList.push_back (mfn);
+    }
+    std::vector<int> errors;
+    const auto records = connection.readRecords (mfnList, errors);
+    REQUIRE (records.size() == mfnList.size());
+    for (std::size_t i = 0; i < mfnList.size(); ++i) {
+        if (mfnList[i] == 13) {
+            CHECK (errors[i] == -140);
+        }
+        else {
+            CHECK (errors[i] == 0);
+            CHECK (records[i].mfn == mfnList[i]);
+            CHECK (records[i].version == 1);
+            CHECK (records[i].fm (200, L'a') == L"Title " + std::to_wstring (mfnList[i]));
+        }
+    }
+
+    CHECK (connection.readRecords (mfnList).size() == mfnList.size() - 1);
+}
+
+TEST_CASE("ConnectionSearch_searchMany_1", "[connection]")
+{
+    // IBIS находит 33000 записей (две порции), RDR -- три, BAD сообщает об ошибке.
+    TinyServer server (TinyServer::only ({ "K" }, [] (const std::vector<std::string> &lines) -> std::string {
+        const auto &database = lines[10];
+        if (database == "BAD") {
+            return "-140\r\n";
+        }
+        const auto found = database == "IBIS" ? 33000 : 3;
+        const auto first = std::stoi (lines[13]);
+        const auto withText = !lines[14].empty();
+        const auto count = std::min (found - first + 1, 32000);
+        std::string result = "0\r\n" + std::to_string (found) + "\r\n";
+        for (auto mfn = first; mfn < first + count; ++mfn) {
+            result += std::to_string (mfn);
+            if (withText) {
+                result += "#Title " + std::to_string (mfn);
+            }
+            result += "\r\n";
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    REQUIRE (server.connect (connection));
+
+    irbis::SearchParameters parameters;
+    parameters.searchExpression = L"T=TITLE$";
+    parameters.formatSpecification = L"@brief";
+    irbis::StringList arrived;
+    const auto result = connection.searchMany (parameters, { L"IBIS", L"RDR", L"BAD" },
+        [&arrived] (const irbis::DatabaseFound &found) { arrived.push_back (found.database); });
+
+    CHECK (arrived.size() == 3);
+    REQUIRE (result.databases.size() == 3);
+    CHECK (result.databases[0].database == L"IBIS");
+    CHECK (result.databases[0].total == 33000);
+    CHECK (result.databases[0].lines.size() == 33000);
+    CHECK (result.databases[0].requests == 2);
+    CHECK (result.databases[0].elapsedMs >= result.databases[0].firstAnswerMs);
+    CHECK (result.databases[1].lines.size() == 3);
+    CHECK (result.databases[1].lines[2].description == L"Title 3");
+    CHECK_FALSE (result.databases[2].success());
+    CHECK (result.databases[2].errorCode == -140);
+    CHECK_FALSE (result.success());
+    CHECK (connection.lastError == -140);
+    CHECK (result.total() == 33003);
+    REQUIRE (result.find (L"rdr") != nullptr);
+    CHECK (result.find (L"rdr")->total == 3);
+    CHECK (result.find (L"NONE") == nullptr);
+    CHECK (result.slowest() != nullptr);
+
+    const auto merged = result.merged();
+    REQUIRE (merged.size() == 33003);
+    CHECK (merged[33000].database == L"RDR");
+    CHECK (merged[33000].mfn == 1);
+
+    // Записи RDR совпадают по тексту с первыми записями IBIS.
+    CHECK (result.distinct().size() == 33000);
+    const auto byMfn = result.distinct ([] (const irbis::MultiSearchResult::Line &line) {
+        return line.database + L"#" + std::to_wstring (line.mfn);
+    });
+    CHECK (byMfn.size() == 33003);
+
+    // Ограничение числа записей действует для каждой базы.
+    parameters.numberOfRecords = 5;
+    const auto limited = connection.searchMany (parameters, { L"IBIS", L"RDR" });
+    CHECK (limited.success());
+    CHECK (limited.databases[0].lines.size() == 5);
+    CHECK (limited.databases[1].lines.size() == 3);
+}
+
+TEST_CASE("ConnectionFull_readRecord_cache_1", "[connection]")
+{
+    std::atomic<int> reads { 0 };
+    std::atomic<int> version { 1 };
+    TinyServer server (TinyServer::only ({ "C", "D" }, [&reads, &version] (const std::vector<std::string> &lines) -> std::string {
+        const auto v = std::to_string (version.load());
+        if (lines[0] == "C") {
+            ++reads;
+            return "0\r\n" + lines[11] + "#0\r\n0#" + v + "\r\n200#^aVersion " + v + "\r\n";
+        }
+        ++version;
+        return "0\r\n1#0\r\n0#" + std::to_string (version.load()) + "\x1E" "200#^aWritten\x1E\r\n";
+    }));
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    connection.cache = std::make_shared<irbis::RecordCache>();
+    REQUIRE (server.connect (connection));
+
+    auto record = connection.readRecord (1);
+    CHECK (record.version == 1);
+    record = connection.readRecord (1);
+    CHECK (record.fm (200, L'a') == L"Version 1");
+    CHECK (reads == 1);
+
+    // Запись изменена другим клиентом: доверие кэшу отдаёт старую версию,
+    // сверка версий -- новую.
+    version = 2;
+    CHECK (connection.readRecord (1).version == 1);
+    CHECK (connection.readRecord (L"IBIS", 1, irbis::CachePolicy::Revalidate).version == 2);
+    CHECK (connection.readRecord (L"IBIS", 1, irbis::CachePolicy::Revalidate).version == 2);
+    CHECK (reads == 3);
+
+    // Сохранение обновляет кэш.
+    connection.writeRecord (record);
+    CHECK (record.version == 3);
+    CHECK (connection.readRecord (1).fm (200, L'a') == L"Written");
+    CHECK (reads == 3);
+
+    connection.actualizeRecord (L"IBIS", 1);
+    CHECK (connection.readRecord (1).version == 3);
+    CHECK (reads == 4);
+
+    const auto stats = connection.cache->statistics();
+    CHECK (stats.hits == 4);
+    CHECK (stats.stale == 1);
+    CHECK (stats.invalidations == 1);
+}
+
+TEST_CASE("Connection_formatRecords_1", "[connection]")
+{
+    std::atomic<int> batches { 0 };
+    TinyServer server (TinyServer::only ({ "G" }, [&batches] (const std::vector<std::string> &lines) -> std::string {
+        if (lines[11].find ('\t') != std::string::npos) {
+            return "0\r\n";
+        }
+        ++batches;
+        std::string result = "0\r\n";
+        const auto count = std::stoi (lines[12]);
+        for (auto i = 0; i < count; ++i) {
+            const auto mfn = lines[13 + i];
+            if (mfn != "13") {
+                result += mfn + "#Title " + mfn + "\x1F" "Line 2\r\n";
+            }
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.batchSize = 7;
+    connection.parallelism = 3;
+    REQUIRE (server.connect (connection));
+
+    irbis::MfnList mfnList;
+    for (irbis::Mfn mfn = 30; mfn > 0; --mfn) {
+        mfnList.push_back (mfn);
+    }
+    const auto wide = connection.formatRecords (L"v200\t", mfnList);
+    const auto lite = connection.formatRecordsLite ("v200\t", mfnList);
+    REQUIRE (wide.size() == mfnList.size());
+    REQUIRE (lite.size() == mfnList.size());
+    for (std::size_t i = 0; i < mfnList.size(); ++i) {
+        if (mfnList[i] == 13) {
+            CHECK (wide[i].empty());
+            CHECK (lite[i].empty());
+        }
+        else {
+            CHECK (wide[i] == L"Title " + std::to_wstring (mfnList[i]) + L"\nLine 2");
+            CHECK (lite[i] == "Title " + std::to_string (mfnList[i]) + "\nLine 2");
+        }
+    }
+    CHECK (batches == 10);
+}
+
+TEST_CASE("Connection_formatRecords_2", "[connection]")
+{
+    // Пакет закрывается по размеру списка MFN раньше, чем по batchSize.
+    std::atomic<int> batches { 0 }, largest { 0 };
+    TinyServer server (TinyServer::only ({ "G" }, [&batches, &largest] (const std::vector<std::string> &lines) -> std::string {
+        ++batches;
+        const auto count = std::stoi (lines[12]);
+        if (count > largest) {
+            largest = count;
+        }
+        std::string result = "0\r\n";
+        for (auto i = 0; i < count; ++i) {
+            result += lines[13 + i] + "#Title\r\n";
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.batchSize = 100;
+    connection.maxPacketSize = 60; // 10 MFN по 6 байт ("10000\n")
+    REQUIRE (server.connect (connection));
+
+    irbis::MfnList mfnList;
+    for (irbis::Mfn mfn = 10000; mfn < 10035; ++mfn) {
+        mfnList.push_back (mfn);
+    }
+    const auto result = connection.formatRecords (L"v200", mfnList);
+    REQUIRE (result.size() == mfnList.size());
+    CHECK (result.back() == L"Title");
+    CHECK (batches == 4);
+    CHECK (largest == 10);
+
+    // Без ограничения -- один пакет.
+    batches = 0;
+    connection.maxPacketSize = 0;
+    connection.formatRecordsLite ("v200", mfnList);
+    CHECK (batches == 1);
+}
+
+TEST_CASE("Connection_writeRecords_1", "[connection]")
+{
+    std::atomic<int> batches { 0 };
+    std::atomic<int> nextMfn { 1 };
+    TinyServer server (TinyServer::only ({ "6" }, [&batches, &nextMfn] (const std::vector<std::string> &lines) -> std::string {
+        ++batches;
+        std::string result = "0\r\n";
+        for (std::size_t i = 12; i < lines.size(); ++i) {
+            if (!lines[i].empty()) {
+                result += std::to_string (nextMfn++) + "#0\x1F\x1E" "0#1\x1F\x1E" "200#^aTitle\x1F\x1E\r\n";
+            }
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    connection.batchSize = 2;
+    REQUIRE (server.connect (connection));
+
+    std::vector<irbis::MarcRecord> records (5);
+    for (auto &record : records) {
+        record.add (200, L"").add (L'a', L"Title");
+    }
+    CHECK (connection.writeRecords (records, false, true, false));
+    CHECK (batches == 3);
+    for (const auto &record : records) {
+        CHECK (record.mfn != 0);
+        CHECK (record.version == 1);
+        CHECK (record.database == L"IBIS");
+        CHECK (record.fields.size() == 1);
+    }
+}
+
+#endif
@@ -7,6 +7,11 @@
 #include "irbis_internal.h"
 #include "safeTests.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 TEST_CASE("DirectAccess_readRecord_1", "[directAccess]")
 {
     auto systemPath = whereIrbis64();
@@ -18,3 +23,256 @@ TEST_CASE("DirectAccess_readRecord_1", "[directAccess]")
     REQUIRE (access.mst != nullptr);
     REQUIRE (access.xrf != nullptr);
 }
+
+TEST_CASE("DirectAccess_readRecord_2", "[directAccess]")
+{
+    auto directory = irbis::IO::combinePath (whereDatai(), L"COUNT");
+    irbis::IO::convertSlashes (directory);
+    irbis::DirectAccess64 access
+        (
+            irbis::IO::combinePath (directory, L"count.mst"),
+            irbis::IO::combinePath (directory, L"count.xrf"),
+            irbis::DirectAccessMode::ReadOnly
+        );
+    CHECK (access.database == L"count");
+    CHECK (access.getMaxMfn() == 3);
+
+    const auto raw = access.readMstRecord (1);
+    CHECK (raw.leader.mfn == 1);
+    CHECK (raw.leader.nvf == raw.fieldCount());
+    CHECK_FALSE (raw.deleted());
+
+    const auto record = access.readRecord (1);
+    CHECK (record.mfn == 1);
+    CHECK (record.version == 60);
+    CHECK (record.database == L"count");
+    CHECK (record.fm (1) == L"01");
+
+    CHECK_THROWS_AS (access.readRecord (4), irbis::IrbisException);
+
+    const auto info = access.getDatabaseInfo();
+    CHECK (info.name == L"count");
+    CHECK (info.maxMfn == 3);
+    CHECK (info.logicallyDeletedRecords.empty());
+}
+
+TEST_CASE("DirectAccess_readRecord_3", "[directAccess]")
+{
+    auto directory = irbis::IO::combinePath (whereDatai(), L"COUNT");
+    irbis::IO::convertSlashes (directory);
+    const auto mstPath = irbis::IO::combinePath (directory, L"count.mst");
+    const auto xrfPath = irbis::IO::combinePath (directory, L"count.xrf");
+    irbis::DirectAccess64 plain (mstPath, xrfPath, irbis::DirectAccessMode::ReadOnly);
+    irbis::MstRecord64 raw;
+    {
+        irbis::DirectAccess64 mapped (mstPath, xrfPath, irbis::DirectAccessMode::ReadOnly, true);
+        CHECK (mapped.mst->memoryMapped());
+        CHECK_FALSE (plain.mst->memoryMapped());
+        CHECK (mapped.getMaxMfn() == plain.getMaxMfn());
+        CHECK (mapped.mst->control.nextPosition == plain.mst->control.nextPosition);
+
+        for (irbis::Mfn mfn = 1; mfn <= plain.getMaxMfn(); ++mfn) {
+            const auto first = plain.readMstRecord (mfn);
+            const auto second = mapped.readMstRecord (mfn);
+            CHECK (first.offset == second.offset);
+            CHECK (first.leader.version == second.leader.version);
+            REQUIRE (first.fieldCount() == second.fieldCount());
+            for (std::size_t i = 0; i < first.fieldCount(); ++i) {
+                CHECK (first.entry (i).tag == second.entry (i).tag);
+                CHECK (first.fieldData (i) == second.fieldData (i));
+            }
+            CHECK (mapped.readRecord (mfn).encode (L"\n") == plain.readRecord (mfn).encode (L"\n"));
+        }
+
+        raw = mapped.readMstRecord (1);
+    }
+
+    // Запись удерживает проекцию и после закрытия базы.
+    const auto lite = raw.toLiteRecord();
+    const auto marc = raw.toMarcRecord();
+    CHECK (lite.mfn == 1);
+    CHECK (lite.version == marc.version);
+    REQUIRE (lite.fields.size() == marc.fields.size());
+    CHECK (lite.fm (1) == "01");
+
+    const auto phantom = raw.toPhantomRecord();
+    CHECK (phantom.mfn == 1);
+    REQUIRE (phantom.fields.size() == marc.fields.size());
+    CHECK (phantom.materialize().encode (L"\n") == marc.encode (L"\n"));
+}
+
+TEST_CASE("DirectAccess_readRecord_4", "[directAccess]")
+{
+    auto directory = irbis::IO::combinePath (whereDatai(), L"COUNT");
+    irbis::IO::convertSlashes (directory);
+    irbis::DirectAccess64 access
+        (
+            irbis::IO::combinePath (directory, L"count.mst"),
+            irbis::IO::combinePath (directory, L"count.xrf"),
+            irbis::DirectAccessMode::ReadOnly
+        );
+    const auto maxMfn = access.getMaxMfn();
+    REQUIRE (maxMfn == 3);
+
+    std::vector<std::wstring> expected (maxMfn + 1);
+    for (irbis::Mfn mfn = 1; mfn <= maxMfn; ++mfn) {
+        expected[mfn] = access.readRecord (mfn).encode (L"\n");
+    }
+
+    // Один объект, много потоков: чтение позиционное, без общей позиции файла.
+    std::atomic<int> mismatches { 0 };
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 8; ++thread) {
+        threads.emplace_back ([&access, &expected, &mismatches, maxMfn, thread] {
+            for (int pass = 0; pass < 300; ++pass) {
+                const auto mfn = static_cast<irbis::Mfn> ((pass + thread) % maxMfn + 1);
+                if (access.readRecord (mfn).encode (L"\n") != expected[mfn]) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto &one : threads) {
+        one.join();
+    }
+    CHECK (mismatches == 0);
+}
+
+TEST_CASE("DirectAccess_scan_1", "[directAccess]")
+{
+    auto directory = irbis::IO::combinePath (whereDatai(), L"COUNT");
+    irbis::IO::convertSlashes (directory);
+    irbis::DirectAccess64 access
+        (
+            irbis::IO::combinePath (directory, L"count.mst"),
+            irbis::IO::combinePath (directory, L"count.xrf"),
+            irbis::DirectAccessMode::ReadOnly
+        );
+
+    // По одному MFN на порцию, чтобы работали все потоки.
+    irbis::ScanOptions options;
+    options.threads = 3;
+    options.partition = 1;
+    std::atomic<int> reports { 0 }, overruns { 0 };
+    options.progress = [&reports, &overruns] (const irbis::ScanProgress &progress) {
+        if (progress.processed > progress.total) {
+            ++overruns;
+        }
+        ++reports;
+        return true;
+    };
+    std::mutex mutex;
+    irbis::MfnList seen;
+    const auto result = access.scan ([&mutex, &seen] (const irbis::MstRecord64 &record) {
+        std::lock_guard<std::mutex> guard (mutex);
+        seen.push_back (record.leader.mfn);
+        return true;
+    }, options);
+    std::sort (seen.begin(), seen.end());
+    CHECK (seen == (irbis::MfnList { 1, 2, 3 }));
+    CHECK (result.total == 3);
+    CHECK (result.processed == 3);
+    CHECK (result.delivered == 3);
+    CHECK (result.skipped == 0);
+    CHECK (result.errors == 0);
+    CHECK (result.bytes > 0);
+    CHECK_FALSE (result.cancelled);
+    CHECK (reports == 3);
+    CHECK (overruns == 0);
+
+    // Обработчик прерывает просмотр.
+    options.threads = 1;
+    options.progress = nullptr;
+    int calls = 0;
+    const auto stopped = access.scan ([&calls] (const irbis::MstRecord64 &) {
+        return ++calls < 2;
+    }, options);
+    CHECK (calls == 2);
+    CHECK (stopped.cancelled);
+    CHECK (stopped.delivered == 2);
+
+    options.firstMfn = 3;
+    options.lastMfn = 10;
+    CHECK (access.scan ([] (const irbis::MstRecord64 &record) { return record.toLiteRecord().mfn == 3; },
+                        options).delivered == 1);
+}
+
+TEST_CASE("DirectAccess_scan_2", "[directAccess]")
+{
+    // Копия базы, в которой запись 2 помечена удалённой в XRF.
+    auto source = irbis::IO::combinePath (whereDatai(), L"COUNT");
+    irbis::IO::convertSlashes (source);
+    auto target = whereTemp();
+    irbis::IO::convertSlashes (target);
+    const auto mstPath = irbis::IO::combinePath (target, L"scan.mst");
+    const auto xrfPath = irbis::IO::combinePath (target, L"scan.xrf");
+    for (const auto &pair : { std::make_pair (L"count.mst", mstPath), std::make_pair (L"count.xrf", xrfPath) }) {
+        const auto content = irbis::File::readAll (irbis::IO::combinePath (source, pair.first));
+        auto file = irbis::File::create (pair.second);
+        file.write (reinterpret_cast<const irbis::Byte*> (content.data()), static_cast<int64_t> (content.size()));
+    }
+
+    {
+        irbis::DirectAccess64 access (mstPath, xrfPath, irbis::DirectAccessMode::Exclusive);
+        auto entry = access.xrf->readRecord (2);
+        entry.status = irbis::RecordStatus::LogicallyDeleted;
+        access.xrf->writeRecord (2, entry);
+
+        irbis::MfnList seen;
+        irbis::ScanOptions options;
+        options.threads = 1;
+        auto result = access.scan ([&seen] (const irbis::MstRecord64 &record) {
+            seen.push_back (record.leader.mfn);
+            return true;
+        }, options);
+
+        // Записи выдаются в порядке размещения в MST-файле.
+        std::sort (seen.begin(), seen.end());
+        CHECK (seen == (irbis::MfnList { 1, 3 }));
+        CHECK (result.delivered == 2);
+        CHECK (result.skipped == 1);
+
+        options.skipDeleted = false;
+        result = access.scan ([] (const irbis::MstRecord64 &) { return true; }, options);
+        CHECK (result.delivered == 3);
+    }
+    irbis::IO::deleteFile (mstPath);
+    irbis::IO::deleteFile (xrfPath);
+}
+
+TEST_CASE("DatabaseScanner_next_1", "[directAccess]")
+{
+    auto directory = irbis::IO::combinePath (whereDatai(), L"COUNT");
+    irbis::IO::convertSlashes (directory);
+    irbis::DirectAccess64 access
+        (
+            irbis::IO::combinePath (directory, L"count.mst"),
+            irbis::IO::combinePath (directory, L"count.xrf"),
+            irbis::DirectAccessMode::ReadOnly
+        );
+
+    irbis::ScanOptions options;
+    options.threads = 2;
+    options.partition = 1;
+    {
+        irbis::DatabaseScanner scanner (access, options, 1);
+        irbis::MfnList seen;
+        irbis::MstRecord64 record;
+        while (scanner.next (record)) {
+            seen.push_back (record.leader.mfn);
+            CHECK (record.toMarcRecord().fm (1) == L"0" + std::to_wstring (record.leader.mfn));
+        }
+        std::sort (seen.begin(), seen.end());
+        CHECK (seen == (irbis::MfnList { 1, 2, 3 }));
+        CHECK (scanner.progress().delivered == 3);
+    }
+
+    {
+        // Прерванный просмотр больше ничего не выдаёт.
+        irbis::DatabaseScanner scanner (access, options, 1);
+        irbis::MstRecord64 record;
+        CHECK (scanner.next (record));
+        scanner.cancel();
+        CHECK_FALSE (scanner.next (record));
+    }
+}
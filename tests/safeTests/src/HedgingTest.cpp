@@ -0,0 +1,185 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+#include "tinyServer.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_CASE("Hedging_delay_1", "[hedging]")
+{
+    irbis::Hedging hedging (0.9, std::chrono::milliseconds (2), std::chrono::milliseconds (50), 100);
+
+    // Пока замеров мало, дубликат отсылается не раньше maxDelay.
+    CHECK (hedging.delay() == std::chrono::milliseconds (50));
+
+    for (uint64_t i = 1; i <= 100; ++i) {
+        hedging.record (i * 100, false, false);
+    }
+    CHECK (hedging.delay() == std::chrono::microseconds (9000));
+
+    // Окно скользит: старые замеры вытесняются.
+    for (uint64_t i = 0; i < 100; ++i) {
+        hedging.record (100, false, false);
+    }
+    CHECK (hedging.delay() == std::chrono::milliseconds (2));
+    for (uint64_t i = 0; i < 100; ++i) {
+        hedging.record (1000000, false, false);
+    }
+    CHECK (hedging.delay() == std::chrono::milliseconds (50));
+}
+
+TEST_CASE("Hedging_statistics_1", "[hedging]")
+{
+    irbis::Hedging hedging;
+    CHECK (hedging.statistics().hedgeRate() == 0.0);
+    CHECK (hedging.statistics().winRate() == 0.0);
+
+    hedging.record (10, false, false);
+    hedging.record (10, true, false);
+    hedging.record (10, true, true);
+    hedging.record (10, false, false);
+    const auto stats = hedging.statistics();
+    CHECK (stats.requests == 4);
+    CHECK (stats.hedged == 2);
+    CHECK (stats.wins == 1);
+    CHECK (stats.hedgeRate() == 0.5);
+    CHECK (stats.winRate() == 0.5);
+}
+
+#ifdef HAVE_TINY_SERVER
+
+namespace {
+
+// Сервер, отвечающий на "C" записью с запрошенным MFN
+// (ответ на первый запрос задерживается на delayMs).
+TinyServer::Handler readHandler (std::atomic<int> &reads, int delayMs)
+{
+    return TinyServer::only ({ "C" }, [&reads, delayMs] (const std::vector<std::string> &lines) -> std::string {
+        if (++reads == 1) {
+            std::this_thread::sleep_for (std::chrono::milliseconds (delayMs));
+        }
+        return "0\r\n" + lines[11] + "#0\r\n0#1\r\n200#^aTitle\r\n";
+    });
+}
+
+}
+
+TEST_CASE("Hedging_readRecord_1", "[hedging]")
+{
+    std::atomic<int> reads { 0 };
+    TinyServer server (readHandler (reads, 200));
+    irbis::ConnectionPool pool (server.connectionString(), 1, 2);
+    pool.warmUp();
+    const auto hedging = std::make_shared<irbis::Hedging> (0.95, std::chrono::milliseconds (1),
+            std::chrono::milliseconds (30));
+    hedging->setPool (&pool);
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    connection.hedging = hedging;
+    REQUIRE (server.connect (connection));
+    const auto sentBefore = connection.socket->statistics.bytesSent;
+
+    // Первый ответ задерживается: запрос дублируется.
+    auto record = connection.readRecord (5);
+    CHECK (record.mfn == 5);
+    CHECK (record.fm (200, L'a') == L"Title");
+    auto stats = hedging->statistics();
+    CHECK (stats.requests == 1);
+    CHECK (stats.hedged == 1);
+
+    // Основной запрос идёт через сокет подключения.
+    CHECK (connection.socket->statistics.bytesSent > sentBefore);
+
+    // Быстрый ответ дубликата не требует (дубликат прошлого запроса
+    // сервер обработал раньше этого).
+    record = connection.readRecord (6);
+    CHECK (record.mfn == 6);
+    stats = hedging->statistics();
+    CHECK (stats.requests == 2);
+    CHECK (stats.hedged == 1);
+    CHECK (reads == 3);
+
+    connection.disconnect();
+}
+
+TEST_CASE("Hedging_readRecord_2", "[hedging]")
+{
+    // Основной сервер медлит, дубликат уходит на другой сервер
+    // (через пул) и отвечает первым: основной запрос не дожидаемся.
+    std::atomic<int> slowReads { 0 }, fastReads { 0 };
+    TinyServer slow (readHandler (slowReads, 600));
+    TinyServer fast (readHandler (fastReads, 0));
+    irbis::ConnectionPool pool (fast.connectionString(), 1, 1);
+    pool.warmUp();
+    const auto hedging = std::make_shared<irbis::Hedging> (0.95, std::chrono::milliseconds (1),
+            std::chrono::milliseconds (30));
+    hedging->setPool (&pool);
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    connection.receiveTimeout = 0;
+    connection.hedging = hedging;
+    REQUIRE (slow.connect (connection));
+
+    const auto started = std::chrono::steady_clock::now();
+    const auto record = connection.readRecord (7);
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    CHECK (record.mfn == 7);
+    CHECK (elapsed < std::chrono::milliseconds (400));
+    const auto stats = hedging->statistics();
+    CHECK (stats.hedged == 1);
+    CHECK (stats.wins == 1);
+    CHECK (fastReads == 1);
+
+    // Подключение дубликата вернулось в пул.
+    CHECK (pool.tryAcquire());
+
+    // Без пула дубликатов нет.
+    hedging->setPool (nullptr);
+    CHECK (connection.readRecord (8).mfn == 8);
+    CHECK (hedging->statistics().hedged == 1);
+    CHECK (hedging->statistics().requests == 2);
+}
+
+TEST_CASE("Hedging_readRecord_3", "[hedging]")
+{
+    // Основной запрос отвечает раньше дубликата, пул разрушается,
+    // пока дубликат ещё в пути: опоздавший ответ пул не трогает.
+    std::atomic<int> primaryReads { 0 }, hedgeReads { 0 };
+    TinyServer primary (readHandler (primaryReads, 100));
+    TinyServer late (readHandler (hedgeReads, 400));
+    const auto hedging = std::make_shared<irbis::Hedging> (0.95, std::chrono::milliseconds (1),
+            std::chrono::milliseconds (30));
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    connection.hedging = hedging;
+    REQUIRE (primary.connect (connection));
+
+    {
+        irbis::ConnectionPool pool (late.connectionString(), 1, 1);
+        pool.warmUp();
+        hedging->setPool (&pool);
+        CHECK (connection.readRecord (9).mfn == 9);
+        const auto stats = hedging->statistics();
+        CHECK (stats.hedged == 1);
+        CHECK (stats.wins == 0);
+
+        // Аренда возвращена в вызывающем потоке.
+        CHECK (pool.tryAcquire());
+        hedging->setPool (nullptr);
+    }
+
+    // Дожидаемся опоздавшего ответа дубликата.
+    std::this_thread::sleep_for (std::chrono::milliseconds (500));
+    CHECK (hedgeReads == 1);
+    CHECK (connection.readRecord (10).mfn == 10);
+    connection.disconnect();
+}
+
+#endif
@@ -0,0 +1,150 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_direct.h"
+#include "irbis_internal.h"
+#include "safeTests.h"
+
+#include <atomic>
+#include <thread>
+
+static irbis::String countIfp()
+{
+    auto result = irbis::IO::combinePath (whereDatai(), L"COUNT/count.ifp");
+    irbis::IO::convertSlashes (result);
+    return result;
+}
+
+static irbis::String ibisIfp()
+{
+    auto result = irbis::IO::combinePath (whereDatai(), L"IBIS/ibis.ifp");
+    irbis::IO::convertSlashes (result);
+    return result;
+}
+
+TEST_CASE("InvertedFile64_readTerms_1", "[invertedFile]")
+{
+    irbis::InvertedFile64 file (countIfp());
+    const auto terms = file.readTerms (L"", 100);
+    REQUIRE (terms.size() == 6);
+    CHECK (terms[0].text == L"I=01");
+    CHECK (terms[0].count == 1);
+    CHECK (terms[2].text == L"I=03");
+    CHECK (terms[3].text == L"S=WW***");
+
+    const auto some = file.readTerms (L"I=02", 2);
+    REQUIRE (some.size() == 2);
+    CHECK (some[0].text == L"I=02");
+    CHECK (some[1].text == L"I=03");
+
+    const auto reversed = file.readTerms (L"I=025", 10, true);
+    REQUIRE (reversed.size() == 2);
+    CHECK (reversed[0].text == L"I=02");
+    CHECK (reversed[1].text == L"I=01");
+
+    CHECK (file.readTerms (L"Z", 10).empty());
+    CHECK (file.readTerms (L"Z", 1, true).size() == 1);
+}
+
+TEST_CASE("InvertedFile64_readPostings_1", "[invertedFile]")
+{
+    irbis::InvertedFile64 file (countIfp());
+    const auto postings = file.readPostings (L"I=03");
+    REQUIRE (postings.size() == 1);
+    CHECK (postings[0].mfn == 3);
+    CHECK (postings[0].tag == 1);
+    CHECK (postings[0].occurrence == 1);
+
+    CHECK (file.readPostings (L"I=04").empty());
+}
+
+TEST_CASE("InvertedFile64_readPostings_2", "[invertedFile]")
+{
+    irbis::InvertedFile64 file (ibisIfp());
+    const auto terms = file.readTerms (L"K=", 200);
+    REQUIRE_FALSE (terms.empty());
+
+    // Число ссылок в словаре совпадает с числом прочитанных ссылок,
+    // в том числе для терминов со специальными блоками.
+    for (const auto &term : terms) {
+        const auto postings = file.readPostings (term.text);
+        CHECK (postings.size() == static_cast<std::size_t> (term.count));
+    }
+
+    const auto &term = terms.front();
+    if (term.count > 2) {
+        const auto page = file.readPostings (term.text, 2, 1);
+        REQUIRE (page.size() == 1);
+        CHECK (page[0].mfn == file.readPostings (term.text)[1].mfn);
+    }
+}
+
+TEST_CASE("InvertedFile64_findTerm_1", "[invertedFile]")
+{
+    const irbis::InvertedFile64 file (countIfp());
+    irbis::TermInfo info;
+    REQUIRE (file.findTerm (L"I=02", info));
+    CHECK (info.text == L"I=02");
+    CHECK (info.count == 1);
+    CHECK_FALSE (file.findTerm (L"I=0", info));
+    CHECK_FALSE (file.findTerm (L"I=04", info));
+
+    const auto prefixed = file.listTerms (L"I=");
+    REQUIRE (prefixed.size() == 3);
+    CHECK (prefixed[0].text == L"I=01");
+    CHECK (prefixed[2].text == L"I=03");
+    CHECK (file.listTerms (L"I=", 2).size() == 2);
+    CHECK (file.listTerms (L"Q=").empty());
+
+    const auto range = file.readTermRange (L"I=015", L"I=03");
+    REQUIRE (range.size() == 2);
+    CHECK (range[0].text == L"I=02");
+    CHECK (range[1].text == L"I=03");
+    CHECK (file.readTermRange (L"I=03", L"I=02").empty());
+
+    irbis::PostingParameters parameters;
+    parameters.listOfTerms = { L"I=01", L"I=04", L"I=03" };
+    const auto postings = file.readPostings (parameters);
+    REQUIRE (postings.size() == 2);
+    CHECK (postings[0].mfn == 1);
+    CHECK (postings[1].mfn == 3);
+}
+
+TEST_CASE("InvertedFile64_listTerms_1", "[invertedFile]")
+{
+    const irbis::InvertedFile64 file (ibisIfp());
+    const auto terms = file.listTerms (L"K=");
+    REQUIRE (terms.size() > 200);
+    for (const auto &term : terms) {
+        CHECK (term.text.compare (0, 2, L"K=") == 0);
+    }
+
+    // Тот же результат через постраничное чтение.
+    const auto paged = file.readTerms (L"K=", static_cast<int> (terms.size()) + 1);
+    CHECK (paged.back().text.compare (0, 2, L"K=") != 0);
+    for (std::size_t i = 0; i < terms.size(); ++i) {
+        CHECK (paged[i].text == terms[i].text);
+        CHECK (paged[i].count == terms[i].count);
+    }
+
+    // Словарь читается из нескольких потоков без блокировок.
+    std::atomic<int> mismatches { 0 };
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread) {
+        threads.emplace_back ([&file, &terms, &mismatches, thread] {
+            for (std::size_t i = static_cast<std::size_t> (thread); i < terms.size(); i += 4) {
+                irbis::TermInfo info;
+                if (!file.findTerm (terms[i].text, info) || info.count != terms[i].count
+                    || file.readPostings (terms[i].text).size() != static_cast<std::size_t> (info.count)) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto &one : threads) {
+        one.join();
+    }
+    CHECK (mismatches == 0);
+}
@@ -132,6 +132,26 @@ TEST_CASE("MarcRecord_decode_1", "[record]")
     CHECK (pfield->subfields.size() == 2);
 }
 
+TEST_CASE("MarcRecord_decode_2", "[record]")
+{
+    const std::string text = "123#64\n0#12\n123#field123\n234#^asubfield a^bsubfield b\n\n";
+    const irbis::ByteSpan span (reinterpret_cast<const irbis::Byte*> (text.data()), text.size());
+    irbis::MarcRecord record;
+    record.decode (span.split ('\n'));
+    CHECK (record.mfn == 123);
+    CHECK (record.status == irbis::RecordStatus::Locked);
+    CHECK (record.version == 12);
+    REQUIRE (record.fields.size() == 2);
+    auto pfield = std::begin (record.fields);
+    CHECK (pfield->tag == 123);
+    CHECK (pfield->value == L"field123");
+    ++pfield;
+    CHECK (pfield->tag == 234);
+    REQUIRE (pfield->subfields.size() == 2);
+    CHECK (pfield->subfields.front().code == L'a');
+    CHECK (pfield->subfields.back().value == L"subfield b");
+}
+
 TEST_CASE("MarcRecord_deleted_1", "[record]")
 {
     irbis::MarcRecord record;
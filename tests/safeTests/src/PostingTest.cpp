@@ -47,6 +47,23 @@ TEST_CASE("TermPosting_parse_1", "[term]")
     CHECK (postings[2].text.empty());
 }
 
+TEST_CASE("TermPosting_parse_2", "[term]")
+{
+    const std::string text = "1#2#3#4#First\n2#3#4#5#\n3#4#5#6";
+    const irbis::ByteSpan span (reinterpret_cast<const irbis::Byte*> (text.data()), text.size());
+    const auto postings = irbis::TermPosting::parse (span.split ('\n'));
+    REQUIRE (postings.size()      == 3);
+    CHECK (postings[0].mfn        == 1);
+    CHECK (postings[0].tag        == 2);
+    CHECK (postings[0].occurrence == 3);
+    CHECK (postings[0].count      == 4);
+    CHECK (postings[0].text       == L"First");
+    CHECK (postings[1].count      == 5);
+    CHECK (postings[1].text.empty());
+    CHECK (postings[2].mfn        == 3);
+    CHECK (postings[2].count      == 6);
+}
+
 TEST_CASE("TermPosting_toString_1", "[term]")
 {
     irbis::TermPosting posting;
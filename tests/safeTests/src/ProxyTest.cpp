@@ -0,0 +1,382 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+#include "proxy.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Части прокси, не требующие сети: разбор пакетов, кэш ответов,
+// маршрутизация и журнал трафика.
+
+namespace {
+
+// Пакет запроса: длина, затем строки через '\n'.
+irbis::Bytes makePacket (const std::vector<std::string> &lines)
+{
+    std::string body;
+    for (const auto &line : lines) {
+        body += line;
+        body += '\n';
+    }
+    const auto text = std::to_string (body.size()) + '\n' + body;
+    return irbis::Bytes (text.begin(), text.end());
+}
+
+// Запрос клиента: стандартный заголовок и параметры команды.
+irbis::Bytes makeRequest (const std::string &command, const std::string &clientId,
+                          const std::vector<std::string> &params)
+{
+    std::vector<std::string> lines { command, "C", command, clientId, "1", "secret", "librarian", "", "", "" };
+    lines.insert (lines.end(), params.begin(), params.end());
+    return makePacket (lines);
+}
+
+// Ответ сервера: заголовок из 10 строк, затем строки ответа.
+irbis::Bytes makeAnswer (const std::string &returnCode, const std::string &tail = std::string(),
+                         std::size_t declared = 0)
+{
+    std::string text = "K\r\n123\r\n1\r\n" + std::to_string (declared) + "\r\n\r\n\r\n\r\n\r\n\r\n\r\n";
+    text += returnCode + "\r\n" + tail;
+    return irbis::Bytes (text.begin(), text.end());
+}
+
+std::string toString (const irbis::Bytes &bytes)
+{
+    return std::string (bytes.begin(), bytes.end());
+}
+
+proxy::RequestInfo parse (const irbis::Bytes &packet)
+{
+    return proxy::parseRequest (packet, packet.size());
+}
+
+}
+
+//=========================================================
+
+TEST_CASE("Proxy_completePacket_1", "[proxy]")
+{
+    const std::string whole = "5\nabcde";
+    const auto data = reinterpret_cast<const irbis::Byte*> (whole.data());
+    CHECK (proxy::completePacket (data, whole.size()) == 7);
+    CHECK (proxy::completePacket (data, 5) == 0);
+    CHECK (proxy::completePacket (data, 1) == 0);
+
+    // Следом может идти начало следующего пакета.
+    const std::string more = "3\nabc4\nab";
+    CHECK (proxy::completePacket (reinterpret_cast<const irbis::Byte*> (more.data()), more.size()) == 5);
+}
+
+TEST_CASE("Proxy_completePacket_2", "[proxy]")
+{
+    const std::string letters = "x\nabc", empty = "0\n", huge = "1234567890\n";
+    CHECK_THROWS (proxy::completePacket (reinterpret_cast<const irbis::Byte*> (letters.data()), letters.size()));
+    CHECK_THROWS (proxy::completePacket (reinterpret_cast<const irbis::Byte*> (empty.data()), empty.size()));
+    CHECK_THROWS (proxy::completePacket (reinterpret_cast<const irbis::Byte*> (huge.data()), huge.size()));
+}
+
+TEST_CASE("Proxy_parseRequest_1", "[proxy]")
+{
+    const auto packet = makeRequest ("K", "123456", { "ibis", "K=ALGEBRA$", "0", "1" });
+    const auto info = parse (packet);
+    CHECK (info.command == "K");
+    CHECK (info.clientId == "123456");
+    CHECK (info.queryId == "1");
+    CHECK (info.database == "IBIS");
+    CHECK_FALSE (info.write);
+    REQUIRE (info.paramsOffset < packet.size());
+    CHECK (toString (packet).substr (info.paramsOffset, 5) == "ibis\n");
+}
+
+TEST_CASE("Proxy_parseRequest_2", "[proxy]")
+{
+    auto info = parse (makeRequest ("L", "1", { "2.IBIS.brief.pft" }));
+    CHECK (info.database == "IBIS");
+    CHECK_FALSE (info.write);
+
+    info = parse (makeRequest ("L", "1", { "&2.IBIS.brief.pft" }));
+    CHECK (info.database == "IBIS");
+    CHECK (info.write);
+
+    info = parse (makeRequest ("D", "1", { "Ibis", "1" }));
+    CHECK (info.database == "IBIS");
+    CHECK (info.write);
+
+    info = parse (makeRequest ("6", "1", { "0", "1", "IBIS\x1F" "0#0" }));
+    CHECK (info.database == "IBIS");
+    CHECK (info.write);
+
+    // Команда без базы данных сбрасывает кэш целиком.
+    info = parse (makeRequest ("5", "1", { "IBIS" }));
+    CHECK (info.database.empty());
+    CHECK (info.write);
+
+    // Неполный заголовок считается записью.
+    info = parse (makePacket ({ "K", "C", "K" }));
+    CHECK (info.command == "K");
+    CHECK (info.write);
+}
+
+TEST_CASE("Proxy_answerIsCacheable_1", "[proxy]")
+{
+    CHECK (proxy::answerIsCacheable (makeAnswer ("0", "1#1\r\n")));
+    CHECK (proxy::answerIsCacheable (makeAnswer ("-202")));
+    CHECK_FALSE (proxy::answerIsCacheable (makeAnswer ("-3333")));
+    CHECK_FALSE (proxy::answerIsCacheable (makeAnswer ("-1000")));
+
+    // Заявлено больше, чем получено.
+    CHECK_FALSE (proxy::answerIsCacheable (makeAnswer ("0", "1#1\r\n", 1000)));
+
+    // Меньше строк, чем в заголовке.
+    const std::string text = "K\r\n123\r\n1\r\n";
+    CHECK_FALSE (proxy::answerIsCacheable (irbis::Bytes (text.begin(), text.end())));
+}
+
+TEST_CASE("Proxy_rewriteAnswer_1", "[proxy]")
+{
+    const auto answer = makeAnswer ("0", "1#1\r\n");
+    const auto rewritten = toString (proxy::rewriteAnswer (answer, "777", "42"));
+    CHECK (rewritten.compare (0, 12, "K\r\n777\r\n42\r\n") == 0);
+    CHECK (rewritten.substr (12) == toString (answer).substr (11));
+
+    // Обрывок ответа не меняется.
+    const std::string text = "K\r\n123";
+    const irbis::Bytes truncated (text.begin(), text.end());
+    CHECK (proxy::rewriteAnswer (truncated, "777", "42") == truncated);
+}
+
+//=========================================================
+
+TEST_CASE("ResponseCache_cacheable_1", "[proxy]")
+{
+    proxy::ResponseCache cache (1024, std::chrono::seconds (30), "K, L");
+    proxy::RequestInfo request;
+    request.command = "K";
+    CHECK (cache.cacheable (request));
+    request.command = "G";
+    CHECK_FALSE (cache.cacheable (request));
+    request.command = "L";
+    request.write = true;
+    CHECK_FALSE (cache.cacheable (request));
+
+    proxy::ResponseCache disabled (0, std::chrono::seconds (30), "K");
+    request.command = "K";
+    request.write = false;
+    CHECK_FALSE (disabled.cacheable (request));
+}
+
+TEST_CASE("ResponseCache_invalidate_1", "[proxy]")
+{
+    proxy::ResponseCache cache (64 * 1024, std::chrono::seconds (30), "K");
+    irbis::Bytes answer;
+
+    auto generation = cache.generation ("IBIS");
+    cache.store ("K\nIBIS\nA", "IBIS", generation, makeAnswer ("0"));
+    cache.store ("K\nRDR\nA", "RDR", cache.generation ("RDR"), makeAnswer ("0"));
+    REQUIRE (cache.lookup ("K\nIBIS\nA", answer));
+    CHECK (answer == makeAnswer ("0"));
+
+    // Запись в базу сбрасывает только её ответы.
+    cache.invalidate ("IBIS");
+    CHECK_FALSE (cache.lookup ("K\nIBIS\nA", answer));
+    CHECK (cache.lookup ("K\nRDR\nA", answer));
+    CHECK (cache.generation ("IBIS") != generation);
+
+    // Ответ, полученный до сброса, в кэш не попадает.
+    cache.store ("K\nIBIS\nB", "IBIS", generation, makeAnswer ("0"));
+    CHECK_FALSE (cache.lookup ("K\nIBIS\nB", answer));
+    cache.store ("K\nIBIS\nB", "IBIS", cache.generation ("IBIS"), makeAnswer ("0"));
+    CHECK (cache.lookup ("K\nIBIS\nB", answer));
+
+    // Сброс без базы меняет поколение всех баз.
+    generation = cache.generation ("RDR");
+    cache.invalidate (std::string());
+    CHECK_FALSE (cache.lookup ("K\nRDR\nA", answer));
+    CHECK_FALSE (cache.lookup ("K\nIBIS\nB", answer));
+    CHECK (cache.generation ("RDR") != generation);
+    CHECK (cache.invalidations == 2);
+}
+
+//=========================================================
+
+namespace {
+
+// Основной сервер и реплика; основной не получает чтения.
+std::vector<proxy::UpstreamConfig> twoUpstreams()
+{
+    proxy::UpstreamConfig primary, replica;
+    primary.port = 1;
+    primary.weight = 0;
+    replica.port = 2;
+    return { primary, replica };
+}
+
+proxy::Route route (proxy::Router &router, const irbis::Bytes &packet, std::size_t avoid = SIZE_MAX)
+{
+    const auto result = router.route (parse (packet), packet, packet.size(), avoid);
+    router.finished (result.upstream, false, 10);
+    return result;
+}
+
+}
+
+TEST_CASE("Router_route_1", "[proxy]")
+{
+    proxy::Router router (twoUpstreams());
+    CHECK_FALSE (router.address (0).address.empty());
+
+    // Регистрация -- на основном сервере.
+    const auto login = makeRequest ("A", "100", { "librarian", "secret" });
+    auto result = route (router, login);
+    CHECK (result.upstream == 0);
+    CHECK (result.preambles.empty());
+
+    // Первое чтение на реплике предваряется регистрацией.
+    const auto search = makeRequest ("K", "100", { "IBIS", "K=ALGEBRA$", "0", "1" });
+    result = route (router, search);
+    CHECK (result.upstream == 1);
+    REQUIRE (result.preambles.size() == 1);
+    CHECK (result.preambles[0].first == 1);
+    CHECK (result.preambles[0].second == login);
+
+    result = route (router, search);
+    CHECK (result.upstream == 1);
+    CHECK (result.preambles.empty());
+
+    // Запись -- на основном сервере.
+    result = route (router, makeRequest ("D", "100", { "IBIS", "1" }));
+    CHECK (result.upstream == 0);
+    CHECK (result.preambles.empty());
+
+    // Реплика отказала: чтение идёт на основной сервер.
+    result = route (router, search, 1);
+    CHECK (result.upstream == 0);
+    CHECK (result.preambles.empty());
+}
+
+TEST_CASE("Router_route_2", "[proxy]")
+{
+    proxy::Router router (twoUpstreams());
+    route (router, makeRequest ("A", "100", { "librarian", "secret" }));
+    const auto search = makeRequest ("K", "100", { "IBIS", "K=ALGEBRA$", "0", "1" });
+    route (router, search);
+
+    // Выход снимает клиента с регистрации и на реплике.
+    const auto logout = makeRequest ("B", "100", { "librarian" });
+    auto result = route (router, logout);
+    CHECK (result.upstream == 0);
+    REQUIRE (result.preambles.size() == 1);
+    CHECK (result.preambles[0].first == 1);
+    CHECK (result.preambles[0].second == logout);
+
+    // После выхода клиент прокси неизвестен: только основной сервер.
+    result = route (router, search);
+    CHECK (result.upstream == 0);
+    CHECK (result.preambles.empty());
+
+    // Клиент, регистрировавшийся не через прокси, -- тоже.
+    result = route (router, makeRequest ("K", "200", { "IBIS", "K=ALGEBRA$", "0", "1" }));
+    CHECK (result.upstream == 0);
+    CHECK (result.preambles.empty());
+}
+
+//=========================================================
+
+TEST_CASE("Proxy_scrubPassword_1", "[proxy]")
+{
+    const auto login = makeRequest ("A", "100", { "librarian", "secret" });
+    bool scrubbed = false;
+    const auto clean = proxy::scrubPassword (login, login.size(), scrubbed);
+    CHECK (scrubbed);
+    CHECK (toString (clean).find ("secret") == std::string::npos);
+    CHECK (proxy::completePacket (clean.data(), clean.size()) == clean.size());
+    CHECK (parse (clean).clientId == "100");
+
+    // Пароль в заголовке и в параметрах A одинаков.
+    CHECK (proxy::restorePassword (clean, "secret") == login);
+}
+
+TEST_CASE("Proxy_scrubPassword_2", "[proxy]")
+{
+    const auto search = makeRequest ("K", "100", { "IBIS", "secret" });
+    bool scrubbed = false;
+    const auto clean = proxy::scrubPassword (search, search.size(), scrubbed);
+    CHECK (scrubbed);
+
+    // Параметры прочих команд не трогаются.
+    const auto text = toString (clean);
+    CHECK (std::count (text.begin(), text.end(), 's') == 1);
+    CHECK (text.find ("IBIS\nsecret\n") != std::string::npos);
+    CHECK (proxy::restorePassword (clean, "secret") == search);
+
+    const auto shortPacket = makePacket ({ "K", "C", "K" });
+    const auto same = proxy::scrubPassword (shortPacket, shortPacket.size(), scrubbed);
+    CHECK_FALSE (scrubbed);
+    CHECK (same == shortPacket);
+}
+
+//=========================================================
+
+TEST_CASE("CaptureReader_read_1", "[proxy]")
+{
+    const auto prefix = irbis::IO::combinePath (irbis::IO::getTempDirectoryNarrow(), "proxyTest");
+    const auto fileName = prefix + ".000001.cap";
+    std::remove (fileName.c_str());
+
+    {
+        proxy::CaptureWriter writer (prefix, 1 << 20);
+        for (uint32_t i = 1; i <= 3; ++i) {
+            proxy::CaptureRecord record;
+            record.timestamp = 1000000 * i;
+            record.latency = 10 * i;
+            record.upstream = static_cast<uint16_t> (i == 3 ? proxy::CaptureRecord::NoUpstream : i - 1);
+            record.flags = i == 3 ? proxy::CaptureRecord::Cached : 0;
+            record.request = makeRequest ("K", std::to_string (i), { "IBIS" });
+            record.response = makeAnswer ("0");
+            writer.write (std::move (record));
+        }
+        writer.close();
+        CHECK (writer.written == 3);
+        CHECK (writer.dropped == 0);
+    }
+
+    // Оборванная запись в конце файла.
+    auto file = std::fopen (fileName.c_str(), "ab");
+    REQUIRE (file != nullptr);
+    std::fwrite ("\x40\0\0\0\1\2", 1, 6, file);
+    std::fclose (file);
+
+    proxy::CaptureReader reader (fileName);
+    proxy::CaptureRecord record;
+    for (uint32_t i = 1; i <= 3; ++i) {
+        REQUIRE (reader.read (record));
+        CHECK (record.timestamp == 1000000u * i);
+        CHECK (record.latency == 10 * i);
+        CHECK (parse (record.request).clientId == std::to_string (i));
+        CHECK (record.response == makeAnswer ("0"));
+    }
+    CHECK (record.upstream == uint16_t (proxy::CaptureRecord::NoUpstream));
+    CHECK (record.flags == uint8_t (proxy::CaptureRecord::Cached));
+    CHECK_FALSE (reader.read (record));
+
+    std::remove (fileName.c_str());
+}
+
+TEST_CASE("CaptureReader_constructor_1", "[proxy]")
+{
+    const auto fileName = irbis::IO::combinePath (irbis::IO::getTempDirectoryNarrow(), "proxyTest.bad");
+    auto file = std::fopen (fileName.c_str(), "wb");
+    REQUIRE (file != nullptr);
+    std::fputs ("not a capture file", file);
+    std::fclose (file);
+
+    CHECK_THROWS (proxy::CaptureReader (fileName));
+    std::remove (fileName.c_str());
+    CHECK_THROWS (proxy::CaptureReader (fileName));
+}
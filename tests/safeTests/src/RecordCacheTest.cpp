@@ -0,0 +1,118 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+
+namespace {
+
+irbis::MarcRecord makeRecord (irbis::Mfn mfn, unsigned int version, const irbis::String &title)
+{
+    irbis::MarcRecord result;
+    result.mfn = mfn;
+    result.version = version;
+    result.add (200).add (L'a', title);
+    return result;
+}
+
+}
+
+TEST_CASE("RecordCache_constructor_1", "[cache]")
+{
+    irbis::RecordCache cache (1024);
+    CHECK (cache.capacity() == 1024);
+    const auto stats = cache.statistics();
+    CHECK (stats.entries == 0);
+    CHECK (stats.bytes == 0);
+    CHECK (stats.hitRatio() == 0.0);
+}
+
+TEST_CASE("RecordCache_get_1", "[cache]")
+{
+    irbis::RecordCache cache;
+    irbis::MarcRecord record;
+    CHECK_FALSE (cache.get (L"IBIS", 1, record));
+
+    cache.put (L"IBIS", makeRecord (1, 3, L"Title"));
+    REQUIRE (cache.get (L"ibis", 1, record));
+    CHECK (record.mfn == 1);
+    CHECK (record.version == 3);
+    CHECK (record.fm (200, L'a') == L"Title");
+
+    irbis::LiteRecord lite;
+    CHECK_FALSE (cache.get (L"IBIS", 1, lite));
+
+    const auto stats = cache.statistics();
+    CHECK (stats.entries == 1);
+    CHECK (stats.hits == 1);
+    CHECK (stats.misses == 2);
+    CHECK (stats.bytes > 0);
+}
+
+TEST_CASE("RecordCache_evict_1", "[cache]")
+{
+    irbis::RecordCache big;
+    big.put (L"IBIS", makeRecord (1, 1, L"Title"));
+    const auto size = big.statistics().bytes;
+
+    // Помещаются ровно две записи.
+    irbis::RecordCache cache (size * 2 + size / 2);
+    cache.put (L"IBIS", makeRecord (1, 1, L"Title"));
+    cache.put (L"IBIS", makeRecord (2, 1, L"Title"));
+    irbis::MarcRecord record;
+    CHECK (cache.get (L"IBIS", 1, record)); // первая запись становится "свежей"
+    cache.put (L"IBIS", makeRecord (3, 1, L"Title"));
+    CHECK (cache.get (L"IBIS", 1, record));
+    CHECK_FALSE (cache.get (L"IBIS", 2, record));
+    CHECK (cache.get (L"IBIS", 3, record));
+
+    const auto stats = cache.statistics();
+    CHECK (stats.entries == 2);
+    CHECK (stats.evictions == 1);
+    CHECK (stats.bytes <= cache.capacity());
+}
+
+TEST_CASE("RecordCache_invalidate_1", "[cache]")
+{
+    irbis::RecordCache cache;
+    cache.put (L"IBIS", makeRecord (1, 1, L"First"));
+    cache.put (L"IBIS", makeRecord (2, 1, L"Second"));
+    cache.put (L"RDR", makeRecord (1, 1, L"Reader"));
+
+    cache.invalidate (L"IBIS", 1);
+    irbis::MarcRecord record;
+    CHECK_FALSE (cache.get (L"IBIS", 1, record));
+    CHECK (cache.get (L"RDR", 1, record));
+
+    cache.invalidateDatabase (L"rdr");
+    CHECK_FALSE (cache.get (L"RDR", 1, record));
+    CHECK (cache.get (L"IBIS", 2, record));
+    CHECK (cache.statistics().invalidations == 2);
+
+    cache.clear();
+    CHECK (cache.statistics().entries == 0);
+    CHECK (cache.statistics().bytes == 0);
+}
+
+TEST_CASE("RecordCache_revalidate_1", "[cache]")
+{
+    irbis::RecordCache cache;
+    cache.put (L"IBIS", makeRecord (1, 5, L"Title"));
+    irbis::MarcRecord record;
+    CHECK (cache.revalidate (L"IBIS", 1, 5, record));
+    CHECK (record.fm (200, L'a') == L"Title");
+    CHECK_FALSE (cache.revalidate (L"IBIS", 1, 6, record));
+    CHECK_FALSE (cache.get (L"IBIS", 1, record));
+
+    const auto stats = cache.statistics();
+    CHECK (stats.revalidations == 2);
+    CHECK (stats.stale == 1);
+}
+
+TEST_CASE("RecordCache_versionOf_1", "[cache]")
+{
+    const std::string text = "1#0\n0#12\n200#^aTitle";
+    const irbis::ByteSpan span (reinterpret_cast<const irbis::Byte*> (text.data()), text.size());
+    CHECK (irbis::RecordCache::versionOf (span.split ('\n')) == 12);
+    CHECK (irbis::RecordCache::versionOf (std::vector<irbis::ByteSpan>()) == -1);
+}
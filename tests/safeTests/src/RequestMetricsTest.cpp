@@ -0,0 +1,171 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+#include "tinyServer.h"
+
+TEST_CASE("Histogram_add_1", "[metrics]")
+{
+    irbis::Histogram histogram;
+    CHECK (histogram.mean() == 0.0);
+    CHECK (histogram.percentile (0.5) == 0);
+
+    for (uint64_t value = 1; value <= 100; ++value) {
+        histogram.add (value);
+    }
+    CHECK (histogram.count == 100);
+    CHECK (histogram.minimum == 1);
+    CHECK (histogram.maximum == 100);
+    CHECK (histogram.mean() == 50.5);
+    CHECK (histogram.percentile (0.0) == 1);
+    CHECK (histogram.percentile (0.5) == 63);
+    CHECK (histogram.percentile (1.0) == 100);
+
+    irbis::Histogram other;
+    other.add (0);
+    histogram.merge (other);
+    CHECK (histogram.count == 101);
+    CHECK (histogram.minimum == 0);
+    CHECK (histogram.buckets[0] == 1);
+}
+
+TEST_CASE("RequestTrace_move_1", "[metrics]")
+{
+    irbis::RequestTrace trace ("K", irbis::RequestStage::Connecting, irbis::RequestTrace::Clock::now());
+    trace.micros[static_cast<std::size_t> (irbis::RequestStage::Connecting)] = 100;
+    trace.move (irbis::RequestStage::Connecting, irbis::RequestStage::NameResolution, 30);
+    CHECK (trace.micros[static_cast<std::size_t> (irbis::RequestStage::Connecting)] == 70);
+    CHECK (trace.micros[static_cast<std::size_t> (irbis::RequestStage::NameResolution)] == 30);
+    trace.move (irbis::RequestStage::Connecting, irbis::RequestStage::NameResolution, 1000);
+    CHECK (trace.micros[static_cast<std::size_t> (irbis::RequestStage::Connecting)] == 0);
+    CHECK (trace.total() == 100);
+}
+
+TEST_CASE("RequestMetrics_record_1", "[metrics]")
+{
+    irbis::RequestMetrics metrics;
+    irbis::RequestTrace trace ("G", irbis::RequestStage::None, irbis::RequestTrace::Clock::now());
+    trace.micros[static_cast<std::size_t> (irbis::RequestStage::Waiting)] = 500;
+    trace.bytesSent = 10;
+    trace.bytesReceived = 2000;
+    metrics.record (trace);
+    trace.failed = true;
+    metrics.record (trace);
+
+    const auto snapshot = metrics.snapshot();
+    REQUIRE (snapshot.size() == 1);
+    CHECK (snapshot[0].command == "G");
+    CHECK (snapshot[0].requests == 2);
+    CHECK (snapshot[0].errors == 1);
+    CHECK (snapshot[0].stage (irbis::RequestStage::Waiting).maximum == 500);
+    CHECK (snapshot[0].stage (irbis::RequestStage::Sending).count == 0);
+    CHECK (snapshot[0].bytesReceived.sum == 4000);
+
+    const auto text = metrics.toText();
+    CHECK (text.find ("command G: requests 2, errors 1") != std::string::npos);
+    CHECK (text.find ("Waiting") != std::string::npos);
+
+    metrics.reset();
+    CHECK (metrics.snapshot().empty());
+}
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("RequestMetrics_connection_1", "[metrics]")
+{
+    TinyServer server;
+    irbis::ConnectionBase connection;
+    connection.host = L"127.0.0.1";
+    connection.port = server.port;
+    connection.metrics = std::make_shared<irbis::RequestMetrics>();
+
+    for (auto i = 0; i < 3; ++i) {
+        irbis::ClientQuery query (connection, "H");
+        irbis::ServerResponse response (connection, query);
+        CHECK (connection.stage == irbis::RequestStage::ParseBody);
+        CHECK (response.checkReturnCode());
+    }
+    CHECK (connection.stage == irbis::RequestStage::None);
+
+    const auto snapshot = connection.metrics->snapshot();
+    REQUIRE (snapshot.size() == 1);
+    const auto &metrics = snapshot[0];
+    CHECK (metrics.command == "H");
+    CHECK (metrics.requests == 3);
+    CHECK (metrics.errors == 0);
+    CHECK (metrics.total.count == 3);
+    CHECK (metrics.bytesSent.minimum > 0);
+    CHECK (metrics.bytesReceived.minimum > 0);
+    CHECK (metrics.stage (irbis::RequestStage::None).count == 0);
+}
+
+TEST_CASE("RequestMetrics_async_1", "[metrics]")
+{
+    TinyServer server;
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    REQUIRE (server.connect (connection));
+    connection.metrics = std::make_shared<irbis::RequestMetrics>();
+
+    const irbis::MfnList mfns { 1, 2, 3 };
+    connection.batchSize = 1;
+    connection.readRecords (mfns);
+
+    const auto snapshot = connection.metrics->snapshot();
+    REQUIRE (snapshot.size() == 1);
+    CHECK (snapshot[0].command == "G");
+    CHECK (snapshot[0].requests == 3);
+    CHECK (snapshot[0].stage (irbis::RequestStage::Waiting).count == 3);
+    CHECK (snapshot[0].bytesReceived.minimum > 0);
+    connection.metrics.reset();
+}
+
+TEST_CASE("RequestMetrics_async_2", "[metrics]")
+{
+    // Поиск сразу в нескольких базах тоже попадает в метрики.
+    TinyServer server (TinyServer::only ({ "K" }, [] (const std::vector<std::string> &) -> std::string {
+        return "0\r\n1\r\n1\r\n";
+    }));
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    REQUIRE (server.connect (connection));
+    connection.metrics = std::make_shared<irbis::RequestMetrics>();
+
+    irbis::SearchParameters parameters;
+    parameters.searchExpression = L"K=A$";
+    const auto result = connection.searchMany (parameters, { L"IBIS", L"RDR" });
+    CHECK (result.success());
+
+    const auto snapshot = connection.metrics->snapshot();
+    REQUIRE (snapshot.size() == 1);
+    CHECK (snapshot[0].command == "K");
+    CHECK (snapshot[0].requests == 2);
+    CHECK (snapshot[0].errors == 0);
+    connection.metrics.reset();
+}
+
+TEST_CASE("RequestMetrics_connection_2", "[metrics]")
+{
+    short port;
+    {
+        TinyServer server;
+        port = server.port;
+    }
+
+    irbis::ConnectionBase connection;
+    connection.host = L"127.0.0.1";
+    connection.port = port;
+    connection.metrics = std::make_shared<irbis::RequestMetrics>();
+    irbis::ClientQuery query (connection, "K");
+    CHECK_THROWS_AS (irbis::ServerResponse (connection, query), irbis::NetworkException);
+    CHECK (connection.stage == irbis::RequestStage::Error);
+
+    const auto snapshot = connection.metrics->snapshot();
+    REQUIRE (snapshot.size() == 1);
+    CHECK (snapshot[0].command == "K");
+    CHECK (snapshot[0].errors == 1);
+}
+
+#endif
@@ -2,7 +2,11 @@
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 
 #include "catch.hpp"
+#include "irbis.h"
 #include "irbis_internal.h"
+#include "tinyServer.h"
+
+#include <chrono>
 
 TEST_CASE("Retry_action_1", "[retry]")
 {
@@ -31,3 +35,68 @@ TEST_CASE("Retry_execute_2", "[retry]")
     const auto value = irbis::Retry (10, 2).execute([] { return 123; });
     CHECK (value == 123);
 }
+
+TEST_CASE("RetryPolicy_backoff_1", "[retry]")
+{
+    irbis::RetryPolicy policy;
+    policy.baseDelay = std::chrono::milliseconds (100);
+    policy.maxDelay = std::chrono::milliseconds (1000);
+    policy.multiplier = 2.0;
+
+    for (auto i = 0; i < 50; ++i) {
+        const auto first = policy.backoff (1).count();
+        CHECK (first >= 50);
+        CHECK (first <= 100);
+        const auto third = policy.backoff (3).count();
+        CHECK (third >= 200);
+        CHECK (third <= 400);
+        const auto capped = policy.backoff (20).count();
+        CHECK (capped >= 500);
+        CHECK (capped <= 1000);
+    }
+
+    policy.baseDelay = std::chrono::milliseconds (0);
+    CHECK (policy.backoff (5).count() == 0);
+}
+
+TEST_CASE("RetryPolicy_idempotent_1", "[retry]")
+{
+    CHECK (irbis::RetryPolicy::idempotent ("C"));
+    CHECK (irbis::RetryPolicy::idempotent ("K"));
+    CHECK (irbis::RetryPolicy::idempotent ("G"));
+    CHECK_FALSE (irbis::RetryPolicy::idempotent ("D"));
+    CHECK_FALSE (irbis::RetryPolicy::idempotent ("6"));
+    CHECK_FALSE (irbis::RetryPolicy::idempotent ("A"));
+    CHECK_FALSE (irbis::RetryPolicy::idempotent (""));
+}
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("RetryPolicy_connect_1", "[retry]")
+{
+    short port;
+    {
+        TinyServer server;
+        port = server.port;
+    }
+
+    // Сервер не слушает: подключение повторяется с паузами.
+    irbis::Connection connection;
+    connection.host = L"127.0.0.1";
+    connection.port = port;
+    connection.retryPolicy.maxAttempts = 3;
+    connection.retryPolicy.baseDelay = std::chrono::milliseconds (20);
+    const auto started = std::chrono::steady_clock::now();
+    CHECK_FALSE (connection.connect());
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    CHECK (elapsed >= std::chrono::milliseconds (30));
+
+    // Срок исчерпан раньше, чем попытки.
+    connection.retryPolicy.maxAttempts = 100;
+    connection.retryPolicy.deadline = std::chrono::milliseconds (100);
+    const auto again = std::chrono::steady_clock::now();
+    CHECK_FALSE (connection.connect());
+    CHECK (std::chrono::steady_clock::now() - again < std::chrono::seconds (2));
+}
+
+#endif
@@ -0,0 +1,62 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "tinyServer.h"
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("SearchCursor_next_1", "[search]")
+{
+    // Сервер находит 70000 записей и отдаёт не более 32000 за раз.
+    const int found = 70000;
+    TinyServer server (TinyServer::only ({ "K" }, [found] (const std::vector<std::string> &lines) -> std::string {
+        const auto wanted = std::stoi (lines[12]);
+        const auto first = std::stoi (lines[13]);
+        const auto withText = !lines[14].empty();
+        auto count = std::min (found - first + 1, 32000);
+        if (wanted != 0) {
+            count = std::min (count, wanted);
+        }
+        std::string result = "0\r\n" + std::to_string (found) + "\r\n";
+        for (auto mfn = first; mfn < first + count; ++mfn) {
+            result += std::to_string (mfn);
+            if (withText) {
+                result += "#Title " + std::to_string (mfn);
+            }
+            result += "\r\n";
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    REQUIRE (server.connect (connection));
+
+    const auto all = connection.search (L"I=$");
+    REQUIRE (all.size() == static_cast<std::size_t> (found));
+    CHECK (all.front() == 1);
+    CHECK (all.back() == static_cast<irbis::Mfn> (found));
+
+    irbis::SearchParameters parameters;
+    parameters.searchExpression = L"I=$";
+    parameters.firstRecord = 100;
+    parameters.numberOfRecords = 40000;
+    parameters.formatSpecification = L"@brief";
+    irbis::SearchCursor cursor (connection, parameters);
+    CHECK (cursor.total() == -1);
+    irbis::FoundLine line;
+    irbis::Mfn expected = 100;
+    while (cursor.next (line)) {
+        if (line.mfn != expected || line.description != L"Title " + std::to_wstring (expected)) {
+            FAIL (line.mfn);
+        }
+        ++expected;
+    }
+    CHECK (cursor.total() == found);
+    CHECK (cursor.position() == 40000);
+    CHECK (expected == 40100);
+}
+
+#endif
@@ -0,0 +1,113 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "irbis_internal.h"
+#include "tinyServer.h"
+
+TEST_CASE("AddressResolver_resolve_1", "[socket]")
+{
+    irbis::AddressResolver resolver;
+    bool cached = true;
+    const auto first = resolver.resolve (L"127.0.0.1", 6666, &cached);
+    REQUIRE_FALSE (first.empty());
+    CHECK_FALSE (cached);
+    CHECK_FALSE (first[0].address.empty());
+
+    const auto second = resolver.resolve (L"127.0.0.1", 6666, &cached);
+    CHECK (cached);
+    CHECK (second.size() == first.size());
+    CHECK (second[0].address == first[0].address);
+    CHECK (resolver.hits() == 1);
+    CHECK (resolver.misses() == 1);
+
+    // Другой порт -- другая запись в кэше.
+    resolver.resolve (L"127.0.0.1", 6667, &cached);
+    CHECK_FALSE (cached);
+
+    resolver.clear();
+    resolver.resolve (L"127.0.0.1", 6666, &cached);
+    CHECK_FALSE (cached);
+    CHECK (resolver.misses() == 3);
+}
+
+TEST_CASE("AddressResolver_ttl_1", "[socket]")
+{
+    irbis::AddressResolver resolver (std::chrono::milliseconds (0));
+    CHECK (resolver.ttl().count() == 0);
+    bool cached = true;
+    resolver.resolve (L"127.0.0.1", 6666, &cached);
+    resolver.resolve (L"127.0.0.1", 6666, &cached);
+    CHECK_FALSE (cached);
+    CHECK (resolver.hits() == 0);
+
+    resolver.setTtl (std::chrono::seconds (1));
+    resolver.resolve (L"127.0.0.1", 6666);
+    resolver.resolve (L"127.0.0.1", 6666, &cached);
+    CHECK (cached);
+}
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("Tcp4Socket_statistics_1", "[socket]")
+{
+    TinyServer server;
+    irbis::Tcp4Socket socket (L"127.0.0.1", server.port);
+    socket.connectTimeout = 1000;
+    socket.receiveTimeout = 1000;
+    socket.open();
+    const std::string packet = "2\nA\n";
+    socket.send (reinterpret_cast<const irbis::Byte*> (packet.data()), packet.size());
+    irbis::Byte buffer[1024];
+    std::size_t total = 0;
+    while (true) {
+        const auto received = socket.receive (buffer, sizeof (buffer));
+        if (received == 0) {
+            break;
+        }
+        total += received;
+    }
+    socket.close();
+    socket.close(); // повторное закрытие безвредно
+
+    CHECK (total > 0);
+    CHECK (socket.statistics.connects == 1);
+    CHECK (socket.statistics.failures == 0);
+    CHECK (socket.statistics.bytesSent == packet.size());
+    CHECK (socket.statistics.bytesReceived == total);
+}
+
+TEST_CASE("Tcp4Socket_receiveTimeout_1", "[socket]")
+{
+    TinyServer server ([] (const std::vector<std::string> &) -> std::string {
+        std::this_thread::sleep_for (std::chrono::milliseconds (300));
+        return "0\r\n";
+    });
+
+    irbis::ConnectionBase connection;
+    connection.host = L"127.0.0.1";
+    connection.port = server.port;
+    connection.receiveTimeout = 50;
+    irbis::ClientQuery query (connection, "A");
+    CHECK_THROWS_AS (irbis::ServerResponse (connection, query), irbis::NetworkException);
+    CHECK (connection.socket->statistics.timeouts == 1);
+}
+
+TEST_CASE("Tcp4Socket_open_1", "[socket]")
+{
+    // Занимаем порт и сразу освобождаем: подключение к нему отвергается.
+    short port;
+    {
+        TinyServer server;
+        port = server.port;
+    }
+
+    irbis::Tcp4Socket socket (L"127.0.0.1", port);
+    socket.connectTimeout = 1000;
+    CHECK_THROWS_AS (socket.open(), irbis::NetworkException);
+    CHECK (socket.statistics.failures == 1);
+    CHECK (socket.statistics.connects == 0);
+}
+
+#endif
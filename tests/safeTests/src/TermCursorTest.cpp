@@ -0,0 +1,85 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "catch.hpp"
+#include "irbis.h"
+#include "tinyServer.h"
+
+#ifdef HAVE_TINY_SERVER
+
+TEST_CASE("TermCursor_next_1", "[term]")
+{
+    // Словарь: 2000 авторов между ключевыми словами и заглавиями.
+    std::vector<std::string> dictionary { "K=KEYWORD", "T=TITLE 1", "T=TITLE 2" };
+    for (auto i = 0; i < 2000; ++i) {
+        dictionary.push_back ("A=AUTHOR " + std::to_string (10000 + i));
+    }
+    std::sort (dictionary.begin(), dictionary.end());
+    std::atomic<int> pages { 0 };
+    TinyServer server (TinyServer::only ({ "H", "P" }, [&dictionary, &pages]
+                                        (const std::vector<std::string> &lines) -> std::string {
+        ++pages;
+        const auto &start = lines[11];
+        const auto count = std::stoi (lines[12]);
+        std::string result = "0\r\n";
+        if (lines[0] == "H") {
+            auto it = std::lower_bound (dictionary.begin(), dictionary.end(), start);
+            for (auto i = 0; i < count && it != dictionary.end(); ++i, ++it) {
+                result += "1#" + *it + "\r\n";
+            }
+        }
+        else {
+            auto it = std::upper_bound (dictionary.begin(), dictionary.end(), start);
+            for (auto i = 0; i < count && it != dictionary.begin(); ++i) {
+                result += "1#" + *--it + "\r\n";
+            }
+        }
+        return result;
+    }));
+
+    irbis::Connection connection;
+    connection.database = L"IBIS";
+    REQUIRE (server.connect (connection));
+
+    const auto authors = connection.listTerms (L"A=");
+    REQUIRE (authors.size() == 2000);
+    CHECK (authors.front() == L"AUTHOR 10000");
+    CHECK (authors.back() == L"AUTHOR 11999");
+
+    irbis::TermParameters parameters;
+    parameters.numberOfTerms = 300;
+    irbis::TermCursor cursor (connection, parameters, L"A=");
+    CHECK (cursor.pageSize() == 300);
+    irbis::TermInfo term;
+    auto expected = 10000;
+    while (cursor.next (term)) {
+        if (term.text != L"A=AUTHOR " + std::to_wstring (expected)) {
+            FAIL (expected);
+        }
+        ++expected;
+    }
+    CHECK (expected == 12000);
+    CHECK (cursor.position() == 2000);
+
+    // Обратный порядок и досрочное завершение.
+    parameters.reverseOrder = true;
+    pages = 0;
+    irbis::TermCursor reverse (connection, parameters, L"A=", false);
+    int count;
+    std::string text;
+    for (auto i = 0; i < 450; ++i) {
+        REQUIRE (reverse.next (count, text));
+    }
+    CHECK (text == "A=AUTHOR 11550");
+    CHECK (pages == 2);
+
+    parameters.reverseOrder = false;
+    parameters.startTerm = L"T=";
+    irbis::TermCursor titles (connection, parameters, L"T=");
+    CHECK (titles.next (term));
+    CHECK (term.text == L"T=TITLE 1");
+    CHECK (titles.next (term));
+    CHECK_FALSE (titles.next (term));
+}
+
+#endif
@@ -24,6 +24,20 @@ TEST_CASE("TermInfo_parse_1", "[term]")
     CHECK (terms[2].text.empty());
 }
 
+TEST_CASE("TermInfo_parse_2", "[term]")
+{
+    const std::string text = "1#First\n2#\xD0\x92\xD1\x82\xD0\xBE\xD1\x80\xD0\xBE\xD0\xB9\n3#";
+    const irbis::ByteSpan span (reinterpret_cast<const irbis::Byte*> (text.data()), text.size());
+    const auto terms = irbis::TermInfo::parse (span.split ('\n'));
+    REQUIRE (terms.size() == 3);
+    CHECK (terms[0].count == 1);
+    CHECK (terms[0].text == L"First");
+    CHECK (terms[1].count == 2);
+    CHECK (terms[1].text == L"\u0412\u0442\u043E\u0440\u043E\u0439");
+    CHECK (terms[2].count == 3);
+    CHECK (terms[2].text.empty());
+}
+
 TEST_CASE("TermInfo_toString_1", "[term]")
 {
     irbis::TermInfo term;
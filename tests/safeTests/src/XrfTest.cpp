@@ -7,6 +7,9 @@
 #include "irbis_internal.h"
 #include "safeTests.h"
 
+#include <atomic>
+#include <thread>
+
 // ReSharper disable StringLiteralTypo
 
 TEST_CASE("XrfFile64_readRecord_1", "[xrf]")
@@ -20,6 +23,133 @@ TEST_CASE("XrfFile64_readRecord_1", "[xrf]")
     CHECK (record.status == irbis::RecordStatus::None);
 }
 
+TEST_CASE("XrfFile64_readRange_1", "[xrf]")
+{
+    auto path = irbis::IO::combinePath (whereIbis(), L"ibis.xrf");
+    irbis::IO::convertSlashes (path);
+    REQUIRE (irbis::IO::fileExist (path));
+    irbis::XrfFile64 xrf (path, irbis::ReadOnly);
+    const auto total = xrf.count();
+    REQUIRE (total > 10);
+
+    // Пачка совпадает с поштучным чтением, хвост файла обрезается.
+    std::vector<irbis::XrfRecord64> records (total + 5);
+    CHECK (xrf.readRange (1, records.size(), records.data()) == total);
+    CHECK (records[0].offset == 22951100ull);
+    for (irbis::Mfn mfn = 1; mfn <= 10; ++mfn) {
+        const auto one = xrf.readRecord (mfn);
+        CHECK (records[mfn - 1].offset == one.offset);
+        CHECK (records[mfn - 1].status == one.status);
+    }
+    CHECK (xrf.readRange (static_cast<irbis::Mfn> (total + 1), 1, records.data()) == 0);
+
+    irbis::XrfView view (path);
+    REQUIRE (view.count() == total);
+    std::vector<irbis::XrfRecord64> mapped (total);
+    CHECK (view.readRange (1, total, mapped.data()) == total);
+    std::size_t deleted = 0;
+    for (std::size_t index = 0; index < total; ++index) {
+        CHECK (mapped[index].offset == records[index].offset);
+        CHECK (mapped[index].status == records[index].status);
+        deleted += records[index].deleted() ? 1 : 0;
+    }
+    CHECK (view.readRecord (1).offset == 22951100ull);
+    CHECK (view.status (1) == irbis::RecordStatus::None);
+    CHECK_THROWS_AS (view.readRecord (0), irbis::IrbisException);
+    CHECK_THROWS_AS (view.status (static_cast<irbis::Mfn> (total + 1)), irbis::IrbisException);
+    CHECK (view.countStatus (irbis::RecordStatus::Deleted) == deleted);
+    CHECK (view.listStatus (irbis::RecordStatus::Deleted).size() == deleted);
+}
+
+TEST_CASE("XrfView_databaseInfo_1", "[xrf]")
+{
+    // Ссылки: обычная, логически удалённая, заблокированная
+    // и неактуализированная, удалённая физически.
+    auto path = irbis::IO::combinePath (whereTemp(), L"view.xrf");
+    irbis::IO::convertSlashes (path);
+    const irbis::Byte bytes[] = {
+        0, 0, 0, 64, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 1, 0,  0, 0, 0, 0, 0, 0, 0, 1,
+        0, 0, 2, 0,  0, 0, 0, 1, 0, 0, 0, 64,
+        0, 0, 0, 0,  0, 0, 0, 0, 0, 0, 0, 10
+    };
+    {
+        auto file = irbis::File::create (path);
+        file.write (bytes, sizeof (bytes));
+    }
+
+    {
+        irbis::XrfView view (path);
+        REQUIRE (view.count() == 4);
+        const auto third = view.readRecord (3);
+        CHECK (third.offset == 0x100000200ull);
+        CHECK (third.locked());
+
+        const auto info = view.databaseInfo();
+        CHECK (info.maxMfn == 4);
+        CHECK (info.logicallyDeletedRecords == irbis::MfnList { 2 });
+        CHECK (info.physicallyDeletedRecords == irbis::MfnList { 4 });
+        CHECK (info.nonActualizedRecords == irbis::MfnList { 4 });
+        CHECK (info.lockedRecords == irbis::MfnList { 3 });
+
+        CHECK (view.countStatus (irbis::RecordStatus::Deleted) == 2);
+        CHECK (view.countStatus (irbis::RecordStatus::Deleted, 3) == 1);
+        CHECK (view.listStatus (irbis::RecordStatus::Locked | irbis::RecordStatus::NonActualized)
+               == (irbis::MfnList { 3, 4 }));
+        CHECK (view.databaseInfo (2).lockedRecords.empty());
+    }
+    irbis::IO::deleteFile (path);
+}
+
+TEST_CASE("XrfFile64_writeRecord_1", "[xrf]")
+{
+    auto path = irbis::IO::combinePath (whereTemp(), L"threads.xrf");
+    irbis::IO::convertSlashes (path);
+    irbis::IO::createFile (path);
+    {
+        irbis::XrfFile64 xrf (path, irbis::DirectAccessMode::Exclusive);
+        const irbis::Mfn total = 1000;
+        for (irbis::Mfn mfn = 1; mfn <= total; ++mfn) {
+            irbis::XrfRecord64 record;
+            record.offset = (static_cast<irbis::Offset> (mfn) << 32u) + mfn;
+            xrf.writeRecord (mfn, record);
+        }
+        REQUIRE (xrf.count() == total);
+
+        // Читатели не мешают друг другу и писателю, меняющему только статусы.
+        std::atomic<int> mismatches { 0 };
+        std::vector<std::thread> threads;
+        for (int thread = 0; thread < 4; ++thread) {
+            threads.emplace_back ([&xrf, &mismatches, thread] {
+                for (int pass = 0; pass < 5; ++pass) {
+                    for (irbis::Mfn mfn = 1 + thread; mfn <= total; mfn += 3) {
+                        const auto record = xrf.readRecord (mfn);
+                        if (record.offset != (static_cast<irbis::Offset> (mfn) << 32u) + mfn) {
+                            ++mismatches;
+                        }
+                    }
+                }
+            });
+        }
+        threads.emplace_back ([&xrf] {
+            for (irbis::Mfn mfn = 1; mfn <= total; mfn += 2) {
+                irbis::XrfRecord64 record;
+                record.offset = (static_cast<irbis::Offset> (mfn) << 32u) + mfn;
+                record.status = irbis::RecordStatus::Locked;
+                xrf.writeRecord (mfn, record);
+            }
+        });
+        for (auto &one : threads) {
+            one.join();
+        }
+        CHECK (mismatches == 0);
+        CHECK (xrf.readRecord (999).locked());
+        CHECK_FALSE (xrf.readRecord (1000).locked());
+        CHECK_THROWS_AS (xrf.readRecord (total + 1), irbis::IrbisException);
+    }
+    irbis::IO::deleteFile (path);
+}
+
 //TEST_CASE("XrfFile64_create_1", "[xrf]")
 //{
 //    auto path = irbis::IO::combinePath (whereTemp(), L"ibis.xrf");